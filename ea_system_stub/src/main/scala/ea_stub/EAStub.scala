@@ -52,36 +52,52 @@ object EAStub {
     }
   }
 
+  def augment(drb_req: DrillbeyondRequest): DrillbeyondResponse = {
+    val entities = drb_req.columns(0)
+
+    val pred = drb_req.predicates.find(a => a.isInstanceOf[NumericValuedPredicate]).asInstanceOf[Option[NumericValuedPredicate]]
+    val output = if (pred.isEmpty) {
+      val candidates = (0 until drb_req.max_cands).map(i => {
+        val vals:Array[java.lang.Double] = entities.map(e =>  new java.lang.Double(new Random(e.hashCode + 1000000*i).nextDouble))
+        DrillbeyondSolution(vals, 1.0)
+      })
+      DrillbeyondResponse(candidates.toArray, unionSelect(pred, candidates))
+    }
+    else
+    {
+      val predVal:Double = pred.get.value
+      val candidates = (0 until drb_req.max_cands).map(i => {
+
+        val vals = pred.get.artificial_values(entities, selectivity, (i+1)*10000, fuzziness)
+        DrillbeyondSolution(
+          vals,
+          drb_req.predicates(0).selectivity(vals))
+        })
+      DrillbeyondResponse(candidates.toArray, unionSelect(pred, candidates))
+    }
+    val unionSelectivity = output.inUnion.count(_ == true) / output.inUnion.size.toDouble
+    output
+  }
+
   def main(args: Array[String]) {
     setup(args)
     
     post(new JsonTransformer("/artificial", "application/json") {
       override def handle(request: Request, response: Response) = {
         val drb_req = JSONSerializable.fromJson(classOf[DrillbeyondRequest], request.body)
-        val entities = drb_req.columns(0)
-
-        val pred = drb_req.predicates.find(a => a.isInstanceOf[NumericValuedPredicate]).asInstanceOf[Option[NumericValuedPredicate]]
-        val output = if (pred.isEmpty) {
-          val candidates = (0 until drb_req.max_cands).map(i => {
-            val vals:Array[java.lang.Double] = entities.map(e =>  new java.lang.Double(new Random(e.hashCode + 1000000*i).nextDouble))
-            DrillbeyondSolution(vals, 1.0)
-          })
-          DrillbeyondResponse(candidates.toArray, unionSelect(pred, candidates))
-        }
-        else
-        {
-          val predVal:Double = pred.get.value
-          val candidates = (0 until drb_req.max_cands).map(i => {
-
-            val vals = pred.get.artificial_values(entities, selectivity, (i+1)*10000, fuzziness)
-            DrillbeyondSolution(
-              vals,
-              drb_req.predicates(0).selectivity(vals))
-            })
-          DrillbeyondResponse(candidates.toArray, unionSelect(pred, candidates))
+        augment(drb_req)
+      }
+    })
+    post(new Route("/artificial/binary") {
+      override def handle(request: Request, response: Response) = {
+        if (request.contentType != BinaryProtocol.ContentType) {
+          halt(415, "Unsupported media type")
         }
-        val unionSelectivity = output.inUnion.count(_ == true) / output.inUnion.size.toDouble
-        output
+        val drb_req = BinaryProtocol.readRequest(request.raw.getInputStream)
+        response.raw.setContentType(BinaryProtocol.ContentType)
+        BinaryProtocol.writeResponse(augment(drb_req), response.raw.getOutputStream)
+        response.raw.getOutputStream.flush()
+        ""
       }
     })
     get(new Route("/set_selectivity/:sel") {
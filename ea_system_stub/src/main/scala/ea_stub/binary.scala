@@ -0,0 +1,69 @@
+package ea_stub
+
+import java.io.{BufferedOutputStream, DataInputStream, DataOutputStream, InputStream, OutputStream}
+import ea_stub.EAStub.DrillbeyondResponse
+
+/*
+ * Binary wire format, see src/backend/drillbeyond/drillbeyond_wire.c for the layout.
+ * DataInput/OutputStream use network byte order, like the backend.
+ */
+object BinaryProtocol {
+  val ContentType = "application/x-drillbeyond"
+  val Magic = 0x44524231
+  val Version = 1
+
+  def readString(in: DataInputStream): String = {
+    val len = in.readInt()
+    if (len < 0) null
+    else {
+      val bytes = new Array[Byte](len)
+      in.readFully(bytes)
+      new String(bytes, "UTF-8")
+    }
+  }
+
+  def readStrings(in: DataInputStream): Array[String] =
+    (0 until in.readInt()).map(_ => readString(in)).toArray
+
+  def readRequest(stream: InputStream): DrillbeyondRequest = {
+    val in = new DataInputStream(stream)
+    if (in.readInt() != Magic)
+      throw new IllegalArgumentException("not a DrillBeyond binary request")
+    in.readInt() // version
+    val req = new DrillbeyondRequest
+    req.keyword = readString(in)
+    req.concept = readString(in)
+    req.max_cands = in.readInt()
+    req.restrictions = readStrings(in)
+    readStrings(in) // column names, not used by the stub
+    req.col_names = readStrings(in)
+    val numCols = in.readInt()
+    val numRows = in.readInt()
+    req.columns = (0 until numCols).map(_ => (0 until numRows).map(_ => readString(in)).toArray).toArray
+    req
+  }
+
+  def writeBitmap(out: DataOutputStream, bits: Seq[Boolean]) = {
+    val bitmap = new Array[Byte]((bits.size + 7) / 8)
+    bits.zipWithIndex.foreach { case (b, i) =>
+      if (b) bitmap(i / 8) = (bitmap(i / 8) | (1 << (i % 8))).toByte
+    }
+    out.write(bitmap)
+  }
+
+  def writeResponse(resp: DrillbeyondResponse, stream: OutputStream) = {
+    val out = new DataOutputStream(new BufferedOutputStream(stream))
+    val numRows = if (resp.candidates.isEmpty) resp.inUnion.length else resp.candidates(0).values.length
+    out.writeInt(Magic)
+    out.writeInt(resp.candidates.length)
+    out.writeInt(numRows)
+    resp.candidates.foreach(cand => {
+      out.writeDouble(cand.selectivity)
+      writeBitmap(out, cand.values.map(_ == null))
+      cand.values.foreach(v => out.writeDouble(if (v == null) 0.0 else v.doubleValue))
+    })
+    writeBitmap(out, resp.inUnion)
+    out.writeInt(-1) // no explanation
+    out.flush()
+  }
+}
@@ -50,6 +50,7 @@
 #include "catalog/storage.h"
 #include "commands/tablecmds.h"
 #include "commands/typecmds.h"
+#include "drillbeyond/drillbeyond.h"
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/var.h"
@@ -1753,6 +1754,8 @@ heap_drop_with_catalog(Oid relid)
 	 * delete statistics
 	 */
 	RemoveStatistics(relid, 0);
+	RemoveDrillBeyondStatistics(relid);
+	RemoveDrillBeyondMaterializations(relid);
 
 	/*
 	 * delete attribute tuples
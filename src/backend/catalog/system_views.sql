@@ -585,6 +585,28 @@ CREATE VIEW pg_stat_replication AS
     WHERE S.usesysid = U.oid AND
             S.pid = W.pid;
 
+CREATE VIEW pg_stat_drillbeyond AS
+    SELECT
+            S.datid,
+            D.datname,
+            S.keyword,
+            S.executions,
+            S.requests,
+            S.bytes_sent,
+            S.bytes_received,
+            S.serialize_time,
+            S.network_time,
+            S.parse_time,
+            S.merge_time,
+            S.input_rows,
+            S.distinct_keys,
+            S.cache_hits,
+            S.rescans,
+            S.rows,
+            S.max_hashtable_bytes
+    FROM pg_stat_get_drillbeyond() AS S
+            LEFT JOIN pg_database D ON (S.datid = D.oid);
+
 CREATE VIEW pg_stat_database AS
     SELECT
             D.oid AS datid,
@@ -29,6 +29,7 @@
 #include "commands/dbcommands.h"
 #include "commands/tablecmds.h"
 #include "commands/vacuum.h"
+#include "drillbeyond/drillbeyond.h"
 #include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "miscadmin.h"
@@ -552,6 +553,10 @@ do_analyze_rel(Relation onerel, VacuumStmt *vacstmt,
 			update_attstats(RelationGetRelid(Irel[ind]), false,
 							thisdata->attr_cnt, thisdata->vacattrstats);
 		}
+
+		/* Re-estimate the selectivities of open attributes on the relation */
+		if (!inh)
+			drillbeyond_analyze_rel(onerel, rows, numrows);
 	}
 
 	/*
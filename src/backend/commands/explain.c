@@ -78,6 +78,10 @@ static void show_sort_keys_common(PlanState *planstate,
 					  List *ancestors, ExplainState *es);
 static void show_sort_info(SortState *sortstate, ExplainState *es);
 static void show_hash_info(HashState *hashstate, ExplainState *es);
+static void show_resultcache_info(ResultCacheState *rcstate, ExplainState *es);
+static void show_drillbeyond_info(DrillBeyondState *dbstate, ExplainState *es);
+static void show_drillbeyond_expand_info(DrillBeyondExpandState *expstate,
+							 ExplainState *es);
 static void show_instrumentation_count(const char *qlabel, int which,
 						   PlanState *planstate, ExplainState *es);
 static void show_foreignscan_info(ForeignScanState *fsstate, ExplainState *es);
@@ -141,6 +145,8 @@ ExplainQuery(ExplainStmt *stmt, const char *queryString,
 			timing_set = true;
 			es.timing = defGetBoolean(opt);
 		}
+		else if (strcmp(opt->defname, "drillbeyond") == 0)
+			es.drillbeyond = defGetBoolean(opt);
 		else if (strcmp(opt->defname, "format") == 0)
 		{
 			char	   *p = defGetString(opt);
@@ -171,6 +177,11 @@ ExplainQuery(ExplainStmt *stmt, const char *queryString,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("EXPLAIN option BUFFERS requires ANALYZE")));
 
+	if (es.drillbeyond && !es.analyze)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("EXPLAIN option DRILLBEYOND requires ANALYZE")));
+
 	/* if the timing was not set explicitly, set default value */
 	es.timing = (timing_set) ? es.timing : es.analyze;
 
@@ -785,6 +796,9 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Material:
 			pname = sname = "Materialize";
 			break;
+		case T_ResultCache:
+			pname = sname = "Result Cache";
+			break;
 		case T_Sort:
 			pname = sname = "Sort";
 			break;
@@ -1234,6 +1248,13 @@ ExplainNode(PlanState *planstate, List *ancestors,
 			if (plan->qual)
 				show_instrumentation_count("Rows Removed by Filter", 2,
 										   planstate, es);
+			if (es->drillbeyond)
+				show_drillbeyond_info((DrillBeyondState *) planstate, es);
+			break;
+		case T_DrillBeyondExpand:
+			if (es->drillbeyond)
+				show_drillbeyond_expand_info((DrillBeyondExpandState *) planstate,
+											 es);
 			break;
 		case T_Agg:
 		case T_Group:
@@ -1261,6 +1282,9 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Hash:
 			show_hash_info((HashState *) planstate, es);
 			break;
+		case T_ResultCache:
+			show_resultcache_info((ResultCacheState *) planstate, es);
+			break;
 		default:
 			break;
 	}
@@ -1715,6 +1739,161 @@ show_hash_info(HashState *hashstate, ExplainState *es)
 	}
 }
 
+/*
+ * Show the parameters a result cache is keyed on, and for EXPLAIN ANALYZE,
+ * how well it did.
+ */
+static void
+show_resultcache_info(ResultCacheState *rcstate, ExplainState *es)
+{
+	ResultCache *plan = (ResultCache *) rcstate->ps.plan;
+	List	   *result = NIL;
+	int			i;
+
+	Assert(IsA(rcstate, ResultCacheState));
+	for (i = 0; i < plan->numParams; i++)
+	{
+		char		buf[32];
+
+		snprintf(buf, sizeof(buf), "$%d", plan->paramIds[i]);
+		result = lappend(result, pstrdup(buf));
+	}
+	ExplainPropertyList("Cache Key", result, es);
+
+	if (!es->analyze)
+		return;
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str, "Hits: %ld  Misses: %ld  Evictions: %ld\n",
+						 rcstate->hits, rcstate->misses, rcstate->evictions);
+	}
+	else
+	{
+		ExplainPropertyLong("Cache Hits", rcstate->hits, es);
+		ExplainPropertyLong("Cache Misses", rcstate->misses, es);
+		ExplainPropertyLong("Cache Evictions", rcstate->evictions, es);
+	}
+}
+
+/*
+ * Show what a DrillBeyond operator spent on the EA service, and the rows and
+ * time of each of its candidates.
+ */
+static void
+show_drillbeyond_info(DrillBeyondState *dbstate, ExplainState *es)
+{
+	DrillBeyondExpansion *expansion = ((DrillBeyond *) dbstate->js.ps.plan)->drb_expansion;
+	DrillBeyondInstrumentation *instr = dbstate->db_instr;
+	DrillBeyondHashTable *hashtable = expansion->results_hashtable;
+	long		spaceKb = hashtable ? (long) ((hashtable->spaceUsed + 1023) / 1024) : 0;
+	long		distinct = expansion->actual_distinct > 0 ? (long) expansion->actual_distinct : 0;
+	int			ncands;
+	int			i;
+
+	/* taken over by a reoptimized plan */
+	if (instr == NULL)
+		return;
+	ncands = Min(Max(dbstate->db_num_cands, 1), instr->num_cands);
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str,
+						 "Requests: %ld  Sent: %ldkB  Received: %ldkB  Cache Hits: %d\n",
+						 instr->requests, (instr->bytes_sent + 1023) / 1024,
+						 (instr->bytes_received + 1023) / 1024,
+						 dbstate->db_cache_hits);
+		if (instr->coalesced > 0)
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str, "Coalesced Requests: %ld\n",
+							 instr->coalesced);
+		}
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str,
+						 "Request Time: serialize=%.3f network=%.3f parse=%.3f merge=%.3f\n",
+						 instr->serialize_ms, instr->network_ms,
+						 instr->parse_ms, instr->merge_ms);
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str,
+						 "Distinct Keys: %ld  Memory Usage: %ldkB  Candidate Rescans: %ld\n",
+						 distinct, spaceKb, instr->rescans);
+		for (i = 0; i < ncands; i++)
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			if (es->timing)
+				appendStringInfo(es->str, "Candidate %d: rows=%.0f time=%.3f\n",
+								 i, instr->cand_rows[i], instr->cand_ms[i]);
+			else
+				appendStringInfo(es->str, "Candidate %d: rows=%.0f\n",
+								 i, instr->cand_rows[i]);
+		}
+	}
+	else
+	{
+		ExplainPropertyLong("EA Requests", instr->requests, es);
+		ExplainPropertyLong("Coalesced Requests", instr->coalesced, es);
+		ExplainPropertyLong("Bytes Sent", instr->bytes_sent, es);
+		ExplainPropertyLong("Bytes Received", instr->bytes_received, es);
+		ExplainPropertyInteger("Cache Hits", dbstate->db_cache_hits, es);
+		ExplainPropertyFloat("Serialize Time", instr->serialize_ms, 3, es);
+		ExplainPropertyFloat("Network Time", instr->network_ms, 3, es);
+		ExplainPropertyFloat("Parse Time", instr->parse_ms, 3, es);
+		ExplainPropertyFloat("Merge Time", instr->merge_ms, 3, es);
+		ExplainPropertyLong("Distinct Keys", distinct, es);
+		ExplainPropertyLong("Memory Usage", spaceKb, es);
+		ExplainPropertyLong("Candidate Rescans", instr->rescans, es);
+		ExplainOpenGroup("Candidates", "Candidates", false, es);
+		for (i = 0; i < ncands; i++)
+		{
+			ExplainOpenGroup("Candidate", NULL, true, es);
+			ExplainPropertyInteger("Candidate", i, es);
+			ExplainPropertyFloat("Actual Rows", instr->cand_rows[i], 0, es);
+			if (es->timing)
+				ExplainPropertyFloat("Actual Time", instr->cand_ms[i], 3, es);
+			ExplainCloseGroup("Candidate", NULL, true, es);
+		}
+		ExplainCloseGroup("Candidates", "Candidates", false, es);
+	}
+}
+
+/*
+ * Show how many result variants DRB_TOP produced, and how many runs of the
+ * plan below were timed for the adaptive strategy.
+ */
+static void
+show_drillbeyond_expand_info(DrillBeyondExpandState *expstate, ExplainState *es)
+{
+	DrillBeyondExpand *plan = (DrillBeyondExpand *) expstate->ps.plan;
+	int			variants = 0;
+
+	if (plan->drb_strategy == DRB_TOP)
+		variants = Min(expstate->current_origin + 1, expstate->total_variants);
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		if (plan->drb_strategy == DRB_TOP)
+			appendStringInfo(es->str, "Result Variants: %d of %d  Timed Runs: %d\n",
+							 variants, expstate->total_variants,
+							 expstate->run_count);
+		else
+			appendStringInfo(es->str, "Timed Runs: %d\n", expstate->run_count);
+	}
+	else
+	{
+		if (plan->drb_strategy == DRB_TOP)
+		{
+			ExplainPropertyInteger("Result Variants", variants, es);
+			ExplainPropertyInteger("Planned Result Variants",
+								   expstate->total_variants, es);
+		}
+		ExplainPropertyInteger("Timed Runs", expstate->run_count, es);
+	}
+}
+
 /*
  * If it's EXPLAIN ANALYZE, show instrumentation information for a plan node
  *
@@ -0,0 +1,484 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_cache.c
+ *    Cross-query cache of entity augmentation results in shared memory.
+ *
+ * The results_hashtable of an expansion only lives for one statement, so
+ * every query used to ask the EA service again for the same keyword over the
+ * same table. This cache keeps the candidate vectors of all answered join
+ * values in a shared hash table, keyed by (database, keyword, augmented
+ * table, request signature, join values). Only augmentations of tables are
+ * cached, those of subqueries have no identity across statements. The
+ * request signature covers everything else that changes the answer of the
+ * service: the restrictions that were sent, max_cands and the service that
+ * was asked, by drb_server_url.
+ *
+ * Entries are kept in the order they were stored and are ignored once they
+ * are older than drb_result_cache_ttl seconds; being shared, the TTL is set
+ * cluster-wide. Lookups only take DrillBeyondCacheLock shared, so a hit does
+ * not move its entry: the oldest entry is evicted first, and expired ones
+ * are dropped by the next store. The cache is only allocated if
+ * drb_result_cache_size is set. Join values whose text does not fit into
+ * the fixed size key, and answers with more than NUM_CANDS candidates, are
+ * simply not cached.
+ *
+ * Keys are built with the type output functions, which may be slow or fail,
+ * so they are built before taking the lock, in batches of DRB_CACHE_BATCH
+ * join values. The lock only covers the probes and the copies.
+ *
+ * Per-candidate selectivities are a property of a whole request, not of a
+ * single join value. For each request signature an additional summary entry
+ * keeps the selectivities of the last response, they are used when join
+ * values are answered from the cache.
+ *
+ * src/backend/drillbeyond/drillbeyond_cache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "drillbeyond/drillbeyond.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+bool drb_enable_result_cache = false;
+int drb_result_cache_size = 0;
+int drb_result_cache_ttl = 3600;
+
+#define DRB_CACHE_KEY_LEN 128
+#define DRB_CACHE_COL_SEP '\x1f'
+#define DRB_CACHE_NULL '\x1e'
+#define DRB_CACHE_BATCH 256
+
+typedef struct DrbCacheKey {
+    Oid dbid;
+    uint32 signature; // see drillbeyond_cache_signature
+    bool summary; // entry holds the selectivities of a request, not values
+    char keyword[NAMEDATALEN];
+    Oid relid; // augmented table
+    char joinValues[DRB_CACHE_KEY_LEN]; // output of all join columns, separated by DRB_CACHE_COL_SEP
+} DrbCacheKey;
+
+typedef struct DrbCacheEntry {
+    DrbCacheKey key; // hash key, must be first
+    SHM_QUEUE lru; // position in the list of entries, oldest first
+    TimestampTz stored;
+    int numValues;
+    bool inUnion;
+    bool is_null[NUM_CANDS];
+    float8 values[NUM_CANDS]; // candidate values, or selectivities for summary entries
+} DrbCacheEntry;
+
+typedef struct DrbCacheShared {
+    SHM_QUEUE lru;
+    int numEntries;
+} DrbCacheShared;
+
+static HTAB *drb_cache_hash = NULL;
+static DrbCacheShared *drb_cache_shared = NULL;
+
+static uint32 drillbeyond_cache_signature(DrillBeyondExpansion *expansion);
+static void init_cache_key(DrbCacheKey *key, DrillBeyondExpansion *expansion, uint32 signature, bool summary);
+static bool fill_cache_key(DrbCacheKey *key, DrillBeyondExpansion *expansion, DrillBeyondValues *values);
+static DrbCacheEntry *cache_lookup(DrbCacheKey *key, TimestampTz now);
+static DrbCacheEntry *cache_insert(DrbCacheKey *key, TimestampTz now);
+static void lookup_cache_batch(DrbCacheKey *keys, int n, DrbCacheEntry *copies, bool *found, TimestampTz now);
+static void store_cache_batch(DrbCacheKey *keys, DrillBeyondValues **batch, int n, TimestampTz now);
+
+/*
+ * DrbCacheShmemSize --- report amount of shared memory space needed
+ */
+Size
+DrbCacheShmemSize(void)
+{
+    if (drb_result_cache_size <= 0)
+        return 0;
+    return add_size(MAXALIGN(sizeof(DrbCacheShared)),
+                    hash_estimate_size(drb_result_cache_size, sizeof(DrbCacheEntry)));
+}
+
+/*
+ * DrbCacheShmemInit --- initialize this module's shared memory
+ */
+void
+DrbCacheShmemInit(void)
+{
+    HASHCTL info;
+    bool found;
+
+    if (drb_result_cache_size <= 0)
+        return;
+
+    drb_cache_shared = (DrbCacheShared *)
+        ShmemInitStruct("DrillBeyond Result Cache Header", sizeof(DrbCacheShared), &found);
+    if (!found) {
+        SHMQueueInit(&drb_cache_shared->lru);
+        drb_cache_shared->numEntries = 0;
+    }
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(DrbCacheKey);
+    info.entrysize = sizeof(DrbCacheEntry);
+    info.hash = tag_hash;
+    drb_cache_hash = ShmemInitHash("DrillBeyond Result Cache",
+                                   drb_result_cache_size, drb_result_cache_size,
+                                   &info,
+                                   HASH_ELEM | HASH_FUNCTION);
+}
+
+/*
+ * Whether requests of expansion go through the cache.
+ */
+extern bool drillbeyond_cache_enabled(DrillBeyondExpansion *expansion) {
+    return drb_enable_result_cache && drb_cache_hash != NULL && OidIsValid(expansion->extended_relid);
+}
+
+/*
+ * Hash of everything besides keyword, table and join values that goes into a
+ * request and changes its answer.
+ */
+static uint32 drillbeyond_cache_signature(DrillBeyondExpansion *expansion) {
+    json_object *msg = json_object_new_object();
+    const char *restrictions;
+    uint32 signature;
+
+    add_restrictions_to_msg(msg, expansion->drb_qual);
+    restrictions = json_object_to_json_string_ext(json_object_object_get(msg, RESTRICTIONS),
+                                                  JSON_C_TO_STRING_PLAIN);
+    signature = DatumGetUInt32(hash_any((const unsigned char *) restrictions, strlen(restrictions)));
+    signature ^= DatumGetUInt32(hash_uint32((uint32) drb_max_num_cands));
+    // any session may point drb_server_url at another service
+    signature = (signature << 1) | (signature >> 31);
+    signature ^= DatumGetUInt32(hash_any((const unsigned char *) drb_server_url, strlen(drb_server_url)));
+    if (drb_enable_rea)
+        signature = ~signature;
+    json_object_put(msg);
+    return signature;
+}
+
+static void init_cache_key(DrbCacheKey *key, DrillBeyondExpansion *expansion, uint32 signature, bool summary) {
+    MemSet(key, 0, sizeof(DrbCacheKey)); // compared with memcmp
+    key->dbid = MyDatabaseId;
+    key->signature = signature;
+    key->summary = summary;
+    strlcpy(key->keyword, expansion->keyword, NAMEDATALEN);
+    key->relid = expansion->extended_relid;
+}
+
+/*
+ * Writes the join values of an entry into the key. Returns false if they
+ * can't be represented, i.e. if they are too long.
+ */
+static bool fill_cache_key(DrbCacheKey *key, DrillBeyondExpansion *expansion, DrillBeyondValues *values) {
+    int num_join_cols = list_length(expansion->join_cols);
+    int i;
+    int len = 0;
+
+    MemSet(key->joinValues, 0, DRB_CACHE_KEY_LEN);
+    for (i = 0; i < num_join_cols; i++) {
+        Datum attr = values->joinValues[i];
+        char *value;
+        int vlen;
+
+        if (i > 0) {
+            if (len + 1 >= DRB_CACHE_KEY_LEN)
+                return false;
+            key->joinValues[len++] = DRB_CACHE_COL_SEP;
+        }
+        if (attr == 0) {
+            if (len + 1 >= DRB_CACHE_KEY_LEN)
+                return false;
+            key->joinValues[len++] = DRB_CACHE_NULL;
+            continue;
+        }
+        attr = PointerGetDatum(PG_DETOAST_DATUM(attr));
+        value = DatumGetCString(FunctionCall1(&(expansion->outFunctions)[i], attr));
+        if (DatumGetPointer(attr) != DatumGetPointer(values->joinValues[i]))
+            pfree(DatumGetPointer(attr));
+        vlen = strlen(value);
+        if (len + vlen >= DRB_CACHE_KEY_LEN ||
+            strchr(value, DRB_CACHE_COL_SEP) || strchr(value, DRB_CACHE_NULL)) {
+            pfree(value);
+            return false;
+        }
+        memcpy(key->joinValues + len, value, vlen);
+        len += vlen;
+        pfree(value);
+    }
+    return true;
+}
+
+/*
+ * Returns the live entry for key, or NULL. Expired entries are left in place
+ * for cache_insert to drop. Caller must hold DrillBeyondCacheLock.
+ */
+static DrbCacheEntry *cache_lookup(DrbCacheKey *key, TimestampTz now) {
+    DrbCacheEntry *entry;
+
+    entry = (DrbCacheEntry *) hash_search(drb_cache_hash, key, HASH_FIND, NULL);
+    if (entry == NULL || TimestampDifferenceExceeds(entry->stored, now, drb_result_cache_ttl * 1000))
+        return NULL;
+    return entry;
+}
+
+/*
+ * Returns the entry for key, creating it if necessary. Drops expired entries
+ * and evicts the oldest one when the cache is full. Caller must hold
+ * DrillBeyondCacheLock exclusively.
+ */
+static DrbCacheEntry *cache_insert(DrbCacheKey *key, TimestampTz now) {
+    DrbCacheEntry *entry;
+    DrbCacheEntry *oldest;
+    bool found;
+
+    // entries are in store order, so expired ones are at the head
+    entry = (DrbCacheEntry *) hash_search(drb_cache_hash, key, HASH_FIND, NULL);
+    while ((oldest = (DrbCacheEntry *)
+            SHMQueueNext(&drb_cache_shared->lru, &drb_cache_shared->lru,
+                         offsetof(DrbCacheEntry, lru))) != NULL && oldest != entry) {
+        if (!TimestampDifferenceExceeds(oldest->stored, now, drb_result_cache_ttl * 1000) &&
+            (entry != NULL || drb_cache_shared->numEntries < drb_result_cache_size))
+            break;
+        SHMQueueDelete(&oldest->lru);
+        hash_search(drb_cache_hash, &oldest->key, HASH_REMOVE, NULL);
+        drb_cache_shared->numEntries--;
+    }
+
+    entry = (DrbCacheEntry *) hash_search(drb_cache_hash, key, HASH_ENTER_NULL, &found);
+    if (entry == NULL)
+        return NULL;
+    if (found)
+        SHMQueueDelete(&entry->lru);
+    else
+        drb_cache_shared->numEntries++;
+    SHMQueueInsertBefore(&drb_cache_shared->lru, &entry->lru);
+    entry->stored = now;
+    return entry;
+}
+
+/*
+ * Probes the keys of one batch under a shared lock and copies the live
+ * entries out, found[i] tells whether copies[i] is valid.
+ */
+static void lookup_cache_batch(DrbCacheKey *keys, int n, DrbCacheEntry *copies, bool *found, TimestampTz now) {
+    int i;
+
+    LWLockAcquire(DrillBeyondCacheLock, LW_SHARED);
+    for (i = 0; i < n; i++) {
+        DrbCacheEntry *entry = cache_lookup(&keys[i], now);
+
+        found[i] = entry != NULL;
+        if (found[i])
+            memcpy(&copies[i], entry, sizeof(DrbCacheEntry));
+    }
+    LWLockRelease(DrillBeyondCacheLock);
+}
+
+/*
+ * Inserts the values of one batch, keys[i] belongs to batch[i]. Only plain
+ * memory of the values is read while the lock is held.
+ */
+static void store_cache_batch(DrbCacheKey *keys, DrillBeyondValues **batch, int n, TimestampTz now) {
+    int i, j;
+
+    LWLockAcquire(DrillBeyondCacheLock, LW_EXCLUSIVE);
+    for (i = 0; i < n; i++) {
+        DrillBeyondValues *values = batch[i];
+        DrbCacheEntry *entry = cache_insert(&keys[i], now);
+
+        if (entry == NULL)
+            break;
+        entry->numValues = values->numValues;
+        entry->inUnion = values->inUnion;
+        for (j = 0; j < values->numValues; j++) {
+            entry->is_null[j] = DRB_VALUE_IS_NULL(values, j);
+            entry->values[j] = entry->is_null[j] ? 0.0 : values->values[j];
+        }
+    }
+    LWLockRelease(DrillBeyondCacheLock);
+}
+
+/*
+ * Answers all join values of the operator that were neither requested nor
+ * are in flight from the cache, so that drillbeyond_collect_entries skips them.
+ * Selectivities of hits are taken from the summary of their request
+ * signature and merged the same way drillbeyond_process_response does.
+ */
+extern void drillbeyond_lookup_cache(DrillBeyondState *dbstate) {
+    DrillBeyond *plan = (DrillBeyond *) dbstate->js.ps.plan;
+    DrillBeyondExpansion *expansion = plan->drb_expansion;
+    DrbCacheKey key;
+    DrbCacheKey *keys;
+    DrillBeyondValues **batch;
+    DrbCacheEntry *copies;
+    bool *found;
+    bool done = false;
+    uint32 pos = 0;
+    TimestampTz now;
+    DrillBeyondValues *values;
+    int hits = 0;
+    int num_prev = dbstate->db_tuples_requested;
+    int num_cands = dbstate->db_num_cands;
+    double sumInUnion = 0;
+    double summary_sel[NUM_CANDS];
+    int summary_cands = 0;
+
+    if (!drillbeyond_cache_enabled(expansion))
+        return;
+
+    init_cache_key(&key, expansion, drillbeyond_cache_signature(expansion), false);
+    now = GetCurrentTimestamp();
+
+    keys = (DrbCacheKey *) palloc(sizeof(DrbCacheKey) * DRB_CACHE_BATCH);
+    batch = (DrillBeyondValues **) palloc(sizeof(DrillBeyondValues *) * DRB_CACHE_BATCH);
+    copies = (DrbCacheEntry *) palloc(sizeof(DrbCacheEntry) * DRB_CACHE_BATCH);
+    found = (bool *) palloc(sizeof(bool) * DRB_CACHE_BATCH);
+
+    while (!done) {
+        int n = 0;
+        int i, j;
+
+        while (n < DRB_CACHE_BATCH) {
+            values = drb_iterateHashTable(expansion->results_hashtable, &pos);
+            if (values == NULL) {
+                done = true;
+                break;
+            }
+            if (values->requested || values->pending)
+                continue;
+            if (!fill_cache_key(&key, expansion, values))
+                continue;
+            keys[n] = key;
+            batch[n++] = values;
+        }
+        if (n == 0)
+            continue;
+
+        lookup_cache_batch(keys, n, copies, found, now);
+
+        for (i = 0; i < n; i++) {
+            DrbCacheEntry *entry = &copies[i];
+
+            if (!found[i])
+                continue;
+            values = batch[i];
+            drb_allocValueRows(expansion, &values, 1, entry->numValues);
+            for (j = 0; j < entry->numValues; j++) {
+                if (!entry->is_null[j]) {
+                    values->values[j] = entry->values[j];
+                    values->nulls[j / 8] &= ~(1 << (j % 8));
+                }
+            }
+            values->inUnion = entry->inUnion;
+            values->requested = true;
+            if (values->inUnion)
+                sumInUnion += 1;
+            if (entry->numValues > num_cands)
+                num_cands = entry->numValues;
+            hits++;
+        }
+    }
+
+    if (hits > 0) {
+        key.summary = true;
+        MemSet(key.joinValues, 0, DRB_CACHE_KEY_LEN);
+        lookup_cache_batch(&key, 1, copies, found, now);
+        if (found[0]) {
+            summary_cands = copies[0].numValues;
+            memcpy(summary_sel, copies[0].values, sizeof(double) * summary_cands);
+        }
+    }
+
+    pfree(keys);
+    pfree(batch);
+    pfree(copies);
+    pfree(found);
+
+    if (hits == 0)
+        return;
+
+    if (num_cands > dbstate->db_num_cands || expansion->selectivities == NULL) {
+        double *selectivities = (double *) palloc0(sizeof(double) * (num_cands > 0 ? num_cands : 1));
+        if (expansion->selectivities != NULL)
+            memcpy(selectivities, expansion->selectivities, sizeof(double) * dbstate->db_num_cands);
+        expansion->selectivities = selectivities;
+    }
+    if (summary_cands > 0) {
+        int i;
+        for (i = 0; i < num_cands && i < summary_cands; i++)
+            expansion->selectivities[i] = (expansion->selectivities[i] * num_prev + summary_sel[i] * hits)
+                                          / (num_prev + hits);
+    } else {
+        int i;
+        // summary already evicted, fall back to the estimate
+        for (i = 0; i < num_cands; i++)
+            expansion->selectivities[i] = (expansion->selectivities[i] * num_prev + expansion->selectivity * hits)
+                                          / (num_prev + hits);
+    }
+    expansion->union_selectivity = (expansion->union_selectivity * num_prev + sumInUnion)
+                                   / (num_prev + hits);
+    dbstate->db_num_cands = num_cands > 0 ? num_cands : 1;
+    dbstate->db_tuples_requested += hits;
+    dbstate->db_cache_hits += hits;
+}
+
+/*
+ * Stores the freshly answered entries of one response, together with the
+ * selectivities that came with it.
+ */
+extern void drillbeyond_store_cache(DrillBeyondState *dbstate, List *entries,
+                                    double *selectivities, int num_cands) {
+    DrillBeyond *plan = (DrillBeyond *) dbstate->js.ps.plan;
+    DrillBeyondExpansion *expansion = plan->drb_expansion;
+    DrbCacheKey key;
+    DrbCacheKey *keys;
+    DrillBeyondValues **batch;
+    DrbCacheEntry *entry;
+    TimestampTz now;
+    ListCell *lc;
+    int n = 0;
+    int j;
+
+    if (!drillbeyond_cache_enabled(expansion) || entries == NIL || num_cands > NUM_CANDS)
+        return;
+
+    init_cache_key(&key, expansion, drillbeyond_cache_signature(expansion), false);
+    now = GetCurrentTimestamp();
+    keys = (DrbCacheKey *) palloc(sizeof(DrbCacheKey) * DRB_CACHE_BATCH);
+    batch = (DrillBeyondValues **) palloc(sizeof(DrillBeyondValues *) * DRB_CACHE_BATCH);
+
+    foreach(lc, entries) {
+        DrillBeyondValues *values = (DrillBeyondValues *) lfirst(lc);
+
+        if (values->numValues > NUM_CANDS || !fill_cache_key(&key, expansion, values))
+            continue;
+        keys[n] = key;
+        batch[n++] = values;
+        if (n == DRB_CACHE_BATCH) {
+            store_cache_batch(keys, batch, n, now);
+            n = 0;
+        }
+    }
+    if (n > 0)
+        store_cache_batch(keys, batch, n, now);
+    pfree(keys);
+    pfree(batch);
+
+    key.summary = true;
+    MemSet(key.joinValues, 0, DRB_CACHE_KEY_LEN);
+    LWLockAcquire(DrillBeyondCacheLock, LW_EXCLUSIVE);
+    entry = cache_insert(&key, now);
+    if (entry != NULL) {
+        entry->numValues = num_cands;
+        for (j = 0; j < num_cands; j++) {
+            entry->is_null[j] = false;
+            entry->values[j] = selectivities[j];
+        }
+    }
+    LWLockRelease(DrillBeyondCacheLock);
+}
@@ -0,0 +1,251 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_coalesce.c
+ *    Coalescing of identical EA requests that are in flight concurrently.
+ *
+ * Sessions that run the same report at the same time send the same requests
+ * to the EA service. A shared registry keeps the requests in flight, keyed
+ * by a hash of the request: server list, path and body. A backend that is
+ * about to send a request that is registered already follows it instead:
+ * it waits until the backend that sent it has merged the response, and then
+ * takes the answers from the result cache (drillbeyond_cache.c). So this
+ * only happens with drb_enable_result_cache.
+ *
+ * Whatever the cache can not answer after the wait, e.g. join values too
+ * long for a cache key, or a hash collision, is simply requested then. Such
+ * a request does not follow another one again, so every backend makes
+ * progress. Registrations of a backend end with its transaction at the
+ * latest, so no follower waits for a request that was given up. The owner
+ * only ends a streamed registration when it polls for responses, though,
+ * which it may not do for a long time, e.g. while idle in a transaction
+ * with an open cursor. So a follower waits at most as long as the HTTP
+ * timeout, and then sends the request itself.
+ *
+ * src/backend/drillbeyond/drillbeyond_coalesce.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "access/xact.h"
+#include "drillbeyond/drillbeyond.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+bool drb_enable_request_coalescing = true;
+
+// longest wait for a followed request, if neither HTTP timeout is set
+#define DRB_INFLIGHT_MAX_WAIT 10000
+
+typedef struct DrbInflightKey {
+    Oid dbid;
+    uint32 hash; // of servers, path and body
+    int32 len; // of the body
+    char keyword[NAMEDATALEN];
+} DrbInflightKey;
+
+typedef struct DrbInflightEntry {
+    DrbInflightKey key; // hash key, must be first
+    uint32 ticket; // tells a registration from later ones of the same request
+} DrbInflightEntry;
+
+typedef struct DrbInflightShared {
+    uint32 next_ticket;
+} DrbInflightShared;
+
+struct DrillBeyondInflight {
+    DrbInflightKey key;
+    uint32 ticket;
+    bool owner; // registered by this backend, not followed
+    TimestampTz wait_until; // follower: when to stop waiting and send itself
+};
+
+static HTAB *drb_inflight_hash = NULL;
+static DrbInflightShared *drb_inflight_shared = NULL;
+
+// registrations of this backend, in TopMemoryContext
+static List *owned_inflight = NIL;
+static bool callback_registered = false;
+
+static void unregister_inflight(DrillBeyondInflight *inflight);
+static void drb_inflight_xact_callback(XactEvent event, void *arg);
+
+/*
+ * DrbInflightShmemSize --- report amount of shared memory space needed
+ */
+Size
+DrbInflightShmemSize(void)
+{
+    return add_size(MAXALIGN(sizeof(DrbInflightShared)),
+                    hash_estimate_size(DRB_INFLIGHT_MAX_ENTRIES, sizeof(DrbInflightEntry)));
+}
+
+/*
+ * DrbInflightShmemInit --- initialize this module's shared memory
+ */
+void
+DrbInflightShmemInit(void)
+{
+    HASHCTL info;
+    bool found;
+
+    drb_inflight_shared = (DrbInflightShared *)
+        ShmemInitStruct("DrillBeyond In-flight Requests Header", sizeof(DrbInflightShared), &found);
+    if (!found)
+        drb_inflight_shared->next_ticket = 0;
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(DrbInflightKey);
+    info.entrysize = sizeof(DrbInflightEntry);
+    info.hash = tag_hash;
+    drb_inflight_hash = ShmemInitHash("DrillBeyond In-flight Requests",
+                                      DRB_INFLIGHT_MAX_ENTRIES, DRB_INFLIGHT_MAX_ENTRIES,
+                                      &info,
+                                      HASH_ELEM | HASH_FUNCTION);
+}
+
+/*
+ * Registers the request of expansion with body, sent to path, as in flight.
+ * If the same request is in flight already, and follow is set, sets
+ * *coalesced and returns a handle to wait for that one instead. Returns NULL
+ * if requests are not coalesced, or the registry is full.
+ */
+extern DrillBeyondInflight *drillbeyond_inflight_begin(DrillBeyondExpansion *expansion, const char *path,
+                                                       StringInfo body, bool follow, bool *coalesced) {
+    DrillBeyondInflight *inflight;
+    DrbInflightEntry *entry;
+    DrbInflightKey key;
+    MemoryContext oldcontext;
+    bool found;
+
+    *coalesced = false;
+    if (!drb_enable_request_coalescing || !drb_enable_result_cache || drb_inflight_hash == NULL)
+        return NULL;
+
+    MemSet(&key, 0, sizeof(key)); // compared with memcmp
+    key.dbid = MyDatabaseId;
+    key.hash = DatumGetUInt32(hash_any((const unsigned char *) body->data, body->len));
+    key.hash ^= DatumGetUInt32(hash_any((const unsigned char *) path, strlen(path)));
+    key.hash = (key.hash << 1) | (key.hash >> 31);
+    key.hash ^= DatumGetUInt32(hash_any((const unsigned char *) drb_server_url, strlen(drb_server_url)));
+    key.len = body->len;
+    strlcpy(key.keyword, expansion->keyword, NAMEDATALEN);
+
+    if (!callback_registered) {
+        RegisterXactCallback(drb_inflight_xact_callback, NULL);
+        callback_registered = true;
+    }
+
+    LWLockAcquire(DrillBeyondInflightLock, LW_EXCLUSIVE);
+    entry = (DrbInflightEntry *) hash_search(drb_inflight_hash, &key, HASH_ENTER_NULL, &found);
+    if (entry == NULL || (found && !follow)) {
+        LWLockRelease(DrillBeyondInflightLock);
+        return NULL;
+    }
+    if (!found)
+        entry->ticket = drb_inflight_shared->next_ticket++;
+    inflight = (DrillBeyondInflight *) MemoryContextAlloc(TopTransactionContext, sizeof(DrillBeyondInflight));
+    inflight->key = key;
+    inflight->ticket = entry->ticket;
+    inflight->owner = !found;
+    LWLockRelease(DrillBeyondInflightLock);
+
+    if (found) {
+        int wait_ms = drb_request_timeout > 0 ? drb_request_timeout :
+                      drb_connect_timeout > 0 ? drb_connect_timeout : DRB_INFLIGHT_MAX_WAIT;
+        inflight->wait_until = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), wait_ms);
+    }
+
+    if (inflight->owner) {
+        oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+        owned_inflight = lappend(owned_inflight, inflight);
+        MemoryContextSwitchTo(oldcontext);
+    }
+    *coalesced = found;
+    return inflight;
+}
+
+/*
+ * Whether the request followed by inflight has been answered, or given up.
+ */
+extern bool drillbeyond_inflight_done(DrillBeyondInflight *inflight) {
+    DrbInflightEntry *entry;
+    bool done;
+
+    LWLockAcquire(DrillBeyondInflightLock, LW_SHARED);
+    entry = (DrbInflightEntry *) hash_search(drb_inflight_hash, &inflight->key, HASH_FIND, NULL);
+    done = entry == NULL || entry->ticket != inflight->ticket;
+    LWLockRelease(DrillBeyondInflightLock);
+    return done;
+}
+
+/*
+ * Whether a follower has waited as long as it may for the request followed
+ * by inflight, and should send it itself.
+ */
+extern bool drillbeyond_inflight_expired(DrillBeyondInflight *inflight) {
+    return !inflight->owner && GetCurrentTimestamp() >= inflight->wait_until;
+}
+
+/*
+ * Waits until the request followed by inflight is done. Returns false if
+ * that took too long.
+ */
+extern bool drillbeyond_inflight_wait(DrillBeyondInflight *inflight) {
+    while (!drillbeyond_inflight_done(inflight)) {
+        if (drillbeyond_inflight_expired(inflight))
+            return false;
+        CHECK_FOR_INTERRUPTS();
+        pg_usleep(10000L);
+    }
+    return true;
+}
+
+/*
+ * Whether this backend has registrations that only end when it polls for
+ * their responses. While it has, it must not block waiting for others: two
+ * backends could each wait for the other's request.
+ */
+extern bool drillbeyond_inflight_owns_any(void) {
+    return owned_inflight != NIL;
+}
+
+/*
+ * Ends a registration, once the response is in the cache, or a wait.
+ */
+extern void drillbeyond_inflight_end(DrillBeyondInflight *inflight) {
+    if (inflight == NULL)
+        return;
+    if (inflight->owner)
+        unregister_inflight(inflight);
+    pfree(inflight);
+}
+
+static void unregister_inflight(DrillBeyondInflight *inflight) {
+    DrbInflightEntry *entry;
+
+    LWLockAcquire(DrillBeyondInflightLock, LW_EXCLUSIVE);
+    entry = (DrbInflightEntry *) hash_search(drb_inflight_hash, &inflight->key, HASH_FIND, NULL);
+    if (entry != NULL && entry->ticket == inflight->ticket)
+        hash_search(drb_inflight_hash, &inflight->key, HASH_REMOVE, NULL);
+    LWLockRelease(DrillBeyondInflightLock);
+
+    owned_inflight = list_delete_ptr(owned_inflight, inflight);
+    inflight->owner = false;
+}
+
+/*
+ * Requests of a failed query are not answered anymore, its followers must
+ * not wait for them. The handles themselves go with TopTransactionContext.
+ */
+static void drb_inflight_xact_callback(XactEvent event, void *arg) {
+    if (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT && event != XACT_EVENT_PREPARE)
+        return;
+    while (owned_inflight != NIL)
+        unregister_inflight((DrillBeyondInflight *) linitial(owned_inflight));
+}
@@ -33,13 +33,22 @@
 #include "utils/tuplestore.h"
 #include "utils/tuplesort.h"
 
+int drb_max_variants = 0;
+int drb_variant_time_budget = 0;
+bool drb_enable_variant_notices = false;
 
 static TupleTableSlot *drb_top(DrillBeyondExpandState *node);
+static bool drb_variant_budget_exhausted(DrillBeyondExpandState *node);
+static void drb_report_variant(DrillBeyondExpandState *node);
+static bool drb_variant_has_duplicates(DrillBeyondExpandState *node);
+static bool drb_next_duplicate(DrillBeyondExpandState *node);
+static TupleTableSlot *drb_begin_replay(DrillBeyondExpandState *node);
+static TupleTableSlot *drb_next_replay(DrillBeyondExpandState *node);
+static void drb_dispatch_independent(PlanState *planState);
 static TupleTableSlot *drb_expand2(DrillBeyondExpandState *node);
 
 static void drb_collect_drb_mat_states(PlanState *planState, List *mat_plans, List **mat_states);
 static bool drb_is_variable(PlanState *planState);
-static bool drb_set_chg_param(PlanState *planState, Bitmapset *resetOps);
 static bool drb_has_variable_subplanstate(PlanState *planState);
 static void drb_ensure_rewind_enabled(PlanState *planState);
 static void drb_enable_rewind(PlanState *planState);
@@ -103,12 +112,34 @@ extern DrillBeyondExpandState *ExecInitDrillBeyondExpand(DrillBeyondExpand *node
         // else if (drb_max_num_cands == 1)
         //     dbstate->total_permutations = 1;
         // else
-        dbstate->total_permutations = pow(drb_max_num_cands, list_length(dbstate->drb_operator_states));
+        drb_count_variants(dbstate);
+        // fan-out: a single pass already contains all variants
+        if (node->drb_fanout)
+            dbstate->total_permutations = 1;
+        INSTR_TIME_SET_ZERO(dbstate->start_time);
+        dbstate->variants_reported = 0;
+        dbstate->variant_rows = 0;
         dbstate->fragments_executed = false;
+        // a worker of a parallel statement runs its part of the variants
+        if (drb_worker_count > 1 && estate->es_plannedstmt != NULL &&
+            estate->es_plannedstmt->planTree == (Plan *) node) {
+            dbstate->part_index = drb_worker_index;
+            dbstate->part_count = drb_worker_count;
+        }
+
+        // duplicate candidates are only known once the first variant's
+        // responses are in, so its rows are kept in any case
+        if (drb_enable_candidate_dedup && !node->drb_fanout) {
+            dbstate->dup_store = tuplestore_begin_heap(false, false, work_mem);
+            dbstate->dup_slot = ExecInitExtraTupleSlot(estate);
+            ExecSetSlotDescriptor(dbstate->dup_slot, ExecGetResultType(outerPlanState(dbstate)));
+            dbstate->dup_buffering = true;
+        }
 
         if (drb_enable_rewind_cache) {
             drb_ensure_rewind_enabled(outerPlanState(dbstate));
         }
+        drb_mark_variance(outerPlanState(dbstate));
     }
     else if (node->drb_strategy == DRB_EXPAND2) {
         //materialization
@@ -116,6 +147,8 @@ extern DrillBeyondExpandState *ExecInitDrillBeyondExpand(DrillBeyondExpand *node
         List *matplanStates = NIL;
         dbstate->tupstore = tuplestore_begin_heap(false, false, work_mem);
         dbstate->materialized = false;
+        if (drb_enable_adaptive_strategy && drb_enable_dynamic_omega)
+            dbstate->run_instr = InstrAlloc(1, INSTRUMENT_TIMER);
         dbstate->needNewContext = true;
         dbstate->intermediate_slot = ExecInitExtraTupleSlot(estate);
         ExecSetSlotDescriptor(dbstate->intermediate_slot,
@@ -156,7 +189,12 @@ extern TupleTableSlot *ExecDrillBeyondExpand(DrillBeyondExpandState *node) {
         case DRB_DEFAULT:
             {
                 PlanState *outerNode = outerPlanState(node);
+                // timed for the adaptive strategy, see drb_record_runs
+                if (node->run_instr)
+                    InstrStartNode(node->run_instr);
                 result = ExecProcNode(outerNode);
+                if (node->run_instr)
+                    InstrStopNode(node->run_instr, TupIsNull(result) ? 0.0 : 1.0);
             }
             break;
         case DRB_EXPAND:
@@ -181,11 +219,12 @@ extern void ExecReScanDrillBeyondExpand(DrillBeyondExpandState *node) {
     node->ps.ps_TupFromTlist = false;
     if (plan->drb_strategy == DRB_EXPAND2) {
         // TODO do we need to handle "normal" rescans here? maybe
-        if (bms_is_member(128, node->ps.chgParam)) {
+        if (drb_candidate_rescan(&node->ps)) {
             // printf("DrillbeyondExpand (%s) Rescan by DRB mechanism (now candiate %d)!\n", plan->drb_expansion->keyword, node->drb_operator_state->db_current_origin);
             node->current_origin += 1;
-            if (bms_is_member(128, outerPlan->chgParam)) {
+            if (outerPlan->chgParam != NULL) {
                 tuplestore_clear(node->tupstore);
+                node->materialized = false;
             } else {
                 // printf("  Deeper plans are invariant!\n");
                 node->materialized = true;
@@ -195,6 +234,7 @@ extern void ExecReScanDrillBeyondExpand(DrillBeyondExpandState *node) {
         else {
             // printf("DrillbeyondEXPAND (%s) Rescan by normal mechanism\n" , plan->drb_expansion->keyword);
             tuplestore_clear(node->tupstore);
+            node->materialized = false;
         }
     }
     if (plan->drb_strategy == DRB_DEFAULT) {
@@ -209,6 +249,9 @@ extern void ExecEndDrillBeyondExpand(DrillBeyondExpandState *node){
 
     if (node->tupstore != NULL)
         tuplestore_end(node->tupstore);
+    if (node->dup_store != NULL)
+        tuplestore_end(node->dup_store);
+    drillbeyond_end_workers(node);
 }
 
 extern DrillBeyondState* stateForExpansion(DrillBeyondExpansion *dbe, List *states) {
@@ -223,6 +266,32 @@ extern DrillBeyondState* stateForExpansion(DrillBeyondExpansion *dbe, List *stat
     return dbs;
 }
 
+/*
+ * Dispatches every DrillBeyond operator below planState that does not depend
+ * on another one or on parameters: its outer plan contains no DrillBeyond
+ * operator, so its join values are known without any response. Operators
+ * above them, and those in subplans, run as usual.
+ */
+static void drb_dispatch_independent(PlanState *planState)
+{
+    if (planState == NULL)
+        return;
+
+    if (nodeTag(planState) == T_DrillBeyondState) {
+        List *nested = NIL;
+
+        drb_collect_drb_operator_states(outerPlanState(planState), &nested);
+        if (nested == NIL) {
+            if (bms_is_empty(planState->plan->extParam))
+                drillbeyond_dispatch((DrillBeyondState *) planState);
+            return;
+        }
+        list_free(nested);
+    }
+    drb_dispatch_independent(outerPlanState(planState));
+    drb_dispatch_independent(innerPlanState(planState));
+}
+
 static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
     PlanState  *outerNode;
     DrillBeyondExpand *plan;
@@ -235,7 +304,31 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
 
     plan = (DrillBeyondExpand *) node->ps.plan;
 
-    if (drb_enable_reoptimization && !node->fragments_executed) {
+    if (INSTR_TIME_IS_ZERO(node->start_time)) {
+        INSTR_TIME_SET_CURRENT(node->start_time);
+        drillbeyond_start_workers(node);
+    }
+
+    // rows of the workers' variants first, as far as they are there; once
+    // our own variants are complete, only theirs remain
+    if (node->workers != NULL) {
+        resultslot = drillbeyond_worker_row(node, node->own_done);
+        if (resultslot != NULL || node->own_done)
+            return resultslot;
+    }
+
+    // send the requests of all operators that can run now, so that they are
+    // answered concurrently instead of one after the other
+    if (drb_enable_concurrent_requests && !node->requests_dispatched) {
+        drb_dispatch_independent(outerPlanState(node));
+        node->requests_dispatched = true;
+    }
+
+    if (node->dup_replaying) {
+        outerNode = outerPlanState(node);
+        outerslot = drb_next_replay(node);
+    }
+    else if (drb_enable_reoptimization && !node->fragments_executed) {
         ListCell *c;
         Query *q;
         foreach(c, node->drb_operator_states) {
@@ -247,7 +340,7 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
             //"manual" rescan
             dbstate->db_NeedNewOuter = true;
             tuplestore_rescan(dbstate->tuplestorestate);
-            // dbstate->js.ps.chgParam = bms_add_member(dbstate->js.ps.chgParam, 128); //T
+            dbstate->db_outerPos = 0;
             // ExecReScan((PlanState *)dbstate);
 
             // printf("after running fragment sel is: %f\n",drbplan->drb_expansion->selectivity);
@@ -275,15 +368,36 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
         if (drb_enable_rewind_cache) {
             drb_ensure_rewind_enabled(outerPlanState(node));
         }
+        node->dup_buffering = drb_variant_has_duplicates(node);
 
         // start new plan
         outerNode = outerPlanState(node);
         outerslot = ExecProcNode(outerNode);
     }
 
+    // a variant of another backend runs here only as far as needed to get
+    // its responses, the first one, see drillbeyond_parallel.c
+    if (!node->dup_replaying && !drillbeyond_variant_is_mine(node)) {
+        node->dup_buffering = false;
+        while (!TupIsNull(outerslot))
+            outerslot = ExecProcNode(outerNode);
+    }
+
+    // the variant is complete, report its rows for duplicate candidates
+    if (TupIsNull(outerslot) && !node->dup_replaying && node->dup_store != NULL)
+        outerslot = drb_begin_replay(node);
+
     // while (TupIsNull(outerslot) && (--node->total_permutations > 0) && (node->current_origin < drb_max_num_cands))
     while (TupIsNull(outerslot) && (--node->total_permutations > 0))
     {
+        if (drillbeyond_variant_is_mine(node)) {
+            drb_record_runs(node);
+            drb_report_variant(node);
+        }
+        if (drb_variant_budget_exhausted(node)) {
+            node->total_permutations = 0;
+            break;
+        }
 
 
         // printf("======================================================================\n");
@@ -299,14 +413,9 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
         for (i = 0; i < list_length(node->drb_operator_states); i++) {
             DrillBeyondState* state = (DrillBeyondState *)list_nth(node->drb_operator_states, i);
             DrillBeyond *dbplan = (DrillBeyond*)state->js.ps.plan;
-            if (state->db_current_origin >= drb_max_num_cands - 1) {
-                state->db_current_origin = 0;
-                resetOps = bms_add_member(resetOps, dbplan->drb_expansion->rti);
-            } else {
-                state->db_current_origin++;
-                resetOps = bms_add_member(resetOps, dbplan->drb_expansion->rti);
+            resetOps = bms_add_member(resetOps, dbplan->drb_expansion->rti);
+            if (drb_advance_candidate(state))
                 break;
-            }
         }
         node->current_origin += 1; // TODO: individual operators
         for (i = 0; i < plan->drb_numExpansions; i++)
@@ -316,13 +425,32 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
             // printf("Next: %d%c", state->db_current_origin, i == list_length(node->drb_operator_states) - 1 ? '\n' : ' ');
         }
         // printf("======================================================================\n");
-        drb_set_chg_param(outerNode, resetOps);
+        // another backend runs this variant, its changes add up to the next one's
+        if (!drillbeyond_variant_is_mine(node)) {
+            node->skipped_resets = bms_add_members(node->skipped_resets, resetOps);
+            continue;
+        }
+        resetOps = bms_add_members(resetOps, node->skipped_resets);
+        bms_free(node->skipped_resets);
+        node->skipped_resets = NULL;
+        drb_begin_epoch(outerNode, resetOps);
+        drb_adapt_strategies(node, resetOps);
         ExecReScan(outerNode);
+        node->dup_buffering = drb_variant_has_duplicates(node);
         outerslot = ExecProcNode(outerNode);
     }
 
-    if (TupIsNull(outerslot))
+    if (TupIsNull(outerslot)) {
+        drb_report_variant(node);
+        if (node->workers != NULL) {
+            node->own_done = true;
+            return drillbeyond_worker_row(node, true);
+        }
         return NULL;
+    }
+    node->variant_rows++;
+    if (node->dup_buffering && !node->dup_replaying)
+        tuplestore_puttupleslot(node->dup_store, outerslot);
 
     // resultslot = outerslot;
     resultslot = node->ps.ps_ResultTupleSlot;
@@ -339,14 +467,171 @@ static TupleTableSlot *drb_top(DrillBeyondExpandState *node) {
         DrillBeyondExpansion *dbex = (DrillBeyondExpansion *)list_nth(plan->drb_all_expansions, i);
         DrillBeyondState *dbe = stateForExpansion(dbex, node->drb_operator_states);
         int to = plan->drb_expandTo[i];
-        values[to] = Int64GetDatum(dbe->db_current_origin);
-        isnulls[to] = false;
+        if (plan->drb_fanout) {
+            int from = plan->drb_fanoutFrom[i];
+            values[to] = values[from];
+            isnulls[to] = isnulls[from];
+        } else {
+            values[to] = Int64GetDatum(node->dup_replaying ? dbe->db_dup_origin : dbe->db_current_origin);
+            isnulls[to] = false;
+        }
     }
     ExecStoreVirtualTuple(resultslot);
 
     return resultslot;
 }
 
+/*
+ * Candidate deduplication, see drb_dedup_candidates: whether the current
+ * combination of candidates stands for others as well.
+ */
+static bool drb_variant_has_duplicates(DrillBeyondExpandState *node) {
+    ListCell *lc;
+
+    if (node->dup_store == NULL)
+        return false;
+    foreach(lc, node->drb_operator_states) {
+        DrillBeyondState *state = (DrillBeyondState *) lfirst(lc);
+        state->db_dup_origin = state->db_current_origin;
+        if (drb_next_duplicate_candidate(state)) {
+            state->db_dup_origin = state->db_current_origin;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Next combination of duplicates of the current candidates, the first
+ * operator advancing fastest. Returns false after the last one.
+ */
+static bool drb_next_duplicate(DrillBeyondExpandState *node) {
+    ListCell *lc;
+
+    foreach(lc, node->drb_operator_states) {
+        if (drb_next_duplicate_candidate((DrillBeyondState *) lfirst(lc)))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Called when a variant is complete. After the first one, every operator
+ * knows its duplicate candidates, and DRB_TOP only counts the variants of
+ * distinct ones. If the variant has duplicates, its stored rows are returned
+ * once more for each of them.
+ */
+static TupleTableSlot *drb_begin_replay(DrillBeyondExpandState *node) {
+    ListCell *lc;
+
+    if (!node->dup_counted) {
+        double total = 1.0;
+
+        foreach(lc, node->drb_operator_states)
+            total *= drb_num_distinct_candidates((DrillBeyondState *) lfirst(lc));
+        if (drb_max_variants > 0 && drb_max_variants < total)
+            total = drb_max_variants;
+        node->total_variants = (int) Min(total, (double) INT_MAX);
+        node->total_permutations = node->total_variants;
+        node->dup_counted = true;
+    }
+
+    if (!node->dup_buffering)
+        return NULL;
+    node->dup_buffering = false;
+
+    foreach(lc, node->drb_operator_states) {
+        DrillBeyondState *state = (DrillBeyondState *) lfirst(lc);
+        state->db_dup_origin = state->db_current_origin;
+    }
+    if (!drb_next_duplicate(node)) {
+        tuplestore_clear(node->dup_store);
+        return NULL;
+    }
+    node->dup_replaying = true;
+    tuplestore_rescan(node->dup_store);
+    return drb_next_replay(node);
+}
+
+static TupleTableSlot *drb_next_replay(DrillBeyondExpandState *node) {
+    for (;;) {
+        if (tuplestore_gettupleslot(node->dup_store, true, false, node->dup_slot))
+            return node->dup_slot;
+        if (!drb_next_duplicate(node))
+            break;
+        tuplestore_rescan(node->dup_store);
+    }
+    node->dup_replaying = false;
+    tuplestore_clear(node->dup_store);
+    return NULL;
+}
+
+/*
+ * Sets the number of variants DRB_TOP runs: one per combination of
+ * candidates, at most drb_max_variants. The candidates of each operator are
+ * visited in the order of drb_candidate_order, so the variants cut off are
+ * those of the least promising candidates.
+ */
+extern void drb_count_variants(DrillBeyondExpandState *node) {
+    double total = pow(drb_max_num_cands, list_length(node->drb_operator_states));
+
+    if (drb_max_variants > 0 && drb_max_variants < total)
+        total = drb_max_variants;
+    node->total_variants = (int) Min(total, (double) INT_MAX);
+    node->total_permutations = node->total_variants;
+}
+
+/*
+ * Whether drb_variant_time_budget is used up, checked between variants, so
+ * that every variant returned is complete.
+ */
+static bool drb_variant_budget_exhausted(DrillBeyondExpandState *node) {
+    instr_time elapsed;
+
+    if (drb_variant_time_budget <= 0)
+        return false;
+    INSTR_TIME_SET_CURRENT(elapsed);
+    INSTR_TIME_SUBTRACT(elapsed, node->start_time);
+    if (INSTR_TIME_GET_MILLISEC(elapsed) < drb_variant_time_budget)
+        return false;
+
+    ereport(NOTICE,
+        (errmsg("drb_variant_time_budget exhausted after %d of %d result variants",
+                node->current_origin + 1, node->total_variants)));
+    return true;
+}
+
+/*
+ * Announces the end of the current variant with drb_enable_variant_notices.
+ * The notice follows the variant's last row in the stream to the client, so
+ * a client that reads rows as they arrive (e.g. in libpq's single-row mode)
+ * can hand on each variant as soon as it is complete.
+ */
+static void drb_report_variant(DrillBeyondExpandState *node) {
+    DrillBeyondExpand *plan = (DrillBeyondExpand *) node->ps.plan;
+    StringInfoData cands;
+    int variant = node->current_origin + 1;
+    int i;
+
+    if (!drb_enable_variant_notices || plan->drb_fanout || node->variants_reported >= variant)
+        return;
+
+    initStringInfo(&cands);
+    for (i = 0; i < list_length(plan->drb_all_expansions); i++) {
+        DrillBeyondExpansion *dbex = (DrillBeyondExpansion *) list_nth(plan->drb_all_expansions, i);
+        DrillBeyondState *dbe = stateForExpansion(dbex, node->drb_operator_states);
+        appendStringInfo(&cands, "%s%s=%d", i > 0 ? ", " : "", dbex->keyword, dbe->db_current_origin);
+    }
+    ereport(NOTICE,
+        (errcode(ERRCODE_DRILLBEYOND_VARIANT_COMPLETE),
+        errmsg("result variant %d of %d complete", variant, node->total_variants),
+        errdetail("%.0f rows, candidates %s", node->variant_rows, cands.data)));
+    pfree(cands.data);
+
+    node->variants_reported = variant;
+    node->variant_rows = 0;
+}
+
 static TupleTableSlot *drb_expand2(DrillBeyondExpandState *node) {
     PlanState  *outerNode;
     DrillBeyondExpand *plan;
@@ -409,11 +694,13 @@ static TupleTableSlot *drb_expand2(DrillBeyondExpandState *node) {
         //  {
         int from = plan->drb_expandFrom[0];
         int to = plan->drb_expandTo[0];
+        DrillBeyondExpansion *expansion = ((DrillBeyond *) dbe->js.ps.plan)->drb_expansion;
         Datum ptrDatum = values[from];
-        //hack: convert NUMERIC into pointer
-        DrillBeyondValues *vals = (DrillBeyondValues *) DirectFunctionCall1(numeric_int8, ptrDatum);
-        values[to] = vals->values[dbe->db_current_origin];
-        isnulls[to] = false;
+        //hack: the open attribute holds a pointer
+        DrillBeyondValues *vals = drb_placeholder_values(expansion, ptrDatum);
+        MemoryContext oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+        values[to] = drb_candidate_value(expansion, vals, dbe->db_current_origin, &isnulls[to]);
+        MemoryContextSwitchTo(oldcxt);
          // }
         ExecStoreVirtualTuple(resultslot);
 
@@ -478,61 +765,113 @@ static bool drb_has_variable_subplanstate(PlanState *planState)
     return result;
 }
 
-static bool _drb_set_chg_param(PlanState *planState, Bitmapset *resetOps, bool expandFound) {
+/*
+ * Candidate epochs
+ *
+ * When DRB_TOP advances the candidates of some expansions, it begins a new
+ * epoch: every node whose output depends on one of them gets the epoch param
+ * in its chgParam and is rescanned in full, all other nodes keep chgParam
+ * NULL, so that their parents rewind them or keep their hash tables, as for
+ * any invariant child. Which expansions a node depends on is marked once,
+ * after the plan state tree is built.
+ *
+ * The epoch param is one past the last PARAM_EXEC of the plan. It is in no
+ * allParam, so UpdateChangedParamSet never passes it on to invariant nodes,
+ * and it does not collide with real parameters.
+ */
+extern int drb_epoch_param(EState *estate) {
+    return estate->es_plannedstmt->nParamExec;
+}
+
+static Bitmapset *drb_mark_subplans(List *subplans) {
+    Bitmapset *result = NULL;
     ListCell *c;
-    bool drb_operator_found = false;
+
+    foreach(c, subplans) {
+        SubPlanState *spState = (SubPlanState *) lfirst(c);
+        result = bms_add_members(result, drb_mark_variance(spState->planstate));
+    }
+    return result;
+}
+
+/*
+ * Marks the expansions every node below planState depends on, and returns
+ * those of planState.
+ */
+extern Bitmapset *drb_mark_variance(PlanState *planState) {
+    Bitmapset *result = NULL;
 
     if (planState == NULL)
-        return false;
-    // printf("Considerig state: %s\n", nodeName(planState->plan));
+        return NULL;
 
+    result = bms_add_members(result, drb_mark_variance(outerPlanState(planState)));
+    result = bms_add_members(result, drb_mark_variance(innerPlanState(planState)));
+    result = bms_add_members(result, drb_mark_subplans(planState->initPlan));
+    result = bms_add_members(result, drb_mark_subplans(planState->subPlan));
     if (nodeTag(planState) == T_DrillBeyondState) {
-    // } &&
-            // !expandFound) { // TODO: not correct
-        // always set chgParam for DrillBeyondNodes!
-        // planState->chgParam = bms_add_member(planState->chgParam, 128); //TODO: evil constant
-        DrillBeyond *dbplan = (DrillBeyond*)planState->plan;
-        if (bms_is_member(dbplan->drb_expansion->rti, resetOps))
-        {
-            resetOps = bms_del_member(resetOps, dbplan->drb_expansion->rti);
-            drb_operator_found = true;
-        }
-        // return true;
-    }
-    if (nodeTag(planState) == T_DrillBeyondExpandState) {
-        // always set chgParam for DrillBeyondNodes!
-        // planState->chgParam = bms_add_member(planState->chgParam, 128); //TODO: evil constant
-        DrillBeyondExpand *dbplan = (DrillBeyondExpand*)planState->plan;
-        if (dbplan->drb_strategy!=DRB_DEFAULT && // default just passed through
-             bms_is_member(dbplan->drb_expansion->rti, resetOps))
-        {
-            resetOps = bms_del_member(resetOps, dbplan->drb_expansion->rti);
-            drb_operator_found = true;
-        }
-        // expandFound = true;
-        // return true;
+        DrillBeyond *dbplan = (DrillBeyond *) planState->plan;
+        result = bms_add_member(result, dbplan->drb_expansion->rti);
     }
 
-    drb_operator_found = _drb_set_chg_param(outerPlanState(planState), resetOps, expandFound) || drb_operator_found;
-    drb_operator_found = _drb_set_chg_param(innerPlanState(planState), resetOps, expandFound) || drb_operator_found;
-    foreach(c, planState->subPlan) {
+    bms_free(planState->drbVariance);
+    planState->drbVariance = result;
+    return result;
+}
+
+static void drb_begin_epoch_subplans(List *subplans, Bitmapset *changedExpansions) {
+    ListCell *c;
+
+    foreach(c, subplans) {
         SubPlanState *spState = (SubPlanState *) lfirst(c);
-        // printf("checking subplan\n");
-        bool foundInSubplan = _drb_set_chg_param(spState->planstate, resetOps, expandFound);
-        drb_operator_found = drb_operator_found || foundInSubplan;
-        // if (foundInSubplan)
-            // printf("found in subplan!\n");
+        drb_begin_epoch(spState->planstate, changedExpansions);
     }
+}
+
+/*
+ * Begins a new epoch below planState, for a change of the candidates of
+ * changedExpansions (rtis).
+ */
+extern void drb_begin_epoch(PlanState *planState, Bitmapset *changedExpansions) {
+    Bitmapset *below;
 
-    if (drb_operator_found) {
-        planState->chgParam = bms_add_member(planState->chgParam, 128); //TODO: evil constant
-        // printf("setting chg_param in %s\n", nodeName(planState->plan));
+    if (planState == NULL || !bms_overlap(planState->drbVariance, changedExpansions))
+        return;
+    planState->chgParam = bms_add_member(planState->chgParam,
+                                         drb_epoch_param(planState->state));
+
+    // below an operator, or an Ω above one, its own expansion doesn't change:
+    // the operator keeps the candidates of all rows and only the chosen one
+    // changes
+    below = changedExpansions;
+    if (nodeTag(planState) == T_DrillBeyondState) {
+        DrillBeyond *dbplan = (DrillBeyond *) planState->plan;
+        below = bms_del_member(bms_copy(below), dbplan->drb_expansion->rti);
+    }
+    if (nodeTag(planState) == T_DrillBeyondExpandState) {
+        DrillBeyondExpand *dbplan = (DrillBeyondExpand *) planState->plan;
+        // default just passes through, and the strategy may change at runtime
+        if (dbplan->drb_strategy != DRB_DEFAULT && dbplan->drb_expansion != NULL)
+            below = bms_del_member(bms_copy(below), dbplan->drb_expansion->rti);
     }
-    return drb_operator_found;
+
+    drb_begin_epoch(outerPlanState(planState), below);
+    drb_begin_epoch(innerPlanState(planState), below);
+    drb_begin_epoch_subplans(planState->initPlan, below);
+    drb_begin_epoch_subplans(planState->subPlan, below);
+    if (below != changedExpansions)
+        bms_free(below);
 }
 
-static bool drb_set_chg_param(PlanState *planState, Bitmapset *resetOps) {
-    return _drb_set_chg_param(planState, resetOps, false);
+/*
+ * Whether the pending rescan of planState is due to a new epoch alone, so
+ * that a DrillBeyond node may keep what it computed from its input, if the
+ * input is unchanged too.
+ */
+extern bool drb_candidate_rescan(PlanState *planState) {
+    int epochParam = drb_epoch_param(planState->state);
+
+    return bms_is_member(epochParam, planState->chgParam) &&
+           bms_membership(planState->chgParam) == BMS_SINGLETON;
 }
 
 static void drb_ensure_rewind_enabled(PlanState *planState) {
@@ -21,12 +21,16 @@
 
 /*
  * final_cost_drillbeyond
- *    Final estimate of the cost and result size of a hashjoin pathnode.
+ *    Final estimate of the cost of a DrillBeyond pathnode.
  *
- * Note: the numbatches estimate is also saved into 'path' for use later
+ * The operator stores and probes every input tuple, and attaches the value
+ * of every candidate to it, so its cost grows with the rows of the outer
+ * path rather than with its result. Augmenting the extended relation before
+ * it is joined to a fact table thus costs |extended relation| such tuples
+ * instead of |fact table|, and the join search can tell both placements
+ * apart.
  *
- * 'path' is already filled in except for the rows and cost fields and
- *      num_batches
+ * 'path' is already filled in except for the cost fields
  * 'sjinfo' is extra info about the join for selectivity estimation
  * 'semifactors' contains valid data if path->jointype is SEMI or ANTI
  */
@@ -48,11 +52,9 @@ final_cost_drillbeyond(PlannerInfo *root, DrillBeyondPath *path,
     Oid relId;
     bool isDefault;
     double distinct;
-    double nrows;
+    double input_rows;
 
-    /* Mark the path with the correct row estimate */
-    path->jpath.path.rows = path->jpath.path.rows;
-    nrows = path->jpath.path.rows;
+    input_rows = outer_path->rows;
 
     expansion = sjinfo->drb_expansion;
     num_join_cols = list_length(expansion->join_cols);
@@ -77,6 +79,12 @@ final_cost_drillbeyond(PlannerInfo *root, DrillBeyondPath *path,
     double original_rows = root->simple_rel_array[expansion->extended_rti]->tuples;
     double rows_without_sel = outer_path->rows;
     double tupFrac = rows_without_sel / original_rows;
+    // an earlier execution counted the distinct join values, when replanning
+    // trust that over the statistics
+    if (expansion->actual_distinct >= 0.0 && expansion->actual_rows > 0.0) {
+        distinct = expansion->actual_distinct;
+        tupFrac = rows_without_sel / expansion->actual_rows;
+    }
     if (tupFrac < 1.0)
         distinct *= tupFrac;
     // RelOptInfo *rel = path->jpath.path.parent;
@@ -95,8 +103,12 @@ final_cost_drillbeyond(PlannerInfo *root, DrillBeyondPath *path,
     //     distinct = nrows;
 
 
-    startup_cost += nrows * cpu_operator_cost + 100*cpu_tuple_cost*distinct; // arbitrary constant for drb index lookup
-    run_cost += cpu_per_tuple * nrows;
+    // phase 1 stores and hashes all input, before the first tuple is returned
+    startup_cost += input_rows * (cpu_tuple_cost + cpu_operator_cost);
+    startup_cost += 100*cpu_tuple_cost*distinct; // arbitrary constant for drb index lookup
+    // phase 2 attaches a value to each of them and evaluates the restrictions,
+    // once per candidate: in one pass per candidate, or all in one with fan-out
+    run_cost += Max(drb_max_num_cands, 1) * (cpu_tuple_cost + cpu_per_tuple) * input_rows;
 
 
     if(drb_startup_cost != -1)
@@ -143,6 +155,96 @@ final_cost_drillbeyond_expand(PlannerInfo *root, DrillBeyondExpand *plan)
     plan->plan.startup_cost = startup_cost;
 }
 
+/*
+ * Costs of the remaining execution of an operator that has an Ω above it, in
+ * both strategies, once its candidates and their selectivities are known.
+ * With DRB_PLACEHOLDER the plan between ω and Ω runs once on all rows, and Ω
+ * reads its store back for every further candidate. With DRB_DEFAULT it runs
+ * once per candidate, on the rows that pass the selection with that
+ * candidate. The planner's cost of that plan is normalized to one run
+ * without selection, and scaled by the actual input rows of the operator
+ * over the estimated ones. *rewind_fraction is the cost of reading the store
+ * back relative to a full run.
+ */
+extern void drillbeyond_strategy_costs(DrillBeyondState *node, double *omega_cost, double *default_cost,
+                    double *rewind_fraction)
+{
+    DrillBeyond *plan = (DrillBeyond *) node->js.ps.plan;
+    DrillBeyondExpand *expandPlan = plan->drb_expandNode;
+    DrillBeyondExpansion *expansion = plan->drb_expansion;
+    double startup_cost = 0.0;
+    double run_cost = 0.0;
+    double planned_rows = outerPlan(plan)->plan_rows;
+    double rows_ratio = 1.0;
+    double store_rows;
+    int i;
+
+    sum_both_costs((Plan*)expandPlan, (Plan*)plan, &startup_cost, &run_cost);
+    if (expansion->selective && expansion->selectivity > 0.0 &&
+        (drb_cost_model == DRB_COST_ONLY_S || drb_cost_model == DRB_COST_BOTH))
+        run_cost /= expansion->selectivity;
+    if (drb_cost_model == DRB_COST_ONLY_K || drb_cost_model == DRB_COST_BOTH) {
+        startup_cost /= drb_max_num_cands;
+        run_cost /= drb_max_num_cands;
+    }
+    if (expansion->actual_rows >= 0.0 && planned_rows > 0.0)
+        rows_ratio = expansion->actual_rows / planned_rows;
+    run_cost *= rows_ratio;
+    store_rows = Max(outerPlan(expandPlan)->plan_rows, 1.0) * rows_ratio;
+
+    *rewind_fraction = startup_cost + run_cost > 0.0 ?
+        store_rows * cpu_tuple_cost / (startup_cost + run_cost) : 0.0;
+    *omega_cost = startup_cost + run_cost +
+        (node->db_num_cands - 1) * store_rows * cpu_tuple_cost;
+    *default_cost = 0.0;
+    for (i = 0; i < node->db_num_cands; i++)
+        *default_cost += startup_cost + run_cost * expansion->selectivities[i];
+}
+
+/*
+ * The same comparison for the remaining runs, once the plan between ω and Ω
+ * was timed in DRB_DEFAULT mode: the time of a run is fitted as
+ * startup + per_sel * selectivity over the runs so far. With a single run,
+ * or runs of equal selectivity, all of the time is taken as per_sel.
+ * Returns false if there is nothing to go by yet.
+ */
+extern bool drillbeyond_measured_strategy_costs(DrillBeyondExpandState *node, DrillBeyondState *op,
+                    double runs, double *omega_ms, double *default_ms)
+{
+    DrillBeyondExpansion *expansion = ((DrillBeyond *) op->js.ps.plan)->drb_expansion;
+    double n = node->run_count;
+    double mean_sel, mean_ms, var_sel, avg_sel;
+    double startup = 0.0;
+    double per_sel = -1.0;
+    int i;
+
+    if (node->run_count == 0 || op->db_num_cands == 0)
+        return false;
+    mean_sel = node->run_sum_sel / n;
+    mean_ms = node->run_sum_ms / n;
+    var_sel = node->run_sum_sel2 / n - mean_sel * mean_sel;
+    if (node->run_count >= 2 && var_sel > 1e-9) {
+        per_sel = (node->run_sum_sel_ms / n - mean_sel * mean_ms) / var_sel;
+        startup = mean_ms - per_sel * mean_sel;
+    }
+    if (per_sel < 0.0 || startup < 0.0) {
+        // noise, or nothing to fit
+        if (mean_sel <= 0.0)
+            return false;
+        startup = 0.0;
+        per_sel = mean_ms / mean_sel;
+    }
+
+    avg_sel = 0.0;
+    for (i = 0; i < op->db_num_cands; i++)
+        avg_sel += expansion->selectivities[i];
+    avg_sel /= op->db_num_cands;
+
+    *default_ms = runs * (startup + per_sel * avg_sel);
+    *omega_ms = startup + per_sel + (runs - 1) * per_sel * node->rewind_fraction;
+    return true;
+}
+
 extern double drillbeyond_estimate_join_size(PlannerInfo *root,
                            double outer_rows,
                            SpecialJoinInfo *sjinfo,
@@ -158,6 +260,7 @@ extern double drillbeyond_estimate_join_size(PlannerInfo *root,
             sel = sjinfo->drb_expansion->selectivity;
         }
         else {
+            sel = -1.0;
             if (drb_enable_selectivity_estimation) {
                 printf("guessing selectivity for %s.%s: ", sjinfo->drb_expansion->extended_relname, sjinfo->drb_expansion->keyword);
                 RangeTblEntry *exrte = planner_rt_fetch(sjinfo->drb_expansion->extended_rti, root);
@@ -171,7 +274,8 @@ extern double drillbeyond_estimate_join_size(PlannerInfo *root,
                 sel = estimateSelectivity(sjinfo->drb_expansion, exrte->relid, ri->baserestrictinfo);
                 printf("%f\n", sel);
             }
-            else {
+            if (sel < 0.0) {
+                // not estimated (yet)
                 if (drb_selectivity == DBL_MAX) {
                     sel = DRB_DEFAULT_SEL;
                 } else {
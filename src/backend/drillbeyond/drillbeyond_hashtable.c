@@ -1,123 +1,418 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_hashtable.c
+ *    Results hashtable of an expansion: join values -> DrillBeyondValues.
+ *
+ * The table is probed once per outer tuple and candidate, so it is built for
+ * that: open addressing with linear probing over an array of precomputed
+ * hash codes, and keys that are flattened into one buffer stored inline with
+ * their entry. For the usual join column types (text, integers, ...) two
+ * keys are equal iff their flattened forms are, and neither hashing nor
+ * comparing needs a function call. Other types fall back to the hash and
+ * equality functions cached in the expansion.
+ *
+ * A flattened key starts with one int32 length per column (-1 for NULL),
+ * followed by the MAXALIGNed column data: the Datum itself for by-value
+ * types, the detoasted bytes otherwise. Padding is zeroed, so the bytes of
+ * a key only depend on its values.
+ *
+ * Entries are never freed on their own, so they are cut from large blocks
+ * instead of being allocated one by one: a table of millions of small keys
+ * then costs what the keys take, without a chunk header and rounding to a
+ * power of 2 for each. The candidate values of the entries are kept apart
+ * from them, in value matrices allocated per response (see
+ * drb_allocValueRows).
+ *
+ * The expansion is passed explicitly everywhere, so several tables can be
+ * used at the same time.
+ *
+ * src/backend/drillbeyond/drillbeyond_hashtable.c
+ *
+ *-------------------------------------------------------------------------
+ */
 #include "postgres.h"
+#include "access/hash.h"
 #include "drillbeyond/drillbeyond.h"
-#include "utils/hsearch.h"
-
-/* this is actually necessary when using dynahash.c
-    as there is no other way to use external data in its hash
-    or eq functions (execGrouping.c for example is doing
-    the same)*/
-static DrillBeyondExpansion *currentExpansion = NULL;
-
-static uint32 drb_key_hash(const void *key, Size keysize);
-static int drb_key_match(const void *key1, const void *key2, Size keysize);
-
-extern HTAB* drb_setupHashTable(DrillBeyondExpansion *exp, int nrows) {
-    HASHCTL hash_ctl;
-    HTAB *results_hashtable;
-    MemSet(&hash_ctl, 0, sizeof(hash_ctl));
-    hash_ctl.keysize = sizeof(Datum);
-    hash_ctl.entrysize = sizeof(DrillBeyondValues);
-    hash_ctl.hash = drb_key_hash;
-    hash_ctl.match = drb_key_match;
-    results_hashtable = hash_create("DrillBeyondHashTable", nrows,
-                                     &hash_ctl,
-                    HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
-
-    return results_hashtable;
+#include "utils/datum.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#define DRB_HASH_MIN_SIZE 64
+#define DRB_HASH_EMPTY NULL
+#define DRB_HASH_STACK_COLS 16 // compare keys with up to this many columns without palloc
+
+static bool is_bitwise_equality(Oid eq_function);
+static Size key_header_size(DrillBeyondHashTable *ht);
+static void key_column_datums(DrillBeyondHashTable *ht, const char *data, Datum *datums);
+static bool keys_equal(DrillBeyondExpansion *exp, DrillBeyondKey *key1, DrillBeyondKey *key2);
+static uint32 find_bucket(DrillBeyondExpansion *exp, DrillBeyondKey *key);
+static DrillBeyondValues *insert_entry(DrillBeyondExpansion *exp, DrillBeyondKey *key, uint32 bucket);
+static void grow_hashtable(DrillBeyondHashTable *ht);
+static char *arena_alloc(DrillBeyondHashTable *ht, Size size);
+
+/*
+ * Equality operators that compare the bytes of their arguments.
+ */
+static bool is_bitwise_equality(Oid eq_function) {
+    switch (eq_function) {
+        case F_TEXTEQ:
+        case F_BYTEAEQ:
+        case F_INT2EQ:
+        case F_INT4EQ:
+        case F_INT8EQ:
+        case F_OIDEQ:
+        case F_BOOLEQ:
+        case F_CHAREQ:
+        case F_DATE_EQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+extern DrillBeyondHashTable* drb_setupHashTable(DrillBeyondExpansion *exp, int nrows) {
+    DrillBeyondHashTable *ht;
+    ListCell *c;
+    int i = 0;
+
+    ht = (DrillBeyondHashTable *) palloc0(sizeof(DrillBeyondHashTable));
+    ht->cxt = AllocSetContextCreate(CurrentMemoryContext,
+                                    "DrillBeyondHashTable",
+                                    ALLOCSET_DEFAULT_MINSIZE,
+                                    ALLOCSET_DEFAULT_INITSIZE,
+                                    ALLOCSET_DEFAULT_MAXSIZE);
+    ht->valuesCxt = AllocSetContextCreate(ht->cxt,
+                                          "DrillBeyondValues",
+                                          ALLOCSET_DEFAULT_MINSIZE,
+                                          ALLOCSET_DEFAULT_INITSIZE,
+                                          ALLOCSET_DEFAULT_MAXSIZE);
+    ht->numCols = list_length(exp->join_cols);
+    ht->typlen = (int16 *) palloc(sizeof(int16) * (ht->numCols + 1));
+    ht->typbyval = (bool *) palloc(sizeof(bool) * (ht->numCols + 1));
+    ht->bitwise = true;
+    foreach(c, exp->join_cols) {
+        Var *var = (Var *) lfirst(c);
+
+        get_typlenbyval(var->vartype, &ht->typlen[i], &ht->typbyval[i]);
+        if (!is_bitwise_equality(exp->eqFunctions[i].fn_oid))
+            ht->bitwise = false;
+        i++;
+    }
+
+    ht->size = DRB_HASH_MIN_SIZE;
+    while (ht->size < (uint32) nrows * 2 && ht->size < (1U << 30))
+        ht->size <<= 1;
+    ht->hashes = (uint32 *) MemoryContextAlloc(ht->cxt, sizeof(uint32) * ht->size);
+    ht->buckets = (DrillBeyondValues **) MemoryContextAllocZero(ht->cxt,
+                                                   sizeof(DrillBeyondValues *) * ht->size);
+    ht->spaceUsed = (sizeof(uint32) + sizeof(DrillBeyondValues *)) * ht->size;
+    return ht;
+}
+
+static Size key_header_size(DrillBeyondHashTable *ht) {
+    return MAXALIGN(sizeof(int32) * ht->numCols);
 }
 
-extern void drb_addToHashTable(DrillBeyondExpansion *exp, Datum *keys, Datum *values, int numValues)
+/*
+ * Flattens the join values keys (0 is NULL) into key, allocated in the
+ * current memory context, and computes its hash code.
+ */
+extern void drb_makeHashKey(DrillBeyondExpansion *exp, Datum *keys, DrillBeyondKey *key) {
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    Datum *values = (Datum *) palloc(sizeof(Datum) * (ht->numCols + 1));
+    int32 *lens;
+    Size len = key_header_size(ht);
+    char *pos;
+    int i;
+
+    // detoast once, then size, then copy
+    for (i = 0; i < ht->numCols; i++) {
+        values[i] = keys[i];
+        if (keys[i] == 0)
+            continue;
+        if (ht->typbyval[i])
+            len += MAXALIGN(sizeof(Datum));
+        else {
+            if (ht->typlen[i] == -1)
+                values[i] = PointerGetDatum(PG_DETOAST_DATUM(keys[i]));
+            len += MAXALIGN(datumGetSize(values[i], false, ht->typlen[i]));
+        }
+    }
+
+    key->len = (int) len;
+    key->data = (char *) palloc0(len);
+    lens = (int32 *) key->data;
+    pos = key->data + key_header_size(ht);
+    for (i = 0; i < ht->numCols; i++) {
+        Size size;
+
+        if (values[i] == 0) {
+            lens[i] = -1;
+            continue;
+        }
+        if (ht->typbyval[i]) {
+            size = sizeof(Datum);
+            memcpy(pos, &values[i], size);
+        } else {
+            size = datumGetSize(values[i], false, ht->typlen[i]);
+            memcpy(pos, DatumGetPointer(values[i]), size);
+            if (values[i] != keys[i])
+                pfree(DatumGetPointer(values[i]));
+        }
+        lens[i] = (int32) size;
+        pos += MAXALIGN(size);
+    }
+
+    if (ht->bitwise)
+        key->hash = DatumGetUInt32(hash_any((unsigned char *) key->data, key->len));
+    else {
+        Datum *datums = values;
+
+        key_column_datums(ht, key->data, datums);
+        key->hash = 0;
+        for (i = 0; i < ht->numCols; i++) {
+            key->hash = (key->hash << 1) | ((key->hash & 0x80000000) ? 1 : 0);
+            if (datums[i] != 0)
+                key->hash ^= DatumGetUInt32(FunctionCall1(&(exp->hashFunctions)[i], datums[i]));
+        }
+    }
+    pfree(values);
+}
+
+/*
+ * Datums of the columns of a flattened key, pointing into it. 0 is NULL.
+ */
+static void key_column_datums(DrillBeyondHashTable *ht, const char *data, Datum *datums) {
+    const int32 *lens = (const int32 *) data;
+    const char *pos = data + key_header_size(ht);
+    int i;
+
+    for (i = 0; i < ht->numCols; i++) {
+        if (lens[i] < 0) {
+            datums[i] = 0;
+            continue;
+        }
+        if (ht->typbyval[i])
+            memcpy(&datums[i], pos, sizeof(Datum));
+        else
+            datums[i] = PointerGetDatum(pos);
+        pos += MAXALIGN(lens[i]);
+    }
+}
+
+static bool keys_equal(DrillBeyondExpansion *exp, DrillBeyondKey *key1, DrillBeyondKey *key2) {
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    Datum d1[DRB_HASH_STACK_COLS], d2[DRB_HASH_STACK_COLS];
+    Datum *datums1 = d1, *datums2 = d2;
+    bool result = true;
+    int i;
+
+    if (ht->bitwise)
+        return key1->len == key2->len && memcmp(key1->data, key2->data, key1->len) == 0;
+
+    if (ht->numCols > DRB_HASH_STACK_COLS) {
+        datums1 = (Datum *) palloc(sizeof(Datum) * ht->numCols);
+        datums2 = (Datum *) palloc(sizeof(Datum) * ht->numCols);
+    }
+    key_column_datums(ht, key1->data, datums1);
+    key_column_datums(ht, key2->data, datums2);
+    for (i = 0; i < ht->numCols && result; i++) {
+        if ((datums1[i] == 0) != (datums2[i] == 0))
+            result = false;
+        else if (datums1[i] != 0)   /* both null are treated as equal */
+            result = DatumGetBool(FunctionCall2(&(exp->eqFunctions)[i], datums1[i], datums2[i]));
+    }
+    if (datums1 != d1) {
+        pfree(datums1);
+        pfree(datums2);
+    }
+    return result;
+}
+
+/*
+ * Bucket holding key, or the empty bucket where it would be inserted.
+ */
+static uint32 find_bucket(DrillBeyondExpansion *exp, DrillBeyondKey *key) {
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    uint32 mask = ht->size - 1;
+    uint32 bucket = key->hash & mask;
+
+    while (ht->buckets[bucket] != DRB_HASH_EMPTY) {
+        if (ht->hashes[bucket] == key->hash && keys_equal(exp, &ht->buckets[bucket]->key, key))
+            break;
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+static void grow_hashtable(DrillBeyondHashTable *ht) {
+    uint32 oldsize = ht->size;
+    uint32 *oldhashes = ht->hashes;
+    DrillBeyondValues **oldbuckets = ht->buckets;
+    uint32 mask;
+    uint32 i;
+
+    ht->size = oldsize * 2;
+    mask = ht->size - 1;
+    ht->hashes = (uint32 *) MemoryContextAlloc(ht->cxt, sizeof(uint32) * ht->size);
+    ht->buckets = (DrillBeyondValues **) MemoryContextAllocZero(ht->cxt,
+                                                   sizeof(DrillBeyondValues *) * ht->size);
+    for (i = 0; i < oldsize; i++) {
+        uint32 bucket;
+
+        if (oldbuckets[i] == DRB_HASH_EMPTY)
+            continue;
+        bucket = oldhashes[i] & mask;
+        while (ht->buckets[bucket] != DRB_HASH_EMPTY)
+            bucket = (bucket + 1) & mask;
+        ht->buckets[bucket] = oldbuckets[i];
+        ht->hashes[bucket] = oldhashes[i];
+    }
+    pfree(oldhashes);
+    pfree(oldbuckets);
+    ht->spaceUsed += (sizeof(uint32) + sizeof(DrillBeyondValues *)) * oldsize;
+}
+
+/*
+ * Zeroed, MAXALIGNed space for an entry, from the current block.
+ */
+static char *arena_alloc(DrillBeyondHashTable *ht, Size size) {
+    char *result;
+
+    size = MAXALIGN(size);
+    if (size > ht->arenaFree) {
+        // large entries get a chunk of their own, so that the rest of the
+        // current block is not wasted
+        if (size > DRB_ARENA_BLOCK_SIZE / 4) {
+            ht->spaceUsed += size;
+            return (char *) MemoryContextAllocZero(ht->cxt, size);
+        }
+        ht->arenaPos = (char *) MemoryContextAllocZero(ht->cxt, DRB_ARENA_BLOCK_SIZE);
+        ht->spaceUsed += DRB_ARENA_BLOCK_SIZE;
+        ht->arenaFree = DRB_ARENA_BLOCK_SIZE;
+    }
+    result = ht->arenaPos;
+    ht->arenaPos += size;
+    ht->arenaFree -= size;
+    return result;
+}
+
+/*
+ * Creates the entry for key in the (empty) bucket. The entry and a copy of
+ * the key are allocated together; its joinValues point into the key.
+ */
+static DrillBeyondValues *insert_entry(DrillBeyondExpansion *exp, DrillBeyondKey *key, uint32 bucket) {
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    Size entrysize = MAXALIGN(sizeof(DrillBeyondValues));
+    Size datumsize = MAXALIGN(sizeof(Datum) * ht->numCols);
+    DrillBeyondValues *entry;
+    char *chunk;
+
+    chunk = arena_alloc(ht, entrysize + datumsize + key->len);
+    entry = (DrillBeyondValues *) chunk;
+    entry->joinValues = (Datum *) (chunk + entrysize);
+    entry->key.hash = key->hash;
+    entry->key.len = key->len;
+    entry->key.data = chunk + entrysize + datumsize;
+    memcpy(entry->key.data, key->data, key->len);
+    key_column_datums(ht, entry->key.data, entry->joinValues);
+
+    ht->buckets[bucket] = entry;
+    ht->hashes[bucket] = key->hash;
+    ht->numEntries++;
+    return entry;
+}
+
+extern DrillBeyondValues* drb_addToHashTable(DrillBeyondExpansion *exp, Datum *keys, bool *found)
 {
-    bool found;
+    DrillBeyondKey key;
     DrillBeyondValues *entry;
 
-    // set global var! non-reentrant code
-    currentExpansion = exp;
+    drb_makeHashKey(exp, keys, &key);
+    drb_addBatchToHashTable(exp, &key, 1, &entry, found);
+    pfree(key.data);
+    return entry;
+}
+
+/*
+ * Looks up n keys made by drb_makeHashKey, adding those that are missing.
+ * entries[i] receives the entry of keys[i], found[i] whether it existed
+ * before. Hashing is done by the caller, so this only touches the table;
+ * the buckets of the whole batch are prefetched before they are probed.
+ */
+extern void drb_addBatchToHashTable(DrillBeyondExpansion *exp, DrillBeyondKey *keys, int n, DrillBeyondValues **entries, bool *found)
+{
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    int i;
 
-    entry = (DrillBeyondValues *) hash_search(exp->results_hashtable,
-                                         (const void *) keys,
-                                         HASH_ENTER,
-                                         &found);
-    if (!found) {
-        entry->requested = false;
-        entry->joinValues = keys;
-    }
-    // value 0 means just allocate entry, do not add anything
-    if (values == NULL) {
-        return;
+#ifdef __GNUC__
+    for (i = 0; i < n; i++)
+        __builtin_prefetch(&ht->hashes[keys[i].hash & (ht->size - 1)]);
+#endif
+
+    for (i = 0; i < n; i++) {
+        uint32 bucket;
+
+        // keep the load factor at most 1/2
+        if ((ht->numEntries + 1) * 2 > ht->size)
+            grow_hashtable(ht);
+
+        bucket = find_bucket(exp, &keys[i]);
+        found[i] = ht->buckets[bucket] != DRB_HASH_EMPTY;
+        if (found[i])
+            entries[i] = ht->buckets[bucket];
+        else
+            entries[i] = insert_entry(exp, &keys[i], bucket);
     }
-    entry->values = values;
-    entry->numValues = numValues;
-    entry->requested = true;
-    entry->inUnion = true;
 }
 
 extern DrillBeyondValues* drb_retrieveFromHashTable(DrillBeyondExpansion *exp, Datum *keys)
 {
-    bool found;
+    DrillBeyondKey key;
     DrillBeyondValues *entry;
 
-    // sets global state, non-reentrant!
-    currentExpansion = exp;
-
-    entry = (DrillBeyondValues *) hash_search(exp->results_hashtable,
-                                         (const void *) keys,
-                                         HASH_FIND,
-                                         &found);
+    drb_makeHashKey(exp, keys, &key);
+    entry = exp->results_hashtable->buckets[find_bucket(exp, &key)];
+    pfree(key.data);
     return entry;
 }
 
-static uint32
-drb_key_hash(const void *key, Size keysize)
+/*
+ * Iterates over all entries. *pos has to be 0 at the start; returns NULL
+ * after the last entry.
+ */
+extern DrillBeyondValues* drb_iterateHashTable(DrillBeyondHashTable *ht, uint32 *pos)
 {
-    int i;
-    Datum       *values = (Datum *) key;
-    uint32      hashkey = 0;
-    int num_join_cols = list_length(currentExpansion->join_cols);
-
-    for (i = 0; i < num_join_cols; i++) {
-        Datum d = values[i];
-        hashkey = (hashkey << 1) | ((hashkey & 0x80000000) ? 1 : 0);
-        if (d != 0) {
-            uint32 h;
-            h = DatumGetUInt32(FunctionCall1(&(currentExpansion->hashFunctions)[i], d));
-            hashkey ^= h;
-        }
+    while (*pos < ht->size) {
+        DrillBeyondValues *entry = ht->buckets[(*pos)++];
+        if (entry != DRB_HASH_EMPTY)
+            return entry;
     }
-    return hashkey;
+    return NULL;
 }
 
 /*
- * Matching function for elements, to be used in hashtable lookups.
+ * Allocates the candidate values of n entries with k candidates each: one
+ * n x k float8 matrix and one null bitmap per row, all NULL at first. Row i
+ * becomes the values of entries[i].
  */
-static int
-drb_key_match(const void *key1, const void *key2, Size keysize)
+extern void drb_allocValueRows(DrillBeyondExpansion *exp, DrillBeyondValues **entries, int n, int k)
 {
+    DrillBeyondHashTable *ht = exp->results_hashtable;
+    Size matrixsize = MAXALIGN(sizeof(float8) * (Size) n * k);
+    int bitmaplen = BITMAPLEN(k);
+    float8 *matrix;
+    bits8 *bitmaps;
     int i;
-    DrillBeyondValues      *values1 = ((DrillBeyondValues *) key1);
-    Datum       *values2 = ((Datum *) key2);
-    int num_join_cols = list_length(currentExpansion->join_cols);
-
-    for (i = 0; i < num_join_cols; i++) {
-        Datum d1 = values1->joinValues[i];
-        Datum d2 = values2[i];
-        bool d1null = d1 == 0;
-        bool d2null = d2 == 0;
-
-        if (d1null != d2null)
-        {
-            return 1; // > 0 is no match
-        }
 
-        if (d1null)
-            continue;           /* both are null, treat as equal */
-
-        if (!DatumGetBool(FunctionCall2(
-                &(currentExpansion->eqFunctions)[i],
-                d1, d2)))
-        {
-            return 1;
-        }
+    matrix = (float8 *) MemoryContextAllocZero(ht->valuesCxt, matrixsize + (Size) n * bitmaplen);
+    ht->spaceUsed += matrixsize + (Size) n * bitmaplen;
+    bitmaps = (bits8 *) ((char *) matrix + matrixsize);
+    memset(bitmaps, 0xFF, (Size) n * bitmaplen);
+    for (i = 0; i < n; i++) {
+        entries[i]->values = matrix + (Size) i * k;
+        entries[i]->nulls = bitmaps + (Size) i * bitmaplen;
+        entries[i]->numValues = k;
     }
-    return 0; // 0 is match
 }
@@ -0,0 +1,252 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_http.c
+ *    Persistent HTTP connections to the entity augmentation service.
+ *
+ * All requests of a backend, blocking or streamed, share one libcurl
+ * connection cache and DNS cache, and HTTP keep-alive is used. Operators,
+ * reoptimization and selectivity estimation thus reuse the connections of
+ * earlier requests instead of paying for connection setup each time.
+ * Streamed requests are sent on one multi handle, which keeps several
+ * requests outstanding at once: on up to drb_max_connections connections
+ * per server, multiplexed if the server speaks HTTP/2.
+ *
+ * drb_server_url lists one or more servers. Requests are distributed round
+ * robin. A request that fails at the transport level, or is answered with
+ * 503, is retried on the next server up to drb_request_retries times.
+ *
+ * src/backend/drillbeyond/drillbeyond_http.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "drillbeyond/drillbeyond.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+char *drb_server_url = NULL;
+int drb_connect_timeout = 10000;
+int drb_request_timeout = 0;
+int drb_request_retries = 2;
+int drb_max_connections = 8;
+
+static CURLSH *share_handle = NULL;
+static CURL *blocking_handle = NULL;
+static CURLM *multi_handle = NULL;
+
+// parsed drb_server_url, in TopMemoryContext
+static char *parsed_server_url = NULL;
+static List *servers = NIL;
+static int next_server = 0;
+
+static void http_init(void);
+static void parse_servers(void);
+static size_t write_data_to_buffer(void *buffer, size_t size, size_t nmemb, void *userp);
+
+static void http_init(void) {
+    if (share_handle != NULL)
+        return;
+    curl_global_init(CURL_GLOBAL_ALL);
+    share_handle = curl_share_init();
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+/*
+ * Splits drb_server_url at its commas into servers, if it changed since
+ * last time. URLs are case sensitive, and may be long, so this is a plain
+ * split rather than SplitIdentifierString. The result is only kept once it
+ * names at least one server.
+ */
+static void parse_servers(void) {
+    MemoryContext oldcontext;
+    List *parsed = NIL;
+    char *rawstring, *url, *next;
+
+    if (parsed_server_url != NULL && strcmp(parsed_server_url, drb_server_url) == 0)
+        return;
+
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    rawstring = pstrdup(drb_server_url);
+    for (url = rawstring; url != NULL; url = next) {
+        int len;
+
+        next = strchr(url, ',');
+        if (next != NULL)
+            *next++ = '\0';
+        while (isspace((unsigned char) *url))
+            url++;
+        len = strlen(url);
+        // paths are appended, a trailing slash would double
+        while (len > 0 && (isspace((unsigned char) url[len - 1]) || url[len - 1] == '/'))
+            url[--len] = '\0';
+        if (len > 0)
+            parsed = lappend(parsed, pstrdup(url));
+    }
+    pfree(rawstring);
+
+    if (parsed == NIL) {
+        MemoryContextSwitchTo(oldcontext);
+        ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("drb_server_url does not name any server: \"%s\"", drb_server_url)
+            ));
+    }
+
+    list_free_deep(servers);
+    servers = parsed;
+    if (parsed_server_url != NULL)
+        pfree(parsed_server_url);
+    parsed_server_url = pstrdup(drb_server_url);
+    next_server = 0;
+    MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Base URL of the server for the next request, round robin.
+ */
+extern const char *drillbeyond_next_server(void) {
+    const char *server;
+
+    parse_servers();
+    server = (const char *) list_nth(servers, next_server % list_length(servers));
+    next_server = (next_server + 1) % list_length(servers);
+    return server;
+}
+
+/*
+ * Sets the options every request has: shared caches, keep-alive, timeouts.
+ */
+extern void drillbeyond_http_setup(CURL *handle) {
+    http_init();
+    curl_easy_setopt(handle, CURLOPT_SHARE, share_handle);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, (long) drb_connect_timeout);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long) drb_request_timeout);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_data_to_buffer);
+}
+
+/*
+ * Sets the URL of a request for path on the next server.
+ */
+extern void drillbeyond_http_set_url(CURL *handle, const char *path) {
+    StringInfoData url;
+
+    initStringInfo(&url);
+    appendStringInfo(&url, "%s%s", drillbeyond_next_server(), path);
+    curl_easy_setopt(handle, CURLOPT_URL, url.data); // curl copies the string
+    pfree(url.data);
+}
+
+/*
+ * Whether a failed request is worth sending again, maybe to another server.
+ */
+extern bool drillbeyond_http_retryable(CURLcode result, long status) {
+    switch (result) {
+        case CURLE_OK:
+            return status == 503;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Multi handle for streamed requests, sharing the connections of blocking
+ * requests.
+ */
+extern CURLM *drillbeyond_http_multi(void) {
+    if (multi_handle != NULL)
+        return multi_handle;
+    http_init();
+    multi_handle = curl_multi_init();
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+    curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, (long) drb_max_connections);
+#endif
+    return multi_handle;
+}
+
+/*
+ * Posts body to path and returns the response body, on the backend's
+ * persistent handle. Retries as described above; *status is the HTTP status
+ * of the last attempt.
+ */
+extern StringInfo drillbeyond_http_post(const char *path, const char *content_type, const char *body, int len, long *status) {
+    char curl_error_buffer[CURL_ERROR_SIZE + 1] = {0};
+    char content_type_header[64];
+    struct curl_slist *headers;
+    StringInfo buffer = makeStringInfo();
+    CURLcode ret;
+    int attempt;
+
+    if (blocking_handle == NULL) {
+        http_init();
+        blocking_handle = curl_easy_init();
+    }
+    curl_easy_reset(blocking_handle); // keeps the connections
+    drillbeyond_http_setup(blocking_handle);
+    curl_easy_setopt(blocking_handle, CURLOPT_ERRORBUFFER, curl_error_buffer);
+    curl_easy_setopt(blocking_handle, CURLOPT_POST, 1L);
+    snprintf(content_type_header, sizeof(content_type_header), "Content-type: %s", content_type);
+    headers = curl_slist_append(NULL, content_type_header);
+    curl_easy_setopt(blocking_handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(blocking_handle, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(blocking_handle, CURLOPT_POSTFIELDSIZE, (long) len);
+    curl_easy_setopt(blocking_handle, CURLOPT_WRITEDATA, buffer);
+
+    // headers are malloc'd, free them on an error or a cancel, too
+    PG_TRY();
+    {
+        for (attempt = 0;; attempt++) {
+            drillbeyond_http_set_url(blocking_handle, path);
+            resetStringInfo(buffer);
+            ret = curl_easy_perform(blocking_handle);
+            *status = 0;
+            curl_easy_getinfo(blocking_handle, CURLINFO_RESPONSE_CODE, status);
+            if (attempt >= drb_request_retries || !drillbeyond_http_retryable(ret, *status))
+                break;
+            // back off a little, the next server may be the same one
+            pg_usleep(Min(100000L << attempt, 2000000L));
+            CHECK_FOR_INTERRUPTS();
+        }
+    }
+    PG_CATCH();
+    {
+        curl_easy_setopt(blocking_handle, CURLOPT_HTTPHEADER, NULL);
+        curl_slist_free_all(headers);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    curl_easy_setopt(blocking_handle, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+
+    if (ret != CURLE_OK) {
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("Can't get a response from server: %s", curl_error_buffer)
+            ));
+    }
+    return buffer;
+}
+
+static size_t write_data_to_buffer(void *buffer, size_t size, size_t nmemb, void *userp) {
+    size_t real_size = size * nmemb;
+    appendBinaryStringInfo((StringInfo) userp, (const char *) buffer, (int) real_size);
+    return real_size;
+}
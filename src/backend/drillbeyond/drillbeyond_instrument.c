@@ -0,0 +1,250 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_instrument.c
+ *    Counters of DrillBeyond operators, and pg_stat_drillbeyond.
+ *
+ * Every DrillBeyond operator counts its requests to the EA service: how
+ * many, how many bytes, and the time spent building, transferring, decoding
+ * and merging them. It also counts its candidate rescans and the rows it
+ * emits per candidate. EXPLAIN (ANALYZE, DRILLBEYOND) shows the counters of
+ * each operator.
+ *
+ * When an operator ends, its counters are added to a shared entry per
+ * (database, keyword), which pg_stat_drillbeyond shows. There are at most
+ * DRB_STATS_MAX_ENTRIES of them; keywords beyond that are not counted until
+ * a superuser empties the table with pg_stat_reset_drillbeyond().
+ *
+ * src/backend/drillbeyond/drillbeyond_instrument.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "drillbeyond/drillbeyond.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+typedef struct DrbStatsKey {
+    Oid dbid;
+    char keyword[NAMEDATALEN];
+} DrbStatsKey;
+
+typedef struct DrbStatsEntry {
+    DrbStatsKey key; // hash key, must be first
+    int64 executions; // operators that ended
+    int64 requests;
+    int64 bytes_sent;
+    int64 bytes_received;
+    double serialize_ms;
+    double network_ms;
+    double parse_ms;
+    double merge_ms;
+    int64 input_rows; // outer tuples
+    int64 distinct_keys;
+    int64 cache_hits;
+    int64 rescans;
+    int64 rows; // emitted, all candidates
+    int64 max_hashtable_bytes;
+} DrbStatsEntry;
+
+#define PG_STAT_GET_DRILLBEYOND_COLS 16
+
+static HTAB *drb_stats_hash = NULL;
+
+/*
+ * DrbStatsShmemSize --- report amount of shared memory space needed
+ */
+Size
+DrbStatsShmemSize(void)
+{
+    return hash_estimate_size(DRB_STATS_MAX_ENTRIES, sizeof(DrbStatsEntry));
+}
+
+/*
+ * DrbStatsShmemInit --- initialize this module's shared memory
+ */
+void
+DrbStatsShmemInit(void)
+{
+    HASHCTL info;
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(DrbStatsKey);
+    info.entrysize = sizeof(DrbStatsEntry);
+    info.hash = tag_hash;
+    drb_stats_hash = ShmemInitHash("DrillBeyond Statistics",
+                                   DRB_STATS_MAX_ENTRIES, DRB_STATS_MAX_ENTRIES,
+                                   &info,
+                                   HASH_ELEM | HASH_FUNCTION);
+}
+
+/*
+ * Counters for a new operator, with room for drb_max_num_cands candidates.
+ */
+extern DrillBeyondInstrumentation *drillbeyond_instr_alloc(void) {
+    DrillBeyondInstrumentation *instr = (DrillBeyondInstrumentation *) palloc0(sizeof(DrillBeyondInstrumentation));
+
+    instr->num_cands = Max(drb_max_num_cands, 1);
+    instr->cand_rows = (double *) palloc0(sizeof(double) * instr->num_cands);
+    instr->cand_ms = (double *) palloc0(sizeof(double) * instr->num_cands);
+    return instr;
+}
+
+extern double drillbeyond_elapsed_ms(instr_time start) {
+    instr_time now;
+
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_SUBTRACT(now, start);
+    return INSTR_TIME_GET_MILLISEC(now);
+}
+
+/*
+ * Adds the counters of an operator that ends to its keyword's entry.
+ */
+extern void drillbeyond_report_stats(DrillBeyondState *node) {
+    DrillBeyondExpansion *expansion = ((DrillBeyond *) node->js.ps.plan)->drb_expansion;
+    DrillBeyondInstrumentation *instr = node->db_instr;
+    DrbStatsKey key;
+    DrbStatsEntry *entry;
+    bool found;
+    int i;
+
+    // operators that never ran, e.g. under EXPLAIN without ANALYZE
+    if (drb_stats_hash == NULL || instr == NULL || node->tuplestorestate == NULL)
+        return;
+
+    MemSet(&key, 0, sizeof(key));
+    key.dbid = MyDatabaseId;
+    strlcpy(key.keyword, expansion->keyword, NAMEDATALEN);
+
+    LWLockAcquire(DrillBeyondStatsLock, LW_EXCLUSIVE);
+    entry = (DrbStatsEntry *) hash_search(drb_stats_hash, &key, HASH_ENTER_NULL, &found);
+    if (entry != NULL) {
+        if (!found)
+            MemSet((char *) entry + sizeof(DrbStatsKey), 0, sizeof(DrbStatsEntry) - sizeof(DrbStatsKey));
+        entry->executions++;
+        entry->requests += instr->requests;
+        entry->bytes_sent += instr->bytes_sent;
+        entry->bytes_received += instr->bytes_received;
+        entry->serialize_ms += instr->serialize_ms;
+        entry->network_ms += instr->network_ms;
+        entry->parse_ms += instr->parse_ms;
+        entry->merge_ms += instr->merge_ms;
+        if (expansion->actual_rows > 0)
+            entry->input_rows += (int64) expansion->actual_rows;
+        if (expansion->actual_distinct > 0)
+            entry->distinct_keys += (int64) expansion->actual_distinct;
+        entry->cache_hits += node->db_cache_hits;
+        entry->rescans += instr->rescans;
+        for (i = 0; i < instr->num_cands; i++)
+            entry->rows += (int64) instr->cand_rows[i];
+        if (expansion->results_hashtable != NULL &&
+            (int64) expansion->results_hashtable->spaceUsed > entry->max_hashtable_bytes)
+            entry->max_hashtable_bytes = (int64) expansion->results_hashtable->spaceUsed;
+    }
+    LWLockRelease(DrillBeyondStatsLock);
+}
+
+/*
+ * The entries of all databases, for pg_stat_drillbeyond.
+ */
+Datum
+pg_stat_get_drillbeyond(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc   tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext per_query_ctx;
+    MemoryContext oldcontext;
+    HASH_SEQ_STATUS status;
+    DrbStatsEntry *entry;
+
+    /* check to see if caller supports us returning a tuplestore */
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not " \
+                        "allowed in this context")));
+
+    /* Build a tuple descriptor for our result type */
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if (drb_stats_hash == NULL)
+        return (Datum) 0;
+
+    LWLockAcquire(DrillBeyondStatsLock, LW_SHARED);
+    hash_seq_init(&status, drb_stats_hash);
+    while ((entry = (DrbStatsEntry *) hash_seq_search(&status)) != NULL) {
+        Datum values[PG_STAT_GET_DRILLBEYOND_COLS];
+        bool nulls[PG_STAT_GET_DRILLBEYOND_COLS];
+        int i = 0;
+
+        MemSet(nulls, false, sizeof(nulls));
+        values[i++] = ObjectIdGetDatum(entry->key.dbid);
+        values[i++] = CStringGetTextDatum(entry->key.keyword);
+        values[i++] = Int64GetDatum(entry->executions);
+        values[i++] = Int64GetDatum(entry->requests);
+        values[i++] = Int64GetDatum(entry->bytes_sent);
+        values[i++] = Int64GetDatum(entry->bytes_received);
+        values[i++] = Float8GetDatum(entry->serialize_ms);
+        values[i++] = Float8GetDatum(entry->network_ms);
+        values[i++] = Float8GetDatum(entry->parse_ms);
+        values[i++] = Float8GetDatum(entry->merge_ms);
+        values[i++] = Int64GetDatum(entry->input_rows);
+        values[i++] = Int64GetDatum(entry->distinct_keys);
+        values[i++] = Int64GetDatum(entry->cache_hits);
+        values[i++] = Int64GetDatum(entry->rescans);
+        values[i++] = Int64GetDatum(entry->rows);
+        values[i++] = Int64GetDatum(entry->max_hashtable_bytes);
+        Assert(i == PG_STAT_GET_DRILLBEYOND_COLS);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    LWLockRelease(DrillBeyondStatsLock);
+
+    return (Datum) 0;
+}
+
+/*
+ * Empties pg_stat_drillbeyond.
+ */
+Datum
+pg_stat_reset_drillbeyond(PG_FUNCTION_ARGS)
+{
+    HASH_SEQ_STATUS status;
+    DrbStatsEntry *entry;
+
+    if (!superuser())
+        ereport(ERROR,
+                (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                 errmsg("must be superuser to reset statistics counters")));
+
+    if (drb_stats_hash == NULL)
+        PG_RETURN_VOID();
+
+    LWLockAcquire(DrillBeyondStatsLock, LW_EXCLUSIVE);
+    hash_seq_init(&status, drb_stats_hash);
+    while ((entry = (DrbStatsEntry *) hash_seq_search(&status)) != NULL)
+        hash_search(drb_stats_hash, &entry->key, HASH_REMOVE, NULL);
+    LWLockRelease(DrillBeyondStatsLock);
+
+    PG_RETURN_VOID();
+}
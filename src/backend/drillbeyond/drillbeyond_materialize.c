@@ -0,0 +1,804 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_materialize.c
+ *    Materialized augmentations: candidates of an open attribute stored in
+ *    a table, and joined instead of asking the EA service.
+ *
+ * drb_materialize(relation, keyword) runs the augmentation of the relation
+ * once, for all of its join values and all candidates, and stores the result
+ * in a new table next to it: the value, the candidate id and the join
+ * columns, in the order of the fake relation's columns. The table gets a
+ * btree index on the join columns and the id, and is analyzed, so that the
+ * planner has real statistics instead of DrillBeyond's estimates. The table
+ * is listed in pg_drb_materialized, and dropped along with the relation.
+ * Materializing again replaces it.
+ *
+ * When a SELECT is planned, its fake relations are replaced by these tables
+ * if all of them are fresh enough: not older than
+ * drb_materialized_max_age, built for at least drb_max_num_cands candidates,
+ * and holding every combination of join values the relation has now. That
+ * is checked by an anti-join of the relation with the table's index, which
+ * is far cheaper than asking the EA service, and keeps rows the table does
+ * not know from silently dropping out of the join. Unless the statement
+ * sees a transaction snapshot, the relation is locked against writers for
+ * the rest of the statement, so that the check and the execution see the
+ * same rows; if it can't be, requests are used.
+ *
+ * The fake quals then join the table like any other, and the candidate ids
+ * are added to the output, grouping, DISTINCT and sort order, like fan-out
+ * execution does (drb_prepare_fanout), so the result has the same shape as
+ * DRB_TOP's. Queries that fan-out cannot run in one pass, those restricting
+ * the values of an open attribute, which the EA service answers with other
+ * candidates, and relations with null join values, which DrillBeyond
+ * matches but a join does not, are still augmented by requests.
+ *
+ * This is decided by the planner rather than the parser, so that views,
+ * rules and SQL functions keep their fake relations, and the plan cache
+ * does not reuse plans that join materializations: every use of one is
+ * checked again.
+ *
+ * src/backend/drillbeyond/drillbeyond_materialize.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/sysattr.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/dependency.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_drb_materialized.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "drillbeyond/drillbeyond.h"
+#include "executor/spi.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "parser/parse_clause.h"
+#include "parser/parse_coerce.h"
+#include "parser/parse_oper.h"
+#include "parser/parsetree.h"
+#include "parser/scansup.h"
+#include "storage/lmgr.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+#include "utils/tqual.h"
+#include "utils/tuplesort.h"
+
+bool drb_enable_materialized_augmentations = true;
+int drb_materialized_max_age = 86400;
+
+#define DRB_MATERIALIZE_FETCH_SIZE 1000 // rows fetched from the augmented query at once
+
+typedef struct MaterializedVarsContext {
+    Relation *matrels; // by range table index, NULL if not materialized
+    int numRtes;
+    bool fix; // set the types of the Vars, instead of checking them
+} MaterializedVarsContext;
+
+static char *id_column_name(const char *keyword);
+static List *join_attnums(Relation rel);
+static SysScanDesc begin_scan(Relation catrel, Oid relid, const char *keyword, NameData *keyname);
+static void remove_catalog_rows(Relation catrel, Oid relid, const char *keyword);
+static Oid lookup_materialization(Oid relid, const char *keyword, Form_pg_drb_materialized form, TimestampTz *created);
+static void store_materialization(Oid relid, const char *keyword, Oid matrelid, bool hasnulls);
+static void force_guc(const char *name, const char *value);
+static bool same_keys(TupleTableSlot *slot, HeapTuple prev, int nkeys, AttrNumber *attNums,
+                      FmgrInfo *eqfns, Oid *collations);
+static bool materialization_usable(Query *query);
+static bool restricts_values_walker(Node *node, Query *query);
+static Relation open_materialization(Query *query, RangeTblEntry *rte, int *maxcands);
+static bool matches_expansion(Relation matrel, DrillBeyondExpansion *expansion, Oid relid);
+static bool materialization_complete(RangeTblEntry *extended, Relation matrel, DrillBeyondExpansion *expansion);
+static bool materialized_vars_walker(Node *node, MaterializedVarsContext *context);
+static TargetEntry *add_id_column(Query *query, Index rti, DrillBeyondExpansion *expansion);
+static SortGroupClause *id_clause(TargetEntry *tle, List *tlist);
+
+// as create_fake_relation() names it, e.g. "gdp_id"
+static char *id_column_name(const char *keyword) {
+    char *name = (char *) palloc(strlen(keyword) + 4);
+
+    sprintf(name, "%s_id", keyword);
+    return name;
+}
+
+/*
+ * The columns the fake relation of an open attribute of rel is joined on,
+ * as drillbeyond_find_string_attrs() finds them.
+ */
+static List *join_attnums(Relation rel) {
+    TupleDesc desc = RelationGetDescr(rel);
+    List *result = NIL;
+    int i;
+
+    for (i = 0; i < desc->natts; i++) {
+        if (desc->attrs[i]->attisdropped)
+            continue;
+        if (TypeCategory(desc->attrs[i]->atttypid) == TYPCATEGORY_STRING)
+            result = lappend_int(result, desc->attrs[i]->attnum);
+    }
+    return result;
+}
+
+static SysScanDesc begin_scan(Relation catrel, Oid relid, const char *keyword, NameData *keyname) {
+    ScanKeyData key[2];
+
+    namestrcpy(keyname, keyword);
+    ScanKeyInit(&key[0],
+                Anum_pg_drb_materialized_drbrelid,
+                BTEqualStrategyNumber, F_OIDEQ,
+                ObjectIdGetDatum(relid));
+    ScanKeyInit(&key[1],
+                Anum_pg_drb_materialized_drbkeyword,
+                BTEqualStrategyNumber, F_NAMEEQ,
+                NameGetDatum(keyname));
+    return systable_beginscan(catrel, DrbMaterializedRelidKeywordIndexId, true,
+                              SnapshotNow, 2, key);
+}
+
+/*
+ * Looks up the materialization of keyword on relid. Returns InvalidOid if
+ * there is none, otherwise its table, and copies its row to *form.
+ */
+static Oid lookup_materialization(Oid relid, const char *keyword, Form_pg_drb_materialized form,
+                                  TimestampTz *created) {
+    Relation catrel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+    NameData keyname;
+    Oid matrelid = InvalidOid;
+    bool isnull;
+
+    catrel = heap_open(DrbMaterializedRelationId, AccessShareLock);
+    scan = begin_scan(catrel, relid, keyword, &keyname);
+    tuple = systable_getnext(scan);
+    if (HeapTupleIsValid(tuple)) {
+        memcpy(form, GETSTRUCT(tuple), sizeof(FormData_pg_drb_materialized));
+        *created = DatumGetTimestampTz(heap_getattr(tuple, Anum_pg_drb_materialized_drbcreated,
+                                                    RelationGetDescr(catrel), &isnull));
+        matrelid = form->drbmatrelid;
+    }
+    systable_endscan(scan);
+    heap_close(catrel, AccessShareLock);
+    return matrelid;
+}
+
+static void remove_catalog_rows(Relation catrel, Oid relid, const char *keyword) {
+    SysScanDesc scan;
+    HeapTuple tuple;
+    NameData keyname;
+
+    scan = begin_scan(catrel, relid, keyword, &keyname);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+        simple_heap_delete(catrel, &tuple->t_self);
+    systable_endscan(scan);
+}
+
+static void store_materialization(Oid relid, const char *keyword, Oid matrelid, bool hasnulls) {
+    Relation catrel;
+    HeapTuple tuple;
+    NameData keyname;
+    Datum values[Natts_pg_drb_materialized];
+    bool nulls[Natts_pg_drb_materialized];
+
+    namestrcpy(&keyname, keyword);
+    memset(nulls, false, sizeof(nulls));
+    values[Anum_pg_drb_materialized_drbrelid - 1] = ObjectIdGetDatum(relid);
+    values[Anum_pg_drb_materialized_drbkeyword - 1] = NameGetDatum(&keyname);
+    values[Anum_pg_drb_materialized_drbmatrelid - 1] = ObjectIdGetDatum(matrelid);
+    values[Anum_pg_drb_materialized_drbmaxcands - 1] = Int32GetDatum(drb_max_num_cands);
+    values[Anum_pg_drb_materialized_drbhasnulls - 1] = BoolGetDatum(hasnulls);
+    values[Anum_pg_drb_materialized_drbcreated - 1] = TimestampTzGetDatum(GetCurrentTimestamp());
+
+    catrel = heap_open(DrbMaterializedRelationId, RowExclusiveLock);
+    remove_catalog_rows(catrel, relid, keyword);
+    tuple = heap_form_tuple(RelationGetDescr(catrel), values, nulls);
+    simple_heap_insert(catrel, tuple);
+    CatalogUpdateIndexes(catrel, tuple);
+    heap_freetuple(tuple);
+    heap_close(catrel, RowExclusiveLock);
+}
+
+/*
+ * Removes the materializations of a relation that is dropped, and the one
+ * held by it, if it is a materialization itself.
+ */
+extern void RemoveDrillBeyondMaterializations(Oid relid) {
+    Relation catrel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+
+    catrel = heap_open(DrbMaterializedRelationId, RowExclusiveLock);
+    scan = systable_beginscan(catrel, InvalidOid, false, SnapshotNow, 0, NULL);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+        Form_pg_drb_materialized form = (Form_pg_drb_materialized) GETSTRUCT(tuple);
+        if (form->drbrelid == relid || form->drbmatrelid == relid)
+            simple_heap_delete(catrel, &tuple->t_self);
+    }
+    systable_endscan(scan);
+    heap_close(catrel, RowExclusiveLock);
+}
+
+static void force_guc(const char *name, const char *value) {
+    (void) set_config_option(name, value, PGC_USERSET, PGC_S_SESSION,
+                             GUC_ACTION_SAVE, true, 0);
+}
+
+/*
+ * Whether the current tuple of slot has the same keys as prev; nulls are
+ * equal to each other, as DrillBeyond's join values are.
+ */
+static bool same_keys(TupleTableSlot *slot, HeapTuple prev, int nkeys, AttrNumber *attNums,
+                      FmgrInfo *eqfns, Oid *collations) {
+    int i;
+
+    for (i = 0; i < nkeys; i++) {
+        bool isnull1, isnull2;
+        Datum d1 = slot_getattr(slot, attNums[i], &isnull1);
+        Datum d2 = heap_getattr(prev, attNums[i], slot->tts_tupleDescriptor, &isnull2);
+
+        if (isnull1 != isnull2)
+            return false;
+        if (!isnull1 && !DatumGetBool(FunctionCall2Coll(&eqfns[i], collations[i], d1, d2)))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * drb_materialize(relation, keyword) --- stores the candidates of keyword
+ * for all join values of relation in a new table, and returns it.
+ */
+Datum
+drb_materialize(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    char *keyword = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    Relation rel, matrel;
+    TupleDesc desc, resultDesc = NULL;
+    List *attnums;
+    ListCell *lc;
+    char *relname, *nspname, *matname, *qualname;
+    Oid nspid, matrelid, valuetype;
+    FormData_pg_drb_materialized oldform;
+    TimestampTz created;
+    ObjectAddress myself, referenced;
+    StringInfoData sql;
+    SPIPlanPtr plan;
+    Portal portal;
+    Tuplesortstate *sortstate = NULL;
+    TupleTableSlot *slot = NULL;
+    BulkInsertState bistate;
+    CommandId mycid;
+    HeapTuple prev = NULL;
+    AttrNumber *attNums;
+    Oid *sortOperators, *collations;
+    bool *nullsFirst;
+    FmgrInfo *eqfns;
+    Datum *values;
+    bool *nulls;
+    int ncols, nkeys, i, save_nestlevel;
+    bool hasnulls = false;
+
+    truncate_identifier(keyword, strlen(keyword), true);
+    if (keyword[0] == '\0')
+        ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("keyword of an open attribute must not be empty")));
+
+    // the candidates stay valid only as long as the join values do
+    rel = heap_open(relid, ShareLock);
+    if (rel->rd_rel->relkind != RELKIND_RELATION)
+        ereport(ERROR,
+            (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+            errmsg("\"%s\" is not a table", RelationGetRelationName(rel))));
+    if (!pg_class_ownercheck(relid, GetUserId()))
+        aclcheck_error(ACLCHECK_NOT_OWNER, ACL_KIND_CLASS, RelationGetRelationName(rel));
+
+    desc = RelationGetDescr(rel);
+    relname = pstrdup(RelationGetRelationName(rel));
+    nspid = RelationGetNamespace(rel);
+    nspname = get_namespace_name(nspid);
+    attnums = join_attnums(rel);
+    ncols = list_length(attnums);
+
+    // the augmentation must run in full, and not read an older materialization
+    save_nestlevel = NewGUCNestLevel();
+    force_guc("drb_enable_materialized_augmentations", "off");
+    force_guc("drb_max_variants", "0");
+    force_guc("drb_variant_time_budget", "0");
+    force_guc("drb_enable_variant_notices", "off");
+    force_guc("drb_parallel_workers", "0");
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        elog(ERROR, "SPI_connect failed");
+
+    // replace the old materialization, under the same name
+    if (OidIsValid(lookup_materialization(relid, keyword, &oldform, &created))) {
+        myself.classId = RelationRelationId;
+        myself.objectId = oldform.drbmatrelid;
+        myself.objectSubId = 0;
+        performDeletion(&myself, DROP_RESTRICT, 0);
+        CommandCounterIncrement();
+    }
+
+    // the join columns, the open attribute and, added by DRB_TOP, its id
+    initStringInfo(&sql);
+    appendStringInfoString(&sql, "SELECT ");
+    foreach(lc, attnums)
+        appendStringInfo(&sql, "%s.%s, ", quote_identifier(relname),
+                         quote_identifier(NameStr(desc->attrs[lfirst_int(lc) - 1]->attname)));
+    appendStringInfo(&sql, "%s.%s FROM %s AS %s", quote_identifier(relname), quote_identifier(keyword),
+                     quote_qualified_identifier(nspname, relname), quote_identifier(relname));
+
+    plan = SPI_prepare(sql.data, 0, NULL);
+    if (plan == NULL)
+        elog(ERROR, "SPI_prepare failed for \"%s\"", sql.data);
+    portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+
+    // sort by id and join values, to store each combination once
+    nkeys = ncols + 1;
+    attNums = (AttrNumber *) palloc(sizeof(AttrNumber) * nkeys);
+    sortOperators = (Oid *) palloc(sizeof(Oid) * nkeys);
+    collations = (Oid *) palloc(sizeof(Oid) * nkeys);
+    nullsFirst = (bool *) palloc0(sizeof(bool) * nkeys);
+    eqfns = (FmgrInfo *) palloc(sizeof(FmgrInfo) * nkeys);
+    for (;;) {
+        SPI_cursor_fetch(portal, true, DRB_MATERIALIZE_FETCH_SIZE);
+        if (resultDesc == NULL) {
+            resultDesc = CreateTupleDescCopy(SPI_tuptable->tupdesc);
+            if (resultDesc->natts != ncols + 2 ||
+                resultDesc->attrs[ncols + 1]->atttypid != INT8OID)
+                ereport(ERROR,
+                    (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+                    errmsg("augmentation of \"%s\" with \"%s\" did not return candidate ids",
+                           relname, keyword)));
+            for (i = 0; i < nkeys; i++) {
+                Oid eqop;
+
+                attNums[i] = i == 0 ? ncols + 2 : i;
+                get_sort_group_operators(resultDesc->attrs[attNums[i] - 1]->atttypid, true, true, false,
+                                         &sortOperators[i], &eqop, NULL, NULL);
+                fmgr_info(get_opcode(eqop), &eqfns[i]);
+                collations[i] = resultDesc->attrs[attNums[i] - 1]->attcollation;
+            }
+            sortstate = tuplesort_begin_heap(resultDesc, nkeys, attNums, sortOperators, collations,
+                                             nullsFirst, maintenance_work_mem, false);
+            slot = MakeSingleTupleTableSlot(resultDesc);
+        }
+        if (SPI_processed == 0)
+            break;
+        for (i = 0; i < SPI_processed; i++) {
+            ExecStoreTuple(SPI_tuptable->vals[i], slot, InvalidBuffer, false);
+            tuplesort_puttupleslot(sortstate, slot);
+        }
+        SPI_freetuptable(SPI_tuptable);
+    }
+    SPI_freetuptable(SPI_tuptable);
+    SPI_cursor_close(portal);
+    tuplesort_performsort(sortstate);
+
+    // the table, with the columns of the fake relation
+    valuetype = resultDesc->attrs[ncols]->atttypid;
+    matname = ChooseRelationName(relname, keyword, "drb", nspid);
+    qualname = quote_qualified_identifier(nspname, matname);
+    resetStringInfo(&sql);
+    appendStringInfo(&sql, "CREATE TABLE %s (%s %s, ", qualname, quote_identifier(keyword),
+                     format_type_with_typemod(valuetype, -1));
+    appendStringInfo(&sql, "%s bigint", quote_identifier(id_column_name(keyword)));
+    foreach(lc, attnums) {
+        Form_pg_attribute att = desc->attrs[lfirst_int(lc) - 1];
+
+        appendStringInfo(&sql, ", %s %s", quote_identifier(NameStr(att->attname)),
+                         format_type_with_typemod(att->atttypid, att->atttypmod));
+        if (OidIsValid(att->attcollation))
+            appendStringInfo(&sql, " COLLATE %s", generate_collation_name(att->attcollation));
+    }
+    appendStringInfoChar(&sql, ')');
+    if (SPI_execute(sql.data, false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "SPI_execute failed for \"%s\"", sql.data);
+    CommandCounterIncrement();
+    matrelid = get_relname_relid(matname, nspid);
+
+    myself.classId = RelationRelationId;
+    myself.objectId = matrelid;
+    myself.objectSubId = 0;
+    referenced.classId = RelationRelationId;
+    referenced.objectId = relid;
+    referenced.objectSubId = 0;
+    recordDependencyOn(&myself, &referenced, DEPENDENCY_AUTO);
+
+    // load it, indexes are built afterwards
+    matrel = heap_open(matrelid, AccessExclusiveLock);
+    bistate = GetBulkInsertState();
+    mycid = GetCurrentCommandId(true);
+    values = (Datum *) palloc(sizeof(Datum) * (ncols + 2));
+    nulls = (bool *) palloc(sizeof(bool) * (ncols + 2));
+    while (tuplesort_gettupleslot(sortstate, true, slot)) {
+        HeapTuple tuple;
+
+        if (prev != NULL && same_keys(slot, prev, nkeys, attNums, eqfns, collations))
+            continue;
+        slot_getallattrs(slot);
+        values[0] = slot->tts_values[ncols];
+        nulls[0] = slot->tts_isnull[ncols];
+        values[1] = slot->tts_values[ncols + 1];
+        nulls[1] = slot->tts_isnull[ncols + 1];
+        for (i = 0; i < ncols; i++) {
+            values[i + 2] = slot->tts_values[i];
+            nulls[i + 2] = slot->tts_isnull[i];
+            hasnulls |= nulls[i + 2];
+        }
+        tuple = heap_form_tuple(RelationGetDescr(matrel), values, nulls);
+        heap_insert(matrel, tuple, mycid, 0, bistate);
+        heap_freetuple(tuple);
+
+        if (prev != NULL)
+            heap_freetuple(prev);
+        prev = ExecCopySlotTuple(slot);
+    }
+    FreeBulkInsertState(bistate);
+    heap_close(matrel, NoLock);
+    tuplesort_end(sortstate);
+    ExecDropSingleTupleTableSlot(slot);
+    CommandCounterIncrement();
+
+    resetStringInfo(&sql);
+    appendStringInfo(&sql, "CREATE INDEX ON %s (", qualname);
+    foreach(lc, attnums)
+        appendStringInfo(&sql, "%s, ", quote_identifier(NameStr(desc->attrs[lfirst_int(lc) - 1]->attname)));
+    appendStringInfo(&sql, "%s)", quote_identifier(id_column_name(keyword)));
+    if (SPI_execute(sql.data, false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "SPI_execute failed for \"%s\"", sql.data);
+
+    resetStringInfo(&sql);
+    appendStringInfo(&sql, "ANALYZE %s", qualname);
+    if (SPI_execute(sql.data, false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "SPI_execute failed for \"%s\"", sql.data);
+
+    store_materialization(relid, keyword, matrelid, hasnulls);
+
+    SPI_finish();
+    AtEOXact_GUC(true, save_nestlevel);
+    heap_close(rel, NoLock);
+
+    PG_RETURN_OID(matrelid);
+}
+
+/*
+ * The candidates of one pass have to be told apart by their ids, as with
+ * fan-out execution (see fanout_applicable), and the variants are all
+ * wanted at once.
+ */
+static bool materialization_usable(Query *query) {
+    ListCell *lc;
+
+    if (query->commandType != CMD_SELECT || query->hasWindowFuncs || query->hasSubLinks ||
+        query->hasDistinctOn || query->setOperations != NULL || query->cteList != NIL ||
+        query->rowMarks != NIL || query->limitCount != NULL || query->limitOffset != NULL)
+        return false;
+    if (drb_max_variants > 0 || drb_variant_time_budget > 0 || drb_enable_variant_notices)
+        return false;
+
+    foreach(lc, query->rtable) {
+        RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+        if (rte->rtekind == RTE_SUBQUERY || rte->rtekind == RTE_CTE)
+            return false;
+    }
+    // the EA service answers restrictions on the values (drb_qual, see
+    // drillbeyond_planner_phase_two) with other candidates than those stored
+    if (restricts_values_walker((Node *) query->jointree, query) ||
+        restricts_values_walker(query->havingQual, query))
+        return false;
+    return true;
+}
+
+/*
+ * Whether a qual references the value of a fake relation; the join quals
+ * only reference its join columns.
+ */
+static bool restricts_values_walker(Node *node, Query *query) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, Var)) {
+        Var *var = (Var *) node;
+
+        return var->varlevelsup == 0 &&
+               rt_fetch(var->varno, query->rtable)->rtekind == RTE_DRILLBEYOND &&
+               (var->varattno == DRB_VALUE_ATTR || var->varattno == InvalidAttrNumber);
+    }
+    return expression_tree_walker(node, restricts_values_walker, (void *) query);
+}
+
+/*
+ * Opens the materialization that can replace the fake relation rte, or
+ * returns NULL if there is none fresh enough. Sets *maxcands to the number
+ * of candidates it was built for.
+ */
+static Relation open_materialization(Query *query, RangeTblEntry *rte, int *maxcands) {
+    DrillBeyondExpansion *expansion = rte->drb_expansion;
+    RangeTblEntry *extended = rt_fetch(expansion->extended_rti, query->rtable);
+    FormData_pg_drb_materialized form;
+    TimestampTz created;
+    Relation matrel;
+    Oid matrelid;
+
+    if (extended->rtekind != RTE_RELATION)
+        return NULL;
+    matrelid = lookup_materialization(extended->relid, expansion->keyword, &form, &created);
+    if (!OidIsValid(matrelid) || form.drbhasnulls || form.drbmaxcands < drb_max_num_cands)
+        return NULL;
+    if (drb_materialized_max_age > 0 &&
+        TimestampDifferenceExceeds(created, GetCurrentTimestamp(), drb_materialized_max_age * 1000))
+        return NULL;
+
+    matrel = try_relation_open(matrelid, AccessShareLock);
+    if (matrel == NULL)
+        return NULL;
+    if (pg_class_aclcheck(matrelid, GetUserId(), ACL_SELECT) != ACLCHECK_OK ||
+        !matches_expansion(matrel, expansion, extended->relid) ||
+        !materialization_complete(extended, matrel, expansion)) {
+        relation_close(matrel, AccessShareLock);
+        return NULL;
+    }
+    *maxcands = form.drbmaxcands;
+    return matrel;
+}
+
+/*
+ * Whether matrel still has the columns of the fake relation of expansion,
+ * which is joined to relid.
+ */
+static bool matches_expansion(Relation matrel, DrillBeyondExpansion *expansion, Oid relid) {
+    TupleDesc desc = RelationGetDescr(matrel);
+    ListCell *lc;
+    int i;
+
+    if (matrel->rd_rel->relkind != RELKIND_RELATION ||
+        desc->natts != list_length(expansion->join_cols) + 2)
+        return false;
+    for (i = 0; i < desc->natts; i++)
+        if (desc->attrs[i]->attisdropped)
+            return false;
+    if (desc->attrs[DRB_VALUE_ATTR - 1]->atttypid != expansion->valuetype ||
+        desc->attrs[DRB_ID_ATTR - 1]->atttypid != INT8OID)
+        return false;
+
+    i = DRB_ID_ATTR;
+    foreach(lc, expansion->join_cols) {
+        Var *var = (Var *) lfirst(lc);
+        Form_pg_attribute att = desc->attrs[i++];
+        char *attname = get_attname(relid, var->varattno);
+
+        if (attname == NULL || strcmp(attname, NameStr(att->attname)) != 0 ||
+            att->atttypid != var->vartype || att->atttypmod != var->vartypmod ||
+            att->attcollation != var->varcollid)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Whether matrel has candidates for every combination of join values the
+ * relation of extended has in the statement's snapshot. Rows added since
+ * drb_materialize, or in this transaction, would not find a partner in the
+ * join and vanish from the result. Join values that are gone don't matter.
+ */
+static bool materialization_complete(RangeTblEntry *extended, Relation matrel, DrillBeyondExpansion *expansion) {
+    Oid relid = extended->relid;
+    StringInfoData sql;
+    ListCell *lc;
+    bool read_only = IsolationUsesXactSnapshot();
+    bool complete;
+
+    if (!read_only) {
+        // the executor takes a new snapshot, which must not see more rows
+        // than the check; writers are kept out until the statement ends
+        if (IsTransactionBlock() || RecoveryInProgress() ||
+            !ConditionalLockRelationOid(relid, ShareLock))
+            return false;
+    }
+    if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+        return false;
+
+    initStringInfo(&sql);
+    appendStringInfo(&sql, "SELECT 1 FROM %s%s r WHERE NOT EXISTS (SELECT 1 FROM ONLY %s m WHERE true",
+                     extended->inh ? "" : "ONLY ",
+                     quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+                                                get_rel_name(relid)),
+                     quote_qualified_identifier(get_namespace_name(RelationGetNamespace(matrel)),
+                                                RelationGetRelationName(matrel)));
+    foreach(lc, expansion->join_cols) {
+        const char *attname = quote_identifier(get_attname(relid, ((Var *) lfirst(lc))->varattno));
+        appendStringInfo(&sql, " AND m.%s = r.%s", attname, attname);
+    }
+    appendStringInfoString(&sql, ") LIMIT 1");
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        elog(ERROR, "SPI_connect failed");
+    // without read_only, SPI takes a new snapshot, after the lock
+    if (SPI_execute(sql.data, read_only, 1) != SPI_OK_SELECT)
+        elog(ERROR, "SPI_execute failed for \"%s\"", sql.data);
+    complete = SPI_processed == 0;
+    SPI_finish();
+    pfree(sql.data);
+    return complete;
+}
+
+/*
+ * Checks that the Vars of the fake relations can be read from their
+ * materializations, or, with context->fix, gives them the typmods and
+ * collations of the table's columns.
+ */
+static bool materialized_vars_walker(Node *node, MaterializedVarsContext *context) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, Var)) {
+        Var *var = (Var *) node;
+        Relation matrel;
+        Form_pg_attribute att;
+
+        if (var->varlevelsup != 0 || var->varno > context->numRtes ||
+            (matrel = context->matrels[var->varno]) == NULL)
+            return false;
+        // whole-row Vars, or the id, which the parser types like an open attribute
+        if (var->varattno <= 0 || var->varattno > RelationGetDescr(matrel)->natts)
+            return true;
+        att = RelationGetDescr(matrel)->attrs[var->varattno - 1];
+        if (var->vartype != att->atttypid)
+            return true;
+        if (context->fix) {
+            var->vartypmod = att->atttypmod;
+            var->varcollid = att->attcollation;
+        }
+        return false;
+    }
+    return expression_tree_walker(node, materialized_vars_walker, (void *) context);
+}
+
+/*
+ * Adds the id of a materialized expansion to the output, named like the id
+ * columns DRB_TOP adds, but in front of the junk columns.
+ */
+static TargetEntry *add_id_column(Query *query, Index rti, DrillBeyondExpansion *expansion) {
+    char *name = (char *) palloc(strlen(expansion->extended_relname) + strlen(expansion->keyword) + 5);
+    Var *var = makeVar(rti, DRB_ID_ATTR, INT8OID, -1, InvalidOid, 0);
+    TargetEntry *tle;
+    List *tlist = NIL;
+    ListCell *lc;
+    AttrNumber resno = 1;
+
+    sprintf(name, "%s_%s_id", expansion->extended_relname, expansion->keyword);
+    tle = makeTargetEntry((Expr *) var, 0, name, false);
+    foreach(lc, query->targetList) {
+        TargetEntry *t = (TargetEntry *) lfirst(lc);
+        if (t->resjunk && !list_member_ptr(tlist, tle))
+            tlist = lappend(tlist, tle);
+        tlist = lappend(tlist, t);
+    }
+    if (!list_member_ptr(tlist, tle))
+        tlist = lappend(tlist, tle);
+    foreach(lc, tlist)
+        ((TargetEntry *) lfirst(lc))->resno = resno++;
+    query->targetList = tlist;
+    return tle;
+}
+
+static SortGroupClause *id_clause(TargetEntry *tle, List *tlist) {
+    SortGroupClause *sgc = makeNode(SortGroupClause);
+
+    get_sort_group_operators(INT8OID, true, true, false,
+                             &sgc->sortop, &sgc->eqop, NULL,
+                             &sgc->hashable);
+    sgc->tleSortGroupRef = assignSortGroupRef(tle, tlist);
+    sgc->nulls_first = false;
+    return sgc;
+}
+
+/*
+ * Called when planning of a statement starts: replaces the fake relations
+ * of a SELECT by their materializations, if all of them have one that is
+ * fresh enough, and returns whether it did. Otherwise the query is left
+ * alone, and augmented by requests. Views, rules and functions store the
+ * fake relations, so the decision is made again for every plan.
+ */
+extern bool drillbeyond_use_materializations(Query *query) {
+    MaterializedVarsContext context;
+    List *idSortClauses = NIL;
+    List *idGroupClauses = NIL;
+    List *idDistinctClauses = NIL;
+    ListCell *lc;
+    int *maxcands;
+    bool usable = true;
+    bool augmented = false;
+    Index rti;
+
+    if (!drb_enable_materialized_augmentations || !materialization_usable(query))
+        return false;
+
+    context.numRtes = list_length(query->rtable);
+    context.matrels = (Relation *) palloc0(sizeof(Relation) * (context.numRtes + 1));
+    context.fix = false;
+    maxcands = (int *) palloc0(sizeof(int) * (context.numRtes + 1));
+    rti = 0;
+    foreach(lc, query->rtable) {
+        RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+        rti++;
+
+        if (rte->rtekind != RTE_DRILLBEYOND)
+            continue;
+        augmented = true;
+        context.matrels[rti] = open_materialization(query, rte, &maxcands[rti]);
+        if (context.matrels[rti] == NULL) {
+            usable = false;
+            break;
+        }
+    }
+    if (usable && augmented)
+        usable = !query_tree_walker(query, materialized_vars_walker, (void *) &context, 0);
+    if (!usable || !augmented) {
+        for (rti = 1; rti <= context.numRtes; rti++)
+            if (context.matrels[rti] != NULL)
+                relation_close(context.matrels[rti], AccessShareLock);
+        return false;
+    }
+
+    context.fix = true;
+    query_tree_walker(query, materialized_vars_walker, (void *) &context, 0);
+
+    rti = 0;
+    foreach(lc, query->rtable) {
+        RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+        DrillBeyondExpansion *expansion = rte->drb_expansion;
+        TargetEntry *tle;
+        rti++;
+
+        if (context.matrels[rti] == NULL)
+            continue;
+
+        // a plain table from now on; the lock is kept until the end of the transaction,
+        // and the plan is not reused (see CheckCachedPlan)
+        rte->rtekind = RTE_RELATION;
+        rte->relid = RelationGetRelid(context.matrels[rti]);
+        rte->relkind = RELKIND_RELATION;
+        rte->drb_expansion = NULL;
+        rte->selectedCols = bms_add_member(rte->selectedCols,
+                                           DRB_ID_ATTR - FirstLowInvalidHeapAttributeNumber);
+        relation_close(context.matrels[rti], NoLock);
+
+        tle = add_id_column(query, rti, expansion);
+        if (maxcands[rti] > drb_max_num_cands) {
+            Const *limit = makeConst(INT8OID, -1, InvalidOid, sizeof(int64),
+                                     Int64GetDatum((int64) drb_max_num_cands), false, FLOAT8PASSBYVAL);
+            Oid ltop;
+
+            get_sort_group_operators(INT8OID, true, false, false, &ltop, NULL, NULL, NULL);
+            query->jointree->quals = make_and_qual(query->jointree->quals,
+                (Node *) make_opclause(ltop, BOOLOID, false, (Expr *) copyObject(tle->expr),
+                                       (Expr *) limit, InvalidOid, InvalidOid));
+        }
+
+        if (query->sortClause != NIL)
+            idSortClauses = lappend(idSortClauses, id_clause(tle, query->targetList));
+        if (query->groupClause != NIL || query->hasAggs || query->havingQual != NULL)
+            idGroupClauses = lappend(idGroupClauses, id_clause(tle, query->targetList));
+        if (query->distinctClause != NIL)
+            idDistinctClauses = lappend(idDistinctClauses, id_clause(tle, query->targetList));
+    }
+    query->sortClause = list_concat(idSortClauses, query->sortClause);
+    query->groupClause = list_concat(idGroupClauses, query->groupClause);
+    query->distinctClause = list_concat(idDistinctClauses, query->distinctClause);
+    return true;
+}
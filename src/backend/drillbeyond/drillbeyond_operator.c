@@ -18,15 +18,34 @@
 #include "utils/builtins.h"
 #include "utils/selfuncs.h"
 #include "json/json.h"
+#include "access/hash.h"
 #include "access/tupmacs.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_type.h"
 #include "utils/builtins.h"
 #include "utils/array.h"
 #include "utils/typcache.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "storage/buffile.h"
+
+bool drb_enable_adaptive_strategy = true;
+int drb_candidate_order = DRB_ORDER_SERVICE;
+bool drb_enable_candidate_dedup = false;
+double drb_candidate_dedup_tolerance = 0.0;
 
 static bool remove_mat_nodes(PlanState *state, List *addedMatNodes);
+static void add_to_probe_batch(DrillBeyondState *node, TupleTableSlot *slot);
+static void flush_probe_batch(DrillBeyondState *node);
+static void collect_outer(DrillBeyondState *node);
+static void remember_entries(DrillBeyondState *node, DrillBeyondValues **entries, int n);
+static DrillBeyondValues *remembered_entry(DrillBeyondState *node);
+static void forget_entries(DrillBeyondState *node);
+static void preselect_outer(DrillBeyondState *node);
+static TupleTableSlot *drillbeyond_next(DrillBeyondState *node);
+static int next_changed_candidate(DrillBeyondValues *vals, int origin);
+static bool candidate_is_null(DrillBeyondValues *vals, int cand);
+static bool candidates_agree(DrillBeyondHashTable *ht, int a, int b);
 
 DrillBeyondState *ExecInitDrillBeyond(DrillBeyond *node, EState *estate, int eflags)
 {
@@ -99,15 +118,19 @@ DrillBeyondState *ExecInitDrillBeyond(DrillBeyond *node, EState *estate, int efl
     dbstate->js.ps.ps_TupFromTlist = false;
     dbstate->db_NeedNewOuter = true;
     dbstate->db_current_origin = 0;
+    dbstate->db_current_rank = 0;
+    dbstate->db_cand_order = NULL;
+    dbstate->db_cand_class = NULL;
 
-    // find slot to put open value in from projection info
+    // find slot to put open value (and candidate id in fan-out mode) in from projection info
     projInfo = innerPlanState(dbstate)->ps_ProjInfo;
+    dbstate->db_idColIdx = -1;
     for (i = 0; i < projInfo->pi_numSimpleVars; i++)
     {
-        if (projInfo->pi_varNumbers[i] == 1) {
+        if (projInfo->pi_varNumbers[i] == DRB_VALUE_ATTR)
             dbstate->db_valueColIdx = i;
-            break;
-        }
+        else if (projInfo->pi_varNumbers[i] == DRB_ID_ATTR)
+            dbstate->db_idColIdx = i;
     }
 
 
@@ -120,6 +143,16 @@ DrillBeyondState *ExecInitDrillBeyond(DrillBeyond *node, EState *estate, int efl
     // materialization
     dbstate->tuplestorestate = NULL;
 
+    // join values are added to the results hashtable in batches
+    dbstate->db_batchKeys = (DrillBeyondKey *) palloc(sizeof(DrillBeyondKey) * DRB_PROBE_BATCH_SIZE);
+    dbstate->db_batchCxt = AllocSetContextCreate(CurrentMemoryContext,
+                                                 "DrillBeyondProbeBatch",
+                                                 ALLOCSET_DEFAULT_MINSIZE,
+                                                 ALLOCSET_DEFAULT_INITSIZE,
+                                                 ALLOCSET_DEFAULT_MAXSIZE);
+    dbstate->db_fragment_instr = InstrAlloc(1, INSTRUMENT_TIMER);
+    dbstate->db_instr = drillbeyond_instr_alloc();
+
     return dbstate;
 }
 
@@ -171,71 +204,45 @@ DrillBeyondDummyState *ExecInitDrillBeyondDummy(SeqScan *node, EState *estate, i
 
 }
 
+/*
+ * First checkpoint of the adaptive strategy: the candidates and their
+ * selectivities just arrived, and the input of the operator was counted.
+ * Decides between DRB_PLACEHOLDER (with Ω) and DRB_DEFAULT by the costs of
+ * both for the rest of the execution, see drillbeyond_strategy_costs.
+ */
 extern PlannedStmt* reconsiderStrategy(DrillBeyondState *node) {
     DrillBeyond *plan;
     DrillBeyondExpand *expandPlan;
     DrillBeyondExpansion *expansion;
-    double cost, sel, score, big_omega_cost, avg_sel;
-    double ARBITRARY_CORRECTION_FACTOR = 0.8;
+    DrillBeyondExpandState *expandState;
+    double sel, omega_cost, default_cost, rewind_fraction, avg_sel;
     int i;
 
 
     plan = (DrillBeyond*) node->js.ps.plan;
     expandPlan = plan->drb_expandNode;
     expansion = plan->drb_expansion;
+    expandState = node->drb_expand_operator_state;
 
     if (expandPlan == NULL)
         return NULL;
 
-    cost = sum_costs((Plan*)expandPlan, (Plan*)plan);
-    // double startup_cost = 0.0;
-    // double run_cost = 0.0;
-    // sum_both_costs((Plan*)expandPlan, (Plan*)plan, &startup_cost, &run_cost);
-    if (expansion->selective) {
-        // cost for one full execution of the partial plan, so no selectivity
-        if (drb_cost_model == DRB_COST_ONLY_S || drb_cost_model == DRB_COST_BOTH) {
-            cost /= expansion->selectivity;
-            // startup_cost /= expansion->selectivity;
-            // run_cost /= expansion->selectivity;
-        }
-    }
-    if (drb_cost_model == DRB_COST_ONLY_K || drb_cost_model == DRB_COST_BOTH) {
-        cost /= drb_max_num_cands;
-        // startup_cost /= drb_max_num_cands;
-        // run_cost /= drb_max_num_cands;
-    }
-
-    // big_omega_cost = startup_cost + run_cost;// cost is now normalized to one run, with no selection
-    // double def_cost = (startup_cost + drb_max_num_cands * run_cost)*expansion->selectivity;
-    // printf("exp->sel %f\n", expansion->selectivity);
-    // printf("startup_cost: %f, run_cost: %f\n", startup_cost, run_cost);
-    // printf("est. def_cost %f\n", def_cost);
-    // printf("est. bigomega cost: %f\n", big_omega_cost);
-    // printf("single_costs:");
-    big_omega_cost = cost ;//* (1/expansion->selectivity); // cost is now normalized to one run, with no selection
-    // printf("cost: %f\n", cost);
-    // printf("est. def_cost %f (cost * k)\n", cost*drb_max_num_cands*expansion->selectivity);
-    // printf("est. bigomega cost: %f (cost * (1/sel))\n", cost);
-    // printf("single_costs:");
+    drillbeyond_strategy_costs(node, &omega_cost, &default_cost, &rewind_fraction);
+    if (expandState != NULL)
+        expandState->rewind_fraction = rewind_fraction;
     avg_sel = 0.0;
-    score = 0.0;
     for (i = 0; i < node->db_num_cands; ++i)
     {
         sel = expansion->selectivities[i];
-        // remove estimatead sel, add real sel
-        score += cost * sel;
-        // score += run_cost * sel; // OH NOES
         avg_sel += sel;
-        // printf("%f[%f] ", run_cost * sel, sel);
-        // printf("%f[%f] ", cost * sel, sel);
     }
     avg_sel /= node->db_num_cands;
-    // printf("\nreal default mode total cost: %f. \n", score);
 
     // REAL DYNAMIC REOPTIMIZATION; JUST FOR FUN
     // ---------------------------------------------------------------------//
-    bool shouldSwitch = score < big_omega_cost * ARBITRARY_CORRECTION_FACTOR;
-    printf("score: %f, bigomega: %f -> %f should switch strategy: %s\n", score, big_omega_cost, score/big_omega_cost, shouldSwitch ? "yes" : "no");
+    bool shouldSwitch = default_cost < omega_cost;
+    elog(DEBUG1, "%s: default cost %f, placeholder cost %f, switch strategy: %s",
+         expansion->keyword, default_cost, omega_cost, shouldSwitch ? "yes" : "no");
     if (drb_enable_static_reoptimization) {
         // "static" means static at runtime, but dynamic at plantime
         if (shouldSwitch)
@@ -297,12 +304,608 @@ static bool remove_mat_nodes(PlanState *state, List *addedMatNodes) {
     return false;
 }
 
+/*
+ * Called by DRB_TOP at the end of each run: records, for every operator
+ * whose Ω passes tuples through in DRB_DEFAULT mode, how long the plan
+ * between them took for the candidate of this run.
+ */
+extern void drb_record_runs(DrillBeyondExpandState *top) {
+    ListCell *lc;
+
+    foreach(lc, top->drb_operator_states) {
+        DrillBeyondState *op = (DrillBeyondState *) lfirst(lc);
+        DrillBeyondExpandState *expandState = op->drb_expand_operator_state;
+        DrillBeyondExpansion *expansion = ((DrillBeyond *) op->js.ps.plan)->drb_expansion;
+        Instrumentation *instr;
+        double sel, ms;
+
+        if (expandState == NULL || expandState->run_instr == NULL)
+            continue;
+        instr = expandState->run_instr;
+        if (!instr->running)
+            continue; // did not run, or was not timed
+        if (expansion->selectivities != NULL && op->db_current_origin < op->db_num_cands) {
+            sel = expansion->selectivities[op->db_current_origin];
+            ms = INSTR_TIME_GET_MILLISEC(instr->counter);
+            expandState->run_count++;
+            expandState->run_sum_sel += sel;
+            expandState->run_sum_ms += ms;
+            expandState->run_sum_sel2 += sel * sel;
+            expandState->run_sum_sel_ms += sel * ms;
+        }
+        InstrEndLoop(instr);
+    }
+}
+
+/*
+ * Later checkpoints of the adaptive strategy, at the start of a run: an
+ * operator whose candidate changes, and that runs in DRB_DEFAULT mode, is
+ * switched to DRB_PLACEHOLDER if the measured times say that one more run on
+ * all rows, read back from Ω for the rest, is faster than running once per
+ * candidate. The operator keeps its stored input, the epoch was already
+ * begun with DRB_DEFAULT, so Ω refills its store from the plan below.
+ * The other direction never pays off: once Ω is filled, only reading it
+ * back remains.
+ */
+extern void drb_adapt_strategies(DrillBeyondExpandState *top, Bitmapset *changedExpansions) {
+    double stride = 1.0;
+    ListCell *lc;
+
+    if (!drb_enable_adaptive_strategy || !drb_enable_dynamic_omega)
+        return;
+
+    // candidates advance like an odometer, the first operator fastest
+    foreach(lc, top->drb_operator_states) {
+        DrillBeyondState *op = (DrillBeyondState *) lfirst(lc);
+        DrillBeyondExpandState *expandState = op->drb_expand_operator_state;
+        DrillBeyond *plan = (DrillBeyond *) op->js.ps.plan;
+        DrillBeyondExpand *expandPlan = plan->drb_expandNode;
+        double runs, omega_ms, default_ms;
+
+        runs = ceil(top->total_permutations / stride);
+        stride *= Max(drb_max_num_cands, 1);
+        if (expandState == NULL || expandPlan == NULL || expandState->tupstore == NULL ||
+            plan->drb_strategy != DRB_DEFAULT || !plan->drb_expansion->selective ||
+            !bms_is_member(plan->drb_expansion->rti, changedExpansions))
+            continue;
+        if (!drillbeyond_measured_strategy_costs(expandState, op, runs, &omega_ms, &default_ms))
+            continue;
+        elog(DEBUG1, "%s: %.0f more runs, default %f ms, placeholder %f ms",
+             plan->drb_expansion->keyword, runs, default_ms, omega_ms);
+        if (omega_ms >= default_ms)
+            continue;
+
+        plan->drb_strategy = DRB_PLACEHOLDER;
+        expandPlan->drb_strategy = DRB_EXPAND2;
+        expandState->materialized = false;
+        tuplestore_clear(expandState->tupstore);
+    }
+}
+
+/*
+ * Orders the candidates of the operator for DRB_TOP, see drb_candidate_order.
+ * The EA service returns its candidates best first. By selectivity, those
+ * that select the most tuples come first, so that a query cut off by
+ * drb_max_variants or drb_variant_time_budget returns the fullest variants;
+ * ties keep the service's order. Candidates missing from the response are
+ * last.
+ */
+extern void drb_order_candidates(DrillBeyondState *node) {
+    DrillBeyondExpansion *expansion = ((DrillBeyond *) node->js.ps.plan)->drb_expansion;
+    int k = Max(drb_max_num_cands, 1);
+    int *order;
+    int i, j;
+
+    order = (int *) palloc(sizeof(int) * k);
+    for (i = 0; i < k; i++)
+        order[i] = i;
+
+    if (drb_candidate_order == DRB_ORDER_SELECTIVITY && expansion->selective &&
+        expansion->selectivities != NULL) {
+        int n = Min(node->db_num_cands, k);
+        // insertion sort, it is stable and k is small
+        for (i = 1; i < n; i++) {
+            int cand = order[i];
+            double sel = expansion->selectivities[cand];
+            for (j = i; j > 0 && expansion->selectivities[order[j - 1]] < sel; j--)
+                order[j] = order[j - 1];
+            order[j] = cand;
+        }
+    }
+    node->db_cand_order = order;
+}
+
+/*
+ * Candidate DRB_TOP visits at position rank.
+ */
+extern int drb_candidate_at(DrillBeyondState *node, int rank) {
+    if (node->db_cand_order == NULL)
+        return rank;
+    return node->db_cand_order[rank];
+}
+
+static bool candidate_is_null(DrillBeyondValues *vals, int cand) {
+    return cand >= vals->numValues || DRB_VALUE_IS_NULL(vals, cand);
+}
+
+/*
+ * Whether candidates a and b have the same value for every entity, within
+ * drb_candidate_dedup_tolerance.
+ */
+static bool candidates_agree(DrillBeyondHashTable *ht, int a, int b) {
+    DrillBeyondValues *vals;
+    uint32 pos = 0;
+
+    while ((vals = drb_iterateHashTable(ht, &pos)) != NULL) {
+        bool a_null = candidate_is_null(vals, a);
+        bool b_null = candidate_is_null(vals, b);
+        float8 x, y;
+
+        if (a_null || b_null) {
+            if (a_null != b_null)
+                return false;
+            continue;
+        }
+        x = vals->values[a];
+        y = vals->values[b];
+        if (x == y)
+            continue;
+        if (fabs(x - y) > drb_candidate_dedup_tolerance * Max(fabs(x), fabs(y)))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Candidate deduplication (drb_enable_candidate_dedup). Sources often agree,
+ * and variants of candidates with the same values for all entities of the
+ * operator return the same rows. Such candidates form a class, represented
+ * by its first candidate in db_cand_order; DRB_TOP runs variants only for
+ * representatives and reports their rows for the other candidates as well.
+ *
+ * Each candidate's value vector is fingerprinted first, so that exact
+ * duplicates are only compared in full if their fingerprints match. An
+ * operator whose entities may change between variants, because there is
+ * another DrillBeyond operator or a parameter below it, is not deduplicated.
+ * Neither are fanned-out ones, all their variants run in one pass anyway.
+ */
+extern void drb_dedup_candidates(DrillBeyondState *node) {
+    DrillBeyondExpansion *expansion = ((DrillBeyond *) node->js.ps.plan)->drb_expansion;
+    DrillBeyondHashTable *ht = expansion->results_hashtable;
+    DrillBeyondValues *vals;
+    List *nested = NIL;
+    int k = Max(drb_max_num_cands, 1);
+    uint32 *fingerprints;
+    int *class;
+    uint32 pos = 0;
+    int rank, other, cand, distinct = 0;
+
+    if (!drb_enable_candidate_dedup || expansion->fanout || ht == NULL || k == 1 ||
+        !bms_is_empty(node->js.ps.plan->extParam))
+        return;
+    drb_collect_drb_operator_states(outerPlanState(node), &nested);
+    if (nested != NIL) {
+        list_free(nested);
+        return;
+    }
+
+    fingerprints = (uint32 *) palloc0(sizeof(uint32) * k);
+    while ((vals = drb_iterateHashTable(ht, &pos)) != NULL) {
+        for (cand = 0; cand < k; cand++) {
+            uint32 h = 0;
+            if (!candidate_is_null(vals, cand))
+                h = DatumGetUInt32(hash_any((const unsigned char *) &vals->values[cand], sizeof(float8)));
+            fingerprints[cand] = ((fingerprints[cand] << 1) | (fingerprints[cand] >> 31)) ^ h;
+        }
+    }
+
+    class = (int *) palloc(sizeof(int) * k);
+    for (rank = 0; rank < k; rank++) {
+        cand = drb_candidate_at(node, rank);
+        class[cand] = cand;
+        for (other = 0; other < rank; other++) {
+            int rep = drb_candidate_at(node, other);
+            if (class[rep] != rep)
+                continue;
+            // near-duplicates hash differently
+            if (drb_candidate_dedup_tolerance <= 0.0 && fingerprints[rep] != fingerprints[cand])
+                continue;
+            if (candidates_agree(ht, rep, cand)) {
+                class[cand] = rep;
+                break;
+            }
+        }
+        if (class[cand] == cand)
+            distinct++;
+    }
+    pfree(fingerprints);
+
+    elog(DEBUG1, "%s: %d of %d candidates distinct", expansion->keyword, distinct, k);
+    if (distinct == k) {
+        pfree(class);
+        return;
+    }
+    node->db_cand_class = class;
+}
+
+extern bool drb_is_class_representative(DrillBeyondState *node, int cand) {
+    return node->db_cand_class == NULL || node->db_cand_class[cand] == cand;
+}
+
+extern int drb_num_distinct_candidates(DrillBeyondState *node) {
+    int k = Max(drb_max_num_cands, 1);
+    int cand, n = 0;
+
+    for (cand = 0; cand < k; cand++)
+        if (drb_is_class_representative(node, cand))
+            n++;
+    return n;
+}
+
+/*
+ * Moves the operator to its next candidate for DRB_TOP, skipping those that
+ * duplicate an earlier one. Returns false when it wraps around to the first.
+ */
+extern bool drb_advance_candidate(DrillBeyondState *node) {
+    int rank = node->db_current_rank;
+
+    do {
+        rank++;
+    } while (rank < drb_max_num_cands &&
+             !drb_is_class_representative(node, drb_candidate_at(node, rank)));
+    if (rank >= drb_max_num_cands)
+        rank = 0;
+    node->db_current_rank = rank;
+    node->db_current_origin = drb_candidate_at(node, rank);
+    return rank > 0;
+}
+
+/*
+ * Moves db_dup_origin to the next candidate of db_current_origin's class:
+ * the representative itself comes first, then the others by index. Returns
+ * false, and starts over at the representative, after the last one.
+ */
+extern bool drb_next_duplicate_candidate(DrillBeyondState *node) {
+    int rep = node->db_current_origin;
+    int cand;
+
+    if (node->db_cand_class != NULL) {
+        for (cand = node->db_dup_origin == rep ? 0 : node->db_dup_origin + 1;
+             cand < drb_max_num_cands; cand++) {
+            if (cand != rep && node->db_cand_class[cand] == rep) {
+                node->db_dup_origin = cand;
+                return true;
+            }
+        }
+    }
+    node->db_dup_origin = rep;
+    return false;
+}
+
+/*
+ * Candidate origin of vals as a Datum of the type of the open attribute.
+ * Candidates missing from a response with fewer candidates are NULL.
+ * Numeric values are allocated in the current memory context.
+ */
+extern Datum drb_candidate_value(DrillBeyondExpansion *exp, DrillBeyondValues *vals, int origin, bool *isnull)
+{
+    if (origin >= vals->numValues || DRB_VALUE_IS_NULL(vals, origin)) {
+        *isnull = true;
+        return (Datum) 0;
+    }
+    *isnull = false;
+    if (exp->valuetype == FLOAT8OID)
+        return Float8GetDatum(vals->values[origin]);
+    return DirectFunctionCall1(float8_numeric, Float8GetDatum(vals->values[origin]));
+}
+
+/*
+ * DRB_PLACEHOLDER passes a pointer to the DrillBeyondValues of a tuple in
+ * the open attribute, up to the Ω operator that expands it. The pointer is
+ * disguised as a value of the attribute's type, so nodes in between can copy
+ * it as usual.
+ */
+extern Datum drb_placeholder_datum(DrillBeyondExpansion *exp, DrillBeyondValues *vals)
+{
+    int64 ptr = (int64) (intptr_t) vals;
+    float8 bits;
+
+    if (exp->valuetype != FLOAT8OID)
+        return DirectFunctionCall1(int8_numeric, Int64GetDatum(ptr));
+    memcpy(&bits, &ptr, sizeof(bits));
+    return Float8GetDatum(bits);
+}
+
+extern DrillBeyondValues *drb_placeholder_values(DrillBeyondExpansion *exp, Datum datum)
+{
+    int64 ptr;
+    float8 bits;
+
+    if (exp->valuetype != FLOAT8OID)
+        return (DrillBeyondValues *) (intptr_t) DatumGetInt64(DirectFunctionCall1(numeric_int8, datum));
+    bits = DatumGetFloat8(datum);
+    memcpy(&ptr, &bits, sizeof(ptr));
+    return (DrillBeyondValues *) (intptr_t) ptr;
+}
+
+/*
+ * Flattens and hashes the join values of an outer tuple for the next batch.
+ */
+static void add_to_probe_batch(DrillBeyondState *node, TupleTableSlot *slot)
+{
+    DrillBeyond *plan = (DrillBeyond *) node->js.ps.plan;
+    MemoryContext oldcxt;
+    int i;
 
+    for (i = 0; i < node->num_join_cols; i++) {
+        Var *join_col_var = (Var*) list_nth(plan->drb_join_cols, i);
+        bool isnull;
+        Datum origattr = slot_getattr(slot, join_col_var->varattno, &isnull);
+        node->keys[i] = isnull ? 0 : origattr;
+    }
+    oldcxt = MemoryContextSwitchTo(node->db_batchCxt);
+    drb_makeHashKey(plan->drb_expansion, node->keys, &node->db_batchKeys[node->db_batchLen++]);
+    MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Adds the batch to the results hashtable and remembers the entries of its
+ * tuples, so that rescans of the tuplestore need not probe again.
+ */
+static void flush_probe_batch(DrillBeyondState *node)
+{
+    DrillBeyond *plan = (DrillBeyond *) node->js.ps.plan;
+    DrillBeyondValues *entries[DRB_PROBE_BATCH_SIZE];
+    bool found[DRB_PROBE_BATCH_SIZE];
+    int i;
+
+    if (node->db_batchLen == 0)
+        return;
+    drb_addBatchToHashTable(plan->drb_expansion, node->db_batchKeys, node->db_batchLen,
+                            entries, found);
+    for (i = 0; i < node->db_batchLen; i++) {
+        if (!found[i])
+            node->db_unsent_keys++;
+    }
+    remember_entries(node, entries, node->db_batchLen);
+    node->db_batchLen = 0;
+    MemoryContextReset(node->db_batchCxt);
+}
+
+/*
+ * Appends the entries of n more tuples. Like the tuplestore, they are kept
+ * in memory up to work_mem, the rest goes to a temporary file. Both are
+ * read in the same order, so the file is only ever read sequentially.
+ */
+static void remember_entries(DrillBeyondState *node, DrillBeyondValues **entries, int n)
+{
+    long maxMemEntries = Max(work_mem * 1024L / (long) sizeof(DrillBeyondValues *), 1024L);
+    int inMemory = 0;
+
+    if (node->db_memEntries == node->db_numEntries && node->db_memEntries < maxMemEntries) {
+        if (node->db_numEntries + n > node->db_maxEntries) {
+            if (node->db_entries == NULL) {
+                node->db_maxEntries = 1024;
+                node->db_entries = (DrillBeyondValues **) MemoryContextAlloc(node->js.ps.state->es_query_cxt,
+                                        sizeof(DrillBeyondValues *) * node->db_maxEntries);
+            } else {
+                node->db_maxEntries = (int) Min((long) node->db_maxEntries * 2, maxMemEntries);
+                node->db_entries = (DrillBeyondValues **) repalloc(node->db_entries,
+                                        sizeof(DrillBeyondValues *) * node->db_maxEntries);
+            }
+        }
+        inMemory = Min(n, node->db_maxEntries - node->db_memEntries);
+        memcpy(node->db_entries + node->db_memEntries, entries, sizeof(DrillBeyondValues *) * inMemory);
+        node->db_memEntries += inMemory;
+    }
+    if (inMemory < n) {
+        size_t len = sizeof(DrillBeyondValues *) * (n - inMemory);
+
+        if (node->db_entriesFile == NULL)
+            node->db_entriesFile = BufFileCreateTemp(false);
+        if (BufFileWrite(node->db_entriesFile, entries + inMemory, len) != len)
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not write to DrillBeyond temporary file: %m")));
+    }
+    node->db_numEntries += n;
+}
+
+/*
+ * Entry of the tuple at db_outerPos, NULL if it was not remembered.
+ */
+static DrillBeyondValues *remembered_entry(DrillBeyondState *node)
+{
+    DrillBeyondValues *entry;
+
+    if (node->db_outerPos >= node->db_numEntries)
+        return NULL;
+    if (node->db_outerPos < node->db_memEntries)
+        return node->db_entries[node->db_outerPos];
+
+    if (node->db_outerPos == node->db_memEntries &&
+        BufFileSeek(node->db_entriesFile, 0, 0L, SEEK_SET) != 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not rewind DrillBeyond temporary file: %m")));
+    if (BufFileRead(node->db_entriesFile, &entry, sizeof(entry)) != sizeof(entry))
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not read from DrillBeyond temporary file: %m")));
+    return entry;
+}
+
+/*
+ * Forgets the entries, when the tuplestore is emptied.
+ */
+static void forget_entries(DrillBeyondState *node)
+{
+    node->db_numEntries = 0;
+    node->db_memEntries = 0;
+    if (node->db_entriesFile != NULL)
+        BufFileClose(node->db_entriesFile);
+    node->db_entriesFile = NULL;
+}
+
+/*
+ * Semi-join of the stored outer tuples with the entities in the union of
+ * the candidates: once the responses are known, the tuples of all other
+ * entities can never pass, and are dropped from the tuplestore with their
+ * entries. Every later pass over the input, one per candidate with DRB_TOP,
+ * then reads only tuples that can pass.
+ */
+static void preselect_outer(DrillBeyondState *node)
+{
+    Tuplestorestate *input = node->tuplestorestate;
+    TupleTableSlot *slot = node->db_OuterTupleSlot;
+    BufFile *file = node->db_entriesFile;
+    int numEntries = node->db_numEntries;
+    int memEntries = node->db_memEntries;
+    int pos;
+
+    node->tuplestorestate = tuplestore_begin_heap(false, false, work_mem);
+    tuplestore_set_eflags(node->tuplestorestate, EXEC_FLAG_REWIND);
+    // kept entries are written over the memory ones already read, the
+    // file is read to the end before a new one is written
+    node->db_numEntries = 0;
+    node->db_memEntries = 0;
+    node->db_entriesFile = NULL;
+    if (file != NULL && BufFileSeek(file, 0, 0L, SEEK_SET) != 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not rewind DrillBeyond temporary file: %m")));
+
+    tuplestore_rescan(input);
+    for (pos = 0; pos < numEntries; pos++) {
+        DrillBeyondValues *entry;
+
+        if (!tuplestore_gettupleslot(input, true, false, slot))
+            break;
+        if (pos < memEntries)
+            entry = node->db_entries[pos];
+        else if (BufFileRead(file, &entry, sizeof(entry)) != sizeof(entry))
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not read from DrillBeyond temporary file: %m")));
+        if (!entry->inUnion)
+            continue;
+        tuplestore_puttupleslot(node->tuplestorestate, slot);
+        remember_entries(node, &entry, 1);
+    }
+    ExecClearTuple(slot);
+    tuplestore_end(input);
+    if (file != NULL)
+        BufFileClose(file);
+}
+
+/*
+ * Phase 1: stores all outer tuples and adds their join values to the results
+ * hashtable. With streaming, batches of new join values are sent meanwhile.
+ */
+static void collect_outer(DrillBeyondState *node)
+{
+    PlanState *outerPlan = outerPlanState(node);
+    TupleTableSlot *outerTupleSlot;
+    DrillBeyondExpansion *expansion = ((DrillBeyond *) node->js.ps.plan)->drb_expansion;
+
+    if (node->tuplestorestate == NULL) {
+        node->tuplestorestate = tuplestore_begin_heap(false, false, work_mem);
+        tuplestore_set_eflags(node->tuplestorestate, EXEC_FLAG_REWIND);
+    }
+    InstrStartNode(node->db_fragment_instr);
+
+    for (;;)
+    {
+        // printf("scanning outer plan, filling tuplestore\n");
+        outerTupleSlot = ExecProcNode(outerPlan);                   //exec node to get tuple
+        if (TupIsNull(outerTupleSlot))
+            break;
+        tuplestore_puttupleslot(node->tuplestorestate, outerTupleSlot);
+        add_to_probe_batch(node, outerTupleSlot);                   //build request data
+        if (node->db_batchLen < DRB_PROBE_BATCH_SIZE)
+            continue;
+        flush_probe_batch(node);
+
+        // streaming: send a batch as soon as enough new join values were seen,
+        // and merge whatever responses arrived in the meantime
+        if (drb_enable_streaming) {
+            if (node->db_unsent_keys >= drb_request_batch_size)
+                drillbeyond_stream_batch(node);
+            else if (node->db_inflight_batches > 0)
+                drillbeyond_poll_requests(node, false);
+        }
+    }
+    flush_probe_batch(node);
+
+    InstrStopNode(node->db_fragment_instr, node->db_numEntries);
+    expansion->actual_rows = node->db_numEntries;
+    expansion->actual_fragment_ms = INSTR_TIME_GET_MILLISEC(node->db_fragment_instr->counter);
+    InstrEndLoop(node->db_fragment_instr);
+}
+
+/*
+ * Runs phase 1 and sends all requests of the operator without waiting for
+ * the responses, which arrive while other operators do the same. The next
+ * ExecDrillBeyond only waits for what is still in flight.
+ */
+extern void drillbeyond_dispatch(DrillBeyondState *node)
+{
+    if (node->db_fetchedResult || node->db_dispatched)
+        return;
+    collect_outer(node);
+    drillbeyond_stream_batch(node);
+    node->db_dispatched = true;
+}
+
+/*
+ * Delta fan-out: the first candidate from origin on that is emitted, which
+ * is the first candidate itself or one whose value differs from it.
+ */
+static int next_changed_candidate(DrillBeyondValues *vals, int origin) {
+    bool base_null = vals->numValues < 1 || DRB_VALUE_IS_NULL(vals, 0);
+    bool cand_null;
+
+    if (origin == 0)
+        return 0;
+    for (; origin < drb_max_num_cands; origin++) {
+        cand_null = origin >= vals->numValues || DRB_VALUE_IS_NULL(vals, origin);
+        if (cand_null != base_null || (!cand_null && vals->values[origin] != vals->values[0]))
+            break;
+    }
+    return origin;
+}
+
+/*
+ * Times each call under EXPLAIN ANALYZE, for the time per candidate. The
+ * call that runs phase 1 is not attributed to a candidate, its time is that
+ * of the requests.
+ */
 TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
+{
+    DrillBeyondInstrumentation *instr = node->db_instr;
+    TupleTableSlot *result;
+    instr_time start;
+    int origin;
+
+    if (node->js.ps.instrument == NULL || !node->js.ps.instrument->need_timer ||
+        !node->db_fetchedResult || instr == NULL)
+        return drillbeyond_next(node);
+
+    if (!((DrillBeyond *) node->js.ps.plan)->drb_expansion->fanout)
+        origin = node->db_current_origin;
+    else
+        origin = node->db_NeedNewOuter ? 0 : node->db_fanout_origin;
+    INSTR_TIME_SET_CURRENT(start);
+    result = drillbeyond_next(node);
+    if (origin >= 0 && origin < instr->num_cands)
+        instr->cand_ms[origin] += drillbeyond_elapsed_ms(start);
+    return result;
+}
+
+static TupleTableSlot *drillbeyond_next(DrillBeyondState *node)
 {
     DrillBeyond *plan;
     PlanState   *innerPlan;
-    PlanState   *outerPlan;
     TupleTableSlot *outerTupleSlot;
     TupleTableSlot *innerTupleSlot;
     List       *joinqual;
@@ -312,9 +915,11 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
     DrillBeyondExpansion *expansion;
     int i;
     int attno;
+    int origin;
     Datum origattr;
     Datum value;
     bool isnull;
+    bool retract;
 
     /*
      * get information from the node
@@ -323,7 +928,6 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
     otherqual = node->js.ps.qual;
     plan = (DrillBeyond *) node->js.ps.plan;
     expansion = plan->drb_expansion;
-    outerPlan = outerPlanState(node);
     innerPlan = innerPlanState(node);
     econtext = node->js.ps.ps_ExprContext;
     inner_econtext = innerPlan->ps_ExprContext;
@@ -331,47 +935,42 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
     drb_quals = node->db_qual;
 
     if (!node->db_fetchedResult) {
-        json_object *msg = NULL;                                        //request data
-        const char *msg_str;
         int request_err;
-        bool req_necessary;
         // phase 1: collect all tuples
-		if (msg == NULL) {
-			msg = initDrillBeyondRequest(plan->drb_expansion);
-            add_restrictions_to_msg(msg, plan->drb_expansion->drb_qual);                        //add qualisfiers (?)
-        }
-
-        if (node->tuplestorestate == NULL) {
-            node->tuplestorestate = tuplestore_begin_heap(false, false, work_mem);
-            tuplestore_set_eflags(node->tuplestorestate, EXEC_FLAG_REWIND);
-        }
-
-        for (;;)
-        {
-            // printf("scanning outer plan, filling tuplestore\n");
-            outerTupleSlot = ExecProcNode(outerPlan);                   //exec node to get tuple
-            if (TupIsNull(outerTupleSlot))
-                break;
-            tuplestore_puttupleslot(node->tuplestorestate, outerTupleSlot);
-            tup_to_json(plan->drb_expansion, plan->drb_join_cols, outerTupleSlot, msg);      //build request data
-        }
-
-        req_necessary = drillbeyond_fill_msg(plan->drb_expansion, msg); //look for open attributes (?)
-
-        if (req_necessary) {                                            //open attributes available -> request
-            msg_str = json_object_to_json_string_ext(msg, JSON_C_TO_STRING_PLAIN);  //convert request data to string
-            request_err = drillbeyond_request(msg_str, node);//drillbeyond_request(msg_str, node);           //do the request
+        if (node->db_dispatched) {
+            // scanned and sent ahead by drb_top, only the responses are missing
+            drillbeyond_poll_requests(node, true);
+            node->db_dispatched = false;
+        } else if (drb_enable_streaming) {
+            collect_outer(node);
+            drillbeyond_stream_batch(node);                             // the remainder
+            drillbeyond_poll_requests(node, true);
+        } else {
+            collect_outer(node);
+            request_err = drillbeyond_request(node);                   //request all open join values
             if (request_err) {
                  ereport(ERROR,
                     (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
                         errmsg("Can't get a response from DrillBeyond server")
                     ));
             }
-            json_object_put(msg); // refcounting: "put" is the strange name for "release" that libjson uses
         }
         node->db_fetchedResult = true;
+        if (expansion->results_hashtable != NULL)
+            expansion->actual_distinct = expansion->results_hashtable->numEntries;
+        if (drb_enable_preselection && expansion->union_selectivity < 1.0)
+            preselect_outer(node);
 
         tuplestore_rescan(node->tuplestorestate);
+        node->db_outerPos = 0;
+
+        // the first response decides the order of the candidates, later ones
+        // must not reorder them while DRB_TOP is iterating
+        if (node->db_cand_order == NULL) {
+            drb_order_candidates(node);
+            drb_dedup_candidates(node);
+            node->db_current_origin = drb_candidate_at(node, node->db_current_rank);
+        }
 
         // now that selectivities are known, reconsider the strategy (PLACEHOLDER VS. DEFAULT)
         PlannedStmt *reoptimized_plan = reconsiderStrategy(node);
@@ -428,18 +1027,23 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
             // print_slot(outerTupleSlot);
             /*
              * we have an outerTuple, try to get the next inner tuple.
-             * first hash the outertuples join attributes
+             * its entry was remembered when it was collected, only a
+             * tuplestore taken over from another plan needs to be probed
              */
-            for (i = 0; i < node->num_join_cols; i++) {
-                Var *join_col_var = (Var*) list_nth(plan->drb_join_cols, i);
-                attno = join_col_var->varattno;
-                origattr = slot_getattr(outerTupleSlot, attno, &isnull);
-                if (isnull)
-                    node->keys[i] = 0;
-                else
-                    node->keys[i] = origattr;
+            node->db_current_values = remembered_entry(node);
+            if (node->db_current_values == NULL) {
+                for (i = 0; i < node->num_join_cols; i++) {
+                    Var *join_col_var = (Var*) list_nth(plan->drb_join_cols, i);
+                    attno = join_col_var->varattno;
+                    origattr = slot_getattr(outerTupleSlot, attno, &isnull);
+                    if (isnull)
+                        node->keys[i] = 0;
+                    else
+                        node->keys[i] = origattr;
+                }
+                node->db_current_values = drb_retrieveFromHashTable(expansion, node->keys);
             }
-            node->db_current_values = drb_retrieveFromHashTable(expansion, node->keys);
+            node->db_outerPos++;
             // preselection of those values that are outside the union of candidates
             if (drb_enable_preselection) {
                 if (!node->db_current_values->inUnion) {
@@ -447,25 +1051,44 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
                 }
             }
             node->db_NeedNewOuter = false;
+            node->db_fanout_origin = 0;
+            node->db_fanout_retracted = false;
+        }
+
+        // in fan-out mode, each outer tuple is emitted once per candidate.
+        // In delta mode, only the first candidate and those that differ from
+        // it are, each of the latter preceded by a retraction: the first
+        // candidate's value tagged with the negated id.
+        if (expansion->fanout_delta && !node->db_fanout_retracted) {
+            node->db_fanout_origin = next_changed_candidate(node->db_current_values, node->db_fanout_origin);
+            if (node->db_fanout_origin >= drb_max_num_cands) {
+                node->db_NeedNewOuter = true;
+                continue;
+            }
         }
+        origin = expansion->fanout ? node->db_fanout_origin : node->db_current_origin;
+        retract = expansion->fanout_delta && origin > 0 && !node->db_fanout_retracted;
 
         econtext->ecxt_innertuple = innerTupleSlot;
         inner_econtext->ecxt_innertuple = innerTupleSlot;
 
         ExecClearTuple(innerTupleSlot);
         if (plan->drb_strategy == DRB_DEFAULT) {
-            isnull = node->db_current_values->is_null[node->db_current_origin];
-            value = node->db_current_values->values[node->db_current_origin];
+            MemoryContext oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+            value = drb_candidate_value(expansion, node->db_current_values, retract ? 0 : origin, &isnull);
+            MemoryContextSwitchTo(oldcxt);
         } else if (plan->drb_strategy == DRB_PLACEHOLDER) {
+            MemoryContext oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
             isnull = false;
-            // value = PointerGetDatum(node->db_current_values); // EVIL HACK
-            // value = node->db_current_values->values[node->db_current_origin];
-            // value = node->db_current_values->context;
-            Datum ptr = PointerGetDatum(node->db_current_values);
-            value = DirectFunctionCall1(int8_numeric, ptr);
+            value = drb_placeholder_datum(expansion, node->db_current_values);
+            MemoryContextSwitchTo(oldcxt);
         }
         innerTupleSlot->tts_isnull[node->db_valueColIdx] = isnull; // ltype is never null
         innerTupleSlot->tts_values[node->db_valueColIdx] = value;
+        if (node->db_idColIdx >= 0) {
+            innerTupleSlot->tts_isnull[node->db_idColIdx] = false;
+            innerTupleSlot->tts_values[node->db_idColIdx] = Int64GetDatum(retract ? -origin : origin);
+        }
         ExecStoreVirtualTuple(innerTupleSlot);
 
         // node->db_current_origin++;
@@ -474,7 +1097,13 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
         //     node->db_NeedNewOuter = true;
         // }
 
-        node->db_NeedNewOuter = true;
+        if (retract)
+            node->db_fanout_retracted = true;
+        else if (expansion->fanout) {
+            node->db_fanout_retracted = false;
+            node->db_NeedNewOuter = ++node->db_fanout_origin >= drb_max_num_cands;
+        } else
+            node->db_NeedNewOuter = true;
 
         // printf("new inner tuple\n");
         // print_slot(innerTupleSlot);
@@ -497,6 +1126,8 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
                 {
                     node->js.ps.ps_TupFromTlist =
                         (isDone == ExprMultipleResult);
+                    if (node->db_instr != NULL && origin < node->db_instr->num_cands)
+                        node->db_instr->cand_rows[origin]++;
                     return result;
                 }
             }
@@ -508,6 +1139,8 @@ TupleTableSlot *ExecDrillBeyond(DrillBeyondState *node)
 
 void ExecEndDrillBeyond(DrillBeyondState *node)
 {
+    drillbeyond_report_stats(node);
+
     /*
      * Free the exprcontext
      */
@@ -521,6 +1154,10 @@ void ExecEndDrillBeyond(DrillBeyondState *node)
     if (node->tuplestorestate != NULL)
         tuplestore_end(node->tuplestorestate);
     node->tuplestorestate = NULL;
+    forget_entries(node);
+
+    if (node->db_inflight_batches > 0)
+        drillbeyond_cancel_requests(node);
 
 
     /*
@@ -549,22 +1186,30 @@ void ExecReScanDrillBeyond(DrillBeyondState *node)
     node->db_NeedNewOuter = true;
     // a drb_reset leaves subnodes untouched and does not fetch new results
     // printf("Drillbeyond (%s) Rescan!\n", db->drb_expansion->keyword);
-    if (bms_is_member(128, node->js.ps.chgParam)) {
+    if (drb_candidate_rescan(&node->js.ps)) {
         // printf("Drillbeyond (%s) Rescan by DRB mechanism (now candiate %d)!\n", db->drb_expansion->keyword, node->db_current_origin);
-        if (bms_is_member(128, outerPlan->chgParam)) {
+        if (node->db_instr != NULL)
+            node->db_instr->rescans++;
+        if (outerPlan->chgParam != NULL) {
             // printf("  Deeper plan rescans!\n");
             tuplestore_clear(node->tuplestorestate);
+            forget_entries(node);
             node->db_fetchedResult = false;
+            node->db_dispatched = false; // batches still in flight are waited for anyway
         } else {
             // printf("  Deeper plans are invariant!\n");
             tuplestore_rescan(node->tuplestorestate);
         }
+        node->db_outerPos = 0;
         return;
     }
     // printf("Drillbeyond (%s) Rescan by normal mechanism!\n", db->drb_expansion->keyword);
     node->db_fetchedResult = false;
+    node->db_dispatched = false;
     if (node->tuplestorestate != NULL)
         tuplestore_clear(node->tuplestorestate);
+    forget_entries(node);
+    node->db_outerPos = 0;
 
     // normal rescan, e.g. in subquery
     // What does the above mean? Don't know anymore
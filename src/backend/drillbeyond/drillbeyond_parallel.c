@@ -0,0 +1,414 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_parallel.c
+ *    Process-parallel execution of DRB_TOP's result variants.
+ *
+ * DRB_TOP runs one variant after the other, each a rescan of the whole plan
+ * with other candidates. With drb_parallel_workers > 0, the backend running
+ * a statement (the leader) starts that many worker backends and divides the
+ * variants among them: every backend runs the variants whose number modulo
+ * the number of backends is its own index, and only advances the candidates
+ * for the others. The leader returns its own rows and those of the workers,
+ * as they arrive.
+ *
+ * The workers are ordinary backends, the leader connects to them as a
+ * client through the module libpqdrillbeyond, and sends them the statement
+ * text with a snapshot it exported, so all backends see the same data. They
+ * get the settings of the leader's session, which keeps their plans, and so
+ * the order of the variants, the same. Their index and count are passed
+ * as connection options, so no other session can set them. Every backend
+ * must get the same candidates for the variants to add up, so statements
+ * only run in parallel with drb_enable_result_cache: the leader asks the
+ * EA service for the first variant, and the workers read its answers from
+ * the cache. A worker never asks the service itself, a join value it can't
+ * answer from the cache fails the statement. If the leader can't connect
+ * to a worker, it runs the statement alone.
+ *
+ * Only read-only SELECT statements without parameters, at the top of the
+ * plan, run in parallel; so do not those that report or cut off variants
+ * (drb_enable_variant_notices, drb_variant_time_budget), or reoptimize.
+ * Rows of different variants are interleaved, those of each variant keep
+ * their order.
+ *
+ * src/backend/drillbeyond/drillbeyond_parallel.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/transam.h"
+#include "access/xact.h"
+#include "commands/dbcommands.h"
+#include "drillbeyond/drillbeyond.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/parsenodes.h"
+#include "parser/parser.h"
+#include "postmaster/postmaster.h"
+#include "tcop/pquery.h"
+#include "utils/builtins.h"
+#include "utils/guc_tables.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+int drb_parallel_workers = 0;
+char *drb_parallel_conninfo = NULL;
+int drb_worker_index = 0;
+int drb_worker_count = 0;
+
+drb_worker_connect_type drb_worker_connect = NULL;
+drb_worker_exec_type drb_worker_exec = NULL;
+drb_worker_send_query_type drb_worker_send_query = NULL;
+drb_worker_next_row_type drb_worker_next_row = NULL;
+drb_worker_wait_type drb_worker_wait = NULL;
+drb_worker_disconnect_type drb_worker_disconnect = NULL;
+
+typedef struct DrillBeyondWorkers {
+    int num_workers;
+    void **conns;
+    bool *done;
+    int next; // worker asked first for the next row
+    int natts; // columns sent by the workers
+    AttrNumber *attnos; // result slot column of each of them
+    FmgrInfo *infuncs;
+    Oid *ioparams;
+    int32 *typmods;
+    char **values;
+} DrillBeyondWorkers;
+
+// connections of all operators, closed at the end of the transaction at the
+// latest, in TopMemoryContext
+static List *open_workers = NIL;
+static bool callback_registered = false;
+
+static bool parallel_eligible(DrillBeyondExpandState *node);
+static char *worker_conninfo(int index, int count);
+static void append_conninfo_value(StringInfo buf, const char *keyword, const char *value);
+static void append_session_settings(StringInfo buf);
+static void setup_worker_columns(DrillBeyondExpandState *node, DrillBeyondWorkers *workers);
+static void disconnect_worker(void *conn);
+static void parallel_xact_callback(XactEvent event, void *arg);
+
+/*
+ * Whether the statement of node can be divided among worker backends.
+ */
+static bool parallel_eligible(DrillBeyondExpandState *node) {
+    DrillBeyondExpand *plan = (DrillBeyondExpand *) node->ps.plan;
+    EState *estate = node->ps.state;
+    PlannedStmt *stmt;
+    List *parsetree;
+    ListCell *lc;
+
+    if (drb_parallel_workers <= 0 || drb_worker_count > 0)
+        return false;
+    // the workers must get the leader's candidates from the cache, asking
+    // the EA service again may give others and multiplies its load
+    foreach(lc, plan->drb_all_expansions) {
+        if (!drillbeyond_cache_enabled((DrillBeyondExpansion *) lfirst(lc)))
+            return false;
+    }
+    if (plan->drb_fanout || node->total_permutations <= 1)
+        return false;
+    if (drb_enable_variant_notices || drb_variant_time_budget > 0 || drb_enable_reoptimization)
+        return false;
+
+    // the workers must run the same statement: this one, and all of it
+    stmt = estate->es_plannedstmt;
+    if (stmt == NULL || stmt->planTree != (Plan *) plan || stmt->commandType != CMD_SELECT ||
+        stmt->hasModifyingCTE || stmt->rowMarks != NIL || estate->es_param_list_info != NULL)
+        return false;
+    if (ActivePortal == NULL || ActivePortal->sourceText == NULL ||
+        list_length(ActivePortal->stmts) != 1 || linitial(ActivePortal->stmts) != (Node *) stmt)
+        return false;
+    parsetree = raw_parser(ActivePortal->sourceText);
+    if (list_length(parsetree) != 1 || !IsA(linitial(parsetree), SelectStmt))
+        return false;
+
+    // the workers could not see the changes of this transaction
+    if (IsSubTransaction() || TransactionIdIsValid(GetTopTransactionIdIfAny()))
+        return false;
+    return true;
+}
+
+/*
+ * Connection string to this server, as the current user, for worker index of
+ * count backends. drb_parallel_conninfo follows, so it overrides any of these
+ * settings or adds a password, except for options, which carry the worker's
+ * part.
+ */
+static char *worker_conninfo(int index, int count) {
+    StringInfoData buf;
+    char port[16];
+    char options[64];
+
+    initStringInfo(&buf);
+    snprintf(port, sizeof(port), "%d", PostPortNumber);
+    append_conninfo_value(&buf, "port", port);
+#ifdef HAVE_UNIX_SOCKETS
+    append_conninfo_value(&buf, "host",
+        (UnixSocketDir != NULL && UnixSocketDir[0] != '\0') ? UnixSocketDir : DEFAULT_PGSOCKET_DIR);
+#endif
+    append_conninfo_value(&buf, "dbname", get_database_name(MyDatabaseId));
+    append_conninfo_value(&buf, "user", GetUserNameFromId(GetUserId()));
+    append_conninfo_value(&buf, "application_name", "drillbeyond worker");
+    if (drb_parallel_conninfo != NULL)
+        appendStringInfoString(&buf, drb_parallel_conninfo);
+    snprintf(options, sizeof(options), "-c drb_worker_index=%d -c drb_worker_count=%d", index, count);
+    appendStringInfoString(&buf, " ");
+    append_conninfo_value(&buf, "options", options);
+    return buf.data;
+}
+
+static void append_conninfo_value(StringInfo buf, const char *keyword, const char *value) {
+    const char *p;
+
+    appendStringInfo(buf, "%s='", keyword);
+    for (p = value; *p; p++) {
+        if (*p == '\'' || *p == '\\')
+            appendStringInfoChar(buf, '\\');
+        appendStringInfoChar(buf, *p);
+    }
+    appendStringInfoString(buf, "' ");
+}
+
+/*
+ * SET commands for the settings of this session that the workers would not
+ * have by themselves: those set by the client, at connection start or later.
+ * Settings of the database and the user apply to the workers anyway.
+ */
+static void append_session_settings(StringInfo buf) {
+    struct config_generic **vars = get_guc_variables();
+    int num_vars = GetNumConfigOptions();
+    int i;
+
+    for (i = 0; i < num_vars; i++) {
+        struct config_generic *var = vars[i];
+        const char *value;
+
+        if (var->context != PGC_USERSET || (var->flags & GUC_NO_RESET_ALL))
+            continue;
+        if (var->source != PGC_S_CLIENT && var->source != PGC_S_SESSION)
+            continue;
+        // the rows are read in the server encoding
+        if (pg_strcasecmp(var->name, "client_encoding") == 0 ||
+            pg_strcasecmp(var->name, "application_name") == 0 ||
+            pg_strncasecmp(var->name, "drb_parallel_", 13) == 0 ||
+            pg_strncasecmp(var->name, "drb_worker_", 11) == 0)
+            continue;
+        value = GetConfigOption(var->name, true, false);
+        if (value == NULL)
+            continue;
+        appendStringInfo(buf, "SET %s TO %s; ", quote_identifier(var->name), quote_literal_cstr(value));
+    }
+    // floats must survive the trip through text
+    appendStringInfoString(buf, "SET extra_float_digits TO 3; ");
+}
+
+/*
+ * The workers send the statement's visible columns as text, which become the
+ * non-junk columns of DRB_TOP's result slot.
+ */
+static void setup_worker_columns(DrillBeyondExpandState *node, DrillBeyondWorkers *workers) {
+    TupleDesc tupdesc = node->ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+    ListCell *lc;
+    int n = 0;
+
+    workers->attnos = (AttrNumber *) palloc(sizeof(AttrNumber) * tupdesc->natts);
+    workers->infuncs = (FmgrInfo *) palloc(sizeof(FmgrInfo) * tupdesc->natts);
+    workers->ioparams = (Oid *) palloc(sizeof(Oid) * tupdesc->natts);
+    workers->typmods = (int32 *) palloc(sizeof(int32) * tupdesc->natts);
+    foreach(lc, node->ps.plan->targetlist) {
+        TargetEntry *tle = (TargetEntry *) lfirst(lc);
+        Form_pg_attribute attr = tupdesc->attrs[tle->resno - 1];
+        Oid infunc;
+
+        if (tle->resjunk)
+            continue;
+        workers->attnos[n] = tle->resno;
+        getTypeInputInfo(attr->atttypid, &infunc, &workers->ioparams[n]);
+        fmgr_info(infunc, &workers->infuncs[n]);
+        workers->typmods[n] = attr->atttypmod;
+        n++;
+    }
+    workers->natts = n;
+    workers->values = (char **) palloc0(sizeof(char *) * Max(n, 1));
+}
+
+/*
+ * Starts the workers for node, if its statement can use them. Called once,
+ * when DRB_TOP returns its first row.
+ */
+extern void drillbeyond_start_workers(DrillBeyondExpandState *node) {
+    DrillBeyondWorkers *workers;
+    StringInfoData setup;
+    char *snapshot;
+    int i;
+
+    if (!parallel_eligible(node))
+        return;
+
+    load_file("libpqdrillbeyond", false);
+    if (drb_worker_connect == NULL)
+        elog(ERROR, "libpqdrillbeyond didn't initialize correctly");
+    if (!callback_registered) {
+        RegisterXactCallback(parallel_xact_callback, NULL);
+        callback_registered = true;
+    }
+
+    workers = (DrillBeyondWorkers *) palloc0(sizeof(DrillBeyondWorkers));
+    workers->num_workers = Min(drb_parallel_workers, node->total_permutations - 1);
+    workers->conns = (void **) palloc0(sizeof(void *) * workers->num_workers);
+    workers->done = (bool *) palloc0(sizeof(bool) * workers->num_workers);
+
+    for (i = 0; i < workers->num_workers; i++) {
+        MemoryContext oldcontext;
+        char *conninfo = worker_conninfo(i + 1, workers->num_workers + 1);
+        void *conn = drb_worker_connect(conninfo);
+
+        pfree(conninfo);
+        if (conn == NULL) {
+            // run serially, the variants are not divided yet
+            while (--i >= 0)
+                disconnect_worker(workers->conns[i]);
+            pfree(workers->conns);
+            pfree(workers->done);
+            pfree(workers);
+            return;
+        }
+
+        oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+        open_workers = lappend(open_workers, conn);
+        MemoryContextSwitchTo(oldcontext);
+        workers->conns[i] = conn;
+    }
+    setup_worker_columns(node, workers);
+
+    snapshot = TextDatumGetCString(DirectFunctionCall1(pg_export_snapshot, (Datum) 0));
+    initStringInfo(&setup);
+    for (i = 0; i < workers->num_workers; i++) {
+        void *conn = workers->conns[i];
+
+        resetStringInfo(&setup);
+        append_session_settings(&setup);
+        appendStringInfoString(&setup, "SET drb_parallel_workers TO 0");
+        drb_worker_exec(conn, setup.data);
+        drb_worker_exec(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+        resetStringInfo(&setup);
+        appendStringInfo(&setup, "SET TRANSACTION SNAPSHOT %s", quote_literal_cstr(snapshot));
+        drb_worker_exec(conn, setup.data);
+        drb_worker_send_query(conn, ActivePortal->sourceText);
+    }
+    pfree(setup.data);
+
+    // the leader runs the first variant, and every num_workers + 1th
+    node->part_index = 0;
+    node->part_count = workers->num_workers + 1;
+    node->workers = workers;
+}
+
+/*
+ * Called by a worker with the join values it could not answer from the
+ * cache. The leader's answers were evicted, expired or never cached (join
+ * values too long for a cache key, or too many candidates); asking the EA
+ * service again could give other candidates than the leader's.
+ */
+extern void drillbeyond_worker_cache_miss(List *entries) {
+    ereport(ERROR,
+        (errcode(ERRCODE_DRILLBEYOND_WORKER_FAILED),
+        errmsg("DrillBeyond worker %d found %d join values not in the result cache",
+               drb_worker_index, list_length(entries)),
+        errhint("Increase drb_result_cache_size or drb_result_cache_ttl, or set drb_parallel_workers to 0.")
+        ));
+}
+
+/*
+ * Next row of any of the workers, in DRB_TOP's result slot. Returns NULL if
+ * none is there yet and wait is false, or once all workers are done.
+ */
+extern TupleTableSlot *drillbeyond_worker_row(DrillBeyondExpandState *node, bool wait) {
+    DrillBeyondWorkers *workers = node->workers;
+    ExprContext *econtext = node->ps.ps_ExprContext;
+    TupleTableSlot *resultslot = node->ps.ps_ResultTupleSlot;
+    MemoryContext oldcontext;
+    int i, j;
+
+    ResetExprContext(econtext);
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+    for (;;) {
+        bool pending = false;
+
+        for (i = 0; i < workers->num_workers; i++) {
+            int w = (workers->next + i) % workers->num_workers;
+            int ret;
+
+            if (workers->done[w])
+                continue;
+            ret = drb_worker_next_row(workers->conns[w], false, workers->natts, workers->values);
+            if (ret < 0) {
+                workers->done[w] = true;
+                continue;
+            }
+            pending = true;
+            if (ret == 0)
+                continue;
+
+            ExecClearTuple(resultslot);
+            for (j = 0; j < resultslot->tts_tupleDescriptor->natts; j++)
+                resultslot->tts_isnull[j] = true;
+            for (j = 0; j < workers->natts; j++) {
+                int attno = workers->attnos[j] - 1;
+                resultslot->tts_values[attno] = InputFunctionCall(&workers->infuncs[j], workers->values[j],
+                                                                  workers->ioparams[j], workers->typmods[j]);
+                resultslot->tts_isnull[attno] = (workers->values[j] == NULL);
+            }
+            workers->next = (w + 1) % workers->num_workers;
+            MemoryContextSwitchTo(oldcontext);
+            return ExecStoreVirtualTuple(resultslot);
+        }
+        if (!pending || !wait)
+            break;
+        drb_worker_wait(workers->conns, workers->num_workers);
+    }
+    MemoryContextSwitchTo(oldcontext);
+    return NULL;
+}
+
+/*
+ * Whether this backend runs the current variant of node.
+ */
+extern bool drillbeyond_variant_is_mine(DrillBeyondExpandState *node) {
+    return node->part_count <= 1 || node->current_origin % node->part_count == node->part_index;
+}
+
+/*
+ * Closes the connections to the workers of node, which ends their
+ * transactions, finished or not.
+ */
+extern void drillbeyond_end_workers(DrillBeyondExpandState *node) {
+    int i;
+
+    if (node->workers == NULL)
+        return;
+    for (i = 0; i < node->workers->num_workers; i++)
+        disconnect_worker(node->workers->conns[i]);
+    node->workers = NULL;
+}
+
+static void disconnect_worker(void *conn) {
+    if (!list_member_ptr(open_workers, conn))
+        return;
+    open_workers = list_delete_ptr(open_workers, conn);
+    drb_worker_disconnect(conn);
+}
+
+/*
+ * Workers of statements that failed, or portals that were not run to the
+ * end, go with the transaction.
+ */
+static void parallel_xact_callback(XactEvent event, void *arg) {
+    if (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT && event != XACT_EVENT_PREPARE)
+        return;
+    while (open_workers != NIL)
+        disconnect_worker(linitial(open_workers));
+}
@@ -1,11 +1,14 @@
 #include "postgres.h"
 #include "miscadmin.h"
 #include "drillbeyond/drillbeyond.h"
+#include "catalog/pg_aggregate.h"
 #include "catalog/pg_type.h"
+#include "executor/nodeAgg.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/var.h"
 #include "optimizer/planmain.h"
 #include "optimizer/tlist.h"
+#include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "parser/parsetree.h"
 #include "parser/parse_clause.h"
@@ -19,12 +22,14 @@
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "utils/hsearch.h"
+#include "utils/selfuncs.h"
 
 
 // optimizations
 bool drb_enable_basic_cache = true;
 bool drb_enable_rewind_cache = true;
 bool drb_enable_additional_cache = true;
+bool drb_enable_rescan_cache = true;
 bool drb_enable_big_omega = true;
 bool drb_enable_send_isnumeric_constraint = false;
 bool drb_enable_pull_up_selection = false;
@@ -39,6 +44,8 @@ int drb_cost_model = 1;
 bool drb_enable_reoptimization = false;
 bool drb_enable_preselection = false;
 bool drb_enable_static_reoptimization = false;
+bool drb_enable_fanout = false;
+bool drb_enable_delta_aggregation = false;
 
 
 bool drb_enable_compress = true;
@@ -72,6 +79,22 @@ typedef struct
     List       *varlist;
 } pull_drb_var_clause_context;
 
+typedef struct
+{
+    PlannerInfo *root;
+    Bitmapset *used;        // ids of the Params referenced
+    List *params;           // the first Param seen for each of them
+    Bitmapset *set;         // ids of the Params set inside the subtree
+    bool volatile_funcs;
+    bool unknown;           // met a node we can't look into
+} plan_params_context;
+
+typedef struct
+{
+    PlannerInfo *root;
+    double calls;
+} cache_subplans_context;
+
 static void setupExpansionExecution(PlannerInfo *root, DrillBeyondExpansion *exp);
 static void set_sorting(List *expansions, Index varno);
 static void set_aggregative(List *expansions, Index varno);
@@ -86,11 +109,208 @@ extern DrillBeyondExpansion* find_expansion(List *expansions, int varno);
 
 
 static void save_query(PlannerInfo *root);
-
-extern void drillbeyond_planner_phase_zero(Query *q) {
+static bool fanout_applicable(Query *q);
+static bool has_ordered_aggs_walker(Node *node, void *context);
+static void drb_prepare_fanout(Query *q);
+static void drb_setup_fanout_agg(PlannerInfo *root, Plan *plan);
+static bool has_non_invertible_aggs_walker(Node *node, void *context);
+static bool plan_params_expr_walker(Node *node, plan_params_context *context);
+static void plan_params_exprs(Node *node, plan_params_context *context);
+static void plan_params_plan_walker(Plan *plan, plan_params_context *context);
+static bool drb_plan_params(PlannerInfo *root, Plan *plan, List **params, bool *volatile_funcs);
+static bool depends_on_rescan_params(PlannerInfo *root, List *params);
+static bool result_cache_pays_off(PlannerInfo *root, Plan *plan, List *keyexprs, double lookups);
+static bool cache_nestloop_inner(PlannerInfo *root, NestLoop *nl);
+static bool cache_subplans_walker(Node *node, cache_subplans_context *context);
+static void cache_subplans(PlannerInfo *root, Plan *plan);
+
+extern void drillbeyond_planner_phase_zero(PlannerGlobal *glob, Query *q) {
+    // may turn the fake relations into tables built by drb_materialize()
+    if (drillbeyond_use_materializations(q))
+        glob->drbMaterialized = true;
+    drb_prepare_fanout(q);
     savedTopLevelQuery = (Query *) copyObject(q);
 }
 
+/*
+ * Fan-out execution: instead of re-running the plan below DRB_TOP once per
+ * combination of candidates, every ω operator emits each input tuple once
+ * per candidate, tagged with the candidate index in its <keyword>_id column.
+ * The ids are carried up to DRB_TOP as resjunk columns, and are prepended to
+ * ORDER BY so that the tuples of each variant are still sorted on their own.
+ *
+ * Aggregation computes all variants in one pass as well: with GROUP BY, the
+ * ids become additional grouping columns; a plain aggregate keeps one set of
+ * transition states per combination of ids (see drb_setup_fanout_agg).
+ *
+ * Window functions, DISTINCT, LIMIT, set operations and subqueries would mix
+ * the variants, and ordered or DISTINCT aggregates are only supported by the
+ * single-group Agg code paths, so such queries are not fanned out.
+ */
+static bool fanout_applicable(Query *q) {
+    ListCell *lc;
+
+    if (q->commandType != CMD_SELECT || q->hasWindowFuncs ||
+        q->hasSubLinks || q->distinctClause != NIL || q->setOperations != NULL ||
+        q->limitCount != NULL || q->limitOffset != NULL)
+        return false;
+    if (q->hasAggs &&
+        (has_ordered_aggs_walker((Node *) q->targetList, NULL) ||
+         has_ordered_aggs_walker(q->havingQual, NULL)))
+        return false;
+
+    foreach(lc, q->rtable) {
+        RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+        if (rte->rtekind == RTE_SUBQUERY)
+            return false;
+    }
+    return true;
+}
+
+static bool has_ordered_aggs_walker(Node *node, void *context) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, Aggref)) {
+        Aggref *aggref = (Aggref *) node;
+        if (aggref->aggorder != NIL || aggref->aggdistinct != NIL)
+            return true;
+    }
+    return expression_tree_walker(node, has_ordered_aggs_walker, context);
+}
+
+static void drb_prepare_fanout(Query *q) {
+    ListCell *lc, *tl;
+    List *idSortClauses = NIL;
+    List *idGroupClauses = NIL;
+    Index rti = 0;
+
+    if (!drb_enable_fanout || drb_max_num_cands <= 1 || !fanout_applicable(q))
+        return;
+    // a single pass can neither stop after some of the variants, nor
+    // deliver them one by one
+    if (drb_max_variants > 0 || drb_variant_time_budget > 0 || drb_enable_variant_notices)
+        return;
+
+    foreach(lc, q->rtable) {
+        RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+        TargetEntry *tle = NULL;
+        Var *var;
+        rti++;
+
+        if (rte->rtekind != RTE_DRILLBEYOND)
+            continue;
+
+        // reoptimization plans the saved query again, which is already prepared
+        foreach(tl, q->targetList) {
+            TargetEntry *t = (TargetEntry *) lfirst(tl);
+            if (t->resjunk && IsA(t->expr, Var) &&
+                ((Var *) t->expr)->varno == rti && ((Var *) t->expr)->varattno == DRB_ID_ATTR)
+                tle = t;
+        }
+        rte->drb_expansion->fanout = true;
+        if (tle != NULL)
+            continue;
+
+        var = makeVar(rti, DRB_ID_ATTR, INT8OID, -1, InvalidOid, 0);
+        tle = makeTargetEntry((Expr *) var, list_length(q->targetList) + 1,
+                              pstrdup(strVal(lsecond(rte->eref->colnames))), true);
+        q->targetList = lappend(q->targetList, tle);
+
+        if (q->sortClause != NIL) {
+            SortGroupClause *sgc = makeNode(SortGroupClause);
+            get_sort_group_operators(INT8OID, true, true, false,
+                                     &sgc->sortop, &sgc->eqop, NULL,
+                                     &sgc->hashable);
+            sgc->tleSortGroupRef = assignSortGroupRef(tle, q->targetList);
+            sgc->nulls_first = false;
+            idSortClauses = lappend(idSortClauses, sgc);
+        }
+        if (q->groupClause != NIL) {
+            SortGroupClause *sgc = makeNode(SortGroupClause);
+            get_sort_group_operators(INT8OID, true, true, false,
+                                     &sgc->sortop, &sgc->eqop, NULL,
+                                     &sgc->hashable);
+            sgc->tleSortGroupRef = assignSortGroupRef(tle, q->targetList);
+            sgc->nulls_first = false;
+            idGroupClauses = lappend(idGroupClauses, sgc);
+        }
+    }
+    q->sortClause = list_concat(idSortClauses, q->sortClause);
+    q->groupClause = list_concat(idGroupClauses, q->groupClause);
+}
+
+/*
+ * A plain aggregate above fanned-out ω operators has to produce one result
+ * per combination of candidates. Tell the Agg node where the ids are in its
+ * input, it then keeps separate transition states per combination.
+ *
+ * With a single fanned-out expansion and drb_enable_delta_aggregation, if
+ * every aggregate's transition can be undone (count, sum, avg), ω emits only
+ * the candidates that differ from the first one, and the Agg derives the
+ * other variants from the first one's states (delta mode).
+ */
+static void drb_setup_fanout_agg(PlannerInfo *root, Plan *plan) {
+    Agg *agg = (Agg *) drb_pull_first_node(root, plan, T_Agg);
+    DrillBeyondExpansion *fanned = NULL;
+    ListCell *c, *tl;
+    int i = 0;
+
+    // expansions are shared with earlier plans of a reoptimized query
+    foreach(c, root->drb_expansions)
+        ((DrillBeyondExpansion *) lfirst(c))->fanout_delta = false;
+
+    if (agg == NULL || agg->aggstrategy != AGG_PLAIN)
+        return;
+
+    agg->drbIdColIdx = (AttrNumber *) palloc(sizeof(AttrNumber) * list_length(root->drb_expansions));
+    foreach(c, root->drb_expansions) {
+        DrillBeyondExpansion *expansion = (DrillBeyondExpansion *) lfirst(c);
+
+        if (!expansion->fanout)
+            continue;
+        agg->drbIdColIdx[i] = InvalidAttrNumber;
+        foreach(tl, agg->plan.lefttree->targetlist) {
+            TargetEntry *te = (TargetEntry *) lfirst(tl);
+            if (IsA(te->expr, Var) && ((Var *) te->expr)->varno == expansion->rti &&
+                ((Var *) te->expr)->varattno == DRB_ID_ATTR) {
+                agg->drbIdColIdx[i] = te->resno;
+                break;
+            }
+        }
+        if (agg->drbIdColIdx[i] == InvalidAttrNumber)
+            elog(ERROR, "candidate id of %s not found in aggregate input", expansion->keyword);
+        fanned = expansion;
+        i++;
+    }
+    agg->drbNumIds = i;
+    agg->drbNumCands = drb_max_num_cands;
+
+    if (i == 1 && drb_enable_delta_aggregation &&
+        !has_non_invertible_aggs_walker((Node *) agg->plan.targetlist, NULL) &&
+        !has_non_invertible_aggs_walker((Node *) agg->plan.qual, NULL)) {
+        agg->drbDelta = true;
+        fanned->fanout_delta = true;
+    }
+}
+
+static bool has_non_invertible_aggs_walker(Node *node, void *context) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, Aggref)) {
+        Oid aggfnoid = ((Aggref *) node)->aggfnoid;
+        HeapTuple aggTuple;
+        bool invertible;
+
+        aggTuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggfnoid));
+        if (!HeapTupleIsValid(aggTuple))
+            elog(ERROR, "cache lookup failed for aggregate %u", aggfnoid);
+        invertible = agg_transfn_invertible(((Form_pg_aggregate) GETSTRUCT(aggTuple))->aggtransfn);
+        ReleaseSysCache(aggTuple);
+        return !invertible;
+    }
+    return expression_tree_walker(node, has_non_invertible_aggs_walker, context);
+}
+
 extern bool drillbeyond_planner_phase_one(PlannerInfo *root, List *tlist) {
     ListCell *sl, *gl, *lr, *c;
     Bitmapset *groupRefs = NULL;
@@ -263,56 +483,359 @@ relation_byte_size(double tuples, int width)
     return tuples * (MAXALIGN(width) + MAXALIGN(sizeof(HeapTupleHeaderData)));
 }
 
-static bool should_materialize(PlannerInfo *root, Plan *plan) {
+/*
+ * Number of times the plan below DRB_TOP runs: once per combination of
+ * candidates, or once in fan-out mode.
+ */
+static double drb_expected_runs(PlannerInfo *root) {
+    ListCell *lc;
+
+    foreach(lc, root->drb_all_expansions) {
+        DrillBeyondExpansion *expansion = (DrillBeyondExpansion *) lfirst(lc);
+        if (expansion->fanout)
+            return 1.0;
+    }
+    return pow(drb_max_num_cands, list_length(root->drb_all_expansions));
+}
+
+static bool plan_params_expr_walker(Node *node, plan_params_context *context) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, Param)) {
+        Param *param = (Param *) node;
+        if (param->paramkind == PARAM_EXEC && !bms_is_member(param->paramid, context->used)) {
+            context->used = bms_add_member(context->used, param->paramid);
+            context->params = lappend(context->params, param);
+        }
+        return false;
+    }
+    if (IsA(node, SubPlan)) {
+        SubPlan *subplan = (SubPlan *) node;
+        ListCell *lc;
+
+        // the subplan sets these itself, from args or by running
+        foreach(lc, subplan->parParam)
+            context->set = bms_add_member(context->set, lfirst_int(lc));
+        foreach(lc, subplan->setParam)
+            context->set = bms_add_member(context->set, lfirst_int(lc));
+        plan_params_plan_walker(planner_subplan_get_plan(context->root, subplan), context);
+        // and fall through for testexpr and args
+    }
+    return expression_tree_walker(node, plan_params_expr_walker, (void *) context);
+}
+
+static void plan_params_exprs(Node *node, plan_params_context *context) {
+    if (node == NULL)
+        return;
+    if (!context->volatile_funcs && contain_volatile_functions(node))
+        context->volatile_funcs = true;
+    plan_params_expr_walker(node, context);
+}
+
+static void plan_params_plan_walker(Plan *plan, plan_params_context *context) {
+    ListCell *lc;
+
+    if (plan == NULL || context->unknown)
+        return;
+
+    plan_params_exprs((Node *) plan->targetlist, context);
+    plan_params_exprs((Node *) plan->qual, context);
+    plan_params_exprs((Node *) plan->initPlan, context);
+
     switch (nodeTag(plan))
     {
+        case T_SeqScan:
         case T_Material:
-        case T_IndexOnlyScan:
-        //case T_Scan:
-        case T_FunctionScan:
-        case T_CteScan:
-        case T_WorkTableScan:
+        case T_ResultCache:
         case T_Sort:
         case T_Hash:
-            return false;
-        case T_IndexScan: {
-            IndexScan *ixs = (IndexScan *)plan;
-            if (list_length(ixs->indexqualorig) == 0)
-                return true;
-            else
-                return false;
+        case T_Unique:
+        case T_SetOp:
+        case T_Agg:
+        case T_Group:
+            break;
+        case T_IndexScan:
+            plan_params_exprs((Node *) ((IndexScan *) plan)->indexqual, context);
+            plan_params_exprs((Node *) ((IndexScan *) plan)->indexorderby, context);
+            break;
+        case T_IndexOnlyScan:
+            plan_params_exprs((Node *) ((IndexOnlyScan *) plan)->indexqual, context);
+            plan_params_exprs((Node *) ((IndexOnlyScan *) plan)->indexorderby, context);
+            break;
+        case T_BitmapIndexScan:
+            plan_params_exprs((Node *) ((BitmapIndexScan *) plan)->indexqual, context);
+            break;
+        case T_BitmapHeapScan:
+            plan_params_exprs((Node *) ((BitmapHeapScan *) plan)->bitmapqualorig, context);
+            break;
+        case T_TidScan:
+            plan_params_exprs((Node *) ((TidScan *) plan)->tidquals, context);
+            break;
+        case T_SubqueryScan:
+            plan_params_plan_walker(((SubqueryScan *) plan)->subplan, context);
+            break;
+        case T_FunctionScan:
+            plan_params_exprs(((FunctionScan *) plan)->funcexpr, context);
+            break;
+        case T_ValuesScan:
+            plan_params_exprs((Node *) ((ValuesScan *) plan)->values_lists, context);
+            break;
+        case T_ForeignScan:
+            plan_params_exprs((Node *) ((ForeignScan *) plan)->fdw_exprs, context);
+            break;
+        case T_NestLoop:
+            plan_params_exprs((Node *) ((Join *) plan)->joinqual, context);
+            foreach(lc, ((NestLoop *) plan)->nestParams)
+                context->set = bms_add_member(context->set,
+                                              ((NestLoopParam *) lfirst(lc))->paramno);
+            break;
+        case T_MergeJoin:
+            plan_params_exprs((Node *) ((Join *) plan)->joinqual, context);
+            plan_params_exprs((Node *) ((MergeJoin *) plan)->mergeclauses, context);
+            break;
+        case T_HashJoin:
+            plan_params_exprs((Node *) ((Join *) plan)->joinqual, context);
+            plan_params_exprs((Node *) ((HashJoin *) plan)->hashclauses, context);
+            break;
+        case T_Limit:
+            plan_params_exprs(((Limit *) plan)->limitOffset, context);
+            plan_params_exprs(((Limit *) plan)->limitCount, context);
+            break;
+        case T_WindowAgg:
+            plan_params_exprs(((WindowAgg *) plan)->startOffset, context);
+            plan_params_exprs(((WindowAgg *) plan)->endOffset, context);
+            break;
+        case T_Result:
+            plan_params_exprs(((Result *) plan)->resconstantqual, context);
+            break;
+        case T_Append:
+            foreach(lc, ((Append *) plan)->appendplans)
+                plan_params_plan_walker((Plan *) lfirst(lc), context);
+            break;
+        case T_MergeAppend:
+            foreach(lc, ((MergeAppend *) plan)->mergeplans)
+                plan_params_plan_walker((Plan *) lfirst(lc), context);
+            break;
+        case T_BitmapAnd:
+            foreach(lc, ((BitmapAnd *) plan)->bitmapplans)
+                plan_params_plan_walker((Plan *) lfirst(lc), context);
+            break;
+        case T_BitmapOr:
+            foreach(lc, ((BitmapOr *) plan)->bitmapplans)
+                plan_params_plan_walker((Plan *) lfirst(lc), context);
+            break;
+        default:
+            // CTE and worktable scans, DrillBeyond operators, ...
+            context->unknown = true;
+            return;
+    }
+    plan_params_plan_walker(outerPlan(plan), context);
+    plan_params_plan_walker(innerPlan(plan), context);
+}
+
+/*
+ * The PARAM_EXEC Params a subtree depends on, that is those it references
+ * but does not set itself. plan->extParam would say the same, but phase
+ * three runs before SS_finalize_plan computes it. Returns false if the
+ * subtree contains nodes whose parameters are not known here.
+ */
+static bool drb_plan_params(PlannerInfo *root, Plan *plan, List **params, bool *volatile_funcs) {
+    plan_params_context context;
+    ListCell *lc;
+
+    memset(&context, 0, sizeof(context));
+    context.root = root;
+    plan_params_plan_walker(plan, &context);
+
+    *params = NIL;
+    *volatile_funcs = context.volatile_funcs;
+    if (context.unknown)
+        return false;
+    foreach(lc, context.params) {
+        Param *param = (Param *) lfirst(lc);
+        if (!bms_is_member(param->paramid, context.set))
+            *params = lappend(*params, param);
+    }
+    return true;
+}
+
+/*
+ * Whether a subtree depending on params is rescanned with changed values
+ * while the query runs. Outputs of initplans, of this query level or an
+ * outer one, are computed once.
+ */
+static bool depends_on_rescan_params(PlannerInfo *root, List *params) {
+    Bitmapset *initParams = NULL;
+    PlannerInfo *r;
+    ListCell *lc, *lc2;
+
+    for (r = root; r != NULL; r = r->parent_root) {
+        foreach(lc, r->init_plans) {
+            SubPlan *initsubplan = (SubPlan *) lfirst(lc);
+            foreach(lc2, initsubplan->setParam)
+                initParams = bms_add_member(initParams, lfirst_int(lc2));
         }
-        case T_SeqScan: {
-            // never materialize full scans
-            if (list_length(plan->qual) == 0)
-                return false;
+    }
+    foreach(lc, params) {
+        if (!bms_is_member(((Param *) lfirst(lc))->paramid, initParams))
             return true;
+    }
+    return false;
+}
 
-            Scan *scan = (Scan*)plan;
-            RelOptInfo *rel = root->simple_rel_array[scan->scanrelid];
-            // random threshold for selectivity
-            // TODO: should use real cost_mat_path machinery
-            if ((plan->plan_rows / rel->tuples) > 0.25)
-                return false;
+/*
+ * Whether a ResultCache above a parameterized plan that is run lookups
+ * times, with key values given by keyexprs, is cheaper than running the
+ * plan each time. Every distinct key misses once; if the results of all of
+ * them don't fit into work_mem, the share that doesn't misses every time.
+ */
+static bool result_cache_pays_off(PlannerInfo *root, Plan *plan, List *keyexprs, double lookups) {
+    double distinct, fit, misses, hits, entry_bytes;
+    Cost cached_cost, uncached_cost;
+
+    if (lookups <= 1.0)
+        return false;
+    distinct = keyexprs != NIL ? estimate_num_groups(root, keyexprs, lookups) : 1.0;
+    distinct = Max(1.0, Min(distinct, lookups));
+    // 64 bytes for the entry and its key
+    entry_bytes = relation_byte_size(plan->plan_rows, plan->plan_width) + 64;
+    fit = Min(1.0, work_mem * 1024.0 / (distinct * entry_bytes));
+    misses = distinct + (lookups - distinct) * (1.0 - fit);
+    hits = lookups - misses;
+
+    cached_cost = misses * plan->total_cost +
+        hits * cpu_operator_cost * plan->plan_rows +
+        lookups * cpu_operator_cost * list_length(keyexprs);
+    uncached_cost = lookups * plan->total_cost;
+    return cached_cost < uncached_cost;
+}
 
-            // // random criterion: we do not spill to disk
-            // double      nbytes = relation_byte_size(scan->plan.plan_rows, scan->plan.plan_width);
-            // long        work_mem_bytes = work_mem * 1024L;
-            // if (nbytes > work_mem_bytes)
-            //     return false;
+/*
+ * Puts a ResultCache above the invariant, parameterized inner side of a
+ * nestloop, if it pays off: the inner side is then run once per distinct
+ * outer values instead of once per outer row and candidate.
+ */
+static bool cache_nestloop_inner(PlannerInfo *root, NestLoop *nl) {
+    Plan *inner = innerPlan(nl);
+    List *params, *keyexprs = NIL;
+    bool volatile_funcs;
+    ListCell *lc;
+
+    if (!drb_enable_rescan_cache || nl->nestParams == NIL || IsA(inner, ResultCache))
+        return false;
+    if (!drb_plan_params(root, inner, &params, &volatile_funcs) ||
+        volatile_funcs || params == NIL)
+        return false;
 
-            return true;
+    foreach(lc, nl->nestParams)
+        keyexprs = lappend(keyexprs, ((NestLoopParam *) lfirst(lc))->paramval);
+    if (!result_cache_pays_off(root, inner, keyexprs,
+                               outerPlan(nl)->plan_rows * drb_expected_runs(root)))
+        return false;
+
+    nl->join.plan.righttree = (Plan *) make_resultcache(inner, params);
+    return true;
+}
+
+static bool cache_subplans_walker(Node *node, cache_subplans_context *context) {
+    if (node == NULL)
+        return false;
+    if (IsA(node, SubPlan)) {
+        SubPlan *subplan = (SubPlan *) node;
+        PlannerInfo *root = context->root;
+        Plan *plan = planner_subplan_get_plan(root, subplan);
+        List *params;
+        bool volatile_funcs;
+
+        // only these read the complete result of every call
+        if ((subplan->subLinkType == EXPR_SUBLINK || subplan->subLinkType == ARRAY_SUBLINK) &&
+            subplan->parParam != NIL && !subplan->useHashTable &&
+            !IsA(plan, ResultCache) && !drb_is_variable_plan(root, plan) &&
+            drb_plan_params(root, plan, &params, &volatile_funcs) &&
+            !volatile_funcs && params != NIL &&
+            result_cache_pays_off(root, plan, subplan->args, context->calls)) {
+            ListCell *lc = list_head(root->glob->subplans);
+            int i;
+
+            for (i = 1; i < subplan->plan_id; i++)
+                lc = lnext(lc);
+            lfirst(lc) = make_resultcache(plan, params);
         }
+    }
+    return expression_tree_walker(node, cache_subplans_walker, (void *) context);
+}
+
+/*
+ * Puts ResultCaches above the plans of invariant correlated SubPlans in the
+ * expressions of a plan node that is run again for every candidate.
+ */
+static void cache_subplans(PlannerInfo *root, Plan *plan) {
+    cache_subplans_context context;
+
+    if (!drb_enable_rescan_cache)
+        return;
+    context.root = root;
+    context.calls = Max(plan->plan_rows, 1.0) * drb_expected_runs(root);
+    cache_subplans_walker((Node *) plan->targetlist, &context);
+    cache_subplans_walker((Node *) plan->qual, &context);
+    switch (nodeTag(plan)) {
+        case T_NestLoop:
+        case T_MergeJoin:
+        case T_HashJoin:
+            cache_subplans_walker((Node *) ((Join *) plan)->joinqual, &context);
+            break;
         default:
-            {
-                if (plan->plan_rows == 1) {
-                    return false;
-                }
-                return true;
-            }
+            break;
     }
 }
 
+/*
+ * Whether materializing an invariant subtree is cheaper than running it
+ * again for every candidate: the first run pays for filling the Material
+ * node (cost_material, including spilling beyond work_mem), each further run
+ * only for reading it back, as in cost_rescan.
+ */
+static bool should_materialize(PlannerInfo *root, Plan *plan) {
+    double runs = drb_expected_runs(root);
+    double nbytes;
+    List *params;
+    bool volatile_funcs;
+    Path matpath;
+    Cost rerun_cost, mat_cost, mat_rescan_cost;
+
+    switch (nodeTag(plan))
+    {
+        // these keep their result anyway, or must stay below their parent
+        case T_Material:
+        case T_FunctionScan:
+        case T_CteScan:
+        case T_WorkTableScan:
+        case T_Sort:
+        case T_Hash:
+            return false;
+        default:
+            break;
+    }
+    // a parameterized subtree is rescanned whenever its parameters change,
+    // a Material node above it would be filled again each time
+    if (!drb_plan_params(root, plan, &params, &volatile_funcs) ||
+        depends_on_rescan_params(root, params))
+        return false;
+    if (runs <= 1.0)
+        return false;
+
+    cost_material(&matpath, plan->startup_cost, plan->total_cost,
+                  plan->plan_rows, plan->plan_width);
+    mat_rescan_cost = cpu_operator_cost * plan->plan_rows;
+    nbytes = relation_byte_size(plan->plan_rows, plan->plan_width);
+    if (nbytes > work_mem * 1024L)
+        mat_rescan_cost += seq_page_cost * ceil(nbytes / BLCKSZ);
+
+    rerun_cost = plan->total_cost * runs;
+    mat_cost = matpath.total_cost + mat_rescan_cost * (runs - 1);
+    return mat_cost < rerun_cost;
+}
+
 static bool add_mat_nodes(PlannerInfo *root, Plan *plan, List ** addedMatNodes) {
     if (!drb_enable_additional_cache)
         return false;
@@ -349,28 +872,24 @@ static bool add_mat_nodes(PlannerInfo *root, Plan *plan, List ** addedMatNodes)
     }
     // no variable nodes beneath this one
     if (result == true) {
+        cache_subplans(root, plan);
         if (innerPlan(plan) != NULL) {
             if (!innerVariable && should_materialize(root, innerPlan(plan))) {
-                Material   *node = makeNode(Material);
-                Plan       *mat_plan = &node->plan;
+                Plan       *mat_plan = materialize_finished_plan(innerPlan(plan));
                 mat_plan->targetlist = (List*)copyObject(innerPlan(plan)->targetlist);
-                mat_plan->qual = NIL;
-                mat_plan->lefttree = innerPlan(plan);
-                mat_plan->righttree = NULL;
                 plan->righttree = mat_plan;
                 *addedMatNodes = lappend(*addedMatNodes, mat_plan);
+            } else if (!innerVariable && IsA(plan, NestLoop) &&
+                       cache_nestloop_inner(root, (NestLoop *) plan)) {
+                // the cache is kept across candidate rescans
             } else {
                 add_mat_nodes(root, innerPlan(plan), addedMatNodes);
             }
         }
         if (outerPlan(plan) != NULL) {
             if (!outerVariable && should_materialize(root, outerPlan(plan))) {
-                Material   *node = makeNode(Material);
-                Plan       *mat_plan = &node->plan;
+                Plan       *mat_plan = materialize_finished_plan(outerPlan(plan));
                 mat_plan->targetlist = (List*)copyObject(outerPlan(plan)->targetlist);
-                mat_plan->qual = NIL;
-                mat_plan->lefttree = outerPlan(plan);
-                mat_plan->righttree = NULL;
                 plan->lefttree = mat_plan;
                 *addedMatNodes = lappend(*addedMatNodes, mat_plan);
             } else {
@@ -506,7 +1025,7 @@ static void add_targetlist_entry(Plan *plan, DrillBeyondExpansion *exp) {
     new_name = (char*)palloc(strlen(exp->keyword)+1);
     sprintf(new_name, "%s", exp->keyword);
 
-    Var *col_expr = makeVar(exp->rti, 1, 1700, 1700, 0, 0);
+    Var *col_expr = makeVar(exp->rti, DRB_VALUE_ATTR, exp->valuetype, -1, 0, 0);
     plan->targetlist = lappend(plan->targetlist, makeTargetEntry(
            (Expr *) col_expr,
            list_length(plan->targetlist) + 1,
@@ -573,6 +1092,7 @@ extern Plan *drillbeyond_planner_phase_three(PlannerInfo *root, Plan *result_pla
     List *drb_ops = NIL;
 
     if (root->query_level == 1) {
+        drb_setup_fanout_agg(root, result_plan);
         outputPlan = (Plan *) make_drillbeyondexpand(root,
             result_plan, DRB_TOP, NULL, NULL, false, drb_ops, NULL);
         save_query(root);
@@ -607,6 +1127,9 @@ extern Plan *drillbeyond_planner_phase_three(PlannerInfo *root, Plan *result_pla
 
                 if (expansion->selective && !drb_enable_pull_up_selection)
                     continue;
+                // all variants are already in the stream, nothing to expand
+                if (expansion->fanout)
+                    continue;
 
                 if (nodeTag(result_plan) == T_Limit) {
                     Plan *child = outerPlan(result_plan);
@@ -95,6 +95,7 @@ void switch_plans(DrillBeyondExpandState *node) {
 
     outerPlan(plan) =  outerPlan(pstmt->planTree);
     outerPlanState(node) = ExecInitNode(outerPlan(plan), estate, node->original_eflags);
+    drb_mark_variance(outerPlanState(node));
 
     /* ---------------------------------------------------------------- */
     /* REFACTOR with Init */
@@ -108,6 +109,12 @@ void switch_plans(DrillBeyondExpandState *node) {
 
         DrillBeyondState *orig_dbs = stateForExpansion(drb->drb_expansion, original_operator_states);
         dbs->db_num_cands = orig_dbs->db_num_cands;
+        dbs->db_cand_order = orig_dbs->db_cand_order;
+        dbs->db_cand_class = orig_dbs->db_cand_class;
+        dbs->db_current_rank = orig_dbs->db_current_rank;
+        dbs->db_current_origin = orig_dbs->db_current_origin;
+        dbs->db_instr = orig_dbs->db_instr; // the requests were made for this expansion
+        orig_dbs->db_instr = NULL;
         DrillBeyond *orig_plan = (DrillBeyond *)orig_dbs->js.ps.plan;
 
         bool tl_is_subset = check_tl_subset(estate->es_range_table, (Plan*)drb, (Plan*)orig_plan);
@@ -116,6 +123,13 @@ void switch_plans(DrillBeyondExpandState *node) {
             dbs->db_fetchedResult = true;
             dbs->tuplestorestate = orig_dbs->tuplestorestate;
             orig_dbs->tuplestorestate = NULL;
+            dbs->db_entries = orig_dbs->db_entries;
+            dbs->db_numEntries = orig_dbs->db_numEntries;
+            dbs->db_memEntries = orig_dbs->db_memEntries;
+            dbs->db_entriesFile = orig_dbs->db_entriesFile;
+            orig_dbs->db_entriesFile = NULL;
+            dbs->db_maxEntries = orig_dbs->db_maxEntries;
+            dbs->db_outerPos = 0;
             // drb->drb_join_cols = (List*)copyObject(orig_plan->drb_join_cols);
             drb->drb_join_cols = (List*)copyObject(drb->drb_expansion->join_cols);
             fix_join_cols(drb);
@@ -140,7 +154,7 @@ void switch_plans(DrillBeyondExpandState *node) {
 
 
     node->current_origin = 0;
-    node->total_permutations = pow(drb_max_num_cands, list_length(node->drb_operator_states));
+    drb_count_variants(node);
 }
 
 static void fix_join_cols(DrillBeyond *drb) {
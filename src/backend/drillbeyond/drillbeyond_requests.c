@@ -1,19 +1,27 @@
 #include "postgres.h"
 
+#include "access/xact.h"
 #include "drillbeyond/drillbeyond.h"
 #include "catalog/pg_type.h"
 #include "curl/curl.h"
+#include "miscadmin.h"
 #include "parser/parse_coerce.h"
 #include "parser/parsetree.h"
 #include "optimizer/clauses.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "lib/stringinfo.h"
+#include "utils/memutils.h"
 
 #include <stdlib.h>
 #include <time.h>
 
 int drb_max_num_cands = 1;
+bool drb_enable_streaming = false;
+bool drb_enable_concurrent_requests = false;
+bool drb_enable_binary_protocol = false;
+int drb_request_batch_size = 1000;
 
 static int next_context = 0;
 
@@ -25,300 +33,502 @@ static int get_context() {
     return next_context++;
 }
 
-// LOCAL DUMMY SERVER
-#define URL_BASE "http://127.0.0.1:8765"
+// paths on the servers listed in drb_server_url
 #define DRILLBEYOND_PATH "/"
 #define DRILLBEYOND_ARTIFICIAL_PATH "/artificial"
 #define SELECTIVITY_PATH "/drb_estimatedSelectivity"
+#define BINARY_PATH "binary"
+
+// REA SERVER: drb_server_url = 'http://141.76.47.133:8765'
+
+/*
+ * A streamed request: one batch of join values that is in flight on the
+ * multi handle. Everything curl touches lives in TopMemoryContext, so an
+ * aborted query can still clean up its handles (see drb_streaming_xact_callback).
+ */
+typedef struct DrillBeyondRequestBatch {
+    CURL *handle;
+    struct curl_slist *headers;
+    StringInfoData response;
+    DrillBeyondState *owner;
+    List *entries; // DrillBeyondValues* in message order, query memory
+    bool binary; // sent in the binary wire format
+    int attempts; // sends that failed and were retried
+    DrillBeyondInflight *inflight; // registration, or the request followed if handle is NULL
+} DrillBeyondRequestBatch;
+
+static CURLM *multi_handle = NULL;
+static List *inflight_batches = NIL; // in TopMemoryContext
+static bool binary_protocol_unsupported = false; // the service answered a binary request with 404/415
+
+static json_object* parse_json_response(StringInfo buffer);
+static DrillBeyondResponse *parse_response(StringInfo buffer, bool binary, int num_rows,
+                                           DrillBeyondInstrumentation *instr);
+static bool build_request(StringInfo body, DrillBeyondExpansion *expansion, List *entries,
+                          DrillBeyondInstrumentation *instr);
+static void count_request(StringInfo body, DrillBeyondInstrumentation *instr);
+static void unmark_pending(List *entries);
+static bool binary_protocol_rejected(long status);
+static const char *drillbeyond_url(bool binary);
+static void drillbeyond_process_response(DrillBeyondResponse *resp, DrillBeyondState *dbstate, List *entries);
+static void stream_batch(DrillBeyondState *dbstate, bool follow);
+static void finish_batch(DrillBeyondRequestBatch *batch, CURLcode result);
+static void finish_followed_batch(DrillBeyondRequestBatch *batch, bool done);
+static void free_batch(DrillBeyondRequestBatch *batch);
+static void drb_streaming_xact_callback(XactEvent event, void *arg);
+
+static void entries_to_json(DrillBeyondExpansion *expansion, List *entries, json_object *msg);
+static json_object* serialize_restrictlist(List *restrictlist);
+static bool is_open_attribute(Node *expr);
+static char* const_to_string(Oid type, Datum value, bool isnull);
+static char* operator_restriction(Oid opno, List *args);
+static char* array_restriction(const ScalarArrayOpExpr *expr);
+static char* restriction_to_string(Node *expr, bool *exact);
 
-// REA SERVER
-// #define URL_BASE "http://141.76.47.133:8765"
-// #define DRILLBEYOND_PATH "/"
-// #define DRILLBEYOND_ARTIFICIAL_PATH "/artificial"
-// #define SELECTIVITY_PATH "/drb_estimatedSelectivity"
+static const char *drillbeyond_url(bool binary) {
+    if (drb_enable_rea)
+        return binary ? DRILLBEYOND_PATH BINARY_PATH : DRILLBEYOND_PATH;
+    return binary ? DRILLBEYOND_ARTIFICIAL_PATH "/" BINARY_PATH : DRILLBEYOND_ARTIFICIAL_PATH;
+}
 
-static size_t write_data_to_buffer(void *buffer, size_t size, size_t nmemb, void *userp);
-static json_object* send_request(const char *path, const char *msg_str);
+/*
+ * Serializes a request for entries into body, in the binary format if it is
+ * enabled and was not rejected by the service before, in JSON otherwise.
+ * Returns true for the binary format.
+ */
+static bool build_request(StringInfo body, DrillBeyondExpansion *expansion, List *entries,
+                          DrillBeyondInstrumentation *instr) {
+    json_object *msg;
+    const char *msg_str;
+    instr_time start;
+    bool binary = drb_enable_binary_protocol && !binary_protocol_unsupported;
 
-static json_object* serialize_restrictlist(List *restrictlist);
-static bool is_simple_restriction(List *argumentList);
-static char* simple_restriction_to_string(const Node *expr);
+    INSTR_TIME_SET_CURRENT(start);
+    if (binary) {
+        drillbeyond_binary_request(body, expansion, entries);
+    } else {
+        msg = initDrillBeyondRequest(expansion);
+        add_restrictions_to_msg(msg, expansion->drb_qual);
+        entries_to_json(expansion, entries, msg);
+        msg_str = json_object_to_json_string_ext(msg, JSON_C_TO_STRING_PLAIN);
+        appendBinaryStringInfo(body, msg_str, strlen(msg_str));
+        json_object_put(msg); // refcounting: "put" is the strange name for "release" that libjson uses
+    }
+    instr->serialize_ms += drillbeyond_elapsed_ms(start);
+    return binary;
+}
 
-extern int drillbeyond_request(const char *msg_str, DrillBeyondState *dbstate) {
-    void *ptr;
-    int j, i, t;
-    int cand_length, num_tuples, result_length;
-    json_object *obj;
-    json_object *values, *candidates, *cand, *explanation, *sel, *inUnion;
-    HASH_SEQ_STATUS seq_status;
+static void count_request(StringInfo body, DrillBeyondInstrumentation *instr) {
+    instr->bytes_sent += body->len;
+    instr->requests++;
+}
+
+/*
+ * Makes entries that were collected, but not sent, collectable again.
+ */
+static void unmark_pending(List *entries) {
+    ListCell *lc;
+
+    foreach(lc, entries)
+        ((DrillBeyondValues *) lfirst(lc))->pending = false;
+}
+
+/*
+ * Services that do not know the binary format answer with 404 (no such
+ * route) or 415 (unsupported media type). Then JSON is used from now on.
+ */
+static bool binary_protocol_rejected(long status) {
+    if (status != 404 && status != 415)
+        return false;
+    if (!binary_protocol_unsupported)
+        ereport(NOTICE,
+            (errmsg("DrillBeyond server does not support the binary protocol, falling back to JSON")));
+    binary_protocol_unsupported = true;
+    return true;
+}
+
+/*
+ * Requests all join values of the operator that are neither answered nor
+ * cached, in a single blocking request, and merges the response. If another
+ * backend has the same request in flight, waits for its answers in the
+ * cache instead, see drillbeyond_coalesce.c; not though while batches this
+ * backend streamed are registered, whose followers would wait for it.
+ */
+extern int drillbeyond_request(DrillBeyondState *dbstate) {
     DrillBeyond *plan = (DrillBeyond *) dbstate->js.ps.plan;
     DrillBeyondExpansion *expansion = plan->drb_expansion;
+    DrillBeyondResponse *resp;
+    DrillBeyondInflight *inflight;
+    StringInfoData body;
+    StringInfo buffer;
+    List *entries;
+    bool binary;
+    bool follow = !drillbeyond_inflight_owns_any();
+    bool coalesced;
+    long status;
+    instr_time start;
+
+    for (;;) {
+        drillbeyond_lookup_cache(dbstate);
+        entries = drillbeyond_collect_entries(expansion);
+        if (entries == NIL)
+            return 0;
+        if (drb_worker_count > 0)
+            drillbeyond_worker_cache_miss(entries);
+
+        initStringInfo(&body);
+        binary = build_request(&body, expansion, entries, dbstate->db_instr);
+        inflight = drillbeyond_inflight_begin(expansion, drillbeyond_url(binary), &body, follow, &coalesced);
+        if (!coalesced)
+            break;
+
+        // on a timeout, whatever is still missing is sent below
+        if (drillbeyond_inflight_wait(inflight))
+            dbstate->db_instr->coalesced++;
+        drillbeyond_inflight_end(inflight);
+        unmark_pending(entries);
+        list_free(entries);
+        pfree(body.data);
+        follow = false;
+    }
 
+    count_request(&body, dbstate->db_instr);
+    INSTR_TIME_SET_CURRENT(start);
+    buffer = drillbeyond_http_post(drillbeyond_url(binary), binary ? DRB_BINARY_CONTENT_TYPE : "application/json",
+                          body.data, body.len, &status);
+    if (binary && binary_protocol_rejected(status)) {
+        // followers of the binary request ask again themselves
+        drillbeyond_inflight_end(inflight);
+        resetStringInfo(&body);
+        binary = build_request(&body, expansion, entries, dbstate->db_instr);
+        inflight = drillbeyond_inflight_begin(expansion, drillbeyond_url(binary), &body, false, &coalesced);
+        count_request(&body, dbstate->db_instr);
+        buffer = drillbeyond_http_post(drillbeyond_url(binary), "application/json", body.data, body.len, &status);
+    }
+    dbstate->db_instr->network_ms += drillbeyond_elapsed_ms(start);
+    dbstate->db_instr->bytes_received += buffer->len;
+    pfree(body.data);
+
+    resp = parse_response(buffer, binary, list_length(entries), dbstate->db_instr);
+    drillbeyond_process_response(resp, dbstate, entries);
+    drillbeyond_inflight_end(inflight);
+    drillbeyond_free_response(resp);
+    list_free(entries);
+    return 0;
+}
 
-    if (drb_enable_rea)
-        obj = send_request(URL_BASE DRILLBEYOND_PATH, msg_str);         //send the JSON request and get a JSON object returned
-    else
-        obj = send_request(URL_BASE DRILLBEYOND_ARTIFICIAL_PATH, msg_str);
+/*
+ * Merge one response into the results hashtable. entries are the
+ * DrillBeyondValues that were serialized into the request, in message order,
+ * so the t-th value of each candidate belongs to the t-th entry.
+ * Selectivities are averaged over all responses of this operator, weighted
+ * by the number of entities in each response.
+ */
+static void drillbeyond_process_response(DrillBeyondResponse *resp, DrillBeyondState *dbstate, List *entries) {
+    ListCell *lc;
+    int j, i, t;
+    int cand_length, num_cands, num_prev, bitmaplen;
+    DrillBeyond *plan = (DrillBeyond *) dbstate->js.ps.plan;
+    DrillBeyondExpansion *expansion = plan->drb_expansion;
+    double *selectivities;
+    double sumInUnion = 0;
+    DrillBeyondValues **rows;
+    instr_time start;
 
-    /* process parsed results */
-    candidates = json_object_object_get(obj, CANDIDATES);           //get the candidates with the values
-    inUnion = json_object_object_get(obj, IN_UNION);           //get the candidates with the values
-    if(candidates)cand_length = json_object_array_length(candidates);
-    else{printf("Empty response\n"); cand_length = 0;}
-    dbstate->db_num_cands = cand_length;
+    if (resp->num_rows < list_length(entries))
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("Server response contains %d entities, %d were requested",
+                   resp->num_rows, list_length(entries))
+            ));
 
+    INSTR_TIME_SET_CURRENT(start);
+    cand_length = resp->num_cands;
+    num_cands = cand_length > dbstate->db_num_cands ? cand_length : dbstate->db_num_cands;
+    bitmaplen = BITMAPLEN(resp->num_rows);
 
-    num_tuples = 0;
-    // calculate total number of tuples across candidates and extract selectivities per candidate
-    expansion->selectivities = (double*) palloc(sizeof(double) * dbstate->db_num_cands);
+    // selectivities per candidate, merged with those of earlier responses
+    num_prev = dbstate->db_tuples_requested;
+    selectivities = (double*) palloc0(sizeof(double) * (num_cands > 0 ? num_cands : 1));
     for (i=0; i<cand_length; i++) {
-        cand = json_object_array_get_idx(candidates, i);            //get one candidate
-        values = json_object_object_get(cand, VALUES);              //get the values out of the candidate
-        result_length = json_object_array_length(values);
-        num_tuples += result_length;
-        sel = json_object_object_get(cand, SELECTIVITY);
-        expansion->selectivities[i] = json_object_get_double(sel);
+        double prev = 0.0;
+        if (expansion->selectivities != NULL && i < dbstate->db_num_cands)
+            prev = expansion->selectivities[i];
+        selectivities[i] = (prev * num_prev + resp->selectivities[i] * list_length(entries))
+                            / (num_prev + list_length(entries));
     }
+    expansion->selectivities = selectivities;
+    dbstate->db_num_cands = num_cands;
 
-
+    // one entity x candidate matrix for the whole response, all NULL at first
+    // without candidates, every entity gets one NULL candidate
+    rows = (DrillBeyondValues **) palloc(sizeof(DrillBeyondValues *) * (list_length(entries) + 1));
     t = 0;
-    double sumInUnion = 0;
-    hash_seq_init(&seq_status, expansion->results_hashtable);
-    while((ptr = hash_seq_search(&seq_status)) != NULL) {
-        Datum *new_values;
-        bool *is_null;
-        DrillBeyondValues *drb_values = (DrillBeyondValues *)ptr;
-        if (drb_values->requested)
-            continue;
+    foreach(lc, entries)
+        rows[t++] = (DrillBeyondValues *) lfirst(lc);
+    drb_allocValueRows(expansion, rows, t, cand_length > 0 ? cand_length : 1);
+    pfree(rows);
 
-        if (dbstate->db_num_cands == 0) {                                   //no candidates
-            new_values = (Datum*)palloc(sizeof(Datum) * 1);
-            is_null = (bool*)palloc(sizeof(bool) * 1);
-            is_null[0] = true;
-            new_values[0] = 0;
-            drb_values->numValues = 1;
-        } else {
-            new_values = (Datum*)palloc(sizeof(Datum) * dbstate->db_num_cands);     //create empty new values
-            is_null = (bool*)palloc(sizeof(bool) * dbstate->db_num_cands);         //a is_null array
-
-            for (j = 0; j < dbstate->db_num_cands; j++) {                   //iterate through the candidates
-                json_object *val;
-                cand = json_object_array_get_idx(candidates, j);
-                values = json_object_object_get(cand, VALUES);              //get values again of the current candidate
-                val = json_object_array_get_idx(values, t);                 //get data at index k for each candidate (k is equal for all candidates)
-                if (json_object_get_type(val) == json_type_null){           //if empty
-                    is_null[j] = true;                                      //set corresponding is_null to true
-                    new_values[j] = 0;
-                }
-                else {
-                    Datum v = Float8GetDatum(json_object_get_double(val));  //always a double value?
-                    new_values[j] = DirectFunctionCall1(float8_numeric, v); //convert value to general numeric
-                    is_null[j] = false;                                     //there was a non null value -> is_null = false
-                }
+    t = 0;
+    foreach(lc, entries) {
+        DrillBeyondValues *drb_values = (DrillBeyondValues *) lfirst(lc);
+
+        for (j = 0; j < cand_length; j++) {                       //iterate through the candidates
+            bits8 *nulls = resp->nulls + (Size) j * bitmaplen;
+            if (!(nulls[t / 8] & (1 << (t % 8)))) {
+                drb_values->values[j] = resp->values[(Size) j * resp->num_rows + t];
+                drb_values->nulls[j / 8] &= ~(1 << (j % 8));
             }
-            drb_values->numValues = dbstate->db_num_cands;
         }
-        drb_values->values = new_values;                                    //requested drillbeyond values drb_values->is_null = is_null;                                      //is_null bit vektor
-        drb_values->is_null = is_null;                                    //requested drillbeyond values drb_values->is_null = is_null;                                      //is_null bit vektor
         drb_values->requested = true;
-        drb_values->inUnion = json_object_get_boolean(json_object_array_get_idx(inUnion, t));
+        drb_values->pending = false;
+        drb_values->inUnion = resp->inUnion[t];
         if (drb_values->inUnion)
             sumInUnion += 1;
-        // Datum attr = drb_values->joinValues[0];
-        // const char *c = DatumGetCString(FunctionCall1(&(expansion->outFunctions)[0], attr));
-        // printf("value %s is in union: %d\n", c, drb_values->inUnion);
         t++;
     }
     if (dbstate->db_num_cands == 0) {
     	dbstate->db_num_cands = 1; // we added one NULL candidate
     }
 
-    expansion->union_selectivity = sumInUnion / t;
+    if (t > 0)
+        expansion->union_selectivity = (expansion->union_selectivity * num_prev + sumInUnion)
+                                        / (num_prev + t);
+    dbstate->db_tuples_requested += t;
 
-    explanation = json_object_object_get(obj, EXPLANATION);
-    merge_explain_data(explanation);
-    json_object_put(obj);
-    return 0;
+    drillbeyond_store_cache(dbstate, entries, selectivities, cand_length);
+    dbstate->db_instr->merge_ms += drillbeyond_elapsed_ms(start);
+
+    // only the first response of an operator contributes to the explanation
+    if (num_prev == dbstate->db_cache_hits)
+        merge_explain_data(resp->explanation);
 }
 
-extern json_object* serialize_restrictlist(List *restrictlist) {
+/*
+ * Renders the restrictions on the open attribute for the EA service, one
+ * string per restriction, with the open attribute left implicit:
+ *
+ *    op const                     e.g. "> 5", for "x > 5" and "5 < x"
+ *    between a and b              for "x >= a AND x <= b", e.g. from BETWEEN
+ *    in (a, b, ...)               for "x IN (...)", "x = ANY (...)"
+ *    not in (a, b, ...)           for "x NOT IN (...)", "x <> ALL (...)"
+ *    (r) and (r), (r) or (r), not (r)
+ *
+ * A cast of the open attribute counts as the attribute itself. The service
+ * only answers for entities that can pass, so what is sent must never be
+ * stricter than the restriction: an AND arm that cannot be rendered is left
+ * out, an OR or NOT that cannot be rendered completely is not sent at all.
+ * Either way, the restrictions are still evaluated locally.
+ */
+static json_object* serialize_restrictlist(List *restrictlist) {
     ListCell *c;
-    // List *simpleRestrictions = NIL;
     json_object *result = json_object_new_array();
+
     foreach(c, restrictlist) {
-        RestrictInfo *rinfo;
-        OpExpr *opExpression = NULL;
-        char *operatorName = NULL;
-        NodeTag expressionType = T_Invalid;
-        Expr *expression;
-
-        if (nodeTag(lfirst(c)) == T_RestrictInfo) {
-        	rinfo = (RestrictInfo *) lfirst(c);
-        	expression = rinfo->clause;
-        } else {
-        	expression = (Expr *) lfirst(c);
-        }
+        bool exact = true;
+        char *rest_str = restriction_to_string((Node *) lfirst(c), &exact);
 
-        /* we only support operator expressions */
-        expressionType = nodeTag(expression);
-        if (expressionType != T_OpExpr)
-        {
-            continue;
-        }
-        opExpression = (OpExpr *) expression;
-        operatorName = get_opname(opExpression->opno);
-        if (is_simple_restriction(opExpression->args)) {
-            json_object *rest_str = json_object_new_string(simple_restriction_to_string((Node *) expression));
-            json_object_array_add(result, rest_str);
-        }
-            // simpleRestrictions = lappend(simpleRestrictions, expression);
+        if (rest_str != NULL)
+            json_object_array_add(result, json_object_new_string(rest_str));
     }
-    // if (list_length(simpleRestrictions) > 0) {
-        // return simple_restriction_to_string((Node *) simpleRestrictions);
-    // }
     return result;
 }
 
-static bool is_simple_restriction(List *argumentList)
+/*
+ * Whether expr is the open attribute, maybe behind a cast.
+ */
+static bool is_open_attribute(Node *expr)
 {
-    ListCell *c;
-    int foundConst = 0;
-    int foundVar = 0;
-    int foundOther = 0;
+    for (;;) {
+        if (expr == NULL)
+            return false;
+        if (IsA(expr, RelabelType))
+            expr = (Node *) ((RelabelType *) expr)->arg;
+        else if (IsA(expr, FuncExpr) &&
+                 ((FuncExpr *) expr)->funcformat == COERCE_IMPLICIT_CAST &&
+                 list_length(((FuncExpr *) expr)->args) == 1)
+            expr = (Node *) linitial(((FuncExpr *) expr)->args);
+        else
+            return IsA(expr, Var);
+    }
+}
 
-    foreach(c, argumentList)
-    {
-        Expr *argument = (Expr *) lfirst(c);
-        switch (nodeTag(argument)) {
-            case T_Var:
-                foundVar++;
-                break;
-            case T_Const:
-                foundConst++;
-                break;
-            default:
-                foundOther++;
-                break;
+static char* const_to_string(Oid type, Datum value, bool isnull)
+{
+    Oid         typoutput;
+    bool        typIsVarlena;
+
+    if (isnull)
+        return "NULL";
+    getTypeOutputInfo(type, &typoutput, &typIsVarlena);
+    return OidOutputFunctionCall(typoutput, value);
+}
+
+/*
+ * "op const" for an operator between the open attribute and a constant, on
+ * either side. NULL if it is anything else.
+ */
+static char* operator_restriction(Oid opno, List *args)
+{
+    Node *left, *right;
+    Const *c;
+    StringInfoData result;
+
+    if (list_length(args) != 2)
+        return NULL;
+    left = (Node *) linitial(args);
+    right = (Node *) lsecond(args);
+    if (is_open_attribute(left) && IsA(right, Const))
+        c = (Const *) right;
+    else if (is_open_attribute(right) && IsA(left, Const)) {
+        // "5 < x" is sent as "> 5"
+        opno = get_commutator(opno);
+        if (!OidIsValid(opno))
+            return NULL;
+        c = (Const *) left;
+    } else
+        return NULL;
+
+    initStringInfo(&result);
+    appendStringInfo(&result, "%s %s", get_opname(opno),
+                     const_to_string(c->consttype, c->constvalue, c->constisnull));
+    return result.data;
+}
+
+/*
+ * "in (...)" for "x = ANY (...)" and "not in (...)" for "x <> ALL (...)",
+ * over an array constant or a list of constants.
+ */
+static char* array_restriction(const ScalarArrayOpExpr *expr)
+{
+    Node *left, *right;
+    char *opname;
+    StringInfoData result;
+    bool first = true;
+
+    if (list_length(expr->args) != 2)
+        return NULL;
+    left = (Node *) linitial(expr->args);
+    right = (Node *) lsecond(expr->args);
+    if (!is_open_attribute(left))
+        return NULL;
+    opname = get_opname(expr->opno);
+    if (opname == NULL)
+        return NULL;
+
+    initStringInfo(&result);
+    if (expr->useOr && strcmp(opname, "=") == 0)
+        appendStringInfoString(&result, "in (");
+    else if (!expr->useOr && strcmp(opname, "<>") == 0)
+        appendStringInfoString(&result, "not in (");
+    else
+        return NULL;
+
+    if (IsA(right, Const) && !((Const *) right)->constisnull) {
+        ArrayType *array = DatumGetArrayTypeP(((Const *) right)->constvalue);
+        Oid elemtype = ARR_ELEMTYPE(array);
+        int16 elmlen;
+        bool elmbyval;
+        char elmalign;
+        Datum *elems;
+        bool *nulls;
+        int num_elems, i;
+
+        get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+        deconstruct_array(array, elemtype, elmlen, elmbyval, elmalign,
+                          &elems, &nulls, &num_elems);
+        for (i = 0; i < num_elems; i++) {
+            appendStringInfo(&result, "%s%s", first ? "" : ", ",
+                             const_to_string(elemtype, elems[i], nulls[i]));
+            first = false;
         }
-    }
+    } else if (IsA(right, ArrayExpr)) {
+        ListCell *lc;
+
+        foreach(lc, ((ArrayExpr *) right)->elements) {
+            Const *c = (Const *) lfirst(lc);
 
-    return (foundVar == 1) && (foundConst == 1) && (foundOther == 0);
+            if (!IsA(c, Const))
+                return NULL;
+            appendStringInfo(&result, "%s%s", first ? "" : ", ",
+                             const_to_string(c->consttype, c->constvalue, c->constisnull));
+            first = false;
+        }
+    } else
+        return NULL;
+    appendStringInfoChar(&result, ')');
+    return result.data;
 }
 
-static char* simple_restriction_to_string(const Node *expr)
+/*
+ * Renders expr as described at serialize_restrictlist. Returns NULL if it
+ * cannot be rendered; clears *exact if what is returned is weaker than expr.
+ */
+static char* restriction_to_string(Node *expr, bool *exact)
 {
     if (expr == NULL)
-    {
         return NULL;
-    }
 
-    if (IsA(expr, Var)) // there can be only one var
-    {
-        return NULL;
-    }
-    else if (IsA(expr, Const))
+    if (IsA(expr, RestrictInfo))
+        return restriction_to_string((Node *) ((RestrictInfo *) expr)->clause, exact);
+    else if (IsA(expr, OpExpr))
+        return operator_restriction(((OpExpr *) expr)->opno, ((OpExpr *) expr)->args);
+    else if (IsA(expr, ScalarArrayOpExpr))
+        return array_restriction((ScalarArrayOpExpr *) expr);
+    else if (IsA(expr, BoolExpr))
     {
-        const Const *c = (const Const *) expr;
-        Oid         typoutput;
-        bool        typIsVarlena;
-        char       *outputstr;
-
-        if (c->constisnull)
-        {
-            return "NULL";
+        const BoolExpr *b = (const BoolExpr *) expr;
+        StringInfoData result;
+        List *args = NIL;
+        ListCell *lc;
+        char *arg;
+
+        if (b->boolop == NOT_EXPR) {
+            bool arg_exact = true;
+
+            arg = restriction_to_string((Node *) linitial(b->args), &arg_exact);
+            if (arg == NULL || !arg_exact)
+                return NULL;
+            initStringInfo(&result);
+            appendStringInfo(&result, "not (%s)", arg);
+            return result.data;
         }
 
-        getTypeOutputInfo(c->consttype,
-                          &typoutput, &typIsVarlena);
-        outputstr = OidOutputFunctionCall(typoutput, c->constvalue);
-        return outputstr;
+        foreach(lc, b->args) {
+            arg = restriction_to_string((Node *) lfirst(lc), exact);
+            if (arg != NULL)
+                args = lappend(args, arg);
+            else if (b->boolop == AND_EXPR)
+                *exact = false; // leaving out an AND arm only admits more
+            else
+                return NULL;
+        }
+        if (args == NIL)
+            return NULL;
+        if (list_length(args) == 1)
+            return (char *) linitial(args);
+
+        initStringInfo(&result);
+        // x >= a AND x <= b, as BETWEEN is parsed
+        if (b->boolop == AND_EXPR && list_length(args) == 2 &&
+            strncmp((char *) linitial(args), ">= ", 3) == 0 &&
+            strncmp((char *) lsecond(args), "<= ", 3) == 0) {
+            appendStringInfo(&result, "between %s and %s",
+                             (char *) linitial(args) + 3, (char *) lsecond(args) + 3);
+            return result.data;
+        }
+        foreach(lc, args) {
+            if (lc != list_head(args))
+                appendStringInfoString(&result, b->boolop == AND_EXPR ? " and " : " or ");
+            appendStringInfo(&result, "(%s)", (char *) lfirst(lc));
+        }
+        return result.data;
     }
-    else if (IsA(expr, OpExpr))
-    {
-        const OpExpr *e = (const OpExpr *) expr;
-        char       *opname, *left, *right, *result;
-        Assert(list_length(e->args) > 1);
-
-        opname = get_opname(e->opno);
-        left = simple_restriction_to_string(get_leftop((const Expr *) e));
-        right = simple_restriction_to_string(get_rightop((const Expr *) e));
-        if (right == NULL) // one of them has to be the constant, switch if necessary
-            right = left;
-        result = palloc(strlen(right) + 2 + 1);
-        sprintf(result, "%s %s", opname, right);
-        return result;
-    }
-    else if (IsA(expr, RestrictInfo))
-    {
-        const RestrictInfo *rinfo = (const RestrictInfo *) expr;
-        return simple_restriction_to_string((Node *) rinfo->clause);
-    }
-    // else if (IsA(expr, List)) {
-    //     ListCell *c;
-    //     List *list = (List *) expr;
-    //     Node *node;
-    //     StringInfo s = makeStringInfo();
-    //     appendStringInfoChar(s, '[');
-    //     foreach(c, list) {
-    //         node = lfirst(c);
-    //         appendStringInfoString(s, simple_restriction_to_string(node));
-    //         if (lnext(c))
-    //             appendStringInfoChar(s, ',');
-    //     }
-    //     appendStringInfoChar(s, ']');
-    //     char *result = s->data;
-    //     pfree(s);
-    //     return result;
-    // }
-    else
-        Assert(false);
     return NULL;
 }
 
-
-static json_object* send_request(const char *url, const char *msg_str) {
-    CURL            *curl;
-    CURLcode        ret;
-    char            curl_error_buffer[CURL_ERROR_SIZE+1]    = {0};
-    struct curl_slist   *curl_opts = NULL;
-    json_object *obj;
-    StringInfo buffer = makeStringInfo();
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    initStringInfo(buffer);
-
-    curl = curl_easy_init();
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_error_buffer);
-    curl_easy_setopt(curl, CURLOPT_POST, 1);
-    curl_opts = curl_slist_append(curl_opts, "Content-type:");
-    curl_opts = curl_slist_append(curl_opts, "application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curl_opts);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_str);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data_to_buffer);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
-
-    // struct timeval  tv;
-    // gettimeofday(&tv, NULL);
-    // double time_in_mill =
-    //      (tv.tv_sec) * 1000 + (tv.tv_usec) / 1000;
-    ret = curl_easy_perform(curl);
-    //     gettimeofday(&tv, NULL);
-    // double time_in_mill2 =
-    //      (tv.tv_sec) * 1000 + (tv.tv_usec) / 1000;
-    // printf("time for req: %f", time_in_mill2-time_in_mill);
-
-    curl_easy_cleanup(curl);
-    if(ret) {
-        ereport(ERROR,
-            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
-            errmsg("Can't get a response from server: %s", curl_error_buffer)
-            ));
-    }
-    if(curl_opts)
-        curl_slist_free_all(curl_opts);
-
-    obj = json_tokener_parse(buffer->data);
+static json_object* parse_json_response(StringInfo buffer) {
+    json_object *obj = json_tokener_parse(buffer->data);
     if(obj == NULL) {
         ereport(ERROR,
             (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
@@ -328,6 +538,24 @@ static json_object* send_request(const char *url, const char *msg_str) {
     return obj;
 }
 
+static DrillBeyondResponse *parse_response(StringInfo buffer, bool binary, int num_rows,
+                                           DrillBeyondInstrumentation *instr) {
+    DrillBeyondResponse *resp;
+    json_object *obj;
+    instr_time start;
+
+    INSTR_TIME_SET_CURRENT(start);
+    if (binary)
+        resp = drillbeyond_binary_response(buffer);
+    else {
+        obj = parse_json_response(buffer);
+        resp = drillbeyond_json_response(obj, num_rows);
+        json_object_put(obj);
+    }
+    instr->parse_ms += drillbeyond_elapsed_ms(start);
+    return resp;
+}
+
 extern void add_restrictions_to_msg(json_object *msg, List* restrictions)
 {
     json_object *restriction_array;
@@ -339,50 +567,92 @@ extern void add_restrictions_to_msg(json_object *msg, List* restrictions)
     if (drb_enable_send_isnumeric_constraint) {
         json_object_array_add(restriction_array, json_object_new_string("isNumeric()"));
     }
+    // with preselection, values of entities outside the union are never
+    // used, the service may leave them out (null)
+    if (drb_enable_preselection && json_object_array_length(restriction_array) > 0) {
+        json_object_array_add(restriction_array, json_object_new_string("inUnionOnly()"));
+    }
 
 	json_object_object_add(msg, RESTRICTIONS, restriction_array);
 }
 
-extern void tup_to_json(DrillBeyondExpansion *expansion, List *join_cols, TupleTableSlot *slot, json_object *msg)
+/*
+ * Adds the join values of the tuple to the results hashtable.
+ * Returns true if they were not seen before.
+ */
+extern bool tup_to_json(DrillBeyondExpansion *expansion, List *join_cols, TupleTableSlot *slot, json_object *msg)
 {
     Datum       origattr;                                                                   //Datum is an unsigned int
     int i;
     bool isnull;
+    bool found;
     int num_join_cols = list_length(join_cols);
 
     Datum *keys = (Datum *)palloc(sizeof(Datum) * num_join_cols);
-    HeapTuple htup = ExecCopySlotTuple(slot);
     for (i = 0; i < num_join_cols; ++i)
     {
         Var *var = (Var *)list_nth(join_cols, i);                                       //get the varattno
-        origattr = heap_getattr(htup, var->varattno, slot->tts_tupleDescriptor, &isnull);   //get the attribute with varattno out of the slot
+        origattr = slot_getattr(slot, var->varattno, &isnull);                            //get the attribute with varattno out of the slot
         if (isnull) {                                                                       //no original attribute? Can this happen?
             keys[i] = 0;
         } else {
             keys[i] = origattr;                                                             //set the key
         }
     }
-    drb_addToHashTable(expansion, keys, NULL, 0);                                           //add the expansion to hash table with keys (?)
+    drb_addToHashTable(expansion, keys, &found);                                           //the entry copies the keys
+    pfree(keys);
+    return !found;
 }
 
-extern bool drillbeyond_fill_msg(DrillBeyondExpansion *expansion, json_object *msg) {
+/*
+ * Returns all join values that were neither answered nor are part of a
+ * streamed request, in hashtable order, and marks them as pending.
+ * Returns NIL if there is nothing worth requesting, i.e. all of them are null.
+ */
+extern List *drillbeyond_collect_entries(DrillBeyondExpansion *expansion) {
+    int num_join_cols = list_length(expansion->join_cols);
+    int         i;
+    uint32      pos = 0;
+    DrillBeyondValues *values;
+    List       *entries = NIL;
+    bool       unrequestedEntries = false;
+
+    while ((values = drb_iterateHashTable(expansion->results_hashtable, &pos)) != NULL) {
+
+        if (values->requested || values->pending)
+            continue;
+
+        for (i = 0; i < num_join_cols; i++) {
+            if (values->joinValues[i] != 0)
+                unrequestedEntries = true;
+        }
+        values->pending = true;
+        entries = lappend(entries, values);
+    }
+    if (!unrequestedEntries) {
+        ListCell *lc;
+        foreach(lc, entries)
+            ((DrillBeyondValues *) lfirst(lc))->pending = false;
+        list_free(entries);
+        return NIL;
+    }
+    return entries;
+}
+
+/*
+ * Serializes the join values of entries into the columns of msg.
+ */
+static void entries_to_json(DrillBeyondExpansion *expansion, List *entries, json_object *msg) {
     int num_join_cols = list_length(expansion->join_cols);
     int         i;
-    void        *ptr;
     Datum       attr;
     char       *value;
     json_object *col_array, *col;
-    HASH_SEQ_STATUS seq_status;
-    int num_tuples = 0;
-    bool       unrequestedEntries = false;
+    ListCell   *lc;
 
     col_array = json_object_object_get(msg, COLUMNS);
-    hash_seq_init(&seq_status, expansion->results_hashtable);
-    while((ptr = hash_seq_search(&seq_status)) != NULL) {
-        DrillBeyondValues *values = (DrillBeyondValues *)ptr;
-
-        if (values->requested)
-            continue;
+    foreach(lc, entries) {
+        DrillBeyondValues *values = (DrillBeyondValues *) lfirst(lc);
 
         for (i = 0; i < num_join_cols; i++) {
             col = json_object_array_get_idx(col_array, i);
@@ -394,7 +664,6 @@ extern bool drillbeyond_fill_msg(DrillBeyondExpansion *expansion, json_object *m
                 attr = PointerGetDatum(PG_DETOAST_DATUM(attr));
                 value = DatumGetCString(FunctionCall1(&(expansion->outFunctions)[i], attr));
                 json_object_array_add(col, json_object_new_string(value));
-                unrequestedEntries = true;
                 pfree(value);
             }
 
@@ -402,9 +671,250 @@ extern bool drillbeyond_fill_msg(DrillBeyondExpansion *expansion, json_object *m
             if (DatumGetPointer(attr) != DatumGetPointer(values->joinValues[i]))
                 pfree(DatumGetPointer(attr));
         }
-        num_tuples++;
     }
-    return unrequestedEntries;
+}
+
+/*
+ * Streaming
+ *
+ * Sends all join values collected since the last batch as one request on the
+ * backend's multi handle and returns immediately. Responses are merged into
+ * the results hashtable by drillbeyond_poll_requests.
+ */
+extern void drillbeyond_stream_batch(DrillBeyondState *dbstate) {
+    stream_batch(dbstate, true);
+}
+
+/*
+ * If another backend has the same request in flight and follow is set, the
+ * batch is not sent but follows that request: drillbeyond_poll_requests
+ * streams what the cache can't answer once it is done.
+ */
+static void stream_batch(DrillBeyondState *dbstate, bool follow) {
+    DrillBeyond *plan = (DrillBeyond *) dbstate->js.ps.plan;
+    DrillBeyondRequestBatch *batch;
+    DrillBeyondInflight *inflight;
+    MemoryContext oldcontext;
+    StringInfoData body;
+    List *entries;
+    bool binary;
+    bool coalesced;
+
+    drillbeyond_lookup_cache(dbstate);
+    entries = drillbeyond_collect_entries(plan->drb_expansion);
+    dbstate->db_unsent_keys = 0;
+    if (entries == NIL)
+        return;
+    if (drb_worker_count > 0)
+        drillbeyond_worker_cache_miss(entries);
+
+    initStringInfo(&body);
+    binary = build_request(&body, plan->drb_expansion, entries, dbstate->db_instr);
+    inflight = drillbeyond_inflight_begin(plan->drb_expansion, drillbeyond_url(binary), &body, follow, &coalesced);
+
+    if (multi_handle == NULL) {
+        multi_handle = drillbeyond_http_multi();
+        RegisterXactCallback(drb_streaming_xact_callback, NULL);
+    }
+
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    batch = (DrillBeyondRequestBatch *) palloc0(sizeof(DrillBeyondRequestBatch));
+    initStringInfo(&batch->response);
+    if (!coalesced)
+        batch->headers = curl_slist_append(NULL, binary ? "Content-type: " DRB_BINARY_CONTENT_TYPE
+                                                        : "Content-type: application/json");
+    inflight_batches = lappend(inflight_batches, batch);
+    MemoryContextSwitchTo(oldcontext);
+
+    batch->owner = dbstate;
+    batch->entries = entries;
+    batch->binary = binary;
+    batch->inflight = inflight;
+    dbstate->db_inflight_batches++;
+
+    if (coalesced) {
+        pfree(body.data);
+        return;
+    }
+
+    count_request(&body, dbstate->db_instr);
+    batch->handle = curl_easy_init();
+    drillbeyond_http_setup(batch->handle);
+    drillbeyond_http_set_url(batch->handle, drillbeyond_url(binary));
+    curl_easy_setopt(batch->handle, CURLOPT_POST, 1);
+    curl_easy_setopt(batch->handle, CURLOPT_HTTPHEADER, batch->headers);
+    curl_easy_setopt(batch->handle, CURLOPT_POSTFIELDSIZE, (long) body.len);
+    curl_easy_setopt(batch->handle, CURLOPT_COPYPOSTFIELDS, body.data); // curl keeps its own copy
+    curl_easy_setopt(batch->handle, CURLOPT_WRITEDATA, &batch->response);
+    curl_easy_setopt(batch->handle, CURLOPT_PRIVATE, batch);
+    pfree(body.data);
+
+    curl_multi_add_handle(multi_handle, batch->handle);
+
+    drillbeyond_poll_requests(dbstate, false);
+}
+
+/*
+ * Drives all transfers on the multi handle and merges finished responses.
+ * With wait, blocks until no request of dbstate is in flight anymore.
+ */
+extern void drillbeyond_poll_requests(DrillBeyondState *dbstate, bool wait) {
+    int running;
+
+    if (multi_handle == NULL)
+        return;
+
+    for (;;)
+    {
+        CURLMsg *info;
+        int queued;
+        ListCell *lc;
+
+        curl_multi_perform(multi_handle, &running);
+
+        while ((info = curl_multi_info_read(multi_handle, &queued)) != NULL) {
+            DrillBeyondRequestBatch *batch;
+            if (info->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(info->easy_handle, CURLINFO_PRIVATE, (char **) &batch);
+            finish_batch(batch, info->data.result);
+        }
+
+        // batches that follow a request of another backend, which is done
+        // or has taken too long
+        foreach(lc, inflight_batches) {
+            DrillBeyondRequestBatch *batch = (DrillBeyondRequestBatch *) lfirst(lc);
+            if (batch->handle == NULL) {
+                bool done = drillbeyond_inflight_done(batch->inflight);
+                if (done || drillbeyond_inflight_expired(batch->inflight)) {
+                    finish_followed_batch(batch, done);
+                    break; // the list changed, the rest is checked next time round
+                }
+            }
+        }
+
+        if (!wait || dbstate->db_inflight_batches == 0)
+            break;
+
+        CHECK_FOR_INTERRUPTS();
+        if (running > 0)
+            curl_multi_wait(multi_handle, NULL, 0, 100, NULL);
+        else
+            pg_usleep(10000L);
+    }
+}
+
+extern void drillbeyond_cancel_requests(DrillBeyondState *dbstate) {
+    ListCell *lc;
+    List *owned = NIL;
+
+    foreach(lc, inflight_batches) {
+        DrillBeyondRequestBatch *batch = (DrillBeyondRequestBatch *) lfirst(lc);
+        if (batch->owner == dbstate)
+            owned = lappend(owned, batch);
+    }
+    foreach(lc, owned) {
+        free_batch((DrillBeyondRequestBatch *) lfirst(lc));
+    }
+    list_free(owned);
+    dbstate->db_inflight_batches = 0;
+}
+
+static void finish_batch(DrillBeyondRequestBatch *batch, CURLcode result) {
+    DrillBeyondState *dbstate = batch->owner;
+    List *entries = batch->entries;
+    bool binary = batch->binary;
+    DrillBeyondResponse *resp;
+    DrillBeyondInflight *inflight;
+    long status = 0;
+    double total_time = 0;
+
+    curl_easy_getinfo(batch->handle, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(batch->handle, CURLINFO_TOTAL_TIME, &total_time);
+    dbstate->db_instr->network_ms += total_time * 1000.0;
+    if (batch->attempts < drb_request_retries && drillbeyond_http_retryable(result, status)) {
+        // send it again, to the next server; curl still has the body
+        curl_multi_remove_handle(multi_handle, batch->handle);
+        resetStringInfo(&batch->response);
+        drillbeyond_http_set_url(batch->handle, drillbeyond_url(binary));
+        batch->attempts++;
+        curl_multi_add_handle(multi_handle, batch->handle);
+        return;
+    }
+
+    dbstate->db_inflight_batches--;
+    if (result != CURLE_OK) {
+        const char *err = curl_easy_strerror(result);
+        free_batch(batch);
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("Can't get a response from server: %s", err)
+            ));
+    }
+
+    if (binary && binary_protocol_rejected(status)) {
+        // send the same join values again, now as JSON
+        free_batch(batch);
+        unmark_pending(entries);
+        dbstate->db_unsent_keys += list_length(entries);
+        list_free(entries);
+        drillbeyond_stream_batch(dbstate);
+        return;
+    }
+
+    dbstate->db_instr->bytes_received += batch->response.len;
+    resp = parse_response(&batch->response, binary, list_length(entries), dbstate->db_instr);
+    // followers look into the cache once the registration ends
+    inflight = batch->inflight;
+    batch->inflight = NULL;
+    free_batch(batch);
+    drillbeyond_process_response(resp, dbstate, entries);
+    drillbeyond_inflight_end(inflight);
+    drillbeyond_free_response(resp);
+    list_free(entries);
+}
+
+/*
+ * The request a batch followed is done and its answers are in the cache, or
+ * it took too long: the rest is streamed once more, without following again.
+ */
+static void finish_followed_batch(DrillBeyondRequestBatch *batch, bool done) {
+    DrillBeyondState *dbstate = batch->owner;
+    List *entries = batch->entries;
+
+    free_batch(batch);
+    dbstate->db_inflight_batches--;
+    if (done)
+        dbstate->db_instr->coalesced++;
+    unmark_pending(entries);
+    dbstate->db_unsent_keys += list_length(entries);
+    list_free(entries);
+    stream_batch(dbstate, false);
+}
+
+static void free_batch(DrillBeyondRequestBatch *batch) {
+    if (batch->handle != NULL) {
+        curl_multi_remove_handle(multi_handle, batch->handle);
+        curl_easy_cleanup(batch->handle);
+    }
+    curl_slist_free_all(batch->headers);
+    drillbeyond_inflight_end(batch->inflight);
+    pfree(batch->response.data);
+    inflight_batches = list_delete_ptr(inflight_batches, batch);
+    pfree(batch);
+}
+
+/*
+ * Batches of a failed query would otherwise stay attached to the multi handle
+ * and deliver their responses into freed executor state.
+ */
+static void drb_streaming_xact_callback(XactEvent event, void *arg) {
+    if (event != XACT_EVENT_ABORT)
+        return;
+    while (inflight_batches != NIL) {
+        DrillBeyondRequestBatch *batch = (DrillBeyondRequestBatch *) linitial(inflight_batches);
+        free_batch(batch);
+    }
 }
 
 //! not used
@@ -445,33 +955,79 @@ extern void heap_tup_to_json(HeapTuple tuple, TupleDesc tupDesc, json_object *ms
     }
 }
 
-extern double estimateSelectivity(DrillBeyondExpansion *expansion, Oid extended_relid, List *restrictlist) {
+/*
+ * Asks the EA service for the selectivity of request, a selectivity request
+ * without sample rows (see drillbeyond_statistics.c), on the given rows.
+ */
+extern double drillbeyond_request_selectivity(const char *request, HeapTuple *rows, int numrows, TupleDesc tupDesc) {
     json_object *req;
     json_object *obj;
-    HeapTuple *samples;
     const char *msg_str;
+    long status;
+    double sel;
+    int i;
+
+    req = json_tokener_parse(request);
+    if (req == NULL)
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("invalid selectivity request: %s", request)
+            ));
+    for (i = 0; i < numrows; ++i)
+    {
+        heap_tup_to_json(rows[i], tupDesc, req);
+    }
+
+    msg_str = json_object_to_json_string_ext(req, JSON_C_TO_STRING_PLAIN);  //convert request data to string
+    obj = parse_json_response(drillbeyond_http_post(SELECTIVITY_PATH, "application/json",
+                                                   msg_str, strlen(msg_str), &status));  //send the JSON request and get a JSON object return
+
+    sel = json_object_get_double(json_object_object_get(obj, SELECTIVITY));
+    json_object_put(obj);
+    json_object_put(req);
+    return sel;
+}
+
+/*
+ * Selectivity of the restrictions on the open attribute of expansion, from
+ * pg_drb_statistic if possible. Returns -1 if it is not known yet.
+ */
+extern double estimateSelectivity(DrillBeyondExpansion *expansion, Oid extended_relid, List *restrictlist) {
+    json_object *req;
+    HeapTuple *samples;
     TupleDesc tupDesc;
+    char *request;
     int numSampleRows;
-    int i;
-    const int numSamples = 25;
+    double sel;
 
     if (expansion->selectivity != -1.0)
         return expansion->selectivity;
 
     req = initDrillBeyondRequest(expansion);
-    json_object_object_add(req, MAX_CANDS, json_object_new_int(numSamples));
-    numSampleRows = drillbeyond_sample_rel(extended_relid, numSamples, &samples, &tupDesc);
-    for (i = 0; i < numSampleRows; ++i)
-    {
-        heap_tup_to_json(samples[i], tupDesc, req);
-    }
-
+    json_object_object_add(req, MAX_CANDS, json_object_new_int(DRB_SELECTIVITY_SAMPLE_SIZE));
     add_restrictions_to_msg(req, restrictlist);
+    request = pstrdup(json_object_to_json_string_ext(req, JSON_C_TO_STRING_PLAIN));
+    json_object_put(req);
+
+    if (drb_enable_selectivity_stats) {
+        bool found = drillbeyond_lookup_selectivity(extended_relid, request, &sel);
+        if (found && sel >= 0.0) {
+            expansion->selectivity = sel;
+            return sel;
+        }
+        // leave it to the next ANALYZE, the planner does not write the catalog
+        if (!found)
+            drillbeyond_record_selectivity_miss(extended_relid, expansion->keyword, request);
+        if (!drb_estimate_selectivity_on_miss) {
+            // planning must not wait for the service
+            pfree(request);
+            return -1.0;
+        }
+    }
 
-    msg_str = json_object_to_json_string_ext(req, JSON_C_TO_STRING_PLAIN);  //convert request data to string
-    obj = send_request(URL_BASE SELECTIVITY_PATH, msg_str);         //send the JSON request and get a JSON object return
-
-    double sel = json_object_get_double(json_object_object_get(obj, SELECTIVITY));
+    numSampleRows = drillbeyond_sample_rel(extended_relid, DRB_SELECTIVITY_SAMPLE_SIZE, &samples, &tupDesc);
+    sel = drillbeyond_request_selectivity(request, samples, numSampleRows, tupDesc);
+    pfree(request);
     expansion->selectivity = sel;
     return sel;
 }
@@ -512,13 +1068,3 @@ extern json_object *initDrillBeyondRequest(DrillBeyondExpansion *expansion) {
 
     return msg;
 }
-
-static size_t
-write_data_to_buffer(void *buffer, size_t size, size_t nmemb, void *userp)
-{
-    StringInfo      b  = (StringInfo)userp;
-    int             s   = size*nmemb;
-    appendBinaryStringInfo(b, buffer, s);
-
-    return s;
-}
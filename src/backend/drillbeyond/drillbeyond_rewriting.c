@@ -25,6 +25,9 @@
 #include "nodes/print.h"
 #include "fmgr.h"
 
+// type of newly opened attributes: float8 instead of numeric
+bool drb_enable_float8_values = false;
+
 static Node * conj_clause(ParseState *pstate, Node *lexpr, Node *rexpr);
 static List * drillbeyond_find_string_attrs(ParseState *pstate, RangeTblEntry *original_rte);
 static void drillbeyond_find_attr_names(ParseState *pstate, RangeTblEntry *original_rte, List **attrNames, List **strAttrNames);
@@ -154,11 +157,15 @@ static RangeTblEntry* create_fake_relation(ParseState* pstate, RangeTblEntry *or
 
     expansion = (DrillBeyondExpansion *) palloc(sizeof(DrillBeyondExpansion));
     expansion->keyword = field_name;
+    expansion->valuetype = drb_enable_float8_values ? FLOAT8OID : NUMERICOID;
     expansion->extended_rti = original_vnum;
     expansion->extended_relname = pstrdup(rel_name);
+    expansion->extended_relid = original_rte->rtekind == RTE_RELATION ? original_rte->relid : InvalidOid;
     expansion->selective = false; //list_length(drb_rel->baserestrictinfo) > 0;
     expansion->aggregative = false;
     expansion->sorting = false;
+    expansion->fanout = false;
+    expansion->fanout_delta = false;
     expansion->join_cols = string_attrs;
     expansion->drb_qual = NIL;
     expansion->extended_attrNames = NIL;
@@ -169,6 +176,9 @@ static RangeTblEntry* create_fake_relation(ParseState* pstate, RangeTblEntry *or
     expansion->was_planned = false;
     expansion->query = NULL;
     expansion->reoptimized = false;
+    expansion->actual_rows = -1.0;
+    expansion->actual_distinct = -1.0;
+    expansion->actual_fragment_ms = 0.0;
 
     drillbeyond_find_attr_names(pstate, original_rte,
         &(expansion->extended_attrNames), &(expansion->extended_strAttrNames));
@@ -223,7 +233,7 @@ drillbeyond_column_transform(ParseState *pstate, ColumnRef *cref, Node *var)
     int         vnum,
                 sublevels_up = 0;
     Oid         vartypeid;
-    int32       type_mod = 1700; //"open"
+    int32       type_mod = -1;
     Oid         varcollid = 0; // encoding something
     int attnum = 1;
     RangeTblEntry* fake_rte;
@@ -286,6 +296,7 @@ drillbeyond_column_transform(ParseState *pstate, ColumnRef *cref, Node *var)
         pstate->p_joinlist = lappend(pstate->p_joinlist, rtr);
         pstate->p_relnamespace = list_concat(pstate->p_relnamespace, relnamespace);
         pstate->p_varnamespace = lappend(pstate->p_varnamespace, fake_rte);
+        vartypeid = fake_rte->drb_expansion->valuetype;
         result = (Node*)makeVar(vnum, attnum, vartypeid, type_mod, varcollid, sublevels_up);
 
         // save the new fake relation
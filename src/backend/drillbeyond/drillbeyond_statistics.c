@@ -0,0 +1,394 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_statistics.c
+ *    Persistent selectivity statistics for open attributes.
+ *
+ * Estimating the selectivity of a restriction on an open attribute takes a
+ * sample of the augmented relation and a request to the EA service. Doing
+ * that while planning made planning as slow as a round trip to the service,
+ * every time a statement was planned. The estimates are now kept in the
+ * catalog pg_drb_statistic, one row per (relation, request), where the
+ * request is the selectivity request without its sample rows: keyword,
+ * columns and the serialized restrictions.
+ *
+ * The planner only reads the catalog: writing it would assign an XID while
+ * planning a SELECT, fail on a standby and in read-only transactions, and
+ * let concurrent planners insert the same row twice. For a request it has
+ * not seen before, it notes the request in shared memory and uses the
+ * default selectivity, unless drb_estimate_selectivity_on_miss asks for the
+ * old synchronous estimate. The next ANALYZE of the relation adds rows for
+ * the noted requests, and re-estimates all its rows from the sample it took
+ * anyway. Each request runs in a subtransaction; if it fails, the
+ * row keeps its old estimate and ANALYZE goes on.
+ *
+ * src/backend/drillbeyond/drillbeyond_statistics.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/hash.h"
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_drb_statistic.h"
+#include "drillbeyond/drillbeyond.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/tqual.h"
+
+bool drb_enable_selectivity_stats = false;
+bool drb_estimate_selectivity_on_miss = false;
+
+// requests the planner found no row for, until ANALYZE adds one
+typedef struct DrbMissKey {
+    Oid dbid;
+    Oid relid;
+    int32 hash; // of the request
+} DrbMissKey;
+
+typedef struct DrbMissEntry {
+    DrbMissKey key; // hash key, must be first
+    char keyword[NAMEDATALEN];
+    char request[DRB_SELECTIVITY_REQUEST_LEN];
+} DrbMissEntry;
+
+static HTAB *drb_miss_hash = NULL;
+
+static int32 request_hash(const char *request);
+static void add_missed_requests(Oid relid);
+static SysScanDesc begin_scan(Relation rel, Oid relid, const char *request);
+static bool matches_request(Relation rel, HeapTuple tuple, const char *request);
+
+/*
+ * DrbSelectivityShmemSize --- report amount of shared memory space needed
+ */
+Size
+DrbSelectivityShmemSize(void)
+{
+    return hash_estimate_size(DRB_SELECTIVITY_MAX_MISSES, sizeof(DrbMissEntry));
+}
+
+/*
+ * DrbSelectivityShmemInit --- initialize this module's shared memory
+ */
+void
+DrbSelectivityShmemInit(void)
+{
+    HASHCTL info;
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(DrbMissKey);
+    info.entrysize = sizeof(DrbMissEntry);
+    info.hash = tag_hash;
+    drb_miss_hash = ShmemInitHash("DrillBeyond Selectivity Misses",
+                                  DRB_SELECTIVITY_MAX_MISSES, DRB_SELECTIVITY_MAX_MISSES,
+                                  &info,
+                                  HASH_ELEM | HASH_FUNCTION);
+}
+
+static int32 request_hash(const char *request) {
+    return DatumGetInt32(hash_any((const unsigned char *) request, strlen(request)));
+}
+
+/*
+ * Scans the rows of relid, all of them if request is NULL, otherwise those
+ * with the hash of request.
+ */
+static SysScanDesc begin_scan(Relation rel, Oid relid, const char *request) {
+    ScanKeyData key[2];
+
+    ScanKeyInit(&key[0],
+                Anum_pg_drb_statistic_drbrelid,
+                BTEqualStrategyNumber, F_OIDEQ,
+                ObjectIdGetDatum(relid));
+    if (request != NULL)
+        ScanKeyInit(&key[1],
+                    Anum_pg_drb_statistic_drbhash,
+                    BTEqualStrategyNumber, F_INT4EQ,
+                    Int32GetDatum(request_hash(request)));
+    return systable_beginscan(rel, DrbStatisticRelidHashIndexId, true,
+                              SnapshotNow, request != NULL ? 2 : 1, key);
+}
+
+static bool matches_request(Relation rel, HeapTuple tuple, const char *request) {
+    bool isnull;
+    Datum d = heap_getattr(tuple, Anum_pg_drb_statistic_drbrequest, RelationGetDescr(rel), &isnull);
+    char *stored;
+    bool result;
+
+    if (isnull)
+        return false;
+    stored = TextDatumGetCString(d);
+    result = strcmp(stored, request) == 0;
+    pfree(stored);
+    return result;
+}
+
+/*
+ * Looks up the estimate for request on relid. Returns false if there is no
+ * row for it; *sel is -1 if there is one, but it was not estimated yet.
+ */
+extern bool drillbeyond_lookup_selectivity(Oid relid, const char *request, double *sel) {
+    Relation rel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+    bool found = false;
+
+    rel = heap_open(DrbStatisticRelationId, AccessShareLock);
+    scan = begin_scan(rel, relid, request);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+        if (!matches_request(rel, tuple, request))
+            continue;
+        *sel = ((Form_pg_drb_statistic) GETSTRUCT(tuple))->drbselectivity;
+        found = true;
+        break;
+    }
+    systable_endscan(scan);
+    heap_close(rel, AccessShareLock);
+    return found;
+}
+
+/*
+ * Notes that the planner found no row for request on relid, for the next
+ * ANALYZE of relid. Requests too long for the table, or arriving while it
+ * is full, are not noted; the planner notes them again later.
+ */
+extern void drillbeyond_record_selectivity_miss(Oid relid, const char *keyword, const char *request) {
+    DrbMissEntry *entry;
+    DrbMissKey key;
+    bool found;
+
+    if (drb_miss_hash == NULL || strlen(request) >= DRB_SELECTIVITY_REQUEST_LEN)
+        return;
+
+    MemSet(&key, 0, sizeof(key)); // compared with memcmp
+    key.dbid = MyDatabaseId;
+    key.relid = relid;
+    key.hash = request_hash(request);
+
+    LWLockAcquire(DrillBeyondSelectivityLock, LW_EXCLUSIVE);
+    entry = (DrbMissEntry *) hash_search(drb_miss_hash, &key, HASH_ENTER_NULL, &found);
+    if (entry != NULL && !found) {
+        strlcpy(entry->keyword, keyword, NAMEDATALEN);
+        strlcpy(entry->request, request, DRB_SELECTIVITY_REQUEST_LEN);
+    }
+    LWLockRelease(DrillBeyondSelectivityLock);
+}
+
+/*
+ * Takes the requests noted for relid, and adds rows without an estimate for
+ * them. ANALYZE locks relid against concurrent ANALYZEs, so no row is added
+ * twice.
+ */
+static void add_missed_requests(Oid relid) {
+    HASH_SEQ_STATUS status;
+    DrbMissEntry *entry;
+    List *missed = NIL;
+    ListCell *lc;
+    double sel;
+
+    if (drb_miss_hash == NULL)
+        return;
+
+    LWLockAcquire(DrillBeyondSelectivityLock, LW_EXCLUSIVE);
+    hash_seq_init(&status, drb_miss_hash);
+    while ((entry = (DrbMissEntry *) hash_seq_search(&status)) != NULL) {
+        if (entry->key.dbid != MyDatabaseId || entry->key.relid != relid)
+            continue;
+        missed = lappend(missed, pstrdup(entry->keyword));
+        missed = lappend(missed, pstrdup(entry->request));
+        hash_search(drb_miss_hash, &entry->key, HASH_REMOVE, NULL);
+    }
+    LWLockRelease(DrillBeyondSelectivityLock);
+
+    for (lc = list_head(missed); lc != NULL; lc = lnext(lnext(lc))) {
+        char *keyword = (char *) lfirst(lc);
+        char *request = (char *) lfirst(lnext(lc));
+
+        if (!drillbeyond_lookup_selectivity(relid, request, &sel))
+            drillbeyond_store_selectivity(relid, keyword, request, -1.0, 0);
+    }
+    if (missed != NIL)
+        CommandCounterIncrement();
+    list_free_deep(missed);
+}
+
+/*
+ * Records the estimate for request on relid, replacing an older one. Only
+ * ANALYZE calls this. Does nothing where the catalog cannot be written, e.g.
+ * on a standby.
+ */
+extern void drillbeyond_store_selectivity(Oid relid, const char *keyword, const char *request,
+                                          double sel, int samplesize) {
+    Relation rel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+    Datum values[Natts_pg_drb_statistic];
+    bool nulls[Natts_pg_drb_statistic];
+    bool replaces[Natts_pg_drb_statistic];
+    bool stored = false;
+
+    if (RecoveryInProgress() || XactReadOnly)
+        return;
+
+    memset(nulls, false, sizeof(nulls));
+    memset(replaces, false, sizeof(replaces));
+    values[Anum_pg_drb_statistic_drbrelid - 1] = ObjectIdGetDatum(relid);
+    values[Anum_pg_drb_statistic_drbhash - 1] = Int32GetDatum(request_hash(request));
+    values[Anum_pg_drb_statistic_drbselectivity - 1] = Float4GetDatum((float4) sel);
+    values[Anum_pg_drb_statistic_drbsamplesize - 1] = Int32GetDatum(samplesize);
+    values[Anum_pg_drb_statistic_drbkeyword - 1] = CStringGetTextDatum(keyword);
+    values[Anum_pg_drb_statistic_drbrequest - 1] = CStringGetTextDatum(request);
+    replaces[Anum_pg_drb_statistic_drbselectivity - 1] = true;
+    replaces[Anum_pg_drb_statistic_drbsamplesize - 1] = true;
+
+    rel = heap_open(DrbStatisticRelationId, RowExclusiveLock);
+    scan = begin_scan(rel, relid, request);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+        HeapTuple newtup;
+
+        if (!matches_request(rel, tuple, request))
+            continue;
+        newtup = heap_modify_tuple(tuple, RelationGetDescr(rel), values, nulls, replaces);
+        simple_heap_update(rel, &newtup->t_self, newtup);
+        CatalogUpdateIndexes(rel, newtup);
+        heap_freetuple(newtup);
+        stored = true;
+    }
+    systable_endscan(scan);
+
+    if (!stored) {
+        tuple = heap_form_tuple(RelationGetDescr(rel), values, nulls);
+        simple_heap_insert(rel, tuple);
+        CatalogUpdateIndexes(rel, tuple);
+        heap_freetuple(tuple);
+    }
+    heap_close(rel, RowExclusiveLock);
+}
+
+/*
+ * Called by ANALYZE with the sample it took of onerel: re-estimates every
+ * request recorded for the relation, or noted by the planner since. A failing request only warns, the rest
+ * of ANALYZE must not depend on the EA service being reachable.
+ */
+extern void drillbeyond_analyze_rel(Relation onerel, HeapTuple *rows, int numrows) {
+    Relation rel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+    HeapTuple *sample;
+    List *tuples = NIL;
+    ListCell *lc;
+    int n, i;
+
+    if (!drb_enable_selectivity_stats || numrows == 0)
+        return;
+
+    // the EA service expects a small sample, spread it over ANALYZE's one
+    n = Min(numrows, DRB_SELECTIVITY_SAMPLE_SIZE);
+    sample = (HeapTuple *) palloc(sizeof(HeapTuple) * n);
+    for (i = 0; i < n; i++)
+        sample[i] = rows[(int) ((double) i * numrows / n)];
+
+    add_missed_requests(RelationGetRelid(onerel));
+
+    rel = heap_open(DrbStatisticRelationId, RowExclusiveLock);
+    scan = begin_scan(rel, RelationGetRelid(onerel), NULL);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+        tuples = lappend(tuples, heap_copytuple(tuple));
+    systable_endscan(scan);
+
+    foreach(lc, tuples) {
+        MemoryContext oldcontext = CurrentMemoryContext;
+        ResourceOwner oldowner = CurrentResourceOwner;
+        Datum values[Natts_pg_drb_statistic];
+        bool nulls[Natts_pg_drb_statistic];
+        bool replaces[Natts_pg_drb_statistic];
+        HeapTuple newtup;
+        char *keyword, *request;
+        bool isnull;
+        double sel;
+
+        tuple = (HeapTuple) lfirst(lc);
+        keyword = TextDatumGetCString(heap_getattr(tuple, Anum_pg_drb_statistic_drbkeyword,
+                                                   RelationGetDescr(rel), &isnull));
+        request = TextDatumGetCString(heap_getattr(tuple, Anum_pg_drb_statistic_drbrequest,
+                                                   RelationGetDescr(rel), &isnull));
+
+        // the request runs in a subtransaction, so that its failure can be
+        // survived; anything but a failed request, e.g. a cancel, is re-thrown
+        BeginInternalSubTransaction(NULL);
+        MemoryContextSwitchTo(oldcontext);
+        PG_TRY();
+        {
+            sel = drillbeyond_request_selectivity(request, sample, n, RelationGetDescr(onerel));
+            ReleaseCurrentSubTransaction();
+            MemoryContextSwitchTo(oldcontext);
+            CurrentResourceOwner = oldowner;
+        }
+        PG_CATCH();
+        {
+            ErrorData *edata;
+
+            MemoryContextSwitchTo(oldcontext);
+            edata = CopyErrorData();
+            FlushErrorState();
+            RollbackAndReleaseCurrentSubTransaction();
+            MemoryContextSwitchTo(oldcontext);
+            CurrentResourceOwner = oldowner;
+
+            if (edata->sqlerrcode != ERRCODE_DRILLBEYOND_REQUEST_FAILED)
+                ReThrowError(edata);
+            ereport(WARNING,
+                (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+                errmsg("could not estimate selectivity of \"%s\" on \"%s\": %s",
+                       keyword, RelationGetRelationName(onerel), edata->message)));
+            FreeErrorData(edata);
+            sel = -1.0;
+        }
+        PG_END_TRY();
+
+        if (sel >= 0.0) {
+            memset(nulls, false, sizeof(nulls));
+            memset(replaces, false, sizeof(replaces));
+            values[Anum_pg_drb_statistic_drbselectivity - 1] = Float4GetDatum((float4) sel);
+            values[Anum_pg_drb_statistic_drbsamplesize - 1] = Int32GetDatum(n);
+            replaces[Anum_pg_drb_statistic_drbselectivity - 1] = true;
+            replaces[Anum_pg_drb_statistic_drbsamplesize - 1] = true;
+            newtup = heap_modify_tuple(tuple, RelationGetDescr(rel), values, nulls, replaces);
+            simple_heap_update(rel, &newtup->t_self, newtup);
+            CatalogUpdateIndexes(rel, newtup);
+            heap_freetuple(newtup);
+        }
+        pfree(keyword);
+        pfree(request);
+    }
+    list_free_deep(tuples);
+    pfree(sample);
+    heap_close(rel, RowExclusiveLock);
+}
+
+/*
+ * Removes the statistics of a relation that is dropped.
+ */
+extern void RemoveDrillBeyondStatistics(Oid relid) {
+    Relation rel;
+    SysScanDesc scan;
+    HeapTuple tuple;
+
+    rel = heap_open(DrbStatisticRelationId, RowExclusiveLock);
+    scan = begin_scan(rel, relid, NULL);
+    while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+        simple_heap_delete(rel, &tuple->t_self);
+    systable_endscan(scan);
+    heap_close(rel, RowExclusiveLock);
+}
@@ -0,0 +1,238 @@
+/*-------------------------------------------------------------------------
+ *
+ * drillbeyond_wire.c
+ *    Wire formats for requests to and responses from the EA service.
+ *
+ * Besides the JSON messages built in drillbeyond_requests.c, requests can be
+ * sent in a compact binary format (drb_enable_binary_protocol). All integers
+ * are in network byte order, strings are length-prefixed, length -1 is NULL.
+ *
+ * Request:
+ *    int32 magic, int32 version
+ *    string keyword, string local table, int32 max_cands
+ *    int32 n, n strings restrictions
+ *    int32 n, n strings column names
+ *    int32 n, n strings string column names
+ *    int32 number of join columns, int32 number of entities
+ *    one block per join column: the values of all entities as strings
+ *
+ * Response:
+ *    int32 magic, int32 number of candidates, int32 number of entities
+ *    per candidate: float8 selectivity, null bitmap, float8 values
+ *    bitmap inUnion
+ *    string explanation (JSON, optional)
+ *
+ * Bitmaps have one bit per entity, least significant bit first. Both
+ * formats are decoded into a DrillBeyondResponse, which is what
+ * drillbeyond_requests.c merges into the results hashtable.
+ *
+ * src/backend/drillbeyond/drillbeyond_wire.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "drillbeyond/drillbeyond.h"
+#include "libpq/pqformat.h"
+
+#define DRB_WIRE_MAGIC 0x44524231 // "DRB1"
+#define DRB_WIRE_VERSION 1
+
+static void send_wire_string(StringInfo buf, const char *str);
+static char *get_wire_string(StringInfo buf);
+static void send_string_list(StringInfo buf, List *strings);
+
+static void send_wire_string(StringInfo buf, const char *str) {
+    int len;
+
+    if (str == NULL) {
+        pq_sendint(buf, -1, 4);
+        return;
+    }
+    len = strlen(str);
+    pq_sendint(buf, len, 4);
+    pq_sendbytes(buf, str, len);
+}
+
+static char *get_wire_string(StringInfo buf) {
+    int len = (int) pq_getmsgint(buf, 4);
+    char *str;
+
+    if (len < 0)
+        return NULL;
+    str = palloc(len + 1);
+    pq_copymsgbytes(buf, str, len);
+    str[len] = '\0';
+    return str;
+}
+
+static void send_string_list(StringInfo buf, List *strings) {
+    ListCell *c;
+
+    pq_sendint(buf, list_length(strings), 4);
+    foreach(c, strings)
+        send_wire_string(buf, strVal((Value *) lfirst(c)));
+}
+
+/*
+ * Serializes a request for the join values of entries into buf.
+ */
+extern void drillbeyond_binary_request(StringInfo buf, DrillBeyondExpansion *expansion, List *entries) {
+    int num_join_cols = list_length(expansion->join_cols);
+    json_object *msg, *restrictions;
+    ListCell *lc;
+    int i, n;
+
+    pq_sendint(buf, DRB_WIRE_MAGIC, 4);
+    pq_sendint(buf, DRB_WIRE_VERSION, 4);
+    send_wire_string(buf, expansion->keyword);
+    send_wire_string(buf, expansion->extended_relname);
+    pq_sendint(buf, drb_max_num_cands, 4);
+
+    // restrictions are rendered to strings the same way as for JSON requests
+    msg = json_object_new_object();
+    add_restrictions_to_msg(msg, expansion->drb_qual);
+    restrictions = json_object_object_get(msg, RESTRICTIONS);
+    n = json_object_array_length(restrictions);
+    pq_sendint(buf, n, 4);
+    for (i = 0; i < n; i++)
+        send_wire_string(buf, json_object_get_string(json_object_array_get_idx(restrictions, i)));
+    json_object_put(msg);
+
+    send_string_list(buf, expansion->extended_attrNames);
+    send_string_list(buf, expansion->extended_strAttrNames);
+
+    // join values, one block per column
+    pq_sendint(buf, num_join_cols, 4);
+    pq_sendint(buf, list_length(entries), 4);
+    for (i = 0; i < num_join_cols; i++) {
+        foreach(lc, entries) {
+            DrillBeyondValues *values = (DrillBeyondValues *) lfirst(lc);
+            Datum attr = values->joinValues[i];
+            char *value;
+
+            if (attr == 0) {
+                pq_sendint(buf, -1, 4);
+                continue;
+            }
+            attr = PointerGetDatum(PG_DETOAST_DATUM(attr));
+            value = DatumGetCString(FunctionCall1(&(expansion->outFunctions)[i], attr));
+            send_wire_string(buf, value);
+            pfree(value);
+            if (DatumGetPointer(attr) != DatumGetPointer(values->joinValues[i]))
+                pfree(DatumGetPointer(attr));
+        }
+    }
+}
+
+/*
+ * Decodes a binary response. The matrices are read in one piece each, no
+ * per-value conversion happens here.
+ */
+extern DrillBeyondResponse *drillbeyond_binary_response(StringInfo buf) {
+    DrillBeyondResponse *resp = (DrillBeyondResponse *) palloc0(sizeof(DrillBeyondResponse));
+    int bitmaplen;
+    int i, j;
+    char *explanation;
+
+    buf->cursor = 0;
+    if ((int) pq_getmsgint(buf, 4) != DRB_WIRE_MAGIC)
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("Could not parse server response: invalid binary message")
+            ));
+    resp->num_cands = (int) pq_getmsgint(buf, 4);
+    resp->num_rows = (int) pq_getmsgint(buf, 4);
+    if (resp->num_cands < 0 || resp->num_rows < 0)
+        ereport(ERROR,
+            (errcode(ERRCODE_DRILLBEYOND_REQUEST_FAILED),
+            errmsg("Could not parse server response: invalid dimensions %d x %d",
+                   resp->num_cands, resp->num_rows)
+            ));
+    bitmaplen = BITMAPLEN(resp->num_rows);
+
+    resp->selectivities = (double *) palloc(sizeof(double) * (resp->num_cands + 1));
+    resp->values = (float8 *) palloc(sizeof(float8) * ((Size) resp->num_cands * resp->num_rows + 1));
+    resp->nulls = (bits8 *) palloc((Size) resp->num_cands * bitmaplen + 1);
+    for (i = 0; i < resp->num_cands; i++) {
+        float8 *values = resp->values + (Size) i * resp->num_rows;
+
+        resp->selectivities[i] = pq_getmsgfloat8(buf);
+        pq_copymsgbytes(buf, (char *) resp->nulls + (Size) i * bitmaplen, bitmaplen);
+        for (j = 0; j < resp->num_rows; j++)
+            values[j] = pq_getmsgfloat8(buf);
+    }
+
+    resp->inUnion = (bool *) palloc(sizeof(bool) * (resp->num_rows + 1));
+    {
+        const bits8 *bitmap = (const bits8 *) pq_getmsgbytes(buf, bitmaplen);
+        for (j = 0; j < resp->num_rows; j++)
+            resp->inUnion[j] = (bitmap[j / 8] & (1 << (j % 8))) != 0;
+    }
+
+    explanation = get_wire_string(buf);
+    if (explanation != NULL) {
+        resp->explanation = json_tokener_parse(explanation);
+        pfree(explanation);
+    }
+    return resp;
+}
+
+/*
+ * Converts a parsed JSON response into the format-independent
+ * representation. num_rows is the number of entities that were requested.
+ */
+extern DrillBeyondResponse *drillbeyond_json_response(json_object *obj, int num_rows) {
+    DrillBeyondResponse *resp = (DrillBeyondResponse *) palloc0(sizeof(DrillBeyondResponse));
+    json_object *candidates, *inUnion;
+    int bitmaplen = BITMAPLEN(num_rows);
+    int i, j;
+
+    candidates = json_object_object_get(obj, CANDIDATES);
+    inUnion = json_object_object_get(obj, IN_UNION);
+    if (candidates)
+        resp->num_cands = json_object_array_length(candidates);
+    else {
+        elog(DEBUG1, "DrillBeyond response has no candidates");
+        resp->num_cands = 0;
+    }
+    resp->num_rows = num_rows;
+
+    resp->selectivities = (double *) palloc(sizeof(double) * (resp->num_cands + 1));
+    resp->values = (float8 *) palloc(sizeof(float8) * ((Size) resp->num_cands * num_rows + 1));
+    resp->nulls = (bits8 *) palloc0((Size) resp->num_cands * bitmaplen + 1);
+    for (i = 0; i < resp->num_cands; i++) {
+        json_object *cand = json_object_array_get_idx(candidates, i);
+        json_object *values = json_object_object_get(cand, VALUES);
+        bits8 *nulls = resp->nulls + (Size) i * bitmaplen;
+
+        resp->selectivities[i] = json_object_get_double(json_object_object_get(cand, SELECTIVITY));
+        for (j = 0; j < num_rows; j++) {
+            json_object *val = json_object_array_get_idx(values, j);
+            if (val == NULL || json_object_get_type(val) == json_type_null) {
+                nulls[j / 8] |= (1 << (j % 8));
+                resp->values[(Size) i * num_rows + j] = 0.0;
+            } else
+                resp->values[(Size) i * num_rows + j] = json_object_get_double(val);
+        }
+    }
+
+    resp->inUnion = (bool *) palloc(sizeof(bool) * (num_rows + 1));
+    for (j = 0; j < num_rows; j++)
+        resp->inUnion[j] = json_object_get_boolean(json_object_array_get_idx(inUnion, j));
+
+    resp->explanation = json_object_object_get(obj, EXPLANATION);
+    if (resp->explanation)
+        json_object_get(resp->explanation); // keep it alive after obj is released
+    return resp;
+}
+
+extern void drillbeyond_free_response(DrillBeyondResponse *resp) {
+    pfree(resp->selectivities);
+    pfree(resp->values);
+    pfree(resp->nulls);
+    pfree(resp->inUnion);
+    if (resp->explanation)
+        json_object_put(resp->explanation);
+    pfree(resp);
+}
@@ -0,0 +1,233 @@
+/*-------------------------------------------------------------------------
+ *
+ * libpqdrillbeyond.c
+ *    The libpq parts of process-parallel DrillBeyond variants.
+ *
+ * The leader backend runs the statement's variants partly in worker
+ * backends, to which it connects as a client. This module holds the libpq
+ * calls for that; it is loaded as a dynamic module, like libpqwalreceiver,
+ * to avoid linking the server binary with libpq. See drillbeyond_parallel.c.
+ *
+ * src/backend/drillbeyond/libpqdrillbeyond/libpqdrillbeyond.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libpq-fe.h"
+#include "drillbeyond/drillbeyond.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+PG_MODULE_MAGIC;
+
+void _PG_init(void);
+
+typedef struct DrbWorker {
+    PGconn *conn;
+    bool done; // all rows received
+} DrbWorker;
+
+static void *libpqdrb_connect(const char *conninfo);
+static void libpqdrb_exec(void *worker, const char *command);
+static void libpqdrb_send_query(void *worker, const char *query);
+static int libpqdrb_next_row(void *worker, bool wait, int natts, char **values);
+static void libpqdrb_wait(void **workers, int n);
+static void libpqdrb_disconnect(void *worker);
+
+static void worker_error(DrbWorker *w, PGresult *res, const char *what);
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+    if (drb_worker_connect != NULL)
+        elog(ERROR, "libpqdrillbeyond already loaded");
+    drb_worker_connect = libpqdrb_connect;
+    drb_worker_exec = libpqdrb_exec;
+    drb_worker_send_query = libpqdrb_send_query;
+    drb_worker_next_row = libpqdrb_next_row;
+    drb_worker_wait = libpqdrb_wait;
+    drb_worker_disconnect = libpqdrb_disconnect;
+}
+
+/*
+ * Reports a failure of the worker, with its message if it sent one.
+ */
+static void worker_error(DrbWorker *w, PGresult *res, const char *what) {
+    char *msg = pstrdup(res != NULL ? PQresultErrorMessage(res) : PQerrorMessage(w->conn));
+
+    if (res != NULL)
+        PQclear(res);
+    ereport(ERROR,
+        (errcode(ERRCODE_DRILLBEYOND_WORKER_FAILED),
+        errmsg("DrillBeyond worker could not %s: %s", what, msg)
+        ));
+}
+
+/*
+ * Returns NULL if the connection fails, after a WARNING; the leader then
+ * runs the statement without workers.
+ */
+static void *libpqdrb_connect(const char *conninfo) {
+    DrbWorker *w = (DrbWorker *) MemoryContextAllocZero(TopMemoryContext, sizeof(DrbWorker));
+    char *msg;
+
+    w->conn = PQconnectdb(conninfo);
+    if (PQstatus(w->conn) != CONNECTION_OK) {
+        msg = pstrdup(PQerrorMessage(w->conn));
+        PQfinish(w->conn);
+        pfree(w);
+        ereport(WARNING,
+            (errcode(ERRCODE_DRILLBEYOND_WORKER_FAILED),
+            errmsg("could not connect to DrillBeyond worker: %s", msg),
+            errdetail("The statement runs without workers.")
+            ));
+        pfree(msg);
+        return NULL;
+    }
+    return w;
+}
+
+static void libpqdrb_exec(void *worker, const char *command) {
+    DrbWorker *w = (DrbWorker *) worker;
+    PGresult *res = PQexec(w->conn, command);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK && PQresultStatus(res) != PGRES_TUPLES_OK)
+        worker_error(w, res, "set up its transaction");
+    PQclear(res);
+}
+
+/*
+ * Sends the statement without waiting for its result, which then arrives
+ * row by row.
+ */
+static void libpqdrb_send_query(void *worker, const char *query) {
+    DrbWorker *w = (DrbWorker *) worker;
+
+    if (!PQsendQuery(w->conn, query) || !PQsetSingleRowMode(w->conn))
+        worker_error(w, NULL, "start the statement");
+}
+
+/*
+ * Reads the next row of the worker into values, which get NULL or a palloc'd
+ * string per column. Returns 1 for a row, -1 after the last one and, unless
+ * wait is set, 0 if the next row has not arrived yet.
+ */
+static int libpqdrb_next_row(void *worker, bool wait, int natts, char **values) {
+    DrbWorker *w = (DrbWorker *) worker;
+    PGresult *res;
+    int i;
+
+    for (;;) {
+        if (w->done)
+            return -1;
+        if (!PQconsumeInput(w->conn))
+            worker_error(w, NULL, "send its rows");
+        if (PQisBusy(w->conn)) {
+            if (!wait)
+                return 0;
+            libpqdrb_wait(&worker, 1);
+            continue;
+        }
+
+        res = PQgetResult(w->conn);
+        if (res == NULL) {
+            w->done = true;
+            return -1;
+        }
+        switch (PQresultStatus(res)) {
+            case PGRES_SINGLE_TUPLE:
+                if (PQnfields(res) != natts) {
+                    int nfields = PQnfields(res);
+                    PQclear(res);
+                    ereport(ERROR,
+                        (errcode(ERRCODE_DRILLBEYOND_WORKER_FAILED),
+                        errmsg("DrillBeyond worker returned %d columns, expected %d", nfields, natts)
+                        ));
+                }
+                for (i = 0; i < natts; i++)
+                    values[i] = PQgetisnull(res, 0, i) ? NULL : pstrdup(PQgetvalue(res, 0, i));
+                PQclear(res);
+                return 1;
+            case PGRES_TUPLES_OK:
+                // end of the rows, the next result is NULL
+                PQclear(res);
+                break;
+            default:
+                worker_error(w, res, "run the statement");
+        }
+    }
+}
+
+/*
+ * Waits until one of the workers that are not done has sent something, or
+ * for a second, so that interrupts are served.
+ */
+static void libpqdrb_wait(void **workers, int n) {
+    int i, nfds = 0;
+#ifdef HAVE_POLL
+    struct pollfd *fds = (struct pollfd *) palloc(sizeof(struct pollfd) * n);
+
+    for (i = 0; i < n; i++) {
+        DrbWorker *w = (DrbWorker *) workers[i];
+        if (w->done || PQsocket(w->conn) < 0)
+            continue;
+        fds[nfds].fd = PQsocket(w->conn);
+        fds[nfds].events = POLLIN | POLLPRI;
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+    if (nfds > 0 && poll(fds, nfds, 1000) < 0 && errno != EINTR)
+        ereport(ERROR,
+            (errcode_for_socket_access(),
+            errmsg("poll() failed: %m")));
+    pfree(fds);
+#else
+    fd_set input_mask;
+    struct timeval timeout;
+    int maxfd = -1;
+
+    FD_ZERO(&input_mask);
+    for (i = 0; i < n; i++) {
+        DrbWorker *w = (DrbWorker *) workers[i];
+        if (w->done || PQsocket(w->conn) < 0)
+            continue;
+        FD_SET(PQsocket(w->conn), &input_mask);
+        maxfd = Max(maxfd, PQsocket(w->conn));
+        nfds++;
+    }
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    if (nfds > 0 && select(maxfd + 1, &input_mask, NULL, NULL, &timeout) < 0 && errno != EINTR)
+        ereport(ERROR,
+            (errcode_for_socket_access(),
+            errmsg("select() failed: %m")));
+#endif
+    CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * Closes the connection, which ends the worker's transaction.
+ */
+static void libpqdrb_disconnect(void *worker) {
+    DrbWorker *w = (DrbWorker *) worker;
+
+    PQfinish(w->conn);
+    pfree(w);
+}
@@ -90,7 +90,9 @@
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
 #include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
@@ -276,6 +278,18 @@ static void build_hash_table(AggState *aggstate);
 static AggHashEntry lookup_hash_entry(AggState *aggstate,
 				  TupleTableSlot *inputslot);
 static TupleTableSlot *agg_retrieve_direct(AggState *aggstate);
+static int	agg_variant_of(AggState *aggstate, TupleTableSlot *slot,
+			   bool *retract);
+static void inverse_transition_function(AggState *aggstate,
+							AggStatePerAgg peraggstate,
+							AggStatePerGroup pergroupstate,
+							FunctionCallInfoData *fcinfo);
+static void advance_aggregates_delta(AggState *aggstate,
+						 AggStatePerGroup pergroup,
+						 int64 *inputs, bool retract);
+static void agg_apply_deltas(AggState *aggstate);
+static TupleTableSlot *agg_retrieve_variants(AggState *aggstate);
+static void agg_reset_variants(AggState *aggstate);
 static void agg_fill_hash_table(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_hash_table(AggState *aggstate);
 static Datum GetAggInitVal(Datum textInitVal, Oid transtype);
@@ -1007,6 +1021,8 @@ ExecAgg(AggState *node)
 			agg_fill_hash_table(node);
 		return agg_retrieve_hash_table(node);
 	}
+	else if (node->drb_numVariants > 0)
+		return agg_retrieve_variants(node);
 	else
 		return agg_retrieve_direct(node);
 }
@@ -1212,6 +1228,470 @@ agg_retrieve_direct(AggState *aggstate)
 	return NULL;
 }
 
+/*
+ * Candidate combination of a DrillBeyond fan-out input tuple, computed from
+ * its candidate id columns.  A delta input tags the retraction of the first
+ * candidate's value from a combination with the negated id; *retract tells.
+ */
+static int
+agg_variant_of(AggState *aggstate, TupleTableSlot *slot, bool *retract)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	int			variant = 0;
+	int			i;
+
+	*retract = false;
+	for (i = node->drbNumIds - 1; i >= 0; i--)
+	{
+		bool		isnull;
+		int64		id;
+
+		id = DatumGetInt64(slot_getattr(slot, node->drbIdColIdx[i], &isnull));
+		if (!isnull && id < 0 && node->drbDelta)
+		{
+			*retract = true;
+			id = -id;
+		}
+		if (isnull || id < 0 || id >= node->drbNumCands)
+			elog(ERROR, "invalid DrillBeyond candidate id");
+		variant = variant * node->drbNumCands + (int) id;
+	}
+	return variant;
+}
+
+/*
+ * Can the effect of transfn on a transition value be undone?  These are the
+ * transition functions of count, and of sum and avg over the integer, float
+ * and numeric types.  All of them ignore inputs with a NULL argument.
+ */
+bool
+agg_transfn_invertible(Oid transfn)
+{
+	switch (transfn)
+	{
+		case F_INT8INC:
+		case F_INT8INC_ANY:
+		case F_INT2_SUM:
+		case F_INT4_SUM:
+		case F_FLOAT4PL:
+		case F_FLOAT8PL:
+		case F_NUMERIC_ADD:
+		case F_FLOAT4_ACCUM:
+		case F_FLOAT8_ACCUM:
+		case F_INT2_AVG_ACCUM:
+		case F_INT4_AVG_ACCUM:
+		case F_NUMERIC_AVG_ACCUM:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Remove an input value from the transition value of an aggregate whose
+ * transfn is agg_transfn_invertible.  The counterpart of
+ * advance_transition_function: the values in fcinfo are not NULL, and were
+ * added to the transition value before.
+ *
+ * Float transition values are recomputed by subtraction, so they may differ
+ * from a fresh aggregation in the last bits.
+ */
+static void
+inverse_transition_function(AggState *aggstate,
+							AggStatePerAgg peraggstate,
+							AggStatePerGroup pergroupstate,
+							FunctionCallInfoData *fcinfo)
+{
+	Datum		transValue = pergroupstate->transValue;
+	Datum		arg = fcinfo->arg[1];
+	MemoryContext oldContext;
+	Datum		newVal;
+
+	/* a NULL transition value stays NULL, as in advance_transition_function */
+	if (pergroupstate->transValueIsNull)
+		return;
+
+	oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+
+	switch (peraggstate->transfn.fn_oid)
+	{
+		case F_INT8INC:
+		case F_INT8INC_ANY:
+			newVal = Int64GetDatum(DatumGetInt64(transValue) - 1);
+			break;
+		case F_INT2_SUM:
+			newVal = Int64GetDatum(DatumGetInt64(transValue) -
+								   (int64) DatumGetInt16(arg));
+			break;
+		case F_INT4_SUM:
+			newVal = Int64GetDatum(DatumGetInt64(transValue) -
+								   (int64) DatumGetInt32(arg));
+			break;
+		case F_FLOAT4PL:
+			newVal = Float4GetDatum(DatumGetFloat4(transValue) -
+									DatumGetFloat4(arg));
+			break;
+		case F_FLOAT8PL:
+			newVal = Float8GetDatum(DatumGetFloat8(transValue) -
+									DatumGetFloat8(arg));
+			break;
+		case F_NUMERIC_ADD:
+			newVal = DirectFunctionCall2(numeric_sub, transValue, arg);
+			break;
+		case F_FLOAT4_ACCUM:
+		case F_FLOAT8_ACCUM:
+			{
+				/* {N, sum(X), sum(X*X)}, modified in place like float8_accum */
+				float8	   *transvalues;
+				float8		newval;
+
+				transvalues = (float8 *) ARR_DATA_PTR(DatumGetArrayTypeP(transValue));
+				newval = (peraggstate->transfn.fn_oid == F_FLOAT4_ACCUM) ?
+					(float8) DatumGetFloat4(arg) : DatumGetFloat8(arg);
+				transvalues[0] -= 1.0;
+				transvalues[1] -= newval;
+				transvalues[2] -= newval * newval;
+				newVal = transValue;
+				break;
+			}
+		case F_INT2_AVG_ACCUM:
+		case F_INT4_AVG_ACCUM:
+			{
+				/* {count, sum}, modified in place like int4_avg_accum */
+				int64	   *transdata;
+
+				transdata = (int64 *) ARR_DATA_PTR(DatumGetArrayTypeP(transValue));
+				transdata[0]--;
+				transdata[1] -= (peraggstate->transfn.fn_oid == F_INT2_AVG_ACCUM) ?
+					(int64) DatumGetInt16(arg) : (int64) DatumGetInt32(arg);
+				newVal = transValue;
+				break;
+			}
+		case F_NUMERIC_AVG_ACCUM:
+			{
+				/* {N, sum(X)} */
+				Datum	   *transdatums;
+				int			ndatums;
+
+				deconstruct_array(DatumGetArrayTypeP(transValue),
+								  NUMERICOID, -1, false, 'i',
+								  &transdatums, NULL, &ndatums);
+				if (ndatums != 2)
+					elog(ERROR, "expected 2-element numeric array");
+				transdatums[0] = DirectFunctionCall2(numeric_sub, transdatums[0],
+													 DirectFunctionCall1(int4_numeric,
+																		 Int32GetDatum(1)));
+				transdatums[1] = DirectFunctionCall2(numeric_sub, transdatums[1], arg);
+				newVal = PointerGetDatum(construct_array(transdatums, 2,
+														 NUMERICOID, -1, false, 'i'));
+				break;
+			}
+		default:
+			elog(ERROR, "transition function %u cannot be inverted",
+				 peraggstate->transfn.fn_oid);
+			newVal = (Datum) 0;	/* keep compiler quiet */
+			break;
+	}
+
+	/* as in advance_transition_function */
+	if (!peraggstate->transtypeByVal &&
+		DatumGetPointer(newVal) != DatumGetPointer(transValue))
+	{
+		MemoryContextSwitchTo(aggstate->aggcontext);
+		newVal = datumCopy(newVal,
+						   peraggstate->transtypeByVal,
+						   peraggstate->transtypeLen);
+		pfree(DatumGetPointer(transValue));
+	}
+	pergroupstate->transValue = newVal;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * Add the current input tuple to the transition states of one combination
+ * of a DrillBeyond delta input, or with retract, remove it.  inputs counts
+ * the non-NULL inputs per aggregate; one that loses its last input gets its
+ * initial state back, so that e.g. its sum is NULL again rather than zero.
+ *
+ * Only agg_transfn_invertible aggregates get here, which ignore inputs with
+ * a NULL argument.
+ */
+static void
+advance_aggregates_delta(AggState *aggstate, AggStatePerGroup pergroup,
+						 int64 *inputs, bool retract)
+{
+	int			aggno;
+
+	for (aggno = 0; aggno < aggstate->numaggs; aggno++)
+	{
+		AggStatePerAgg peraggstate = &aggstate->peragg[aggno];
+		AggStatePerGroup pergroupstate = &pergroup[aggno];
+		int			nargs = peraggstate->numArguments;
+		FunctionCallInfoData fcinfo;
+		TupleTableSlot *slot;
+		int			i;
+
+		slot = ExecProject(peraggstate->evalproj, NULL);
+		for (i = 0; i < nargs; i++)
+		{
+			if (slot->tts_isnull[i])
+				break;
+			fcinfo.arg[i + 1] = slot->tts_values[i];
+			fcinfo.argnull[i + 1] = false;
+		}
+		if (i < nargs)
+			continue;
+
+		if (!retract)
+		{
+			inputs[aggno]++;
+			advance_transition_function(aggstate, peraggstate, pergroupstate,
+										&fcinfo);
+		}
+		else if (inputs[aggno] <= 0)
+			elog(ERROR, "DrillBeyond delta retracts an input that was not added");
+		else if (--inputs[aggno] > 0)
+			inverse_transition_function(aggstate, peraggstate, pergroupstate,
+										&fcinfo);
+		else
+		{
+			if (!peraggstate->transtypeByVal && !pergroupstate->transValueIsNull)
+				pfree(DatumGetPointer(pergroupstate->transValue));
+			if (peraggstate->initValueIsNull)
+				pergroupstate->transValue = peraggstate->initValue;
+			else
+			{
+				MemoryContext oldContext;
+
+				oldContext = MemoryContextSwitchTo(aggstate->aggcontext);
+				pergroupstate->transValue = datumCopy(peraggstate->initValue,
+													  peraggstate->transtypeByVal,
+													  peraggstate->transtypeLen);
+				MemoryContextSwitchTo(oldContext);
+			}
+			pergroupstate->transValueIsNull = peraggstate->initValueIsNull;
+			pergroupstate->noTransValue = peraggstate->initValueIsNull;
+		}
+	}
+}
+
+/*
+ * Second phase of a DrillBeyond delta input: every other combination starts
+ * from a copy of the first candidate's transition states, then the stored
+ * changes are applied to it.  Each combination thus costs in proportion to
+ * the input tuples whose candidate value differs from the first one.
+ */
+static void
+agg_apply_deltas(AggState *aggstate)
+{
+	TupleTableSlot *slot = aggstate->ss.ss_ScanTupleSlot;
+	ExprContext *tmpcontext = aggstate->tmpcontext;
+	AggStatePerAgg peragg = aggstate->peragg;
+	int			numaggs = aggstate->numaggs;
+	int			variant;
+	int			aggno;
+	bool		retract;
+
+	for (variant = 1; variant < aggstate->drb_numVariants; variant++)
+	{
+		for (aggno = 0; aggno < numaggs; aggno++)
+		{
+			AggStatePerGroup from = &aggstate->drb_pergroups[aggno];
+			AggStatePerGroup to = &aggstate->drb_pergroups[variant * numaggs + aggno];
+
+			*to = *from;
+			if (!peragg[aggno].transtypeByVal && !from->transValueIsNull)
+			{
+				MemoryContext oldContext;
+
+				oldContext = MemoryContextSwitchTo(aggstate->aggcontext);
+				to->transValue = datumCopy(from->transValue,
+										   peragg[aggno].transtypeByVal,
+										   peragg[aggno].transtypeLen);
+				MemoryContextSwitchTo(oldContext);
+			}
+			aggstate->drb_inputs[variant * numaggs + aggno] = aggstate->drb_inputs[aggno];
+		}
+	}
+
+	while (tuplestore_gettupleslot(aggstate->drb_deltas, true, false, slot))
+	{
+		variant = agg_variant_of(aggstate, slot, &retract);
+		tmpcontext->ecxt_outertuple = slot;
+		advance_aggregates_delta(aggstate, &aggstate->drb_pergroups[variant * numaggs],
+								 &aggstate->drb_inputs[variant * numaggs], retract);
+		ResetExprContext(tmpcontext);
+	}
+	ExecClearTuple(slot);
+	tuplestore_end(aggstate->drb_deltas);
+	aggstate->drb_deltas = NULL;
+}
+
+/*
+ * ExecAgg for AGG_PLAIN over a DrillBeyond fan-out input: the input carries
+ * all candidate combinations at once, tagged by their id columns. One scan
+ * advances a separate set of transition states per combination, then one
+ * result row per combination is emitted, as if the plan had been executed
+ * once per combination. Combinations without input rows yield the usual
+ * empty-input aggregate results.
+ *
+ * A delta input (drbDelta) carries the first candidate's tuples with id 0,
+ * and for each other candidate only the tuples whose value differs, each
+ * with a retraction of the first candidate's value.  The scan advances the
+ * first candidate's states and stores the rest for agg_apply_deltas.
+ */
+static TupleTableSlot *
+agg_retrieve_variants(AggState *aggstate)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	PlanState  *outerPlan = outerPlanState(aggstate);
+	ExprContext *econtext = aggstate->ss.ps.ps_ExprContext;
+	ExprContext *tmpcontext = aggstate->tmpcontext;
+	Datum	   *aggvalues = econtext->ecxt_aggvalues;
+	bool	   *aggnulls = econtext->ecxt_aggnulls;
+	AggStatePerAgg peragg = aggstate->peragg;
+	TupleTableSlot *firstSlot = aggstate->ss.ss_ScanTupleSlot;
+	TupleTableSlot *outerslot;
+	int			numaggs = aggstate->numaggs;
+	int			aggno;
+	int			variant;
+
+	if (!aggstate->drb_scanned)
+	{
+		for (aggno = 0; aggno < numaggs; aggno++)
+		{
+			if (peragg[aggno].numSortCols > 0)
+				elog(ERROR, "ordered aggregates are not supported with DrillBeyond candidate groups");
+		}
+
+		MemoryContextResetAndDeleteChildren(aggstate->aggcontext);
+		for (variant = 0; variant < aggstate->drb_numVariants; variant++)
+		{
+			initialize_aggregates(aggstate, peragg,
+								  &aggstate->drb_pergroups[variant * numaggs]);
+			/* the others are copied from the first one */
+			if (node->drbDelta)
+				break;
+		}
+		if (node->drbDelta)
+			aggstate->drb_deltas = tuplestore_begin_heap(false, false, work_mem);
+
+		for (;;)
+		{
+			bool		retract;
+
+			outerslot = ExecProcNode(outerPlan);
+			if (TupIsNull(outerslot))
+				break;
+
+			variant = agg_variant_of(aggstate, outerslot, &retract);
+			if (node->drbDelta && variant > 0)
+			{
+				tuplestore_puttupleslot(aggstate->drb_deltas, outerslot);
+				continue;
+			}
+			if (aggstate->drb_firstTuples[variant] == NULL)
+				aggstate->drb_firstTuples[variant] = ExecCopySlotTuple(outerslot);
+
+			tmpcontext->ecxt_outertuple = outerslot;
+			if (node->drbDelta)
+				advance_aggregates_delta(aggstate, aggstate->drb_pergroups,
+										 aggstate->drb_inputs, false);
+			else
+				advance_aggregates(aggstate, &aggstate->drb_pergroups[variant * numaggs]);
+			ResetExprContext(tmpcontext);
+		}
+		if (node->drbDelta)
+			agg_apply_deltas(aggstate);
+		aggstate->drb_scanned = true;
+	}
+
+	while (aggstate->drb_nextVariant < aggstate->drb_numVariants)
+	{
+		AggStatePerGroup pergroup;
+		int			rest;
+		int			i;
+
+		variant = aggstate->drb_nextVariant++;
+		pergroup = &aggstate->drb_pergroups[variant * numaggs];
+
+		ResetExprContext(econtext);
+
+		for (aggno = 0; aggno < numaggs; aggno++)
+			finalize_aggregate(aggstate, &peragg[aggno], &pergroup[aggno],
+							   &aggvalues[aggno], &aggnulls[aggno]);
+
+		/*
+		 * The representative tuple supplies the candidate ids to the tlist.
+		 * Combinations without input get an all-null tuple with just the ids.
+		 */
+		ExecClearTuple(firstSlot);
+		if (aggstate->drb_firstTuples[variant] != NULL)
+			heap_deform_tuple(aggstate->drb_firstTuples[variant],
+							  firstSlot->tts_tupleDescriptor,
+							  firstSlot->tts_values, firstSlot->tts_isnull);
+		else
+			MemSet(firstSlot->tts_isnull, true,
+				   firstSlot->tts_tupleDescriptor->natts * sizeof(bool));
+		rest = variant;
+		for (i = 0; i < node->drbNumIds; i++)
+		{
+			firstSlot->tts_values[node->drbIdColIdx[i] - 1] = Int64GetDatum(rest % node->drbNumCands);
+			firstSlot->tts_isnull[node->drbIdColIdx[i] - 1] = false;
+			rest /= node->drbNumCands;
+		}
+		ExecStoreVirtualTuple(firstSlot);
+		econtext->ecxt_outertuple = firstSlot;
+
+		if (ExecQual(aggstate->ss.ps.qual, econtext, false))
+		{
+			TupleTableSlot *result;
+			ExprDoneCond isDone;
+
+			result = ExecProject(aggstate->ss.ps.ps_ProjInfo, &isDone);
+
+			if (isDone != ExprEndResult)
+			{
+				aggstate->ss.ps.ps_TupFromTlist =
+					(isDone == ExprMultipleResult);
+				return result;
+			}
+		}
+		else
+			InstrCountFiltered1(aggstate, 1);
+	}
+
+	aggstate->agg_done = true;
+	return NULL;
+}
+
+/*
+ * Forget the candidate groups of a DrillBeyond fan-out aggregation.
+ */
+static void
+agg_reset_variants(AggState *aggstate)
+{
+	int			variant;
+
+	for (variant = 0; variant < aggstate->drb_numVariants; variant++)
+	{
+		if (aggstate->drb_firstTuples[variant] != NULL)
+			heap_freetuple(aggstate->drb_firstTuples[variant]);
+		aggstate->drb_firstTuples[variant] = NULL;
+	}
+	MemSet(aggstate->drb_pergroups, 0,
+		   sizeof(AggStatePerGroupData) * aggstate->numaggs * aggstate->drb_numVariants);
+	if (aggstate->drb_inputs != NULL)
+		MemSet(aggstate->drb_inputs, 0,
+			   sizeof(int64) * aggstate->numaggs * aggstate->drb_numVariants);
+	if (aggstate->drb_deltas != NULL)
+		tuplestore_end(aggstate->drb_deltas);
+	aggstate->drb_deltas = NULL;
+	aggstate->drb_nextVariant = 0;
+	aggstate->drb_scanned = false;
+}
+
 /*
  * ExecAgg for hashed case: phase 1, read input and build hash table
  */
@@ -1532,6 +2012,23 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 
 		pergroup = (AggStatePerGroup) palloc0(sizeof(AggStatePerGroupData) * numaggs);
 		aggstate->pergroup = pergroup;
+
+		/* DrillBeyond fan-out: separate working state per candidate combination */
+		if (node->drbNumIds > 0)
+		{
+			int			i;
+
+			aggstate->drb_numVariants = 1;
+			for (i = 0; i < node->drbNumIds; i++)
+				aggstate->drb_numVariants *= node->drbNumCands;
+			aggstate->drb_pergroups = (AggStatePerGroup)
+				palloc0(sizeof(AggStatePerGroupData) * numaggs * aggstate->drb_numVariants);
+			aggstate->drb_firstTuples = (HeapTuple *)
+				palloc0(sizeof(HeapTuple) * aggstate->drb_numVariants);
+			if (node->drbDelta)
+				aggstate->drb_inputs = (int64 *)
+					palloc0(sizeof(int64) * numaggs * aggstate->drb_numVariants);
+		}
 	}
 
 	/*
@@ -1888,6 +2385,8 @@ ExecEndAgg(AggState *node)
 		if (peraggstate->sortstate)
 			tuplesort_end(peraggstate->sortstate);
 	}
+	if (node->drb_deltas != NULL)
+		tuplestore_end(node->drb_deltas);
 
 	/*
 	 * Free both the expr contexts.
@@ -1981,6 +2480,8 @@ ExecReScanAgg(AggState *node)
 		 */
 		MemSet(node->pergroup, 0,
 			   sizeof(AggStatePerGroupData) * node->numaggs);
+		if (node->drb_numVariants > 0)
+			agg_reset_variants(node);
 	}
 
 	/*
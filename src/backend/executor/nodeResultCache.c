@@ -0,0 +1,415 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodeResultCache.c
+ *	  Routines to handle result cache nodes.
+ *
+ * A result cache sits above a parameterized subplan, such as the inner side
+ * of a nestloop with parameters or the plan of a correlated SubPlan, and
+ * keeps the complete output of the subplan for each combination of values
+ * of its parameters. On a rescan with values that were seen before, the
+ * cached tuples are returned and the subplan is not run at all.
+ *
+ * Unlike a Material node, the cache survives rescans: the DrillBeyond
+ * executor re-runs the whole plan once per candidate, and an invariant,
+ * parameterized subplan then only needs to run once per distinct parameter
+ * values instead of once per candidate and outer row.
+ *
+ * Keys are the binary images of the parameter values. Values that are
+ * equal but have different images (-0.0 and 0.0, say) are cached twice,
+ * which is harmless. The cache is bounded by work_mem; when it fills up, the
+ * least recently used entries are evicted, and a single result that does
+ * not fit is passed through without being cached. A result that was not
+ * read to its end before the next rescan is incomplete and is dropped.
+ *
+ * Portions Copyright (c) 1996-2012, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/nodeResultCache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+/*
+ * INTERFACE ROUTINES
+ *		ExecResultCache			- return the cached or computed subplan output
+ *		ExecInitResultCache		- initialize node and subnodes
+ *		ExecEndResultCache		- shutdown node and subnodes
+ *		ExecReScanResultCache	- rescan, keeping the cache
+ *
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "executor/executor.h"
+#include "executor/nodeResultCache.h"
+#include "executor/nodeSubplan.h"
+#include "miscadmin.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+typedef struct ResultCacheKey
+{
+	uint32		hash;
+	int			len;
+	char	   *data;			/* binary image of the parameter values */
+} ResultCacheKey;
+
+typedef struct ResultCacheEntry
+{
+	ResultCacheKey key;			/* hash key, must be first */
+	Dlelem		lru;			/* position in the LRU list */
+	List	   *tuples;			/* MinimalTuples, in subplan order */
+	Size		mem;			/* memory used by key and tuples */
+	bool		complete;		/* subplan was read to its end */
+} ResultCacheEntry;
+
+static uint32 cache_key_hash(const void *key, Size keysize);
+static int	cache_key_match(const void *key1, const void *key2, Size keysize);
+static void build_cache_key(ResultCacheState *node, ResultCacheKey *key);
+static void cache_lookup(ResultCacheState *node);
+static void cache_store(ResultCacheState *node, TupleTableSlot *slot);
+static void cache_remove_entry(ResultCacheState *node, ResultCacheEntry *entry);
+
+static uint32
+cache_key_hash(const void *key, Size keysize)
+{
+	return ((const ResultCacheKey *) key)->hash;
+}
+
+static int
+cache_key_match(const void *key1, const void *key2, Size keysize)
+{
+	const ResultCacheKey *k1 = (const ResultCacheKey *) key1;
+	const ResultCacheKey *k2 = (const ResultCacheKey *) key2;
+
+	if (k1->hash != k2->hash || k1->len != k2->len)
+		return 1;
+	return memcmp(k1->data, k2->data, k1->len);
+}
+
+/*
+ * Builds the key from the current values of the parameters, in per-tuple
+ * memory.
+ */
+static void
+build_cache_key(ResultCacheState *node, ResultCacheKey *key)
+{
+	ResultCache *plan = (ResultCache *) node->ps.plan;
+	ExprContext *econtext = node->ps.ps_ExprContext;
+	MemoryContext oldcontext;
+	StringInfoData buf;
+	int			i;
+
+	ResetExprContext(econtext);
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	initStringInfo(&buf);
+	for (i = 0; i < plan->numParams; i++)
+	{
+		ParamExecData *prm = &(econtext->ecxt_param_exec_vals[plan->paramIds[i]]);
+		char		isnull;
+
+		/* the value of an initplan's output is computed on first use */
+		if (prm->execPlan != NULL)
+			ExecSetParamPlan(prm->execPlan, econtext);
+
+		isnull = prm->isnull ? 1 : 0;
+		appendBinaryStringInfo(&buf, &isnull, 1);
+		if (prm->isnull)
+			continue;
+
+		if (node->paramTypbyval[i])
+			appendBinaryStringInfo(&buf, (char *) &prm->value, sizeof(Datum));
+		else if (node->paramTyplen[i] == -1)
+		{
+			struct varlena *value = PG_DETOAST_DATUM_PACKED(prm->value);
+			int32		len = VARSIZE_ANY_EXHDR(value);
+
+			appendBinaryStringInfo(&buf, (char *) &len, sizeof(len));
+			appendBinaryStringInfo(&buf, VARDATA_ANY(value), len);
+		}
+		else
+			appendBinaryStringInfo(&buf, DatumGetPointer(prm->value),
+								   datumGetSize(prm->value, false,
+												node->paramTyplen[i]));
+	}
+	MemoryContextSwitchTo(oldcontext);
+
+	key->data = buf.data;
+	key->len = buf.len;
+	key->hash = DatumGetUInt32(hash_any((unsigned char *) buf.data, buf.len));
+}
+
+/*
+ * Decides how the rescan is answered: from a complete entry, or by running
+ * the subplan and filling a new one.
+ */
+static void
+cache_lookup(ResultCacheState *node)
+{
+	PlanState  *outerNode = outerPlanState(node);
+	ResultCacheKey key;
+	ResultCacheEntry *entry;
+	bool		found;
+
+	build_cache_key(node, &key);
+	entry = (ResultCacheEntry *) hash_search(node->hashtable, &key,
+											 HASH_ENTER, &found);
+	if (found && entry->complete)
+	{
+		node->hits++;
+		DLMoveToFront(&entry->lru);
+		node->entry = entry;
+		node->next = list_head(entry->tuples);
+		node->status = RC_HIT;
+		return;
+	}
+
+	/* incomplete entries are removed on rescan */
+	Assert(!found);
+	node->misses++;
+
+	/* the key still points into per-tuple memory */
+	entry->key.data = MemoryContextAlloc(node->tableContext, key.len);
+	memcpy(entry->key.data, key.data, key.len);
+	entry->tuples = NIL;
+	entry->mem = key.len + sizeof(ResultCacheEntry);
+	entry->complete = false;
+	node->memUsed += entry->mem;
+	DLInitElem(&entry->lru, entry);
+	DLAddHead(&node->lru, &entry->lru);
+	node->entry = entry;
+	node->status = RC_FILL;
+
+	/*
+	 * The subplan must produce its output from the start. If its chgParam is
+	 * set, ExecProcNode rescans it; otherwise do it here, unless it was not
+	 * read since its last rescan anyway.
+	 */
+	if (outerNode->chgParam == NULL && node->childStarted)
+		ExecReScan(outerNode);
+	node->childStarted = true;
+}
+
+/*
+ * Adds a subplan tuple to the entry being filled, evicting other entries if
+ * the cache grows beyond work_mem.
+ */
+static void
+cache_store(ResultCacheState *node, TupleTableSlot *slot)
+{
+	ResultCacheEntry *entry = node->entry;
+	MemoryContext oldcontext;
+	MinimalTuple tuple;
+	Size		size;
+
+	oldcontext = MemoryContextSwitchTo(node->tableContext);
+	tuple = ExecCopySlotMinimalTuple(slot);
+	entry->tuples = lappend(entry->tuples, tuple);
+	MemoryContextSwitchTo(oldcontext);
+
+	size = GetMemoryChunkSpace(tuple) + sizeof(ListCell);
+	entry->mem += size;
+	node->memUsed += size;
+
+	while (node->memUsed > work_mem * 1024L)
+	{
+		ResultCacheEntry *victim;
+
+		victim = (ResultCacheEntry *) DLE_VAL(DLGetTail(&node->lru));
+		if (victim == entry)
+		{
+			/* this result alone does not fit, don't cache it */
+			cache_remove_entry(node, entry);
+			node->entry = NULL;
+			node->status = RC_PASS;
+			break;
+		}
+		cache_remove_entry(node, victim);
+		node->evictions++;
+	}
+}
+
+static void
+cache_remove_entry(ResultCacheState *node, ResultCacheEntry *entry)
+{
+	List	   *tuples = entry->tuples;
+	char	   *data = entry->key.data;
+
+	node->memUsed -= entry->mem;
+	DLRemove(&entry->lru);
+	hash_search(node->hashtable, &entry->key, HASH_REMOVE, NULL);
+	list_free_deep(tuples);
+	pfree(data);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecResultCache
+ *
+ *		Returns the next tuple of the cached result, or of the subplan,
+ *		caching it.
+ * ----------------------------------------------------------------
+ */
+TupleTableSlot *
+ExecResultCache(ResultCacheState *node)
+{
+	TupleTableSlot *slot;
+
+	if (node->status == RC_LOOKUP)
+		cache_lookup(node);
+
+	if (node->status == RC_HIT)
+	{
+		MinimalTuple tuple;
+
+		if (node->next == NULL)
+			return ExecClearTuple(node->ps.ps_ResultTupleSlot);
+		tuple = (MinimalTuple) lfirst(node->next);
+		node->next = lnext(node->next);
+		return ExecStoreMinimalTuple(tuple, node->ps.ps_ResultTupleSlot, false);
+	}
+
+	slot = ExecProcNode(outerPlanState(node));
+	if (node->status == RC_FILL)
+	{
+		if (TupIsNull(slot))
+		{
+			/* from now on, return the end of the complete entry */
+			node->entry->complete = true;
+			node->next = NULL;
+			node->status = RC_HIT;
+		}
+		else
+			cache_store(node, slot);
+	}
+	return slot;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecInitResultCache
+ * ----------------------------------------------------------------
+ */
+ResultCacheState *
+ExecInitResultCache(ResultCache *node, EState *estate, int eflags)
+{
+	ResultCacheState *rcstate;
+	HASHCTL		hash_ctl;
+	int			i;
+
+	/* check for unsupported flags */
+	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
+
+	/*
+	 * create state structure
+	 */
+	rcstate = makeNode(ResultCacheState);
+	rcstate->ps.plan = (Plan *) node;
+	rcstate->ps.state = estate;
+
+	/*
+	 * Miscellaneous initialization
+	 *
+	 * The expression context is only used to build cache keys.
+	 */
+	ExecAssignExprContext(estate, &rcstate->ps);
+
+	/*
+	 * tuple table initialization
+	 */
+	ExecInitResultTupleSlot(estate, &rcstate->ps);
+
+	/*
+	 * initialize child nodes
+	 *
+	 * The cache does any rewinding, the child need not support it.
+	 */
+	eflags &= ~EXEC_FLAG_REWIND;
+	outerPlanState(rcstate) = ExecInitNode(outerPlan(node), estate, eflags);
+
+	/*
+	 * initialize tuple type.  no need to initialize projection info because
+	 * this node doesn't do projections.
+	 */
+	ExecAssignResultTypeFromTL(&rcstate->ps);
+	rcstate->ps.ps_ProjInfo = NULL;
+
+	rcstate->paramTyplen = (int16 *) palloc(sizeof(int16) * (node->numParams + 1));
+	rcstate->paramTypbyval = (bool *) palloc(sizeof(bool) * (node->numParams + 1));
+	for (i = 0; i < node->numParams; i++)
+		get_typlenbyval(node->paramTypes[i],
+						&rcstate->paramTyplen[i], &rcstate->paramTypbyval[i]);
+
+	rcstate->tableContext = AllocSetContextCreate(CurrentMemoryContext,
+												  "ResultCache",
+												  ALLOCSET_DEFAULT_MINSIZE,
+												  ALLOCSET_DEFAULT_INITSIZE,
+												  ALLOCSET_DEFAULT_MAXSIZE);
+	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(ResultCacheKey);
+	hash_ctl.entrysize = sizeof(ResultCacheEntry);
+	hash_ctl.hash = cache_key_hash;
+	hash_ctl.match = cache_key_match;
+	hash_ctl.hcxt = rcstate->tableContext;
+	rcstate->hashtable = hash_create("ResultCache", 256, &hash_ctl,
+						HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+	DLInitList(&rcstate->lru);
+	rcstate->memUsed = 0;
+	rcstate->status = RC_LOOKUP;
+	rcstate->entry = NULL;
+	rcstate->next = NULL;
+	rcstate->childStarted = false;
+
+	return rcstate;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecEndResultCache
+ * ----------------------------------------------------------------
+ */
+void
+ExecEndResultCache(ResultCacheState *node)
+{
+	/*
+	 * Free the exprcontext
+	 */
+	ExecFreeExprContext(&node->ps);
+
+	/*
+	 * clean out the tuple table
+	 */
+	ExecClearTuple(node->ps.ps_ResultTupleSlot);
+
+	/*
+	 * release the cache
+	 */
+	MemoryContextDelete(node->tableContext);
+	node->hashtable = NULL;
+
+	/*
+	 * shut down the subplan
+	 */
+	ExecEndNode(outerPlanState(node));
+}
+
+/* ----------------------------------------------------------------
+ *		ExecReScanResultCache
+ *
+ *		Keeps the cache; the next ExecResultCache looks up the current
+ *		parameter values. The subplan is rescanned only when it has to run.
+ * ----------------------------------------------------------------
+ */
+void
+ExecReScanResultCache(ResultCacheState *node)
+{
+	ExecClearTuple(node->ps.ps_ResultTupleSlot);
+
+	/* a result that was not read to its end is incomplete */
+	if (node->status == RC_FILL)
+		cache_remove_entry(node, node->entry);
+
+	node->entry = NULL;
+	node->next = NULL;
+	node->status = RC_LOOKUP;
+}
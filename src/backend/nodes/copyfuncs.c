@@ -83,6 +83,7 @@ _copyPlannedStmt(const PlannedStmt *from)
 	COPY_SCALAR_FIELD(hasModifyingCTE);
 	COPY_SCALAR_FIELD(canSetTag);
 	COPY_SCALAR_FIELD(transientPlan);
+	COPY_SCALAR_FIELD(drbMaterialized);
 	COPY_NODE_FIELD(planTree);
 	COPY_NODE_FIELD(rtable);
 	COPY_NODE_FIELD(resultRelations);
@@ -737,6 +738,8 @@ _copyDrillBeyondExpand(const DrillBeyondExpand *from)
 	COPY_SCALAR_FIELD(drb_expandFrom);
 	COPY_SCALAR_FIELD(drb_expandTo);
 	COPY_SCALAR_FIELD(drb_expansion);
+	COPY_SCALAR_FIELD(drb_fanout);
+	COPY_SCALAR_FIELD(drb_fanoutFrom);
 	return newnode;
 }
 
@@ -772,6 +775,29 @@ _copyMaterial(const Material *from)
 	return newnode;
 }
 
+/*
+ * _copyResultCache
+ */
+static ResultCache *
+_copyResultCache(const ResultCache *from)
+{
+	ResultCache *newnode = makeNode(ResultCache);
+
+	/*
+	 * copy node superclass fields
+	 */
+	CopyPlanFields((const Plan *) from, (Plan *) newnode);
+
+	/*
+	 * copy remainder of node
+	 */
+	COPY_SCALAR_FIELD(numParams);
+	COPY_POINTER_FIELD(paramIds, from->numParams * sizeof(int));
+	COPY_POINTER_FIELD(paramTypes, from->numParams * sizeof(Oid));
+
+	return newnode;
+}
+
 
 /*
  * _copySort
@@ -831,6 +857,11 @@ _copyAgg(const Agg *from)
 		COPY_POINTER_FIELD(grpOperators, from->numCols * sizeof(Oid));
 	}
 	COPY_SCALAR_FIELD(numGroups);
+	COPY_SCALAR_FIELD(drbNumIds);
+	if (from->drbNumIds > 0)
+		COPY_POINTER_FIELD(drbIdColIdx, from->drbNumIds * sizeof(AttrNumber));
+	COPY_SCALAR_FIELD(drbNumCands);
+	COPY_SCALAR_FIELD(drbDelta);
 
 	return newnode;
 }
@@ -3924,6 +3955,9 @@ copyObject(const void *from)
 		case T_Material:
 			retval = _copyMaterial(from);
 			break;
+		case T_ResultCache:
+			retval = _copyResultCache(from);
+			break;
 		case T_Sort:
 			retval = _copySort(from);
 			break;
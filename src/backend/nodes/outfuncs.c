@@ -248,6 +248,7 @@ _outPlannedStmt(StringInfo str, const PlannedStmt *node)
 	WRITE_BOOL_FIELD(hasModifyingCTE);
 	WRITE_BOOL_FIELD(canSetTag);
 	WRITE_BOOL_FIELD(transientPlan);
+	WRITE_BOOL_FIELD(drbMaterialized);
 	WRITE_NODE_FIELD(planTree);
 	WRITE_NODE_FIELD(rtable);
 	WRITE_NODE_FIELD(resultRelations);
@@ -681,6 +682,13 @@ _outAgg(StringInfo str, const Agg *node)
 		appendStringInfo(str, " %u", node->grpOperators[i]);
 
 	WRITE_LONG_FIELD(numGroups);
+
+	WRITE_INT_FIELD(drbNumIds);
+	appendStringInfo(str, " :drbIdColIdx");
+	for (i = 0; i < node->drbNumIds; i++)
+		appendStringInfo(str, " %d", node->drbIdColIdx[i]);
+	WRITE_INT_FIELD(drbNumCands);
+	WRITE_BOOL_FIELD(drbDelta);
 }
 
 static void
@@ -746,6 +754,26 @@ _outMaterial(StringInfo str, const Material *node)
 	_outPlanInfo(str, (const Plan *) node);
 }
 
+static void
+_outResultCache(StringInfo str, const ResultCache *node)
+{
+	int			i;
+
+	WRITE_NODE_TYPE("RESULTCACHE");
+
+	_outPlanInfo(str, (const Plan *) node);
+
+	WRITE_INT_FIELD(numParams);
+
+	appendStringInfo(str, " :paramIds");
+	for (i = 0; i < node->numParams; i++)
+		appendStringInfo(str, " %d", node->paramIds[i]);
+
+	appendStringInfo(str, " :paramTypes");
+	for (i = 0; i < node->numParams; i++)
+		appendStringInfo(str, " %u", node->paramTypes[i]);
+}
+
 static void
 _outSort(StringInfo str, const Sort *node)
 {
@@ -1730,6 +1758,7 @@ _outPlannerGlobal(StringInfo str, const PlannerGlobal *node)
 	WRITE_UINT_FIELD(lastPHId);
 	WRITE_UINT_FIELD(lastRowMarkId);
 	WRITE_BOOL_FIELD(transientPlan);
+	WRITE_BOOL_FIELD(drbMaterialized);
 }
 
 static void
@@ -2861,6 +2890,9 @@ _outNode(StringInfo str, const void *obj)
 			case T_Material:
 				_outMaterial(str, obj);
 				break;
+			case T_ResultCache:
+				_outResultCache(str, obj);
+				break;
 			case T_Sort:
 				_outSort(str, obj);
 				break;
@@ -3377,6 +3409,9 @@ nodeName(const void *obj)
 			case T_Material:
 				WRITE_NODE_TYPE("Material");
 				break;
+			case T_ResultCache:
+				WRITE_NODE_TYPE("ResultCache");
+				break;
 			case T_Sort:
 				WRITE_NODE_TYPE("Sort");
 				break;
@@ -2222,6 +2222,28 @@ extern DrillBeyondExpand *make_drillbeyondexpand(PlannerInfo *root,
 				new_tlist_pos++;
 			}
 
+			// fan-out: take the ids from the tuples instead of iterating over the candidates
+			drillbeyondExpand->drb_fanout = numExpansions > 0;
+			drillbeyondExpand->drb_fanoutFrom = (int*) palloc(sizeof(int) * numExpansions);
+			for (i=0; i<numExpansions; i++) {
+				DrillBeyondExpansion *sdrb = (DrillBeyondExpansion*) list_nth(root->drb_all_expansions, i);
+				ListCell *lc;
+				int pos = 0;
+
+				drillbeyondExpand->drb_fanoutFrom[i] = -1;
+				foreach(lc, subplan->targetlist) {
+					TargetEntry *te = (TargetEntry *) lfirst(lc);
+					if (IsA(te->expr, Var) && ((Var *) te->expr)->varno == sdrb->rti &&
+						((Var *) te->expr)->varattno == DRB_ID_ATTR) {
+						drillbeyondExpand->drb_fanoutFrom[i] = pos;
+						break;
+					}
+					pos++;
+				}
+				if (!sdrb->fanout || drillbeyondExpand->drb_fanoutFrom[i] < 0)
+					drillbeyondExpand->drb_fanout = false;
+			}
+
 			drillbeyondExpand->drb_numExpansions = numExpansions;
 		    plan->targetlist = list_concat(plan->targetlist, newTlist);
 		    break;
@@ -4365,6 +4387,54 @@ materialize_finished_plan(Plan *subplan)
 	return matplan;
 }
 
+/*
+ * make_resultcache: stick a ResultCache node atop a completed plan
+ *
+ * params is the list of PARAM_EXEC Params the subplan depends on, which
+ * make up the cache key. The costs are those of a miss; the caller decides
+ * whether the cache pays off. Like materialize_finished_plan, this is used
+ * after SS_finalize_plan may have run on the subplan, so the parameter lists
+ * are copied from it.
+ */
+ResultCache *
+make_resultcache(Plan *subplan, List *params)
+{
+	ResultCache *node = makeNode(ResultCache);
+	Plan	   *plan = &node->plan;
+	ListCell   *lc;
+	int			i;
+
+	plan->startup_cost = subplan->startup_cost;
+	plan->total_cost = subplan->total_cost +
+		cpu_operator_cost * subplan->plan_rows;
+	plan->plan_rows = subplan->plan_rows;
+	plan->plan_width = subplan->plan_width;
+
+	plan->targetlist = (List *) copyObject(subplan->targetlist);
+	plan->qual = NIL;
+	plan->lefttree = subplan;
+	plan->righttree = NULL;
+
+	node->numParams = list_length(params);
+	node->paramIds = (int *) palloc(sizeof(int) * (node->numParams + 1));
+	node->paramTypes = (Oid *) palloc(sizeof(Oid) * (node->numParams + 1));
+	i = 0;
+	foreach(lc, params)
+	{
+		Param	   *param = (Param *) lfirst(lc);
+
+		Assert(IsA(param, Param) && param->paramkind == PARAM_EXEC);
+		node->paramIds[i] = param->paramid;
+		node->paramTypes[i] = param->paramtype;
+		i++;
+	}
+
+	plan->extParam = bms_copy(subplan->extParam);
+	plan->allParam = bms_copy(subplan->allParam);
+
+	return node;
+}
+
 Agg *
 make_agg(PlannerInfo *root, List *tlist, List *qual,
 		 AggStrategy aggstrategy, const AggClauseCosts *aggcosts,
@@ -4885,6 +4955,7 @@ is_projection_capable_plan(Plan *plan)
 	{
 		case T_Hash:
 		case T_Material:
+		case T_ResultCache:
 		case T_Sort:
 		case T_Unique:
 		case T_SetOp:
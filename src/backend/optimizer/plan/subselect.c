@@ -2356,6 +2356,7 @@ finalize_plan(PlannerInfo *root, Plan *plan, Bitmapset *valid_params,
 		case T_Hash:
 		case T_Agg:
 		case T_Material:
+		case T_ResultCache:
 		case T_DrillBeyondExpand: // might need more finalization in the future?
 		case T_Sort:
 		case T_Unique:
@@ -19,6 +19,7 @@
 #include "access/sysattr.h"
 #include "catalog/heap.h"
 #include "catalog/namespace.h"
+#include "drillbeyond/drillbeyond.h"
 #include "catalog/pg_type.h"
 #include "funcapi.h"
 #include "nodes/makefuncs.h"
@@ -2180,8 +2181,11 @@ get_rte_attribute_type(RangeTblEntry *rte, AttrNumber attnum,
 		case RTE_DRILLBEYOND:
 			{
 				//DRILLBEYOND-TODO: Typinferenz
-				*vartype = 1700;
-    			*vartypmod = 1700; //"numeric"
+				if (attnum == DRB_VALUE_ATTR && rte->drb_expansion != NULL)
+					*vartype = rte->drb_expansion->valuetype;
+				else
+					*vartype = 1700;
+    			*vartypmod = -1;
     			*varcollid = 0; // encoding something
 			}
 			break;
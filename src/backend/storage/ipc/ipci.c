@@ -21,6 +21,7 @@
 #include "access/subtrans.h"
 #include "access/twophase.h"
 #include "commands/async.h"
+#include "drillbeyond/drillbeyond.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "postmaster/autovacuum.h"
@@ -126,6 +127,10 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 		size = add_size(size, BTreeShmemSize());
 		size = add_size(size, SyncScanShmemSize());
 		size = add_size(size, AsyncShmemSize());
+		size = add_size(size, DrbCacheShmemSize());
+		size = add_size(size, DrbStatsShmemSize());
+		size = add_size(size, DrbInflightShmemSize());
+		size = add_size(size, DrbSelectivityShmemSize());
 #ifdef EXEC_BACKEND
 		size = add_size(size, ShmemBackendArraySize());
 #endif
@@ -235,6 +240,10 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 	BTreeShmemInit();
 	SyncScanShmemInit();
 	AsyncShmemInit();
+	DrbCacheShmemInit();
+	DrbStatsShmemInit();
+	DrbInflightShmemInit();
+	DrbSelectivityShmemInit();
 
 #ifdef EXEC_BACKEND
 
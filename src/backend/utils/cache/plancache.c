@@ -86,6 +86,7 @@ static void AcquirePlannerLocks(List *stmt_list, bool acquire);
 static void ScanQueryForLocks(Query *parsetree, bool acquire);
 static bool ScanQueryWalker(Node *node, bool *acquire);
 static bool plan_list_is_transient(List *stmt_list);
+static bool plan_list_is_drb_materialized(List *stmt_list);
 static TupleDesc PlanCacheComputeResultDesc(List *stmt_list);
 static void PlanCacheRelCallback(Datum arg, Oid relid);
 static void PlanCacheFuncCallback(Datum arg, int cacheid, uint32 hashvalue);
@@ -769,6 +770,13 @@ CheckCachedPlan(CachedPlanSource *plansource)
 			!TransactionIdEquals(plan->saved_xmin, TransactionXmin))
 			plan->is_valid = false;
 
+		/*
+		 * DrillBeyond materializations are only checked for freshness when
+		 * planning, so a plan that joins them is used just once.
+		 */
+		if (plan->is_valid && plan_list_is_drb_materialized(plan->stmt_list))
+			plan->is_valid = false;
+
 		/*
 		 * By now, if any invalidation has happened, the inval callback
 		 * functions will have marked the plan invalid.
@@ -1560,6 +1568,29 @@ plan_list_is_transient(List *stmt_list)
 	return false;
 }
 
+/*
+ * plan_list_is_drb_materialized: check if any of the plans in the list join
+ * DrillBeyond materializations.
+ */
+static bool
+plan_list_is_drb_materialized(List *stmt_list)
+{
+	ListCell   *lc;
+
+	foreach(lc, stmt_list)
+	{
+		PlannedStmt *plannedstmt = (PlannedStmt *) lfirst(lc);
+
+		if (!IsA(plannedstmt, PlannedStmt))
+			continue;			/* Ignore utility statements */
+
+		if (plannedstmt->drbMaterialized)
+			return true;
+	}
+
+	return false;
+}
+
 /*
  * PlanCacheComputeResultDesc: given a list of analyzed-and-rewritten Queries,
  * determine the result tupledesc it will produce.	Returns NULL if the
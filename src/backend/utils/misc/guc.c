@@ -669,6 +669,95 @@ static struct config_bool ConfigureNamesBool[] =
 {
 
 	// drb optimizations
+	{
+        {"drb_enable_streaming", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable streaming of batched augmentation requests while the outer plan is scanned")
+        },
+        &drb_enable_streaming,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_result_cache", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable the cross-query cache of augmentation results in shared memory")
+        },
+        &drb_enable_result_cache,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_request_coalescing", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable waiting for identical augmentation requests in flight in other sessions, instead of sending them again"),
+            gettext_noop("Only has an effect with drb_enable_result_cache.")
+        },
+        &drb_enable_request_coalescing,
+        true,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_materialized_augmentations", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable joining the tables built by drb_materialize() instead of requesting the augmentation")
+        },
+        &drb_enable_materialized_augmentations,
+        true,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_binary_protocol", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable the binary wire format for augmentation requests, falls back to JSON if the server does not support it")
+        },
+        &drb_enable_binary_protocol,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_selectivity_stats", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable selectivity estimates from pg_drb_statistic, refreshed by ANALYZE")
+        },
+        &drb_enable_selectivity_stats,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_estimate_selectivity_on_miss", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable asking the server for selectivities that pg_drb_statistic does not have yet, while planning")
+        },
+        &drb_estimate_selectivity_on_miss,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_concurrent_requests", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable sending the requests of independent DrillBeyond operators concurrently")
+        },
+        &drb_enable_concurrent_requests,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_fanout", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable emitting all candidates in one pass instead of re-executing the plan per candidate")
+        },
+        &drb_enable_fanout,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_delta_aggregation", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable computing the variants of a fanned-out plain aggregate from the changes to the first candidate")
+        },
+        &drb_enable_delta_aggregation,
+        false,
+        NULL, NULL, NULL
+    },
+	{
+        {"drb_enable_float8_values", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable float8 instead of numeric as the type of open attributes")
+        },
+        &drb_enable_float8_values,
+        false,
+        NULL, NULL, NULL
+    },
 	{
         {"drb_enable_static_reoptimization", PGC_USERSET, CUSTOM_OPTIONS,
             gettext_noop("Enable/disable static selectivity planning in reoptimization")
@@ -700,6 +789,33 @@ static struct config_bool ConfigureNamesBool[] =
         &drb_enable_dynamic_omega,
         false,
         NULL, NULL, NULL
+    },
+    {
+        {"drb_enable_adaptive_strategy", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable revising the dynamic strategy between candidate runs, by measured run times."),
+            gettext_noop("Only has an effect with drb_enable_dynamic_omega.")
+        },
+        &drb_enable_adaptive_strategy,
+        true,
+        NULL, NULL, NULL
+    },
+    {
+        {"drb_enable_variant_notices", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable a notice after each result variant, with its candidates and the progress of the query."),
+            gettext_noop("The rows sent since the previous notice belong to the variant.")
+        },
+        &drb_enable_variant_notices,
+        false,
+        NULL, NULL, NULL
+    },
+    {
+        {"drb_enable_candidate_dedup", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable running one variant for candidates with the same values, and reporting its rows for all of them."),
+            gettext_noop("Values closer than drb_candidate_dedup_tolerance count as the same.")
+        },
+        &drb_enable_candidate_dedup,
+        false,
+        NULL, NULL, NULL
     },
 	{
         {"drb_enable_rea", PGC_USERSET, CUSTOM_OPTIONS,
@@ -781,6 +897,16 @@ static struct config_bool ConfigureNamesBool[] =
         true,
         NULL, NULL, NULL
     },
+    {
+        {"drb_enable_rescan_cache", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Enable/disable result caches above invariant parameterized subplans for drillbeyond"),
+            gettext_noop("They keep the output of nestloop inner sides and correlated subplans "
+                         "per parameter values across candidate rescans.")
+        },
+        &drb_enable_rescan_cache,
+        true,
+        NULL, NULL, NULL
+    },
     {
         {"drb_enable_big_omega", PGC_USERSET, CUSTOM_OPTIONS,
             gettext_noop("Enable/disable split omega operator for drillbeyond")
@@ -1597,6 +1723,137 @@ static struct config_int ConfigureNamesInt[] =
 		1, 1, INT_MAX / 2,
 		NULL, NULL, NULL
 	},
+	{
+		{"drb_candidate_order", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Order in which the candidates of an open attribute are evaluated: 0: as ranked by the server, 1: most selected tuples first")
+		},
+		&drb_candidate_order,
+		0, 0, 1, // see drillbeyond.h
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_max_variants", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Maximum number of result variants computed for a query"),
+			gettext_noop("0 computes a variant for every combination of candidates.")
+		},
+		&drb_max_variants,
+		0, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_parallel_workers", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Number of worker backends that compute result variants along with the leader"),
+			gettext_noop("0 computes all variants in the backend running the query. Requires drb_enable_result_cache.")
+		},
+		&drb_parallel_workers,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_worker_index", PGC_BACKEND, CUSTOM_OPTIONS,
+			gettext_noop("Shows which of the result variants a DrillBeyond worker computes."),
+			NULL,
+			GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE
+		},
+		&drb_worker_index,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_worker_count", PGC_BACKEND, CUSTOM_OPTIONS,
+			gettext_noop("Shows among how many backends a DrillBeyond worker's query is divided."),
+			gettext_noop("0 in backends that are not DrillBeyond workers."),
+			GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE
+		},
+		&drb_worker_count,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_variant_time_budget", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Time after which no further result variants are started"),
+			gettext_noop("The first variant is always computed. 0 means no limit."),
+			GUC_UNIT_MS
+		},
+		&drb_variant_time_budget,
+		0, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_request_batch_size", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Number of distinct join values per streamed augmentation request")
+		},
+		&drb_request_batch_size,
+		1000, 1, INT_MAX,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_result_cache_size", PGC_POSTMASTER, CUSTOM_OPTIONS,
+			gettext_noop("Maximum number of join values kept in the augmentation result cache"),
+			gettext_noop("0 disables the cache.")
+		},
+		&drb_result_cache_size,
+		0, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_result_cache_ttl", PGC_SIGHUP, CUSTOM_OPTIONS,
+			gettext_noop("Time after which cached augmentation results are requested again"),
+			NULL,
+			GUC_UNIT_S
+		},
+		&drb_result_cache_ttl,
+		3600, 0, INT_MAX / 1000,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_materialized_max_age", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Time after which a table built by drb_materialize() is not used anymore"),
+			gettext_noop("0 means no limit."),
+			GUC_UNIT_S
+		},
+		&drb_materialized_max_age,
+		86400, 0, INT_MAX / 1000,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_connect_timeout", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Maximum time to wait for a connection to the DrillBeyond server"),
+			gettext_noop("0 means no limit."),
+			GUC_UNIT_MS
+		},
+		&drb_connect_timeout,
+		10000, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_request_timeout", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Maximum time a request to the DrillBeyond server may take"),
+			gettext_noop("0 means no limit."),
+			GUC_UNIT_MS
+		},
+		&drb_request_timeout,
+		0, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_request_retries", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Number of times a failed request is sent again, to the next DrillBeyond server"),
+			NULL
+		},
+		&drb_request_retries,
+		2, 0, 100,
+		NULL, NULL, NULL
+	},
+	{
+		{"drb_max_connections", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Maximum number of connections per DrillBeyond server for streamed requests"),
+			gettext_noop("Takes effect for the first streamed request of a session.")
+		},
+		&drb_max_connections,
+		8, 1, 1024,
+		NULL, NULL, NULL
+	},
 	{
 		{"archive_timeout", PGC_SIGHUP, WAL_ARCHIVING,
 			gettext_noop("Forces a switch to the next xlog file if a "
@@ -2560,6 +2817,15 @@ static struct config_real ConfigureNamesReal[] =
         &drb_selectivity,
         DBL_MAX, 0, DBL_MAX,
         NULL, NULL, NULL
+    },
+    {
+        {"drb_candidate_dedup_tolerance", PGC_USERSET, CUSTOM_OPTIONS,
+            gettext_noop("Relative difference up to which candidate values count as the same for drb_enable_candidate_dedup."),
+            gettext_noop("0 deduplicates only candidates with exactly the same values.")
+        },
+        &drb_candidate_dedup_tolerance,
+        0.0, 0.0, 1.0,
+        NULL, NULL, NULL
     },
 	{
 		{"seq_page_cost", PGC_USERSET, QUERY_TUNING_COST,
@@ -3240,6 +3506,27 @@ static struct config_string ConfigureNamesString[] =
 		check_application_name, assign_application_name, NULL
 	},
 
+	{
+		{"drb_server_url", PGC_USERSET, CUSTOM_OPTIONS,
+			gettext_noop("Sets the DrillBeyond servers requests are sent to."),
+			gettext_noop("A comma-separated list of base URLs, used round robin.")
+		},
+		&drb_server_url,
+		"http://127.0.0.1:8765",
+		NULL, NULL, NULL
+	},
+
+	{
+		{"drb_parallel_conninfo", PGC_SUSET, CUSTOM_OPTIONS,
+			gettext_noop("Sets additional connection options for DrillBeyond worker backends."),
+			gettext_noop("Appended to the connection string to this server, e.g. for a password."),
+			GUC_SUPERUSER_ONLY
+		},
+		&drb_parallel_conninfo,
+		"",
+		NULL, NULL, NULL
+	},
+
 	/* End-of-list marker */
 	{
 		{NULL, 0, 0, NULL, NULL}, NULL, NULL, NULL, NULL, NULL
@@ -221,6 +221,13 @@ DECLARE_INDEX(pg_shdepend_reference_index, 1233, on pg_shdepend using btree(refc
 DECLARE_UNIQUE_INDEX(pg_statistic_relid_att_inh_index, 2696, on pg_statistic using btree(starelid oid_ops, staattnum int2_ops, stainherit bool_ops));
 #define StatisticRelidAttnumInhIndexId	2696
 
+/* This following index is not used for a cache and is not unique */
+DECLARE_INDEX(pg_drb_statistic_relid_hash_index, 3461, on pg_drb_statistic using btree(drbrelid oid_ops, drbhash int4_ops));
+#define DrbStatisticRelidHashIndexId	3461
+
+DECLARE_UNIQUE_INDEX(pg_drb_materialized_relid_keyword_index, 3467, on pg_drb_materialized using btree(drbrelid oid_ops, drbkeyword name_ops));
+#define DrbMaterializedRelidKeywordIndexId	3467
+
 DECLARE_UNIQUE_INDEX(pg_tablespace_oid_index, 2697, on pg_tablespace using btree(oid oid_ops));
 #define TablespaceOidIndexId  2697
 DECLARE_UNIQUE_INDEX(pg_tablespace_spcname_index, 2698, on pg_tablespace using btree(spcname name_ops));
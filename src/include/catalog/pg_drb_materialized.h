@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_drb_materialized.h
+ *	  definition of the system "DrillBeyond materialized augmentation"
+ *	  relation (pg_drb_materialized) along with the relation's initial
+ *	  contents.
+ *
+ * Each row links an augmentation of a relation with a keyword to the table
+ * drb_materialize() stored its candidates in. The planner joins that table
+ * instead of asking the EA service while the row is fresh enough (see
+ * drillbeyond_materialize.c).
+ *
+ * Portions Copyright (c) 1996-2012, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/catalog/pg_drb_materialized.h
+ *
+ * NOTES
+ *	  the genbki.pl script reads this file and generates .bki
+ *	  information from the DATA() statements.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PG_DRB_MATERIALIZED_H
+#define PG_DRB_MATERIALIZED_H
+
+#include "catalog/genbki.h"
+
+/* ----------------
+ *		pg_drb_materialized definition.  cpp turns this into
+ *		typedef struct FormData_pg_drb_materialized
+ * ----------------
+ */
+#define DrbMaterializedRelationId  3466
+
+CATALOG(pg_drb_materialized,3466) BKI_WITHOUT_OIDS
+{
+	Oid			drbrelid;		/* relation that is augmented */
+	NameData	drbkeyword;		/* keyword of the open attribute */
+	Oid			drbmatrelid;	/* table holding the candidates */
+	int4		drbmaxcands;	/* drb_max_num_cands it was built with */
+	bool		drbhasnulls;	/* some join values of drbrelid were null */
+
+#ifdef CATALOG_VARLEN			/* not accessed through the struct */
+	timestamptz drbcreated;		/* time it was built */
+#endif
+} FormData_pg_drb_materialized;
+
+/* ----------------
+ *		Form_pg_drb_materialized corresponds to a pointer to a tuple with
+ *		the format of pg_drb_materialized relation.
+ * ----------------
+ */
+typedef FormData_pg_drb_materialized *Form_pg_drb_materialized;
+
+/* ----------------
+ *		compiler constants for pg_drb_materialized
+ * ----------------
+ */
+#define Natts_pg_drb_materialized				6
+#define Anum_pg_drb_materialized_drbrelid		1
+#define Anum_pg_drb_materialized_drbkeyword		2
+#define Anum_pg_drb_materialized_drbmatrelid	3
+#define Anum_pg_drb_materialized_drbmaxcands	4
+#define Anum_pg_drb_materialized_drbhasnulls	5
+#define Anum_pg_drb_materialized_drbcreated		6
+
+#endif   /* PG_DRB_MATERIALIZED_H */
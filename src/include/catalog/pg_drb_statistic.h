@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_drb_statistic.h
+ *	  definition of the system "DrillBeyond statistic" relation
+ *	  (pg_drb_statistic) along with the relation's initial contents.
+ *
+ * Each row holds the selectivity the EA service estimated for augmenting a
+ * relation with a keyword under a set of restrictions. The planner reads
+ * them instead of asking the service; ANALYZE of the relation refreshes
+ * them from its sample (see drillbeyond_statistics.c).
+ *
+ * Portions Copyright (c) 1996-2012, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/catalog/pg_drb_statistic.h
+ *
+ * NOTES
+ *	  the genbki.pl script reads this file and generates .bki
+ *	  information from the DATA() statements.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PG_DRB_STATISTIC_H
+#define PG_DRB_STATISTIC_H
+
+#include "catalog/genbki.h"
+
+/* ----------------
+ *		pg_drb_statistic definition.  cpp turns this into
+ *		typedef struct FormData_pg_drb_statistic
+ * ----------------
+ */
+#define DrbStatisticRelationId  3460
+
+CATALOG(pg_drb_statistic,3460) BKI_WITHOUT_OIDS
+{
+	Oid			drbrelid;		/* relation that is augmented */
+	int4		drbhash;		/* hash of drbrequest, for the index */
+	float4		drbselectivity;	/* estimated selectivity, -1 if not yet estimated */
+	int4		drbsamplesize;	/* rows the estimate was computed from */
+
+#ifdef CATALOG_VARLEN			/* variable-length fields start here */
+	text		drbkeyword;		/* keyword of the open attribute */
+	text		drbrequest;		/* request without sample rows: keyword,
+								 * columns and restrictions */
+#endif
+} FormData_pg_drb_statistic;
+
+/* ----------------
+ *		Form_pg_drb_statistic corresponds to a pointer to a tuple with
+ *		the format of pg_drb_statistic relation.
+ * ----------------
+ */
+typedef FormData_pg_drb_statistic *Form_pg_drb_statistic;
+
+/* ----------------
+ *		compiler constants for pg_drb_statistic
+ * ----------------
+ */
+#define Natts_pg_drb_statistic					6
+#define Anum_pg_drb_statistic_drbrelid			1
+#define Anum_pg_drb_statistic_drbhash			2
+#define Anum_pg_drb_statistic_drbselectivity	3
+#define Anum_pg_drb_statistic_drbsamplesize		4
+#define Anum_pg_drb_statistic_drbkeyword		5
+#define Anum_pg_drb_statistic_drbrequest		6
+
+#endif   /* PG_DRB_STATISTIC_H */
@@ -2604,6 +2604,12 @@ DATA(insert OID = 2022 (  pg_stat_get_activity			PGNSP PGUID 12 1 100 0 0 f f f
 DESCR("statistics: information about currently active backends");
 DATA(insert OID = 3099 (  pg_stat_get_wal_senders	PGNSP PGUID 12 1 10 0 0 f f f f f t s 0 0 2249 "" "{23,25,25,25,25,25,23,25}" "{o,o,o,o,o,o,o,o}" "{pid,state,sent_location,write_location,flush_location,replay_location,sync_priority,sync_state}" _null_ pg_stat_get_wal_senders _null_ _null_ _null_ ));
 DESCR("statistics: information about currently active replication");
+DATA(insert OID = 3464 (  pg_stat_get_drillbeyond	PGNSP PGUID 12 1 100 0 0 f f f f f t v 0 0 2249 "" "{26,25,20,20,20,20,701,701,701,701,20,20,20,20,20,20}" "{o,o,o,o,o,o,o,o,o,o,o,o,o,o,o,o}" "{datid,keyword,executions,requests,bytes_sent,bytes_received,serialize_time,network_time,parse_time,merge_time,input_rows,distinct_keys,cache_hits,rescans,rows,max_hashtable_bytes}" _null_ pg_stat_get_drillbeyond _null_ _null_ _null_ ));
+DESCR("statistics: DrillBeyond operators per keyword");
+DATA(insert OID = 3465 (  pg_stat_reset_drillbeyond	PGNSP PGUID 12 1 0 0 0 f f f f f f v 0 0 2278 "" _null_ _null_ _null_ _null_ pg_stat_reset_drillbeyond _null_ _null_ _null_ ));
+DESCR("statistics: reset collected DrillBeyond statistics");
+DATA(insert OID = 3468 (  drb_materialize	PGNSP PGUID 12 1 0 0 0 f f f f t f v 2 0 2205 "2205 25" _null_ _null_ _null_ _null_ drb_materialize _null_ _null_ _null_ ));
+DESCR("store the candidates of an open attribute in a table");
 DATA(insert OID = 2026 (  pg_backend_pid				PGNSP PGUID 12 1 0 0 0 f f f f t f s 0 0 23 "" _null_ _null_ _null_ _null_ pg_backend_pid _null_ _null_ _null_ ));
 DESCR("statistics: current backend PID");
 DATA(insert OID = 1937 (  pg_stat_get_backend_pid		PGNSP PGUID 12 1 0 0 0 f f f f t f s 1 0 23 "23" _null_ _null_ _null_ _null_ pg_stat_get_backend_pid _null_ _null_ _null_ ));
@@ -47,6 +47,7 @@ DECLARE_TOAST(pg_proc, 2836, 2837);
 DECLARE_TOAST(pg_rewrite, 2838, 2839);
 DECLARE_TOAST(pg_seclabel, 3598, 3599);
 DECLARE_TOAST(pg_statistic, 2840, 2841);
+DECLARE_TOAST(pg_drb_statistic, 3462, 3463);
 DECLARE_TOAST(pg_trigger, 2336, 2337);
 
 /* shared catalogs */
@@ -11,11 +11,13 @@
 #ifndef DRILLBEYOND_H
 #define DRILLBEYOND_H
 
+#include "lib/stringinfo.h"
 #include "parser/parse_node.h"
 #include "nodes/execnodes.h"
 #include "nodes/relation.h"
 #include "nodes/plannodes.h"
 #include "json/json.h"
+#include "curl/curl.h"
 
  /*
   * Explaining
@@ -43,6 +45,7 @@ extern bool drb_enable_basic_cache;
 extern bool drb_enable_big_omega;
 extern bool drb_enable_rewind_cache;
 extern bool drb_enable_additional_cache;
+extern bool drb_enable_rescan_cache;
 extern bool drb_enable_send_isnumeric_constraint;
 extern bool drb_enable_pull_up_selection;
 extern bool drb_enable_send_predicates;
@@ -53,12 +56,39 @@ extern bool drb_enable_force_big_omega_before_agg;
 extern bool drb_enable_selectivity_estimation;
 extern bool drb_enable_rea;
 extern bool drb_enable_dynamic_omega;
+extern bool drb_enable_adaptive_strategy;
 extern bool drb_enable_reoptimization;
 extern bool drb_enable_preselection;
 extern bool drb_enable_static_reoptimization;
+extern bool drb_enable_streaming;
+extern bool drb_enable_concurrent_requests;
+extern bool drb_enable_selectivity_stats;
+extern bool drb_estimate_selectivity_on_miss;
+extern bool drb_enable_result_cache;
+extern bool drb_enable_request_coalescing;
+extern bool drb_enable_materialized_augmentations;
+extern bool drb_enable_binary_protocol;
+extern bool drb_enable_fanout;
+extern bool drb_enable_delta_aggregation;
+extern bool drb_enable_candidate_dedup;
+extern bool drb_enable_float8_values;
+extern bool drb_enable_variant_notices;
 
 extern int drb_cost_model;
 extern int drb_max_num_cands;
+extern int drb_candidate_order;
+extern double drb_candidate_dedup_tolerance;
+extern int drb_max_variants;
+extern int drb_variant_time_budget;
+extern int drb_request_batch_size;
+extern int drb_result_cache_size;
+extern int drb_result_cache_ttl;
+extern int drb_materialized_max_age;
+extern char *drb_server_url;
+extern int drb_connect_timeout;
+extern int drb_request_timeout;
+extern int drb_request_retries;
+extern int drb_max_connections;
 extern double drb_run_cost;
 extern double drb_startup_cost;
 extern double drb_fixed_cost;
@@ -69,15 +99,51 @@ extern double drb_fixed_cost;
 #define DRB_COST_ONLY_K 3
 #define DRB_COST_BOTH 4
 
+/* order in which DRB_TOP visits the candidates of an operator */
+#define DRB_ORDER_SERVICE 0 // as ranked by the EA service
+#define DRB_ORDER_SELECTIVITY 1 // most selected tuples first
+
 /*
  * global constants
  */
 #define NUM_CANDS 10
 #define DRB_VALUE_ATTR 1  // first attr of drb_relation is value
 #define DRB_ID_ATTR 2 // second is id
+#define DRB_PROBE_BATCH_SIZE 64 // outer tuples added to the results hashtable at once
+#define DRB_ARENA_BLOCK_SIZE (64 * 1024) // entries of the results hashtable are allocated in blocks of this size
 
 
 #define DRB_DEFAULT_SEL 0.33
+#define DRB_SELECTIVITY_SAMPLE_SIZE 25 // sample rows sent with a selectivity request
+
+/*
+ * Join values of one tuple as stored in the results hashtable: all columns
+ * flattened into one buffer, plus its hash code (see drillbeyond_hashtable.c)
+ */
+typedef struct DrillBeyondKey {
+    uint32 hash;
+    int len;
+    char *data;
+} DrillBeyondKey;
+
+/*
+ * Open addressing hashtable of DrillBeyondValues, keyed by join values
+ */
+typedef struct DrillBeyondHashTable {
+    MemoryContext cxt; // holds the buckets and all entries
+    MemoryContext valuesCxt; // holds the candidate values of the entries
+    int numCols;
+    int16 *typlen; // of the join columns
+    bool *typbyval;
+    bool bitwise; // keys are equal iff their flattened forms are
+    uint32 size; // number of buckets, a power of 2
+    uint32 numEntries;
+    uint32 *hashes; // hash code of the entry in each bucket
+    struct DrillBeyondValues **buckets; // NULL if empty
+    char *arenaPos; // free space for entries in the current block of cxt
+    Size arenaFree;
+    Size spaceUsed; // bytes allocated for buckets, entries and values
+} DrillBeyondHashTable;
 
 /*
  * One DrillBeyondExpansion object is created for each open attribute found
@@ -88,8 +154,10 @@ typedef struct DrillBeyondExpansion {
     Index rti; // entry in query rangetable for the fake relation
     Index extended_rti; // entry in query rangetable for the extened relation e.g. Nation
     char *keyword; // original keywod queried by the user
+    Oid valuetype; // type of the open attribute, NUMERICOID or FLOAT8OID
     /* the following attributes are used to generate the explain info */
     char *extended_relname; // name of relation that was extended e.g. Nation
+    Oid extended_relid; // the extended table, InvalidOid for a subquery
     List *extended_attrNames;
     List *extended_strAttrNames;
     /* flags that indicate in which way the attribute is used in the query */
@@ -97,6 +165,10 @@ typedef struct DrillBeyondExpansion {
     bool aggregative;
     bool groupedby;
     bool sorting;
+    /* all candidates are emitted in one pass, tagged by the id column (see drb_prepare_fanout) */
+    bool fanout;
+    /* in fan-out mode, only candidates that differ from the first are emitted (see drb_setup_fanout_agg) */
+    bool fanout_delta;
 
     /* List of Var* -> columns on which the fake relation is "joined" with the extended relation
      * this effectively determines the "identity" of a tuple from the view of drillbeyond
@@ -115,10 +187,10 @@ typedef struct DrillBeyondExpansion {
     FmgrInfo *hashFunctions;
 
     /* filled by the external entity augmentation system in drillbeyond_requests.c
-     * contains DrillBeyondValues objects (see below) as values and Datum arrays as key
-     * these Datums are joining values from native tuples (e.g. n_name)
+     * contains DrillBeyondValues objects (see below), keyed by the joining values
+     * from native tuples (e.g. n_name)
      */
-    HTAB *results_hashtable;
+    DrillBeyondHashTable *results_hashtable;
     double *selectivities; // actual selectivities found (one predicate only)
 
     /* selectivity estimation, at the moment for one predicate only */
@@ -129,6 +201,11 @@ typedef struct DrillBeyondExpansion {
    Query *query;
    bool reoptimized; // only reoptimize once
 
+    /* feedback from execution, for strategy decisions and replanning (drillbeyond_cost.c) */
+    double actual_rows; // input rows of the operator, -1 if not executed yet
+    double actual_distinct; // distinct join values among them, -1 if not executed yet
+    double actual_fragment_ms; // time it took to produce them
+
 
 } DrillBeyondExpansion;
 
@@ -137,14 +214,18 @@ typedef struct DrillBeyondExpansion {
  * container for drilled values for one combinations of join values
  */
 typedef struct DrillBeyondValues {
-    Datum *joinValues; // array of join values, e.g. n_names
-    Datum *values; // array of drilled values e.g. 23.0, 12.0
-    bool *is_null; // array of bools, true if the value is null
+    DrillBeyondKey key; // flattened join values, owned by the hashtable
+    Datum *joinValues; // array of join values, e.g. n_names, pointing into key
+    float8 *values; // drilled values e.g. 23.0, 12.0, one row of a value matrix
+    bits8 *nulls; // null bitmap of values, bit set if the value is null
     int numValues; // number of different variants (values) available
-    bool requested; // request for these joinValues was sent
+    bool requested; // response for these joinValues was received
+    bool pending; // joinValues are part of a streamed request still in flight
     bool inUnion; // true if it passes the predicate(s) in at least one candidate
 } DrillBeyondValues;
 
+#define DRB_VALUE_IS_NULL(vals, i) (((vals)->nulls[(i) / 8] & (1 << ((i) % 8))) != 0)
+
 
 /*
  * Rewriting
@@ -182,6 +263,13 @@ extern void ExecEndDrillBeyondExpand(DrillBeyondExpandState *node);
 
 extern void ExecReScanDrillBeyondExpand(DrillBeyondExpandState *node);
 extern const char *drb_strategyname(enum DrillBeyondStrategy f);
+
+/* Candidate epochs */
+extern int drb_epoch_param(EState *estate);
+extern Bitmapset *drb_mark_variance(PlanState *planState);
+extern void drb_begin_epoch(PlanState *planState, Bitmapset *changedExpansions);
+extern bool drb_candidate_rescan(PlanState *planState);
+extern void drb_count_variants(DrillBeyondExpandState *node);
 extern void reset_context();
 
 /*
@@ -209,13 +297,151 @@ extern void reset_context();
 #define SELECTIVITIES "selectivities"
 
 
-extern int drillbeyond_request(const char *msg_str, DrillBeyondState *dbstate);
+extern int drillbeyond_request(DrillBeyondState *dbstate);
 extern void heap_tup_to_json(HeapTuple tup, TupleDesc tupdesc, json_object *msg);                   //not used
 extern json_object *initDrillBeyondRequest(DrillBeyondExpansion *expansion);
-extern void tup_to_json(DrillBeyondExpansion *expansion, List *join_cols, TupleTableSlot *slot, json_object *msg);
+extern bool tup_to_json(DrillBeyondExpansion *expansion, List *join_cols, TupleTableSlot *slot, json_object *msg);
 extern void add_restrictions_to_msg(json_object *msg, List* restrictions);
-extern bool drillbeyond_fill_msg(DrillBeyondExpansion *expansion, json_object *msg);
+extern List *drillbeyond_collect_entries(DrillBeyondExpansion *expansion);
+
+/*
+ * A response of the EA service, decoded from either wire format
+ * (drillbeyond_wire.c). Values are stored candidate-major, with one null
+ * bitmap of BITMAPLEN(num_rows) bytes per candidate.
+ */
+typedef struct DrillBeyondResponse {
+    int num_cands;
+    int num_rows;
+    double *selectivities; // per candidate
+    float8 *values; // num_cands * num_rows
+    bits8 *nulls; // bit set if the value is null
+    bool *inUnion; // per entity
+    json_object *explanation; // may be NULL
+} DrillBeyondResponse;
+
+#define DRB_BINARY_CONTENT_TYPE "application/x-drillbeyond"
+
+extern void drillbeyond_binary_request(StringInfo buf, DrillBeyondExpansion *expansion, List *entries);
+extern DrillBeyondResponse *drillbeyond_binary_response(StringInfo buf);
+extern DrillBeyondResponse *drillbeyond_json_response(json_object *obj, int num_rows);
+extern void drillbeyond_free_response(DrillBeyondResponse *resp);
+
+/* streaming: batches of join values sent through curl's multi interface while the outer plan is scanned */
+extern void drillbeyond_stream_batch(DrillBeyondState *dbstate);
+extern void drillbeyond_dispatch(DrillBeyondState *node);
+extern void drillbeyond_poll_requests(DrillBeyondState *dbstate, bool wait);
+extern void drillbeyond_cancel_requests(DrillBeyondState *dbstate);
+
+/* persistent connections to the EA service (drillbeyond_http.c) */
+extern const char *drillbeyond_next_server(void);
+extern void drillbeyond_http_setup(CURL *handle);
+extern void drillbeyond_http_set_url(CURL *handle, const char *path);
+extern bool drillbeyond_http_retryable(CURLcode result, long status);
+extern CURLM *drillbeyond_http_multi(void);
+extern StringInfo drillbeyond_http_post(const char *path, const char *content_type, const char *body, int len, long *status);
+
+/* cross-query result cache in shared memory (drillbeyond_cache.c) */
+extern Size DrbCacheShmemSize(void);
+extern void DrbCacheShmemInit(void);
+extern bool drillbeyond_cache_enabled(struct DrillBeyondExpansion *expansion);
+extern void drillbeyond_lookup_cache(DrillBeyondState *dbstate);
+extern void drillbeyond_store_cache(DrillBeyondState *dbstate, List *entries,
+                                    double *selectivities, int num_cands);
+
+/* coalescing of identical requests in flight in other backends (drillbeyond_coalesce.c) */
+#define DRB_INFLIGHT_MAX_ENTRIES 1024
+
+typedef struct DrillBeyondInflight DrillBeyondInflight;
+
+extern Size DrbInflightShmemSize(void);
+extern void DrbInflightShmemInit(void);
+extern DrillBeyondInflight *drillbeyond_inflight_begin(DrillBeyondExpansion *expansion, const char *path,
+                                                       StringInfo body, bool follow, bool *coalesced);
+extern bool drillbeyond_inflight_done(DrillBeyondInflight *inflight);
+extern bool drillbeyond_inflight_expired(DrillBeyondInflight *inflight);
+extern bool drillbeyond_inflight_wait(DrillBeyondInflight *inflight);
+extern bool drillbeyond_inflight_owns_any(void);
+extern void drillbeyond_inflight_end(DrillBeyondInflight *inflight);
+
 extern double estimateSelectivity(DrillBeyondExpansion *expansion, Oid extended_relid, List *restrictlist);
+extern double drillbeyond_request_selectivity(const char *request, HeapTuple *rows, int numrows, TupleDesc tupDesc);
+
+/* selectivity statistics in pg_drb_statistic (drillbeyond_statistics.c) */
+#define DRB_SELECTIVITY_MAX_MISSES 256 // requests without a row, noted for ANALYZE
+#define DRB_SELECTIVITY_REQUEST_LEN 1024 // longest request that is noted
+
+extern Size DrbSelectivityShmemSize(void);
+extern void DrbSelectivityShmemInit(void);
+extern void drillbeyond_record_selectivity_miss(Oid relid, const char *keyword, const char *request);
+extern bool drillbeyond_lookup_selectivity(Oid relid, const char *request, double *sel);
+extern void drillbeyond_store_selectivity(Oid relid, const char *keyword, const char *request,
+                                          double sel, int samplesize);
+extern void drillbeyond_analyze_rel(Relation onerel, HeapTuple *rows, int numrows);
+extern void RemoveDrillBeyondStatistics(Oid relid);
+
+/* candidates stored in tables, listed in pg_drb_materialized (drillbeyond_materialize.c) */
+extern bool drillbeyond_use_materializations(Query *query);
+extern void RemoveDrillBeyondMaterializations(Oid relid);
+extern Datum drb_materialize(PG_FUNCTION_ARGS);
+
+/*
+ * What a DrillBeyond operator spent on the EA service and on its candidates,
+ * shown by EXPLAIN (ANALYZE, DRILLBEYOND) and summed up per keyword in
+ * pg_stat_drillbeyond (drillbeyond_instrument.c). Times are in milliseconds.
+ */
+typedef struct DrillBeyondInstrumentation {
+    long requests; // requests sent, not counting retries
+    long coalesced; // requests not sent, answered by another backend's
+    long bytes_sent;
+    long bytes_received;
+    double serialize_ms; // building request bodies
+    double network_ms; // transfers, concurrent ones each count in full
+    double parse_ms; // decoding responses
+    double merge_ms; // merging responses into the results hashtable
+    long rescans; // candidate rescans
+    int num_cands; // length of the arrays below
+    double *cand_rows; // rows emitted per candidate
+    double *cand_ms; // time spent emitting them, only under EXPLAIN ANALYZE
+} DrillBeyondInstrumentation;
+
+#define DRB_STATS_MAX_ENTRIES 256 // (database, keyword) pairs kept for pg_stat_drillbeyond
+
+extern Size DrbStatsShmemSize(void);
+extern void DrbStatsShmemInit(void);
+extern DrillBeyondInstrumentation *drillbeyond_instr_alloc(void);
+extern double drillbeyond_elapsed_ms(instr_time start);
+extern void drillbeyond_report_stats(DrillBeyondState *node);
+extern Datum pg_stat_get_drillbeyond(PG_FUNCTION_ARGS);
+extern Datum pg_stat_reset_drillbeyond(PG_FUNCTION_ARGS);
+
+/*
+ * Process-parallel variants (drillbeyond_parallel.c). The libpq parts are
+ * in the module libpqdrillbeyond, so the server binary is not linked with
+ * libpq; it sets these hooks when it is loaded.
+ */
+extern int drb_parallel_workers;
+extern char *drb_parallel_conninfo;
+extern int drb_worker_index;
+extern int drb_worker_count;
+
+typedef void *(*drb_worker_connect_type) (const char *conninfo); // NULL on failure
+extern PGDLLIMPORT drb_worker_connect_type drb_worker_connect;
+typedef void (*drb_worker_exec_type) (void *worker, const char *command);
+extern PGDLLIMPORT drb_worker_exec_type drb_worker_exec;
+typedef void (*drb_worker_send_query_type) (void *worker, const char *query);
+extern PGDLLIMPORT drb_worker_send_query_type drb_worker_send_query;
+typedef int (*drb_worker_next_row_type) (void *worker, bool wait, int natts, char **values);
+extern PGDLLIMPORT drb_worker_next_row_type drb_worker_next_row;
+typedef void (*drb_worker_wait_type) (void **workers, int n);
+extern PGDLLIMPORT drb_worker_wait_type drb_worker_wait;
+typedef void (*drb_worker_disconnect_type) (void *worker);
+extern PGDLLIMPORT drb_worker_disconnect_type drb_worker_disconnect;
+
+extern void drillbeyond_start_workers(DrillBeyondExpandState *node);
+extern void drillbeyond_worker_cache_miss(List *entries);
+extern TupleTableSlot *drillbeyond_worker_row(DrillBeyondExpandState *node, bool wait);
+extern bool drillbeyond_variant_is_mine(DrillBeyondExpandState *node);
+extern void drillbeyond_end_workers(DrillBeyondExpandState *node);
 
 /*
  * Costs
@@ -227,12 +453,16 @@ extern void final_cost_drillbeyond_expand(PlannerInfo *root, DrillBeyondExpand *
 extern double drillbeyond_estimate_join_size(PlannerInfo *root, double outer_rows,
                     SpecialJoinInfo *sjinfo, List *restrictlist);
 extern void cost_drillbeyond_expand(PlannerInfo *root, DrillBeyondExpand *expand);
+extern void drillbeyond_strategy_costs(DrillBeyondState *node, double *omega_cost, double *default_cost,
+                    double *rewind_fraction);
+extern bool drillbeyond_measured_strategy_costs(DrillBeyondExpandState *node, DrillBeyondState *op,
+                    double runs, double *omega_ms, double *default_ms);
 
 /*
  * Planner
  */
 
-extern void drillbeyond_planner_phase_zero(Query *parse);
+extern void drillbeyond_planner_phase_zero(PlannerGlobal *glob, Query *parse);
 extern bool drillbeyond_planner_phase_one(PlannerInfo *root, List *tlist);
 extern void drillbeyond_planner_phase_two(PlannerInfo *root);
 extern Plan *drillbeyond_planner_phase_three(PlannerInfo *root, Plan *result_plan);
@@ -254,14 +484,30 @@ extern PlannedStmt* reoptimize(Query *query);
 extern void print_explanation(PlannedStmt *pstmt);
 extern void switch_plans(DrillBeyondExpandState *node);
 extern PlannedStmt* reconsiderStrategy(DrillBeyondState *node);
+extern void drb_record_runs(DrillBeyondExpandState *top);
+extern void drb_adapt_strategies(DrillBeyondExpandState *top, Bitmapset *changedExpansions);
+extern void drb_order_candidates(DrillBeyondState *node);
+extern int drb_candidate_at(DrillBeyondState *node, int rank);
+extern void drb_dedup_candidates(DrillBeyondState *node);
+extern bool drb_is_class_representative(DrillBeyondState *node, int cand);
+extern int drb_num_distinct_candidates(DrillBeyondState *node);
+extern bool drb_advance_candidate(DrillBeyondState *node);
+extern bool drb_next_duplicate_candidate(DrillBeyondState *node);
 extern void execute_drb_fragment(DrillBeyondState *drb);
 
 /*
  * Util
  */
-extern HTAB* drb_setupHashTable(DrillBeyondExpansion *exp, int nrows);
-extern void drb_addToHashTable(DrillBeyondExpansion *exp, Datum *keys, Datum *values, int numValues);
+extern DrillBeyondHashTable* drb_setupHashTable(DrillBeyondExpansion *exp, int nrows);
+extern void drb_makeHashKey(DrillBeyondExpansion *exp, Datum *keys, DrillBeyondKey *key);
+extern DrillBeyondValues* drb_addToHashTable(DrillBeyondExpansion *exp, Datum *keys, bool *found);
+extern void drb_addBatchToHashTable(DrillBeyondExpansion *exp, DrillBeyondKey *keys, int n, DrillBeyondValues **entries, bool *found);
 extern DrillBeyondValues* drb_retrieveFromHashTable(DrillBeyondExpansion *exp, Datum *keys);
+extern DrillBeyondValues* drb_iterateHashTable(DrillBeyondHashTable *ht, uint32 *pos);
+extern void drb_allocValueRows(DrillBeyondExpansion *exp, DrillBeyondValues **entries, int n, int k);
+extern Datum drb_candidate_value(DrillBeyondExpansion *exp, DrillBeyondValues *vals, int origin, bool *isnull);
+extern Datum drb_placeholder_datum(DrillBeyondExpansion *exp, DrillBeyondValues *vals);
+extern DrillBeyondValues *drb_placeholder_values(DrillBeyondExpansion *exp, Datum datum);
 
 extern void drb_reset_query();
 extern void drb_finished_reset_query();
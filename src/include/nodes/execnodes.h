@@ -17,6 +17,7 @@
 #include "access/genam.h"
 #include "access/heapam.h"
 #include "executor/instrument.h"
+#include "lib/dllist.h"
 #include "nodes/params.h"
 #include "nodes/plannodes.h"
 #include "utils/reltrigger.h"
@@ -999,6 +1000,12 @@ typedef struct PlanState
 	 */
 	Bitmapset  *chgParam;		/* set of IDs of changed Params */
 
+	/*
+	 * DrillBeyond candidate epochs: rtis of the expansions whose candidates
+	 * the output of this node depends on, see drillbeyond_compress.c
+	 */
+	Bitmapset  *drbVariance;
+
 	/*
 	 * Other run-time state needed by most if not all node types.
 	 */
@@ -1534,11 +1541,37 @@ typedef struct DrillBeyondState
 	int             db_valueColIdx;
 	int  			db_current_context;
 	int             db_current_origin;
+	int             db_current_rank; // position of db_current_origin in db_cand_order
+	int            *db_cand_order; // candidates in the order DRB_TOP visits them, NULL until known
+	int            *db_cand_class; // first candidate in db_cand_order with the same values, NULL if all differ (drb_enable_candidate_dedup)
+	int             db_dup_origin; // candidate whose rows DRB_TOP reports while replaying duplicates
+	int             db_fanout_origin; // candidate of the current outer tuple in fan-out mode
+	bool            db_fanout_retracted; // delta fan-out: first candidate's value retracted for db_fanout_origin
+	int             db_idColIdx; // slot of the id column in the inner tuple, -1 if not needed
 	struct DrillBeyondValues *db_current_values;
     int         num_join_cols;
     struct DrillBeyondExpandState *drb_expand_operator_state;
     Datum *keys;
     Tuplestorestate *tuplestorestate; // include tuplestore directly into drb
+    /* streaming requests (drb_enable_streaming) */
+    int             db_unsent_keys; // distinct join values collected but not yet sent
+    int             db_inflight_batches; // streamed requests without a response
+    bool            db_dispatched; // outer plan scanned and requests sent ahead (drb_enable_concurrent_requests)
+    int             db_cache_hits; // join values answered by the result cache
+    /* results hashtable entry of each tuple in the tuplestore, in order:
+     * the first db_memEntries in memory, the rest in db_entriesFile */
+    struct DrillBeyondValues **db_entries;
+    int             db_numEntries;
+    int             db_memEntries;
+    int             db_maxEntries;
+    struct BufFile *db_entriesFile;
+    int             db_outerPos; // tuplestore position of the next outer tuple
+    /* join values of outer tuples not yet added to the hashtable */
+    struct DrillBeyondKey *db_batchKeys;
+    int             db_batchLen;
+    MemoryContext   db_batchCxt;
+    Instrumentation *db_fragment_instr; // times phase 1, for feedback into the expansion
+    struct DrillBeyondInstrumentation *db_instr; // requests and candidates, see drillbeyond.h
 } DrillBeyondState;
 
 typedef struct DrillBeyondExpandState
@@ -1554,6 +1587,22 @@ typedef struct DrillBeyondExpandState
 	TupleTableSlot *temp_slot;
 	int current_origin;
 	int total_permutations;
+	int total_variants; // variants DRB_TOP runs at most, see drb_count_variants
+	instr_time start_time; // of the first variant, for drb_variant_time_budget
+	int variants_reported; // variants announced by drb_enable_variant_notices
+	double variant_rows; // rows of the current variant so far
+	/* candidate deduplication: rows of a variant, reported again for duplicate candidates */
+	Tuplestorestate *dup_store;
+	TupleTableSlot *dup_slot;
+	bool dup_buffering; // rows of the current variant go into dup_store
+	bool dup_replaying; // rows come from dup_store
+	bool dup_counted; // total_variants reduced to the distinct combinations
+	/* process-parallel variants: this backend runs those with current_origin % part_count == part_index */
+	int part_index;
+	int part_count; // 0 if not partitioned
+	Bitmapset *skipped_resets; // expansions changed by variants skipped since the last one run
+	struct DrillBeyondWorkers *workers; // leader only, NULL if none
+	bool own_done; // leader: its own variants are complete, only workers' rows remain
 	List *drb_operator_states;
 	DrillBeyondState *drb_operator_state;
 	List *drb_quals;
@@ -1567,6 +1616,15 @@ typedef struct DrillBeyondExpandState
 	int             current_val;
 	int original_eflags;
 	bool fragments_executed;
+	bool requests_dispatched;
+	/* adaptive strategy: the plan below, timed per run in DRB_DEFAULT mode */
+	Instrumentation *run_instr;
+	int run_count;
+	double run_sum_sel; // sums for fitting time = startup + per_sel * selectivity
+	double run_sum_ms;
+	double run_sum_sel2;
+	double run_sum_sel_ms;
+	double rewind_fraction; // cost of reading the store back, relative to a full run
 } DrillBeyondExpandState;
 
 /* ----------------
@@ -1690,6 +1748,40 @@ typedef struct MaterialState
 	Tuplestorestate *tuplestorestate;
 } MaterialState;
 
+/* ----------------
+ *	 ResultCacheState information
+ *
+ *		Output of the subplan per parameter values, in a hash table that is
+ *		bounded by work_mem and evicts the least recently used entries. It is
+ *		kept across rescans, that is the point of the node.
+ * ----------------
+ */
+typedef enum ResultCacheStatus
+{
+	RC_LOOKUP,					/* rescanned, key not looked up yet */
+	RC_HIT,						/* returning a complete cached result */
+	RC_FILL,					/* returning subplan tuples, caching them */
+	RC_PASS						/* returning subplan tuples, result too big */
+} ResultCacheStatus;
+
+typedef struct ResultCacheState
+{
+	PlanState	ps;				/* its first field is NodeTag */
+	int16	   *paramTyplen;
+	bool	   *paramTypbyval;
+	MemoryContext tableContext; /* hash table, keys and cached tuples */
+	HTAB	   *hashtable;
+	Dllist		lru;			/* entries, most recently used first */
+	Size		memUsed;		/* memory of the cached tuples */
+	ResultCacheStatus status;
+	struct ResultCacheEntry *entry; /* entry being filled or returned */
+	ListCell   *next;			/* next cached tuple to return */
+	bool		childStarted;	/* subplan read since its last rescan */
+	long		hits;			/* for EXPLAIN ANALYZE */
+	long		misses;
+	long		evictions;
+} ResultCacheState;
+
 /* ----------------
  *	 SortState information
  * ----------------
@@ -1753,6 +1845,14 @@ typedef struct AggState
 	List	   *hash_needed;	/* list of columns needed in hash table */
 	bool		table_filled;	/* hash table filled yet? */
 	TupleHashIterator hashiter; /* for iterating through hash table */
+	/* these fields are used for DrillBeyond candidate groups (drbNumIds > 0): */
+	int			drb_numVariants;	/* number of candidate combinations */
+	AggStatePerGroup drb_pergroups; /* working state per combination */
+	HeapTuple  *drb_firstTuples;	/* representative input tuple per combination */
+	int			drb_nextVariant;	/* next combination to emit */
+	bool		drb_scanned;	/* input consumed yet? */
+	int64	   *drb_inputs;		/* non-null inputs per combination and Aggref (drbDelta) */
+	Tuplestorestate *drb_deltas;	/* changed input tuples (drbDelta) */
 } AggState;
 
 /* ----------------
@@ -79,6 +79,7 @@ typedef enum NodeTag
 	T_DrillBeyond,
 	T_DrillBeyondExpand,
 	T_DrillBeyondDummy,
+	T_ResultCache,
 	/* these aren't subclasses of Plan: */
 	T_NestLoopParam,
 	T_PlanRowMark,
@@ -127,6 +128,7 @@ typedef enum NodeTag
 	T_DrillBeyondState,
 	T_DrillBeyondExpandState,
 	T_DrillBeyondDummyState,
+	T_ResultCacheState,
 
 	/*
 	 * TAGS FOR PRIMITIVE NODES (primnodes.h)
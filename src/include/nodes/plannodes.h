@@ -47,6 +47,9 @@ typedef struct PlannedStmt
 
 	bool		transientPlan;	/* redo plan when TransactionXmin changes? */
 
+	bool		drbMaterialized;	/* joins DrillBeyond materializations, which
+									 * are only checked when planning */
+
 	struct Plan *planTree;		/* tree of Plan nodes */
 
 	List	   *rtable;			/* list of RangeTblEntry nodes */
@@ -609,6 +612,8 @@ typedef struct DrillBeyondExpand
 	int         		drb_numExpansions;
 	struct DrillBeyondExpansion *drb_expansion;
 	PlannedStmt *reoptimized_plan; /* set by lower level DrillBeyond nodes if reoptimization is necessary */
+	bool		drb_fanout;		/* DRB_TOP: variants arrive in one pass, no re-execution */
+	int		   *drb_fanoutFrom;	/* DRB_TOP: offset of each expansion's id column in the subplan tlist, or -1 */
 } DrillBeyondExpand;
 
 /* ----------------
@@ -620,6 +625,22 @@ typedef struct Material
 	Plan		plan;
 } Material;
 
+/* ----------------
+ *		result cache node
+ *
+ * Caches the complete output of its subplan for each combination of values
+ * of the PARAM_EXEC parameters the subplan depends on, so that rescans with
+ * parameter values seen before need not run the subplan again.
+ * ----------------
+ */
+typedef struct ResultCache
+{
+	Plan		plan;
+	int			numParams;		/* number of parameters in the cache key */
+	int		   *paramIds;		/* their PARAM_EXEC ids */
+	Oid		   *paramTypes;		/* and their types */
+} ResultCache;
+
 /* ----------------
  *		sort node
  * ----------------
@@ -677,6 +698,11 @@ typedef struct Agg
 	AttrNumber *grpColIdx;		/* their indexes in the target list */
 	Oid		   *grpOperators;	/* equality operators to compare with */
 	long		numGroups;		/* estimated number of groups in input */
+	/* DrillBeyond fan-out, AGG_PLAIN only: one group per candidate combination */
+	int			drbNumIds;		/* number of candidate id columns */
+	AttrNumber *drbIdColIdx;	/* their indexes in the input target list */
+	int			drbNumCands;	/* candidates per id */
+	bool		drbDelta;		/* input carries changes to the first candidate only */
 } Agg;
 
 /* ----------------
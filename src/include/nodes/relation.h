@@ -99,6 +99,8 @@ typedef struct PlannerGlobal
 
 	bool		transientPlan;	/* redo plan when TransactionXmin changes? */
 
+	bool		drbMaterialized;	/* joins DrillBeyond materializations? */
+
 	/* Added post-release, will be in a saner place in 9.3: */
 	int			nParamExec;		/* number of PARAM_EXEC Params used */
 } PlannerGlobal;
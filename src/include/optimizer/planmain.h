@@ -70,6 +70,7 @@ extern Group *make_group(PlannerInfo *root, List *tlist, List *qual,
 		   double numGroups,
 		   Plan *lefttree);
 extern Plan *materialize_finished_plan(Plan *subplan);
+extern ResultCache *make_resultcache(Plan *subplan, List *params);
 extern Unique *make_unique(Plan *lefttree, List *distinctList);
 extern LockRows *make_lockrows(Plan *lefttree, List *rowMarks, int epqParam);
 extern Limit *make_limit(Plan *lefttree, Node *limitOffset, Node *limitCount,
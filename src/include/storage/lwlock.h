@@ -79,6 +79,10 @@ typedef enum LWLockId
 	SerializablePredicateLockListLock,
 	OldSerXidLock,
 	SyncRepLock,
+	DrillBeyondCacheLock,
+	DrillBeyondStatsLock,
+	DrillBeyondInflightLock,
+	DrillBeyondSelectivityLock,
 	/* Individual lock IDs end here */
 	FirstBufMappingLock,
 	FirstLockMgrLock = FirstBufMappingLock + NUM_BUFFER_PARTITIONS,